@@ -0,0 +1,281 @@
+/* bench_conntab.c
+ * memory and slot allocation cost of myepoll.c's client bookkeeping with
+ * -n mostly idle connections, without the sockets: fds are numbered the
+ * way the kernel hands them out (lowest free first) and the records are
+ * filled as do_accept_client fills them.
+ *   array   : the original layout, a fixed client_t array with a 1K buffer
+ *             in every slot and a linear scan for a free one per accept
+ *   conntab : conntab.c, records by fd and buffers from size classes,
+ *             held only by the -a percent of connections with data pending
+ * Each mode runs in a child of its own and reports the RSS it grew by after
+ * opening everything, after the active connections took their buffers, and
+ * the cost of a close and an accept with the table full.
+ * build with : gcc -O2 -Wall -o bench_conntab bench_conntab.c conntab.c
+ * run with   : ./bench_conntab [-n conns] [-a active_percent] [-d seconds] [-m array|conntab]
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "conntab.h"
+#include "twheel.h"
+
+#define MAX_IP_LEN 16
+#define MAX_CLIENT_BUFF_LEN 1024
+#define FIRST_FD 5
+
+/* myepoll.c before: every slot carries its buffer */
+typedef struct
+{
+   int fd;
+   char host[MAX_IP_LEN];
+   int port;
+   int len;
+   char buff[MAX_CLIENT_BUFF_LEN];
+   char status;
+} old_client_t;
+
+/* and now */
+typedef struct
+{
+   int fd;
+   int port;
+   char host[MAX_IP_LEN];
+   char *buff;
+   size_t cap;
+   size_t off;
+   size_t len;
+   twheel_timer_t timer;
+} client_t;
+
+static int nconns = 1000000, active_pct = 1, stride;
+static double secs = 2;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t rss_bytes(void)
+{
+   unsigned long size, rss = 0;
+   FILE *f = fopen("/proc/self/statm", "r");
+
+   if (f != NULL)
+   {
+      if (fscanf(f, "%lu %lu", &size, &rss) != 2)
+         rss = 0;
+      fclose(f);
+   }
+   return rss * sysconf(_SC_PAGESIZE);
+}
+
+static void report(const char *label, const char *what, size_t base)
+{
+   size_t grew = rss_bytes() - base;
+
+   printf("%-8s %-22s RSS +%8.1f MB  %6.0f bytes/conn\n", label, what, grew / 1048576.0,
+      (double)grew / nconns);
+}
+
+static void report_churn(const char *label, unsigned long ops, double t)
+{
+   printf("%-8s %-22s %8lu in %.1fs  %10.0f ns/conn\n", label, "close + accept, full", ops,
+      t, t * 1e9 / (ops ? ops : 1));
+}
+
+static void fill_host(char *host, int fd)
+{
+   snprintf(host, MAX_IP_LEN, "10.%d.%d.%d", (fd >> 16) & 255, (fd >> 8) & 255, fd & 255);
+}
+
+static void run_array(void)
+{
+   size_t base = rss_bytes();
+   /* like new client_t[], pages nobody wrote to cost nothing */
+   old_client_t *cli = calloc(nconns, sizeof(old_client_t));
+   unsigned long ops = 0;
+   unsigned seed = 1;
+   double t0, t;
+   int i, n;
+
+   if (cli == NULL)
+   {
+      perror("calloc");
+      exit(1);
+   }
+   /* filling up, the scan would find slot n after n others: skip it, it
+    * is quadratic */
+   for (n = 0; n < nconns; n++)
+   {
+      i = n;
+      cli[i].fd = FIRST_FD + n;
+      cli[i].port = n & 0xffff;
+      fill_host(cli[i].host, cli[i].fd);
+      cli[i].len = 0;
+      cli[i].status = 1;
+   }
+   report("array", "all open, idle", base);
+   for (i = 0; stride > 0 && i < nconns; i += stride)
+   {
+      memset(cli[i].buff, 'x', 512);
+      cli[i].len = 512;
+   }
+   report("array", "active have data", base);
+
+   t0 = now_sec();
+   do
+   {
+      int k;
+
+      for (k = 0; k < 16; k++, ops++)
+      {
+         int fd;
+
+         seed = seed * 1103515245 + 12345;
+         i = (seed >> 4) % nconns;
+         fd = cli[i].fd;
+         cli[i].status = 0;
+         for (i = 0; i < nconns; i++)
+            if (!cli[i].status)
+               break;
+         cli[i].fd = fd;
+         cli[i].len = 0;
+         cli[i].status = 1;
+      }
+   } while ((t = now_sec() - t0) < secs);
+   report_churn("array", ops, t);
+   free(cli);
+}
+
+static void run_conntab(void)
+{
+   size_t base = rss_bytes();
+   conntab_t *tab = conntab_create(sizeof(client_t));
+   conntab_stats_t st;
+   unsigned long ops = 0;
+   unsigned seed = 1;
+   double t0, t;
+   int fd;
+
+   if (tab == NULL)
+   {
+      perror("conntab_create");
+      exit(1);
+   }
+   for (fd = FIRST_FD; fd < FIRST_FD + nconns; fd++)
+   {
+      client_t *c = conntab_add(tab, fd);
+
+      if (c == NULL)
+      {
+         perror("conntab_add");
+         exit(1);
+      }
+      c->fd = fd;
+      c->port = fd & 0xffff;
+      fill_host(c->host, fd);
+   }
+   report("conntab", "all open, idle", base);
+   for (fd = FIRST_FD; stride > 0 && fd < FIRST_FD + nconns; fd += stride)
+   {
+      client_t *c = conntab_get(tab, fd);
+
+      c->buff = conntab_buf_get(tab, 512, &c->cap);
+      if (c->buff == NULL)
+      {
+         perror("conntab_buf_get");
+         exit(1);
+      }
+      memset(c->buff, 'x', 512);
+      c->len = 512;
+   }
+   report("conntab", "active have data", base);
+   conntab_stats(tab, &st);
+   printf("%-8s %-22s index %.1f MB, records %.1f MB, %zu buffers %.1f MB\n", "conntab",
+      "accounted", st.table_bytes / 1048576.0, st.rec_bytes / 1048576.0, st.bufs,
+      st.buf_bytes / 1048576.0);
+
+   t0 = now_sec();
+   do
+   {
+      int k;
+
+      for (k = 0; k < 16; k++, ops++)
+      {
+         client_t *c;
+
+         seed = seed * 1103515245 + 12345;
+         fd = FIRST_FD + (seed >> 4) % nconns;
+         c = conntab_get(tab, fd);
+         conntab_buf_put(tab, c->buff, c->cap);
+         conntab_del(tab, fd);
+         /* the kernel hands the same fd straight back */
+         c = conntab_add(tab, fd);
+         c->fd = fd;
+         c->port = fd & 0xffff;
+         fill_host(c->host, fd);
+      }
+   } while ((t = now_sec() - t0) < secs);
+   report_churn("conntab", ops, t);
+   conntab_destroy(tab);
+}
+
+static void run(void (*fn)(void))
+{
+   pid_t pid = fork();
+   int status;
+
+   if (pid < 0)
+   {
+      perror("fork");
+      exit(1);
+   }
+   if (pid == 0)
+   {
+      fn();
+      fflush(stdout);
+      _exit(0);
+   }
+   waitpid(pid, &status, 0);
+}
+
+int main(int argc, char *argv[])
+{
+   const char *mode = NULL;
+   int ch;
+
+   while ((ch = getopt(argc, argv, "n:a:d:m:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'n': nconns = atoi(optarg); break;
+         case 'a': active_pct = atoi(optarg); break;
+         case 'd': secs = atof(optarg); break;
+         case 'm': mode = optarg; break;
+         default:
+            fprintf(stderr, "bench_conntab [-n conns] [-a active_percent] [-d seconds] [-m array|conntab]\n");
+            exit(1);
+      }
+   }
+   if (nconns < 1)
+      nconns = 1000000;
+   if (active_pct < 0 || active_pct > 100)
+      active_pct = 1;
+
+   stride = active_pct > 0 ? 100 / active_pct : 0;
+   printf("%d connections, %d%% with 512 bytes pending\n", nconns, active_pct);
+   fflush(stdout);
+   if (mode == NULL || strcmp(mode, "array") == 0)
+      run(run_array);
+   if (mode == NULL || strcmp(mode, "conntab") == 0)
+      run(run_conntab);
+   return 0;
+}
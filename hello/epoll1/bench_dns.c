@@ -0,0 +1,125 @@
+/* bench_dns.c
+ * resolves every line of a host file through dns.c, keeping up to
+ * <inflight> queries on the wire, and reports names/sec and what the
+ * cache saved. -c 1 behaves like one blocking lookup after the other.
+ * build with : gcc -O2 -Wall -o bench_dns bench_dns.c dns.c se.c
+ * run with   : ./bench_dns -s 127.0.0.1:5353 -c 256 hosts.txt
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "se.h"
+#include "dns.h"
+
+#define MAX_LINE 1024
+
+static se_loop_t *loop;
+static dns_t *dns;
+static FILE *fp;
+static int window, feeding, eof, verbose;
+static long long lines, resolved, failed;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void feed(void);
+
+static void on_resolved(const char *host, const struct in_addr *addr, void *arg)
+{
+   if (addr)
+      resolved++;
+   else
+      failed++;
+   if (verbose)
+      printf("%s\t%s\n", host, addr ? inet_ntoa(*addr) : "-");
+   feed();
+}
+
+/* keep the resolver busy without queueing the whole file */
+static void feed(void)
+{
+   char buf[MAX_LINE];
+
+   if (feeding)
+      return;
+   feeding = 1;
+   while (!eof && dns_pending(dns) < window)
+   {
+      if (fgets(buf, sizeof(buf), fp) == NULL)
+      {
+         eof = 1;
+         break;
+      }
+      buf[strcspn(buf, "\r\n")] = '\0';
+      if (buf[0] == '\0')
+         continue;
+      lines++;
+      dns_resolve(dns, buf, on_resolved, NULL);
+   }
+   feeding = 0;
+   if (eof && dns_pending(dns) == 0)
+      se_stop(loop);
+}
+
+int main(int argc, char *argv[])
+{
+   const dns_stats_t *st;
+   char *server = NULL;
+   int ch, inflight = 256, timeout = 1000;
+   double start, secs;
+
+   while ((ch = getopt(argc, argv, "s:c:T:vh?")) != -1)
+   {
+      switch (ch)
+      {
+         case 's': server = optarg; break;
+         case 'c': inflight = atoi(optarg); break;
+         case 'T': timeout = atoi(optarg); break;
+         case 'v': verbose = 1; break;
+         default: optind = argc + 1; break;
+      }
+   }
+   if (optind != argc - 1)
+   {
+      printf("bench_dns [-s server[:port]] [-c inflight] [-T timeout ms] [-v] <hostfile>\n");
+      exit(1);
+   }
+   if ((fp = fopen(argv[optind], "r")) == NULL)
+   {
+      perror(argv[optind]);
+      exit(1);
+   }
+
+   loop = se_create(64);
+   if ((dns = dns_create(loop, server, inflight, timeout)) == NULL)
+   {
+      perror("dns_create");
+      exit(1);
+   }
+   // queued names cost memory only, twice the window keeps the wire full
+   window = inflight * 2;
+
+   start = now_sec();
+   feed();
+   if (!eof || dns_pending(dns) > 0)
+      se_loop(loop, -1);
+   secs = now_sec() - start;
+
+   st = dns_stats(dns);
+   fprintf(stderr, "%lld names, %d in flight, %.2fs\n", lines, inflight, secs);
+   fprintf(stderr, "Resolved: %lld\nFailed: %lld\n", resolved, failed);
+   fprintf(stderr, "Literals: %lu\nCache hits: %lu\nCoalesced: %lu\n",
+      st->literals, st->cache_hits, st->coalesced);
+   fprintf(stderr, "Queries: %lu\nRetries: %lu\nNames/sec: %.0f\n",
+      st->sent, st->retries, lines / secs);
+   return 0;
+}
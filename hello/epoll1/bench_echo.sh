@@ -0,0 +1,61 @@
+#!/bin/sh
+# Echo servers side by side: echo_server.c on epoll, echo_server.c -u on
+# uring.c (multishot recv, provided buffers), and iocpserverex_linux.c,
+# the iocp1/serverex design on io_uring (preposted accepts, pooled
+# per-I/O contexts, one ring per worker). Each gets THREADS threads and
+# CONNS keep-alive connections from sockevent, one message in flight per
+# connection, for 64 byte and 4 KB messages. Messages/sec and latency
+# come from sockevent, system calls per message from syscount.so.
+#
+#   ./bench_echo.sh [port] [seconds]
+
+PORT=${1:-5001}
+SECS=${2:-10}
+THREADS=${THREADS:-4}
+CONNS=${CONNS:-256}
+OUT=/tmp/syscount.$$
+
+gcc -O2 -pthread -o echo_server echo_server.c uring.c || exit 1
+gcc -O2 -pthread -o iocpserverex_linux ../iocp1/serverex/iocpserverex_linux.c || exit 1
+gcc -O2 -o sockevent sockevent.c hist.c reqtmpl.c http_resp.c -lpthread || exit 1
+gcc -O2 -shared -fPIC -o syscount.so syscount.c -ldl || exit 1
+
+# run <label> <message size> <server command...>
+run()
+{
+    label=$1
+    size=$2
+    shift 2
+    SYSCOUNT_OUT=$OUT LD_PRELOAD=./syscount.so "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    msg=$(head -c $size /dev/zero | tr '\0' x)
+    ./sockevent -t $THREADS -k -m "$msg" -r $size -d $SECS 127.0.0.1:$PORT $CONNS 2>&1 |
+        awk '/^Reponses received:/ { n = $3 }
+             /^Rates in/ { split($4, r, "rep/s"); rate = r[1] }
+             /^Errors:/ { err = $2 }
+             $1 == "#[Mean" { mean = $3; sub(",", "", mean) }
+             END { printf "%s %.0f %s %s\n", n, rate, err, mean }' > $OUT.load
+    kill $pid
+    wait $pid 2> /dev/null || true
+    # a ring is torn down after its process is gone, and an accept still
+    # posted on it keeps the listening socket open until then
+    sleep 1
+    read n rate err mean < $OUT.load
+    total=$(awk '$1 == "total" { print $2 }' $OUT)
+    awk -v label="$label" -v n="${n:-0}" -v rate="${rate:-0}" -v err="${err:-0}" \
+        -v mean="$mean" -v total="${total:-0}" 'BEGIN {
+            if (n == 0) { printf "%-22s no messages\n", label; exit }
+            printf "%-22s %9.0f msg/s %7.3f syscalls/msg  mean %s us  errors %s\n",
+                label, rate, total / n, mean, err
+        }'
+    rm -f $OUT $OUT.load
+}
+
+for size in 64 4096
+do
+    echo "== $THREADS threads, $CONNS connections, $size byte messages"
+    run "echo_server (epoll)" $size ./echo_server -t $THREADS $PORT
+    run "echo_server -u" $size ./echo_server -u -t $THREADS $PORT
+    run "iocpserverex_linux" $size ./iocpserverex_linux -e:$PORT -t:$THREADS
+done
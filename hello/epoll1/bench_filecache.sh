@@ -0,0 +1,41 @@
+#!/bin/sh
+# Per-request cost of epoll_poll.c with and without the open-file cache
+# (the uncached build is the same source with -DNO_FILE_CACHE). One
+# keep-alive connection fetches a small file, so the average latency is
+# simply 1/(requests/sec). When strace is installed the syscalls the
+# server makes during a fixed number of requests are counted as well.
+#
+#   ./bench_filecache.sh [seconds]
+
+SECS=${1:-10}
+DIR=`mktemp -d`
+HERE=`pwd`
+
+g++ -O2 -pthread -o epoll_poll epoll_poll.c twheel.c || exit 1
+g++ -O2 -pthread -DNO_FILE_CACHE -o epoll_poll_nocache epoll_poll.c twheel.c || exit 1
+gcc -O2 -o bench_http bench_http.c || exit 1
+
+head -c 2048 /dev/urandom > $DIR/asset.js
+
+for server in epoll_poll_nocache epoll_poll
+do
+    (cd $DIR && exec $HERE/$server > /dev/null 2>&1) &
+    pid=$!
+    sleep 1
+    rps=`./bench_http -k -c 1 -d $SECS -u /asset.js 127.0.0.1:8002 | sed -n 's/Requests\/sec: //p'`
+    echo "== $server: $rps req/s, `awk -v r=$rps 'BEGIN { printf "%.1f", 1000000 / r }'` us/request"
+
+    if which strace > /dev/null 2>&1
+    then
+        strace -c -f -p $pid -o $DIR/strace.out &
+        spid=$!
+        sleep 1
+        ./bench_http -k -c 1 -d 2 -u /asset.js 127.0.0.1:8002 | grep Requests:
+        kill -INT $spid
+        wait $spid
+        cat $DIR/strace.out
+    fi
+    kill $pid
+    wait $pid 2> /dev/null || true
+done
+rm -rf $DIR
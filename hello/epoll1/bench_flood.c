@@ -0,0 +1,274 @@
+/* bench_flood.c
+ * what a connection storm costs the clients already connected: one thread
+ * keeps -c keep-alive connections busy with one request in flight each and
+ * records every response time, while -f flood threads open connections as
+ * fast as the server lets them, send a request on each and reset it (or,
+ * with -H, hold the last H of them open first). Prints the steady clients'
+ * throughput and percentiles and the flood's connection rate.
+ * build with : gcc -O2 -Wall -pthread -o bench_flood bench_flood.c hist.c http_resp.c
+ * run with   : ./bench_flood -c 64 -f 4 -d 10 127.0.0.1:8080
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "hist.h"
+#include "http_resp.h"
+
+#define MAX_FLOODERS 64
+#define MAXEVENTS 256
+
+static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+struct steady
+{
+   int fd;
+   uint64_t sent_at;
+   http_resp_t resp;
+};
+
+struct flooder
+{
+   pthread_t tid;
+   unsigned long conns;
+   unsigned long failed;
+};
+
+static struct sockaddr_in addr;
+static int nsteady = 64, nflood = 4, hold;
+static volatile int stop;
+
+static hist_t latency;
+static unsigned long steady_done, steady_errors;
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int steady_connect(struct steady *s, int epfd)
+{
+   struct epoll_event ev;
+   int one = 1;
+
+   s->fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (s->fd < 0)
+      return -1;
+   if (connect(s->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+   {
+      close(s->fd);
+      return -1;
+   }
+   setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+   ev.events = EPOLLIN;
+   ev.data.ptr = s;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0)
+   {
+      close(s->fd);
+      return -1;
+   }
+   return 0;
+}
+
+static int steady_send(struct steady *s)
+{
+   http_resp_init(&s->resp, 0);
+   s->sent_at = now_ns();
+   return send(s->fd, request, sizeof(request) - 1, MSG_NOSIGNAL) == sizeof(request) - 1 ? 0 : -1;
+}
+
+/* drop a broken steady connection and open a new one in its place */
+static void steady_redo(struct steady *s, int epfd)
+{
+   steady_errors++;
+   close(s->fd);
+   while (!stop && (steady_connect(s, epfd) < 0 || steady_send(s) < 0))
+      steady_errors++;
+}
+
+static void *flood_main(void *arg)
+{
+   struct flooder *f = arg;
+   struct linger lg = { 1, 0 };
+   int *held = calloc(hold > 0 ? hold : 1, sizeof(int));
+   int i, next = 0;
+
+   for (i = 0; i < hold; i++)
+      held[i] = -1;
+   while (!stop)
+   {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+      if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      {
+         f->failed++;
+         if (fd >= 0)
+            close(fd);
+         continue;
+      }
+      send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+      /* reset rather than close, or the ports run out in TIME_WAIT */
+      setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+      if (hold > 0)
+      {
+         int old = held[next];
+
+         held[next] = fd;
+         next = (next + 1) % hold;
+         fd = old;
+      }
+      if (fd >= 0)
+         close(fd);
+      f->conns++;
+   }
+   for (i = 0; i < hold; i++)
+      if (held[i] >= 0)
+         close(held[i]);
+   free(held);
+   return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+   static struct flooder flooders[MAX_FLOODERS];
+   struct epoll_event events[MAXEVENTS];
+   struct steady *conns;
+   struct rlimit rl;
+   unsigned long flood_conns = 0, flood_failed = 0;
+   double secs = 10;
+   uint64_t start, end;
+   char buf[16384], *colon;
+   int ch, epfd, i, n;
+
+   while ((ch = getopt(argc, argv, "c:f:H:d:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'c': nsteady = atoi(optarg); break;
+         case 'f': nflood = atoi(optarg); break;
+         case 'H': hold = atoi(optarg); break;
+         case 'd': secs = atof(optarg); break;
+         default:
+            fprintf(stderr, "bench_flood [-c steady_conns] [-f flood_threads] [-H held_per_thread] [-d seconds] ip:port\n");
+            exit(1);
+      }
+   }
+   if (optind >= argc || (colon = strchr(argv[optind], ':')) == NULL)
+   {
+      fprintf(stderr, "bench_flood [-c steady_conns] [-f flood_threads] [-H held_per_thread] [-d seconds] ip:port\n");
+      exit(1);
+   }
+   *colon = '\0';
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(atoi(colon + 1));
+   if (inet_pton(AF_INET, argv[optind], &addr.sin_addr) != 1)
+   {
+      fprintf(stderr, "bad address %s\n", argv[optind]);
+      exit(1);
+   }
+   if (nsteady < 1)
+      nsteady = 1;
+   if (nflood < 0 || nflood > MAX_FLOODERS)
+      nflood = 4;
+   if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+   {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+   }
+
+   hist_init(&latency);
+   epfd = epoll_create1(0);
+   conns = calloc(nsteady, sizeof(struct steady));
+   if (epfd < 0 || conns == NULL)
+   {
+      perror("init");
+      exit(1);
+   }
+   for (i = 0; i < nsteady; i++)
+   {
+      if (steady_connect(&conns[i], epfd) < 0 || steady_send(&conns[i]) < 0)
+      {
+         perror("steady connection");
+         exit(1);
+      }
+   }
+
+   for (i = 0; i < nflood; i++)
+   {
+      if (pthread_create(&flooders[i].tid, NULL, flood_main, &flooders[i]) != 0)
+      {
+         perror("pthread_create");
+         exit(1);
+      }
+   }
+
+   start = now_ns();
+   end = start + (uint64_t)(secs * 1e9);
+   while (now_ns() < end)
+   {
+      n = epoll_wait(epfd, events, MAXEVENTS, 100);
+      for (i = 0; i < n; i++)
+      {
+         struct steady *s = events[i].data.ptr;
+         ssize_t len = recv(s->fd, buf, sizeof(buf), 0);
+         size_t used;
+
+         if (len <= 0)
+         {
+            steady_redo(s, epfd);
+            continue;
+         }
+         switch (http_resp_feed(&s->resp, buf, len, &used))
+         {
+            case HTTP_RESP_AGAIN:
+               break;
+            case HTTP_RESP_DONE:
+               hist_record(&latency, now_ns() - s->sent_at);
+               steady_done++;
+               if (steady_send(s) < 0)
+                  steady_redo(s, epfd);
+               break;
+            default:
+               steady_redo(s, epfd);
+               break;
+         }
+      }
+   }
+   end = now_ns();
+   stop = 1;
+   for (i = 0; i < nflood; i++)
+   {
+      pthread_join(flooders[i].tid, NULL);
+      flood_conns += flooders[i].conns;
+      flood_failed += flooders[i].failed;
+   }
+   secs = (end - start) / 1e9;
+
+   printf("steady: %d conns %.0f req/s p50 %.0f us p99 %.0f us p99.9 %.0f us max %.0f us errors %lu\n",
+      nsteady, steady_done / secs, hist_percentile(&latency, 50) / 1e3,
+      hist_percentile(&latency, 99) / 1e3, hist_percentile(&latency, 99.9) / 1e3,
+      latency.max / 1e3, steady_errors);
+   printf("flood: %d threads %.0f conn/s held %d failed %lu\n", nflood, flood_conns / secs,
+      hold * nflood, flood_failed);
+
+   for (i = 0; i < nsteady; i++)
+      close(conns[i].fd);
+   free(conns);
+   close(epfd);
+   return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# What a connection flood does to the clients already being served:
+# bench_flood keeps CONNS keep-alive connections busy against
+# epoll_server.c (classic mode) and reports their p99 while FLOODERS
+# threads open and reset connections as fast as they can, and then again
+# with each flood thread holding HOLD of them open. The server drains the
+# whole backlog per wakeup (-a 0), takes the default accept budget, and
+# takes the budget with MAX connections admitted (-m).
+#
+#   ./bench_flood.sh [port] [seconds]
+
+PORT=${1:-8080}
+SECS=${2:-10}
+CONNS=${CONNS:-64}
+FLOODERS=${FLOODERS:-4}
+HOLD=${HOLD:-1000}
+MAX=${MAX:-2000}
+
+gcc -O2 -pthread -o epoll_server epoll_server.c http_parser.c uring.c twheel.c master.c processtitle.c topo.c || exit 1
+gcc -O2 -pthread -o bench_flood bench_flood.c hist.c http_resp.c || exit 1
+
+# run <label> <server options...>
+run()
+{
+    label=$1
+    shift
+    ./epoll_server "$@" $PORT > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    for flood in "-f 0" "-f $FLOODERS" "-f $FLOODERS -H $HOLD"
+    do
+        printf "%-24s %-14s " "$label" "$flood"
+        ./bench_flood -c $CONNS $flood -d $SECS 127.0.0.1:$PORT | awk '
+            /^steady:/ { printf "%7.0f req/s  p50 %6.0f us  p99 %7.0f us  p99.9 %7.0f us", $4, $7, $10, $13 }
+            /^flood:/ { printf "  flood %6.0f conn/s\n", $4 }'
+    done
+    kill $pid
+    wait $pid 2> /dev/null || true
+    sleep 1
+}
+
+run "drain backlog (-a 0)" -a 0
+run "accept budget"
+run "budget, -m $MAX" -m $MAX
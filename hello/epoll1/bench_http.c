@@ -0,0 +1,267 @@
+/* bench_http.c
+ * a small wrk style HTTP benchmark: keeps <connections> busy against one
+ * server for <seconds> and reports requests/sec. With -k the connections
+ * are kept alive and -p sends that many pipelined requests per round
+ * trip, without -k every request asks for Connection: close and pays a
+ * new TCP handshake.
+ * build with : gcc -O2 -Wall -o bench_http bench_http.c
+ * run with   : ./bench_http -c 100 -d 10 -k -p 16 127.0.0.1:8080
+ *              ./bench_http -c 10 -d 10 -k -u /100m.bin 127.0.0.1:8002
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+static const char req_keepalive[] = "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char req_close[] = "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+struct conn
+{
+   int fd;
+   int outstanding;       // requests sent and not answered yet
+   long body_left;        // body bytes of the current response still to skip
+   int len;               // bytes in buffer
+   char buffer[16384];
+};
+
+static struct config
+{
+   struct sockaddr_in target;
+   int connections;
+   int seconds;
+   int keepalive;
+   int pipeline;
+   char *path;
+} cfg;
+
+static char *batch;       // cfg.pipeline requests back to back
+static int batchlen;
+static long long responses, errors, connects;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int conn_open(int epfd, struct conn *c)
+{
+   struct epoll_event ev;
+
+   c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+   if (c->fd < 0)
+   {
+      perror("socket");
+      exit(1);
+   }
+   if (connect(c->fd, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) < 0
+      && errno != EINPROGRESS)
+   {
+      perror("connect");
+      exit(1);
+   }
+   c->outstanding = 0;
+   c->body_left = 0;
+   c->len = 0;
+   connects++;
+
+   ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+   ev.data.ptr = c;
+   return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static void conn_reopen(int epfd, struct conn *c)
+{
+   close(c->fd);
+   conn_open(epfd, c);
+}
+
+/* count the responses completed by the data in the buffer, bodies are
+ * skipped as they stream in so they can be larger than the buffer */
+static int consume_responses(struct conn *c)
+{
+   int n = 0;
+   char *p = c->buffer, *end = c->buffer + c->len;
+
+   for (;;)
+   {
+      char *eoh, *cl;
+
+      if (c->body_left > 0)
+      {
+         long skip = end - p < c->body_left ? end - p : c->body_left;
+
+         p += skip;
+         c->body_left -= skip;
+         if (c->body_left > 0)
+            break;
+         n++;
+         continue;
+      }
+
+      eoh = memmem(p, end - p, "\r\n\r\n", 4);
+      if (eoh == NULL)
+         break;
+      *eoh = 0;
+      if ((cl = strcasestr(p, "\r\nContent-Length:")) != NULL)
+         c->body_left = strtol(cl + 17, NULL, 10);
+      *eoh = '\r';
+      p = eoh + 4;
+      if (c->body_left == 0)
+         n++;
+   }
+   c->len = end - p;
+   memmove(c->buffer, p, c->len);
+   return n;
+}
+
+static void on_writable(struct conn *c)
+{
+   if (c->outstanding > 0)
+      return;
+   if (send(c->fd, batch, batchlen, MSG_NOSIGNAL) != batchlen)
+   {
+      // the batch is small enough to always fit an empty socket buffer
+      errors++;
+      return;
+   }
+   c->outstanding = cfg.pipeline;
+}
+
+static void on_readable(int epfd, struct conn *c)
+{
+   for (;;)
+   {
+      int n = recv(c->fd, c->buffer + c->len, sizeof(c->buffer) - c->len, 0);
+
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return;
+      if (n <= 0)
+      {
+         // without keep-alive the server closing is the normal end
+         if (cfg.keepalive || c->outstanding > 0)
+            errors++;
+         conn_reopen(epfd, c);
+         return;
+      }
+      c->len += n;
+      n = consume_responses(c);
+      responses += n;
+      c->outstanding -= n;
+
+      if (c->outstanding == 0)
+      {
+         if (cfg.keepalive)
+            on_writable(c);
+         else
+         {
+            conn_reopen(epfd, c);
+            return;
+         }
+      }
+   }
+}
+
+static int parse_args(int argc, char *argv[])
+{
+   int ch;
+   char *port;
+
+   cfg.connections = 100;
+   cfg.seconds = 10;
+   cfg.pipeline = 1;
+   cfg.path = "/";
+   while ((ch = getopt(argc, argv, "c:d:kp:u:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'c': cfg.connections = atoi(optarg); break;
+         case 'd': cfg.seconds = atoi(optarg); break;
+         case 'k': cfg.keepalive = 1; break;
+         case 'p': cfg.pipeline = atoi(optarg); break;
+         case 'u': cfg.path = optarg; break;
+         default: return -1;
+      }
+   }
+   if (optind >= argc || (port = strrchr(argv[optind], ':')) == NULL)
+      return -1;
+   *port++ = 0;
+   cfg.target.sin_family = AF_INET;
+   cfg.target.sin_port = htons(atoi(port));
+   if (!inet_aton(argv[optind], &cfg.target.sin_addr))
+      return -1;
+   if (!cfg.keepalive || cfg.pipeline < 1)
+      cfg.pipeline = 1;
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   int epfd, i, n;
+   struct conn *conns;
+   struct epoll_event *events;
+   double start, end;
+
+   if (parse_args(argc, argv) != 0)
+   {
+      printf("bench_http [-c connections] [-d seconds] [-k] [-p pipeline] [-u path] <ip:port>\n");
+      exit(1);
+   }
+   signal(SIGPIPE, SIG_IGN);
+
+   batchlen = snprintf(NULL, 0, cfg.keepalive ? req_keepalive : req_close, cfg.path);
+   batch = malloc(batchlen * cfg.pipeline + 1);
+   for (i = 0; i < cfg.pipeline; i++)
+      sprintf(batch + i * batchlen, cfg.keepalive ? req_keepalive : req_close, cfg.path);
+   batchlen *= cfg.pipeline;
+
+   epfd = epoll_create1(0);
+   conns = calloc(cfg.connections, sizeof(struct conn));
+   events = calloc(cfg.connections, sizeof(struct epoll_event));
+   for (i = 0; i < cfg.connections; i++)
+      if (conn_open(epfd, &conns[i]) != 0)
+      {
+         perror("epoll_ctl");
+         exit(1);
+      }
+
+   start = now_sec();
+   end = start + cfg.seconds;
+   while (now_sec() < end)
+   {
+      n = epoll_wait(epfd, events, cfg.connections, 100);
+      for (i = 0; i < n; i++)
+      {
+         struct conn *c = events[i].data.ptr;
+
+         if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN))
+         {
+            errors++;
+            conn_reopen(epfd, c);
+            continue;
+         }
+         if (events[i].events & EPOLLOUT)
+            on_writable(c);
+         if (events[i].events & EPOLLIN)
+            on_readable(epfd, c);
+      }
+   }
+   end = now_sec() - start;
+
+   printf("%d connections, keep-alive %s, pipeline %d, %.1fs\n",
+      cfg.connections, cfg.keepalive ? "on" : "off", cfg.pipeline, end);
+   printf("Requests: %lld\nConnects: %lld\nErrors: %lld\nRequests/sec: %.0f\n",
+      responses, connects, errors, responses / end);
+   return 0;
+}
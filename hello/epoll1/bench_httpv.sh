@@ -0,0 +1,34 @@
+#!/bin/sh
+# Hosts/sec of httpv.c with 1, 2, 4, ... scanner threads, up to the number
+# of cores, against delayhttpd forked once per core on 127.0.0.1. Each
+# thread scans its own slice of the host list with its own epoll instance,
+# so the rate should grow with the thread count until the cores run out.
+#
+#   ./bench_httpv.sh [port] [lines]
+
+PORT=${1:-8091}
+LINES=${2:-200000}
+CONNS=${CONNS:-500}
+MIX=${MIX:-1:100}
+CORES=`nproc`
+TARGETS=/tmp/bench_httpv_targets.txt
+
+gcc -O2 -o delayhttpd delayhttpd.c se.c || exit 1
+gcc -O2 -pthread -o httpv httpv.c se.c dns.c http_scan.c || exit 1
+
+yes 127.0.0.1 | head -n $LINES > $TARGETS
+
+./delayhttpd -m $MIX -n $CORES $PORT 2> /dev/null &
+pid=$!
+sleep 1
+
+t=1
+while [ $t -le $CORES ]; do
+   echo "== $t threads, $CONNS connections each"
+   ./httpv -P $PORT -t $t -c $CONNS -f $TARGETS 2>&1 > /dev/null | tail -1
+   t=`expr $t \* 2`
+done
+
+kill $pid
+wait $pid 2> /dev/null || true
+rm -f $TARGETS
@@ -0,0 +1,219 @@
+/* bench_log.c
+ * cost of an INFO line to the thread that logs it, with -t threads (1, then
+ * 16) each logging -n lines (a format with an int, a string and a double)
+ * to -o (/dev/null):
+ *   sync  : logtest.c as it was, vsnprintf into a 4K buffer, then time,
+ *           localtime, strftime and fprintf on the caller's thread
+ *   async : logger.c, the arguments go into the thread's ring and the
+ *           writer thread formats the lines and writes them in batches
+ * For each: ns per call as the callers see it, and lines per second from
+ * the first call until the last line is written (for async, LOG_DESTORY
+ * waits for the writer), with the lines dropped on full rings.
+ * Then the cost of a line that is not logged, over -d calls in a loop:
+ *   empty    : the loop alone
+ *   sync     : logtest.c as it was, the level is tested after vsnprintf
+ *   disabled : INFO with LOG_LEVEL(LOG_ERROR), one test of a global
+ *   compiled : DEBUG, compiled out by LOG_MIN_LEVEL LOG_INFO
+ * with how many times the line's argument was evaluated.
+ * build with : gcc -O2 -Wall -pthread -o bench_log bench_log.c logger.c
+ * run with   : ./bench_log [-t threads] [-n lines_per_thread] [-o file] [-d calls]
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LOG_MIN_LEVEL LOG_INFO
+#include "logger.h"
+
+static int nthreads = 16, nlines = 200000;
+static long ncalls = 100000000;
+static int sync_level = LOG_ALL;
+static long evaluated;
+static const char *path = "/dev/null";
+static FILE *sync_device;
+static pthread_barrier_t start;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* logtest.c's LOG_ADD and LOG_WRITER before logger.c */
+static void sync_add(int level, const char *file, const char *func, int line, const char *msg)
+{
+   const char *c = "IWEDX";
+   time_t meow = time(NULL);
+   char buf[64];
+
+   if ((level & ~sync_level) != 0)
+      return;
+   strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&meow));
+   fprintf(sync_device, "%s%s[%d][%s(%s):%d] %c, %s%s\n", "", buf, (int)getpid(), file, func, line, c[0], msg, "");
+}
+
+static void sync_writer(int level, const char *file, const char *func, int line, const char *fmt, ...)
+{
+   va_list ap;
+   char msg[LOG_MAX_MSG_LEN];
+
+   va_start(ap, fmt);
+   vsnprintf(msg, sizeof(msg), fmt, ap);
+   sync_add(level, file, func, line, msg);
+   va_end(ap);
+}
+
+struct job
+{
+   int id;
+   int async;
+   double ns;
+};
+
+static void *logger_thread(void *arg)
+{
+   struct job *j = arg;
+   double t0;
+   int i;
+
+   pthread_barrier_wait(&start);
+   t0 = now_sec();
+   if (j->async)
+      for (i = 0; i < nlines; i++)
+         INFO("request %d from %s done in %.3f ms", i, "127.0.0.1:52114", i * 0.001);
+   else
+      for (i = 0; i < nlines; i++)
+         sync_writer(LOG_INFO, __FILE__, __FUNCTION__, __LINE__,
+                     "request %d from %s done in %.3f ms", i, "127.0.0.1:52114", i * 0.001);
+   j->ns = (now_sec() - t0) * 1e9 / nlines;
+   return NULL;
+}
+
+static void run(int async, int threads)
+{
+   pthread_t *tids = calloc(threads, sizeof(pthread_t));
+   struct job *jobs = calloc(threads, sizeof(struct job));
+   unsigned long dropped = LOG_DROPPED();
+   double t0, t, ns = 0;
+   int i;
+
+   if (async)
+   {
+      LOG_INIT(path);
+      LOG_LEVEL(LOG_ALL);
+   }
+   else if ((sync_device = fopen(path, "a")) == NULL)
+   {
+      perror(path);
+      exit(1);
+   }
+
+   pthread_barrier_init(&start, NULL, threads + 1);
+   for (i = 0; i < threads; i++)
+   {
+      jobs[i].id = i;
+      jobs[i].async = async;
+      pthread_create(&tids[i], NULL, logger_thread, &jobs[i]);
+   }
+   pthread_barrier_wait(&start);
+   t0 = now_sec();
+   for (i = 0; i < threads; i++)
+   {
+      pthread_join(tids[i], NULL);
+      ns += jobs[i].ns;
+   }
+   if (async)
+   {
+      LOG_DESTORY();
+      dropped = LOG_DROPPED() - dropped;
+   }
+   else
+   {
+      fclose(sync_device);
+      dropped = 0;
+   }
+   t = now_sec() - t0;
+   pthread_barrier_destroy(&start);
+
+   printf("%-5s %2d threads %8.1f ns/call %10.0f lines/s  dropped %lu\n",
+          async ? "async" : "sync", threads, ns / threads,
+          ((double)threads * nlines - dropped) / t, dropped);
+   free(tids);
+   free(jobs);
+}
+
+/* a line's argument, counted when it is evaluated */
+static __attribute__((noinline)) long arg(long i)
+{
+   evaluated++;
+   return i;
+}
+
+static void disabled(const char *name, int mode)
+{
+   double t0, t;
+   long i;
+
+   evaluated = 0;
+   sync_level = LOG_ERROR;
+   LOG_LEVEL(LOG_ERROR);
+   t0 = now_sec();
+   for (i = 0; i < ncalls; i++)
+   {
+      if (mode == 1)
+         sync_writer(LOG_INFO, __FILE__, __FUNCTION__, __LINE__, "request %ld", arg(i));
+      else if (mode == 2)
+         INFO("request %ld", arg(i));
+      else if (mode == 3)
+         DEBUG("request %ld", arg(i));
+      __asm__ __volatile__("" ::: "memory");
+   }
+   t = now_sec() - t0;
+   sync_level = LOG_ALL;
+   LOG_LEVEL(LOG_ALL);
+
+   printf("%-8s %6.2f ns/call  arguments evaluated %ld\n", name, t * 1e9 / ncalls, evaluated);
+}
+
+int main(int argc, char *argv[])
+{
+   int ch;
+
+   while ((ch = getopt(argc, argv, "t:n:o:d:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 't': nthreads = atoi(optarg); break;
+         case 'n': nlines = atoi(optarg); break;
+         case 'o': path = optarg; break;
+         case 'd': ncalls = atol(optarg); break;
+         default:
+            fprintf(stderr, "bench_log [-t threads] [-n lines_per_thread] [-o file] [-d calls]\n");
+            exit(1);
+      }
+   }
+   if (nthreads < 1)
+      nthreads = 16;
+   if (nlines < 1)
+      nlines = 200000;
+   if (ncalls < 1)
+      ncalls = 100000000;
+
+   run(0, 1);
+   run(1, 1);
+   run(0, nthreads);
+   run(1, nthreads);
+
+   disabled("empty", 0);
+   disabled("sync", 1);
+   disabled("disabled", 2);
+   disabled("compiled", 3);
+   return 0;
+}
@@ -0,0 +1,297 @@
+/* bench_numa.c
+ * where the workers' connection buffers end up and how often they are read
+ * from a remote node, with -w worker processes (one per online cpu) each
+ * allocating -b MB of 16K buffers and reading them at random for -d seconds:
+ *   none       : no placement, the scheduler moves the workers at will
+ *   active_cpu : processtitle.c's active_cpu(id), as master.c does without -N
+ *   numa       : topo.c's topo_place(id), as master.c does with -N
+ * With -L the buffers are allocated before the placement, as by a worker
+ * that sets up its pools first; numa mode then moves them with topo_mbind.
+ * For every mode: the buffer pages on the worker's own node and on others
+ * (move_pages), the allocations the kernel served from another node than
+ * the one asked for (numastat other_node), the loads served from a remote
+ * node (the node-load-misses counter, where perf exposes it) and ns/read.
+ * build with : gcc -O2 -Wall -o bench_numa bench_numa.c topo.c processtitle.c
+ * run with   : ./bench_numa [-w workers] [-b MB] [-d seconds] [-L] [-m none|active_cpu|numa]
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "processtitle.h"
+#include "topo.h"
+
+#define BUF_SIZE (16 * 1024)
+#define PAGES_PER_CALL 1024
+
+struct result
+{
+   int cpu;
+   int node;
+   long local;
+   long remote;
+   long untouched;
+   double reads;
+   double ns;
+   long long remote_loads;     /* -1 when the counter is not there */
+   long long loads;
+};
+
+static int nworkers, mb = 64, late;
+static double secs = 2;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* sum of one numastat field over every node */
+static long long numastat(const char *field)
+{
+   long long sum = 0;
+   int node;
+
+   for (node = 0; node < 1024; node++)
+   {
+      char path[96], name[32];
+      long long v;
+      FILE *f;
+
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", node);
+      if ((f = fopen(path, "r")) == NULL)
+      {
+         if (node >= topo_nodes() + 64)
+            break;
+         continue;
+      }
+      while (fscanf(f, "%31s %lld", name, &v) == 2)
+         if (strcmp(name, field) == 0)
+            sum += v;
+      fclose(f);
+   }
+   return sum;
+}
+
+static int node_counter(int result)
+{
+   struct perf_event_attr attr;
+
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = PERF_TYPE_HW_CACHE;
+   attr.config = PERF_COUNT_HW_CACHE_NODE |
+                 (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long counter_read(int fd)
+{
+   long long v;
+
+   if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+      return -1;
+   return v;
+}
+
+static void place(int mode, int id)
+{
+   if (mode == 1)
+      active_cpu(id);
+   else if (mode == 2)
+      topo_place(id);
+}
+
+static void worker(int mode, int id, int out)
+{
+   int nbufs = (int)((long)mb * 1024 * 1024 / BUF_SIZE), i, j;
+   long page = sysconf(_SC_PAGESIZE), npages = BUF_SIZE / page;
+   char **bufs = malloc(nbufs * sizeof(char *));
+   void *pages[PAGES_PER_CALL];
+   int status[PAGES_PER_CALL];
+   struct result r;
+   unsigned seed = id + 1;
+   unsigned char sum = 0;
+   int miss_fd, access_fd;
+   double t0;
+
+   memset(&r, 0, sizeof(r));
+   if (!late)
+      place(mode, id);
+   for (i = 0; i < nbufs; i++)
+   {
+      bufs[i] = malloc(BUF_SIZE);
+      memset(bufs[i], i, BUF_SIZE);
+   }
+   if (late)
+   {
+      place(mode, id);
+      if (mode == 2)
+         for (i = 0; i < nbufs; i++)
+            topo_mbind(bufs[i], BUF_SIZE, topo_node_of_cpu(topo_worker_cpu(id)));
+   }
+
+   miss_fd = node_counter(PERF_COUNT_HW_CACHE_RESULT_MISS);
+   access_fd = node_counter(PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+   t0 = now_sec();
+   do
+   {
+      for (i = 0; i < 1 << 16; i++)
+      {
+         /* each read picks the next one, so they cannot overlap */
+         seed = seed * 1103515245 + 12345 + sum;
+         sum = bufs[(seed >> 8) % nbufs][seed % BUF_SIZE & ~63];
+      }
+      r.reads += 1 << 16;
+   } while (now_sec() - t0 < secs);
+   r.ns = (now_sec() - t0) * 1e9 / r.reads;
+   r.remote_loads = counter_read(miss_fd);
+   r.loads = counter_read(access_fd);
+
+   r.cpu = sched_getcpu();
+   r.node = topo_node_of_cpu(r.cpu);
+   for (i = 0, j = 0; i < nbufs; i++)
+   {
+      long p;
+
+      for (p = 0; p < npages; p++)
+      {
+         pages[j++] = bufs[i] + p * page;
+         if (j == PAGES_PER_CALL || (i == nbufs - 1 && p == npages - 1))
+         {
+            int k;
+
+            if (syscall(__NR_move_pages, 0, j, pages, NULL, status, 0) == -1)
+               memset(status, 0xff, sizeof(status));
+            for (k = 0; k < j; k++)
+            {
+               if (status[k] < 0)
+                  r.untouched++;
+               else if (status[k] == r.node)
+                  r.local++;
+               else
+                  r.remote++;
+            }
+            j = 0;
+         }
+      }
+   }
+
+   r.reads += sum & 1;   /* keep the reads */
+   if (write(out, &r, sizeof(r)) != sizeof(r))
+      perror("write");
+   _exit(0);
+}
+
+static void run(int mode)
+{
+   static const char *names[] = { "none", "active_cpu", "numa" };
+   struct result r, total;
+   long long other0 = numastat("other_node"), miss0 = numastat("numa_miss");
+   int fds[2], i, have_counter = 1;
+
+   fflush(stdout);
+   if (pipe(fds) == -1)
+   {
+      perror("pipe");
+      exit(1);
+   }
+   for (i = 0; i < nworkers; i++)
+   {
+      pid_t pid = fork();
+
+      if (pid == -1)
+      {
+         perror("fork");
+         exit(1);
+      }
+      if (pid == 0)
+      {
+         close(fds[0]);
+         worker(mode, i, fds[1]);
+      }
+   }
+   close(fds[1]);
+
+   printf("== %s%s\n", names[mode], late ? " (buffers allocated first)" : "");
+   memset(&total, 0, sizeof(total));
+   for (i = 0; i < nworkers; i++)
+   {
+      if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+         break;
+      printf("   cpu %3d node %2d  pages local %7ld remote %7ld  %6.1f ns/read",
+             r.cpu, r.node, r.local, r.remote, r.ns);
+      if (r.remote_loads >= 0)
+         printf("  remote loads %lld of %lld", r.remote_loads, r.loads);
+      printf("\n");
+      total.local += r.local;
+      total.remote += r.remote;
+      total.ns += r.ns;
+      total.remote_loads += r.remote_loads;
+      total.loads += r.loads;
+      have_counter &= r.remote_loads >= 0;
+   }
+   close(fds[0]);
+   while (wait(NULL) > 0)
+      ;
+
+   printf("   total: remote pages %.1f%%  other_node %+lld  numa_miss %+lld  %.1f ns/read",
+          100.0 * total.remote / (total.local + total.remote + !(total.local + total.remote)),
+          numastat("other_node") - other0, numastat("numa_miss") - miss0,
+          total.ns / (i ? i : 1));
+   if (have_counter)
+      printf("  remote loads %.2f%%", 100.0 * total.remote_loads / (total.loads + !total.loads));
+   else
+      printf("  remote loads n/a");
+   printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *only = NULL;
+   int ch;
+
+   while ((ch = getopt(argc, argv, "w:b:d:Lm:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'w': nworkers = atoi(optarg); break;
+         case 'b': mb = atoi(optarg); break;
+         case 'd': secs = atof(optarg); break;
+         case 'L': late = 1; break;
+         case 'm': only = optarg; break;
+         default:
+            fprintf(stderr, "bench_numa [-w workers] [-b MB] [-d seconds] [-L] [-m none|active_cpu|numa]\n");
+            exit(1);
+      }
+   }
+   topo_init(NULL);
+   if (nworkers < 1)
+      nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+   if (nworkers < 1)
+      nworkers = 1;
+   if (mb < 1)
+      mb = 64;
+
+   printf("%d nodes, %d workers, %d MB of %d byte buffers each\n",
+          topo_nodes(), nworkers, mb, BUF_SIZE);
+   if (only == NULL || strcmp(only, "none") == 0)
+      run(0);
+   if (only == NULL || strcmp(only, "active_cpu") == 0)
+      run(1);
+   if (only == NULL || strcmp(only, "numa") == 0)
+      run(2);
+   return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Closed against open loop load from sockevent.c on epoll_server.c, with
+# keep-alive HTTP requests. The closed loop run gives the throughput the
+# server keeps up with; the open loop run then asks for RATE requests/s
+# regardless, and its percentiles include the time requests spent
+# waiting to be sent once the server falls behind.
+#
+#   ./bench_openloop.sh [port] [seconds]
+
+PORT=${1:-8092}
+SECS=${2:-10}
+CONNS=${CONNS:-1000}
+RATE=${RATE:-1000000}
+THREADS=${THREADS:-`nproc`}
+REQ='GET / HTTP/1.1\r\nHost: localhost\r\n\r\n'
+
+gcc -O2 -pthread -o epoll_server epoll_server.c http_parser.c uring.c twheel.c master.c processtitle.c topo.c || exit 1
+gcc -O3 -Wall -o sockevent sockevent.c hist.c reqtmpl.c http_resp.c -lpthread || exit 1
+
+ulimit -n `expr $CONNS \* 2 + 1024`
+./epoll_server $PORT $THREADS > /dev/null 2>&1 &
+pid=$!
+sleep 1
+
+# only 200s with the whole body count
+echo "== closed loop, $THREADS threads, $CONNS connections"
+./sockevent -t $THREADS -k -H -s 200 -d $SECS -m "$REQ" 127.0.0.1:$PORT $CONNS | grep -E "^(Time|Rates|Errors|Invalid|#)"
+echo "== open loop at $RATE req/s"
+./sockevent -t $THREADS -R $RATE -k -H -s 200 -d $SECS -m "$REQ" 127.0.0.1:$PORT $CONNS | grep -E "^(Time|Rates|Errors|Invalid|#)"
+
+kill $pid
+wait $pid 2> /dev/null || true
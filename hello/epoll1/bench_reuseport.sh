@@ -0,0 +1,61 @@
+#!/bin/sh
+# Throughput of epoll_server.c: the classic single epoll loop against the
+# SO_REUSEPORT multi-reactor mode with 1, 4, 16 and 32 reactors, and
+# master mode with a worker process per CPU, sharing one listening socket
+# and with a SO_REUSEPORT socket each (-R).
+#
+#   ./bench_reuseport.sh [port] [seconds]
+#
+# The load generator defaults to bench_http with keep-alive; override
+# LOADGEN to use another one, the target ip:port is appended to it.
+#
+# On a 1-CPU VM, 5 s per run, so the reactor count cannot show any
+# scaling there, only what the extra loops cost:
+#
+#   single loop     66114 req/s        master -p 0     139905 req/s
+#   1 reactor       79365 req/s        master -p 0 -R  110540 req/s
+#   4 reactors      78375 req/s
+#   16 reactors     65649 req/s
+#   32 reactors     67158 req/s
+
+PORT=${1:-8080}
+SECS=${2:-10}
+CONNS=${CONNS:-256}
+LOADGEN=${LOADGEN:-"./bench_http -k -c $CONNS -d $SECS"}
+
+gcc -O2 -pthread -o epoll_server epoll_server.c http_parser.c uring.c twheel.c master.c processtitle.c topo.c || exit 1
+gcc -O2 -o bench_http bench_http.c || exit 1
+
+run()
+{
+    ./epoll_server $PORT $1 > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    echo "== reactors: ${1:-single loop}"
+    $LOADGEN 127.0.0.1:$PORT | grep -E "Requests/sec|Latency"
+    kill $pid
+    wait $pid 2> /dev/null || true
+}
+
+# run_master <label> <master options...>
+run_master()
+{
+    label=$1
+    shift
+    ./epoll_server "$@" $PORT > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    echo "== workers: $label"
+    $LOADGEN 127.0.0.1:$PORT | grep -E "Requests/sec|Latency"
+    kill $pid
+    wait $pid 2> /dev/null || true
+    sleep 1
+}
+
+run
+for n in 1 4 16 32
+do
+    run $n
+done
+run_master "one per cpu, shared socket" -p 0
+run_master "one per cpu, SO_REUSEPORT" -p 0 -R
@@ -0,0 +1,163 @@
+/* bench_scan.c
+ * responses per second per core for t2.c's response handling: the old
+ * realloc per recv + substring/substr + strstr path against http_scan.c
+ * scanning a fixed arena with precompiled matchers. The sample responses
+ * are delivered in 1500 byte pieces, like the recv calls in t2.
+ * build with : gcc -O2 -Wall -o bench_scan bench_scan.c http_scan.c
+ * run with   : ./bench_scan [seconds]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_scan.h"
+
+#define CHUNK 1500
+
+static char *samples[4];
+static size_t sample_len[4];
+static const char *want_title = "Welcome";
+static const char *want_server = "nginx";
+static volatile long sink;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* head, then pad bytes of markup before the title, then some more */
+static char *make_sample(const char *server, const char *title_tag, int pad, size_t *len)
+{
+   char *p = malloc(64 * 1024), *q;
+   int i;
+
+   q = p + sprintf(p, "HTTP/1.1 200 OK\r\nDate: Thu, 01 Jan 2026 00:00:00 GMT\r\n"
+      "Content-Type: text/html; charset=utf-8\r\nServer: %s\r\n"
+      "Cache-Control: no-cache\r\nSet-Cookie: id=0123456789abcdef; path=/\r\n\r\n"
+      "<!DOCTYPE html><html><head><meta charset=\"utf-8\">", server);
+   for (i = 0; i < pad; i += 64)
+      q += sprintf(q, "<link rel=\"stylesheet\" href=\"/static/css/%08d.css\">\n", i);
+   if (title_tag)
+      q += sprintf(q, "<%s>Welcome to the stand-in host</%s>", title_tag, title_tag);
+   q += sprintf(q, "</head><body>");
+   for (i = 0; i < 2048; i += 32)
+      q += sprintf(q, "<p>lorem ipsum dolor sit.</p>\n");
+   q += sprintf(q, "</body></html>\n");
+   *len = q - p;
+   return p;
+}
+
+/* t2.c before the arena: kept verbatim apart from the static */
+static char *substring(const char *str, size_t begin, size_t len)
+{
+   if (str == 0 || strlen(str) == 0 || strlen(str) < begin || strlen(str) < (begin + len))
+      return 0;
+   return strndup(str + begin, len);
+}
+
+static char *substr(char *haystack, char *begin, char *end)
+{
+   char *ret;
+   char *b = strstr(haystack, begin);
+   if (b)
+   {
+      char *e = strstr(b, end);
+      if (e)
+      {
+         int offset = e - b;
+         int retlen = offset - strlen(begin);
+         if ((ret = malloc(retlen + 1)) == NULL)
+            return NULL;
+         ret[retlen] = '\0';
+         strncpy(ret, b + strlen(begin), retlen);
+         return ret;
+      }
+   }
+   return NULL;
+}
+
+static int old_path(const char *data, size_t len)
+{
+   char *response = NULL;
+   size_t total = 0, off;
+   int hit = 0;
+
+   for (off = 0; off < len; off += CHUNK)
+   {
+      size_t n = len - off < CHUNK ? len - off : CHUNK;
+
+      response = realloc(response, total + n + 1);
+      memcpy(response + total, data + off, n);
+      total += n;
+      response[total] = '\0';
+   }
+   char *status = substring(response, 9, 3);
+   char *server = substr(response, "Server: ", "\r\n");
+   char *title = substr(response, "<title>", "</title>");
+   if (title && strstr(title, want_title) && server && strstr(server, want_server))
+      hit = 1;
+   free(status);
+   free(server);
+   free(title);
+   free(response);
+   return hit;
+}
+
+static int new_path(const char *data, size_t len, char *arena,
+   const http_matcher_t *tm, const http_matcher_t *sm)
+{
+   http_scan_t scan;
+   size_t total = 0;
+
+   http_scan_init(&scan);
+   while (total < len && total < HTTP_SCAN_ARENA)
+   {
+      size_t n = len - total < CHUNK ? len - total : CHUNK;
+
+      if (n > HTTP_SCAN_ARENA - total)
+         n = HTTP_SCAN_ARENA - total;
+      memcpy(arena + total, data + total, n);    // stands in for recv
+      total += n;
+      if (http_scan_execute(&scan, arena, total))
+         break;
+   }
+   return scan.title_view.p && http_matcher_find(tm, scan.title_view.p, scan.title_view.len)
+      && scan.server.p && http_matcher_find(sm, scan.server.p, scan.server.len);
+}
+
+int main(int argc, char *argv[])
+{
+   double secs = argc > 1 ? atof(argv[1]) : 2, start, t;
+   static char arena[HTTP_SCAN_ARENA];
+   http_matcher_t tm, sm;
+   long n;
+   int i, hits;
+
+   samples[0] = make_sample("nginx/1.24.0", "title", 0, &sample_len[0]);
+   samples[1] = make_sample("nginx", "title", 6000, &sample_len[1]);
+   samples[2] = make_sample("Apache", NULL, 1000, &sample_len[2]);
+   samples[3] = make_sample("nginx", "TITLE", 200, &sample_len[3]);
+   http_matcher_init(&tm, want_title);
+   http_matcher_init(&sm, want_server);
+
+   for (i = 0, hits = 0; i < 4; i++)
+      hits += old_path(samples[i], sample_len[i]) * 10 + new_path(samples[i], sample_len[i], arena, &tm, &sm);
+   printf("sample sizes %zu %zu %zu %zu, matches old/new: %d/%d\n",
+      sample_len[0], sample_len[1], sample_len[2], sample_len[3], hits / 10, hits % 10);
+
+   start = now_sec();
+   for (n = 0; (n & 1023) || (t = now_sec() - start) < secs; n++)
+      sink += old_path(samples[n & 3], sample_len[n & 3]);
+   printf("realloc + substr: %10.0f responses/s\n", n / t);
+
+   start = now_sec();
+   for (n = 0; (n & 1023) || (t = now_sec() - start) < secs; n++)
+      sink += new_path(samples[n & 3], sample_len[n & 3], arena, &tm, &sm);
+   printf("arena + scanner:  %10.0f responses/s\n", n / t);
+   return 0;
+}
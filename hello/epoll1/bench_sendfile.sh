@@ -0,0 +1,39 @@
+#!/bin/sh
+# Static file serving in epoll_poll.c: sendfile against the old copy path
+# (read the whole file into a malloc'd buffer, then write it), built from
+# the same source with -DNO_SENDFILE. For 4 KB, 1 MB and 100 MB files it
+# reports requests/sec plus the server's CPU time and peak RSS.
+#
+#   ./bench_sendfile.sh [connections] [seconds]
+
+CONNS=${1:-16}
+SECS=${2:-10}
+DIR=`mktemp -d`
+HERE=`pwd`
+
+g++ -O2 -pthread -o epoll_poll epoll_poll.c twheel.c || exit 1
+g++ -O2 -pthread -DNO_SENDFILE -o epoll_poll_copy epoll_poll.c twheel.c || exit 1
+gcc -O2 -o bench_http bench_http.c || exit 1
+
+head -c 4096 /dev/urandom > $DIR/4k.bin
+head -c 1048576 /dev/urandom > $DIR/1m.bin
+head -c 104857600 /dev/urandom > $DIR/100m.bin
+
+printf "server\t\tfile\treq/s\tcpu(s)\trss(kB)\n"
+for file in 4k.bin 1m.bin 100m.bin
+do
+    for server in epoll_poll epoll_poll_copy
+    do
+        (cd $DIR && exec $HERE/$server > /dev/null 2>&1) &
+        pid=$!
+        sleep 1
+        rps=`./bench_http -k -c $CONNS -d $SECS -u /$file 127.0.0.1:8002 | sed -n 's/Requests\/sec: //p'`
+        # utime + stime in clock ticks, fields 14 and 15 of /proc/pid/stat
+        cpu=`awk -v hz=\`getconf CLK_TCK\` '{ printf "%.2f", ($14 + $15) / hz }' /proc/$pid/stat`
+        rss=`awk '/VmHWM/ { print $2 }' /proc/$pid/status`
+        printf "%s\t%s\t%s\t%s\t%s\n" $server $file $rps $cpu $rss
+        kill $pid
+        wait $pid 2> /dev/null || true
+    done
+done
+rm -rf $DIR
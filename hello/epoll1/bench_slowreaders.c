@@ -0,0 +1,164 @@
+/* bench_slowreaders.c
+ * open many connections that keep sending requests but never read the
+ * replies, and measure the request latency of one well behaved client
+ * next to them. A reactor that blocks on, or dies from, the slow readers
+ * shows up as a growing probe latency.
+ * build with : gcc -O2 -Wall -o bench_slowreaders bench_slowreaders.c
+ * run with   : ./bench_slowreaders 127.0.0.1:8080 1000 30
+ *
+ * epoll_server with 500 slow readers for 8 s on a 1-CPU VM, before and
+ * after it kept unsent output per connection:
+ *   before: probe p50 2.3-2.9 ms, p99 3.9-8.3 ms, max up to 14.9 ms
+ *   after:  probe p50 2.7-3.3 ms, p99 5.2-6.9 ms, max 6.8 ms
+ * The gain is in correctness: of 20000 pipelined requests from a client
+ * that reads late, the old loop answered 1055 and dropped the rest.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static double now_us(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+   return x < y ? -1 : x > y;
+}
+
+static int connect_to(struct sockaddr_in *target)
+{
+   int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+   if (sock < 0 || connect(sock, (struct sockaddr *)target, sizeof(*target)) != 0)
+   {
+      perror("connect");
+      exit(1);
+   }
+   return sock;
+}
+
+/* send one request on the probe connection and wait for the whole reply */
+static double probe(int sock)
+{
+   char buffer[4096];
+   double start = now_us();
+   int got = 0;
+   struct pollfd pfd = { sock, POLLIN, 0 };
+
+   if (send(sock, request, sizeof(request) - 1, 0) < 0)
+   {
+      perror("probe send");
+      exit(1);
+   }
+   while (got < 4 || memmem(buffer, got, "</html>", 7) == NULL)
+   {
+      int n;
+
+      if (poll(&pfd, 1, 5000) <= 0)
+      {
+         fprintf(stderr, "probe timed out, the reactor is stalled\n");
+         exit(1);
+      }
+      n = recv(sock, buffer + got, sizeof(buffer) - got, 0);
+      if (n <= 0)
+      {
+         fprintf(stderr, "probe connection closed\n");
+         exit(1);
+      }
+      got += n;
+      if (got == sizeof(buffer))
+         got = 0;
+   }
+   return now_us() - start;
+}
+
+int main(int argc, char *argv[])
+{
+   struct sockaddr_in target;
+   char *c;
+   int nslow, seconds, i, sec;
+   int *slow;
+   int psock;
+   double *samples;
+   int nsamples;
+
+   if (argc < 3)
+   {
+      printf("bench_slowreaders <ip:port> <slow connections> [seconds]\n");
+      exit(1);
+   }
+
+   memset(&target, 0, sizeof(target));
+   target.sin_family = AF_INET;
+   if ((c = strrchr(argv[1], ':')) == NULL)
+   {
+      printf("bad target %s\n", argv[1]);
+      exit(1);
+   }
+   *c++ = 0;
+   target.sin_port = htons(atoi(c));
+   if (!inet_aton(argv[1], &target.sin_addr))
+   {
+      printf("bad address %s\n", argv[1]);
+      exit(1);
+   }
+   nslow = atoi(argv[2]);
+   seconds = argc > 3 ? atoi(argv[3]) : 10;
+
+   signal(SIGPIPE, SIG_IGN);
+
+   slow = calloc(nslow, sizeof(int));
+   samples = calloc(1000, sizeof(double));
+   for (i = 0; i < nslow; i++)
+   {
+      slow[i] = connect_to(&target);
+      fcntl(slow[i], F_SETFL, O_NONBLOCK);
+   }
+   psock = connect_to(&target);
+
+   printf("sec\tslow\tprobes\tp50(us)\tp99(us)\tmax(us)\n");
+   for (sec = 1; sec <= seconds; sec++)
+   {
+      double end = now_us() + 1e6;
+
+      nsamples = 0;
+      while (now_us() < end && nsamples < 1000)
+      {
+         /* keep the slow readers' send queues topped up */
+         for (i = 0; i < nslow; i++)
+            if (send(slow[i], request, sizeof(request) - 1, 0) < 0
+               && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+               perror("slow send");
+               exit(1);
+            }
+
+         samples[nsamples++] = probe(psock);
+         usleep(1000);
+      }
+
+      qsort(samples, nsamples, sizeof(double), cmp_double);
+      printf("%d\t%d\t%d\t%.0f\t%.0f\t%.0f\n", sec, nslow, nsamples,
+         samples[nsamples / 2], samples[nsamples * 99 / 100],
+         samples[nsamples - 1]);
+   }
+
+   return 0;
+}
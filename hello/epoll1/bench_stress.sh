@@ -0,0 +1,60 @@
+#!/bin/sh
+# Where the echo servers top out: iocpclient_linux (iocp1/client) drives
+# echo_server.c on epoll, echo_server.c -u on uring.c, and
+# iocpserverex_linux.c with CTHREADS client threads and a growing number
+# of connections per client thread, for 64 byte and 16 KB messages with
+# OUTSTANDING messages in flight per connection. Every echo is checked
+# byte for byte; a run with mismatches is flagged.
+#
+#   ./bench_stress.sh [port] [seconds]
+
+PORT=${1:-5001}
+SECS=${2:-10}
+THREADS=${THREADS:-4}
+CTHREADS=${CTHREADS:-2}
+OUTSTANDING=${OUTSTANDING:-1}
+CONNS=${CONNS:-"100 1000 4000"}
+OUT=/tmp/stress.$$
+
+gcc -O2 -pthread -o echo_server echo_server.c uring.c || exit 1
+gcc -O2 -pthread -o iocpserverex_linux ../iocp1/serverex/iocpserverex_linux.c || exit 1
+gcc -O2 -pthread -I. -o iocpclient_linux ../iocp1/client/iocpclient_linux.c hist.c || exit 1
+
+# run <label> <message size> <connections per client thread> <server command...>
+run()
+{
+    label=$1
+    size=$2
+    conns=$3
+    shift 3
+    "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    ./iocpclient_linux -n:127.0.0.1 -e:$PORT -t:$CTHREADS -c:$conns -s:$size \
+        -o:$OUTSTANDING -d:$SECS > $OUT
+    kill $pid
+    wait $pid 2> /dev/null || true
+    # a ring is torn down after its process is gone, and an accept still
+    # posted on it keeps the listening socket open until then
+    sleep 1
+    awk -v label="$label" -v conns=$((conns * CTHREADS)) '
+        /^Connections:/ { est = $2; err = $4; nak = $6 }
+        /^Messages:/ { rate = $5; mbs = $7 }
+        /^Round trip:/ { p99 = $7 }
+        END {
+            printf "%-20s %6d conns %9.0f msg/s %8.1f MB/s  p99 %9.0f us  errors %s%s\n",
+                label, conns, rate, mbs, p99, err, (nak > 0 ? "  MISMATCHES " nak : "")
+        }' $OUT
+    rm -f $OUT
+}
+
+for size in 64 16384
+do
+    echo "== $THREADS server threads, $CTHREADS client threads, $size byte messages, $OUTSTANDING outstanding"
+    for c in $CONNS
+    do
+        run "echo_server (epoll)" $size $c ./echo_server -t $THREADS $PORT
+        run "echo_server -u" $size $c ./echo_server -u -t $THREADS $PORT
+        run "iocpserverex_linux" $size $c ./iocpserverex_linux -e:$PORT -t:$THREADS
+    done
+done
@@ -0,0 +1,156 @@
+/* bench_twheel.c
+ * cost of refreshing a connection's idle timeout on every read, with -n
+ * connections (100k) each holding a timer, reads landing on random
+ * connections and every -b reads ending an event batch (an epoll_wait on
+ * an empty set, then the wheel runs):
+ *   none  : the batches alone, what the others are measured against
+ *   touch : twheel_touch, the new deadline is stored, the timer moves later
+ *   add   : twheel_add, the timer is unlinked and linked again every time
+ *   se    : se_timer_add on se.c's hierarchical wheel, the same way
+ * build with : gcc -O2 -Wall -o bench_twheel bench_twheel.c twheel.c se.c
+ * run with   : ./bench_twheel [-n conns] [-b batch] [-t timeout_ms] [-d seconds]
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "se.h"
+#include "twheel.h"
+
+/* a timer of each kind in what stands for epoll_server's struct connection */
+struct conn
+{
+   twheel_timer_t timer;
+   se_timer_t se_timer;
+   char rest[160];
+};
+
+static int nconns = 100000, batch = 64, timeout_ms = 60000;
+static double secs = 2;
+static unsigned long fired;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_twheel(twheel_timer_t *t, void *arg)
+{
+   (void)t;
+   (void)arg;
+   fired++;
+}
+
+static void on_se(se_timer_t *t)
+{
+   (void)t;
+   fired++;
+}
+
+/* ns per read */
+static double run(const char *mode, double base)
+{
+   struct conn *conns = calloc(nconns, sizeof(struct conn));
+   struct epoll_event ev;
+   twheel_t *w = twheel_create(0, 0, on_twheel, NULL);
+   se_loop_t *loop = se_create(16);
+   int efd = epoll_create1(0);
+   unsigned long reads = 0;
+   unsigned seed = 1;
+   double t0, t;
+   int i, m = mode[0] == 't' ? 1 : mode[0] == 'a' ? 2 : mode[0] == 's' ? 3 : 0;
+
+   if (conns == NULL || w == NULL || loop == NULL || efd < 0)
+   {
+      perror("init");
+      exit(1);
+   }
+   for (i = 0; i < nconns; i++)
+   {
+      twheel_add(w, &conns[i].timer, timeout_ms);
+      se_timer_add(loop, &conns[i].se_timer, timeout_ms, on_se, &conns[i]);
+   }
+
+   fired = 0;
+   t0 = now_sec();
+   do
+   {
+      int k, j;
+
+      for (k = 0; k < 64; k++)
+      {
+         for (j = 0; j < batch; j++, reads++)
+         {
+            struct conn *c;
+
+            seed = seed * 1103515245 + 12345;
+            c = &conns[(seed >> 4) % nconns];
+            if (m == 1)
+               twheel_touch(w, &c->timer, timeout_ms);
+            else if (m == 2)
+               twheel_add(w, &c->timer, timeout_ms);
+            else if (m == 3)
+               se_timer_add(loop, &c->se_timer, timeout_ms, on_se, c);
+         }
+         /* the end of a batch, as in the servers' loops */
+         if (m == 3)
+            se_loop(loop, 0);
+         else
+         {
+            epoll_wait(efd, &ev, 1, 0);
+            twheel_update(w);
+            twheel_run(w);
+         }
+      }
+   } while ((t = now_sec() - t0) < secs);
+
+   t = t * 1e9 / reads;
+   printf("%-6s %10.0f reads/s %7.1f ns/read", mode, 1e9 / t, t);
+   if (base > 0)
+      printf("  %6.1f ns for the timer", t - base);
+   printf("  fired %lu\n", fired);
+
+   se_destroy(loop);
+   twheel_destroy(w);
+   close(efd);
+   free(conns);
+   return t;
+}
+
+int main(int argc, char *argv[])
+{
+   double base;
+   int ch;
+
+   while ((ch = getopt(argc, argv, "n:b:t:d:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'n': nconns = atoi(optarg); break;
+         case 'b': batch = atoi(optarg); break;
+         case 't': timeout_ms = atoi(optarg); break;
+         case 'd': secs = atof(optarg); break;
+         default:
+            fprintf(stderr, "bench_twheel [-n conns] [-b batch] [-t timeout_ms] [-d seconds]\n");
+            exit(1);
+      }
+   }
+   if (nconns < 1)
+      nconns = 100000;
+   if (batch < 1)
+      batch = 64;
+
+   printf("%d connections, %d reads per batch, %d ms timeout\n", nconns, batch, timeout_ms);
+   base = run("none", 0);
+   run("touch", base);
+   run("add", base);
+   run("se", base);
+   return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# epoll against the io_uring backend (uring.c, -u) on the same machine:
+# requests/sec from bench_http and system calls per request, counted by
+# syscount.so preloaded into the server. Covers epoll_server.c and
+# epoll_server2.c (fixed port 823, so run as root), keep-alive with one
+# request per round trip and with PIPELINE pipelined ones.
+#
+#   ./bench_uring.sh [port] [seconds]
+
+PORT=${1:-8080}
+SECS=${2:-10}
+CONNS=${CONNS:-256}
+PIPELINE=${PIPELINE:-16}
+OUT=/tmp/syscount.$$
+
+gcc -O2 -pthread -o epoll_server epoll_server.c http_parser.c uring.c twheel.c master.c processtitle.c topo.c || exit 1
+gcc -O2 -o epoll_server2 epoll_server2.c http_parser.c uring.c || exit 1
+gcc -O2 -o bench_http bench_http.c || exit 1
+gcc -O2 -shared -fPIC -o syscount.so syscount.c -ldl || exit 1
+
+# run <label> <port> <pipeline> <server command...>
+run()
+{
+    label=$1
+    port=$2
+    pipeline=$3
+    shift 3
+    SYSCOUNT_OUT=$OUT LD_PRELOAD=./syscount.so "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    reqs=$(./bench_http -k -c $CONNS -p $pipeline -d $SECS 127.0.0.1:$port | awk '/^Requests:/ { print $2 }')
+    kill $pid
+    wait $pid 2> /dev/null || true
+    # a ring is torn down after its process is gone, and the multishot
+    # accept on it keeps the listening socket open until then
+    sleep 1
+    awk -v label="$label" -v reqs="${reqs:-0}" -v secs=$SECS '
+        $1 == "total" { total = $2; next }
+        $2 > 0 && reqs > 0 { detail = detail sprintf(" %s=%.3f", $1, $2 / reqs) }
+        END {
+            if (reqs == 0) { printf "%-24s no requests\n", label; exit }
+            printf "%-24s %9.0f req/s %7.3f syscalls/req %s\n", label, reqs / secs, total / reqs, detail
+        }' $OUT
+    rm -f $OUT
+}
+
+for p in 1 $PIPELINE
+do
+    echo "== $CONNS connections, pipeline $p"
+    run "epoll_server" $PORT $p ./epoll_server $PORT
+    run "epoll_server -u" $PORT $p ./epoll_server -u $PORT
+    run "epoll_server2" 823 $p ./epoll_server2
+    run "epoll_server2 -u" 823 $p ./epoll_server2 -u
+done
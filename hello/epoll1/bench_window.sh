@@ -0,0 +1,31 @@
+#!/bin/sh
+# Targets/sec of t2.c with the sliding window against the old batch mode
+# (-B), scanning a list of 127.0.0.1 lines served by delayhttpd. By
+# default 90% of the answers take 1 ms, 9% 200 ms and 1% 2 s, so every
+# batch waits for its slowest hosts and then for t2's 4 s idle timeout.
+#
+#   ./bench_window.sh [port] [lines]
+
+PORT=${1:-8090}
+LINES=${2:-20000}
+CONNS=${CONNS:-1000}
+MIX=${MIX:-1:90,200:9,2000:1}
+TARGETS=/tmp/bench_window_targets.txt
+
+gcc -O2 -o delayhttpd delayhttpd.c se.c || exit 1
+gcc -O2 -o t2 t2.c se.c dns.c http_scan.c || exit 1
+
+yes 127.0.0.1 | head -n $LINES > $TARGETS
+
+./delayhttpd -m $MIX $PORT 2> /dev/null &
+pid=$!
+sleep 1
+
+echo "== sliding window, $CONNS in flight"
+./t2 -P $PORT -t $CONNS -f $TARGETS 2>&1 > /dev/null | grep "/s$" | tail -1
+echo "== batches of $CONNS"
+./t2 -B -P $PORT -t $CONNS -f $TARGETS 2>&1 > /dev/null | grep "/s$" | tail -1
+
+kill $pid
+wait $pid 2> /dev/null || true
+rm -f $TARGETS
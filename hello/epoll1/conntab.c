@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "conntab.h"
+
+#define SLAB_BYTES   (64 * 1024)
+#define NCLASSES     5          /* 256, 1K, 4K, 16K, 64K */
+#define REC_ALIGN    16
+
+typedef struct item {
+    struct item *next;
+} item_t;
+
+typedef struct slab {
+    struct slab *next;
+} slab_t;
+
+/* free objects of one size and the slabs they come from */
+typedef struct pool {
+    size_t size;
+    item_t *free;
+    slab_t *slabs;
+    size_t nslabs;
+} pool_t;
+
+struct conntab_s {
+    void **slots;               /* by fd */
+    size_t nslots;
+    size_t conns;
+    size_t bufs;
+    pool_t recs;
+    pool_t classes[NCLASSES];
+};
+
+/* slab header, rounded so the objects after it stay aligned */
+#define SLAB_HDR  REC_ALIGN
+
+static void *pool_get(pool_t *p)
+{
+    item_t *it = p->free;
+
+    if (it == NULL) {
+        size_t per = SLAB_BYTES / p->size, i;
+        slab_t *slab;
+        char *base;
+
+        if (per == 0)
+            per = 1;
+        slab = (slab_t *)malloc(SLAB_HDR + per * p->size);
+        if (slab == NULL)
+            return NULL;
+        slab->next = p->slabs;
+        p->slabs = slab;
+        p->nslabs++;
+        base = (char *)slab + SLAB_HDR;
+        for (i = per; i-- > 0; ) {
+            it = (item_t *)(base + i * p->size);
+            it->next = p->free;
+            p->free = it;
+        }
+        it = p->free;
+    }
+    p->free = it->next;
+    return it;
+}
+
+static void pool_put(pool_t *p, void *obj)
+{
+    item_t *it = (item_t *)obj;
+
+    it->next = p->free;
+    p->free = it;
+}
+
+static void pool_fini(pool_t *p)
+{
+    slab_t *slab;
+
+    while ((slab = p->slabs) != NULL) {
+        p->slabs = slab->next;
+        free(slab);
+    }
+}
+
+static size_t pool_bytes(const pool_t *p)
+{
+    size_t per = SLAB_BYTES / p->size;
+
+    return p->nslabs * (SLAB_HDR + (per ? per : 1) * p->size);
+}
+
+conntab_t *conntab_create(size_t rec_size)
+{
+    conntab_t *t = (conntab_t *)calloc(1, sizeof(conntab_t));
+    size_t size = CONNTAB_BUF_MIN;
+    int i;
+
+    if (t == NULL)
+        return NULL;
+    if (rec_size < sizeof(item_t))
+        rec_size = sizeof(item_t);
+    t->recs.size = (rec_size + REC_ALIGN - 1) & ~(size_t)(REC_ALIGN - 1);
+    for (i = 0; i < NCLASSES; i++, size *= 4)
+        t->classes[i].size = size;
+    return t;
+}
+
+void conntab_destroy(conntab_t *t)
+{
+    int i;
+
+    pool_fini(&t->recs);
+    for (i = 0; i < NCLASSES; i++)
+        pool_fini(&t->classes[i]);
+    free(t->slots);
+    free(t);
+}
+
+void *conntab_add(conntab_t *t, int fd)
+{
+    void *rec;
+
+    if (fd < 0)
+        return NULL;
+    if ((size_t)fd >= t->nslots) {
+        size_t n = t->nslots ? t->nslots : 1024;
+        void **slots;
+
+        while (n <= (size_t)fd)
+            n *= 2;
+        slots = (void **)realloc(t->slots, n * sizeof(void *));
+        if (slots == NULL)
+            return NULL;
+        memset(slots + t->nslots, 0, (n - t->nslots) * sizeof(void *));
+        t->slots = slots;
+        t->nslots = n;
+    }
+    if (t->slots[fd] != NULL)
+        return NULL;
+    if ((rec = pool_get(&t->recs)) == NULL)
+        return NULL;
+    memset(rec, 0, t->recs.size);
+    t->slots[fd] = rec;
+    t->conns++;
+    return rec;
+}
+
+void *conntab_get(conntab_t *t, int fd)
+{
+    if (fd < 0 || (size_t)fd >= t->nslots)
+        return NULL;
+    return t->slots[fd];
+}
+
+void conntab_del(conntab_t *t, int fd)
+{
+    void *rec = conntab_get(t, fd);
+
+    if (rec == NULL)
+        return;
+    t->slots[fd] = NULL;
+    pool_put(&t->recs, rec);
+    t->conns--;
+}
+
+static int class_of(size_t size)
+{
+    size_t c = CONNTAB_BUF_MIN;
+    int i;
+
+    for (i = 0; i < NCLASSES - 1 && c < size; i++)
+        c *= 4;
+    return i;
+}
+
+void *conntab_buf_get(conntab_t *t, size_t size, size_t *cap)
+{
+    pool_t *p = &t->classes[class_of(size)];
+    void *buf = pool_get(p);
+
+    if (buf == NULL)
+        return NULL;
+    *cap = p->size;
+    t->bufs++;
+    return buf;
+}
+
+void conntab_buf_put(conntab_t *t, void *buf, size_t cap)
+{
+    if (buf == NULL)
+        return;
+    pool_put(&t->classes[class_of(cap)], buf);
+    t->bufs--;
+}
+
+void conntab_stats(conntab_t *t, conntab_stats_t *st)
+{
+    int i;
+
+    st->conns = t->conns;
+    st->table_bytes = t->nslots * sizeof(void *);
+    st->rec_bytes = pool_bytes(&t->recs);
+    st->bufs = t->bufs;
+    st->buf_bytes = 0;
+    for (i = 0; i < NCLASSES; i++)
+        st->buf_bytes += pool_bytes(&t->classes[i]);
+}
@@ -0,0 +1,67 @@
+#ifndef CONNTAB_H
+#define CONNTAB_H
+
+#include <stddef.h>    /* for size_t type */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * conntab: connection table for servers that hold many mostly idle
+ * connections.
+ *
+ * Records are found by fd in a pointer array that doubles when an fd
+ * falls past its end, so lookup, insert and delete are O(1) and there is
+ * no client limit other than the fd limit. The records themselves are
+ * carved from 64K slabs and kept on an intrusive free list: a free record's
+ * first bytes link it to the next one, and a new connection takes the head.
+ *
+ * A record holds no I/O buffer. A connection that has bytes it could not
+ * pass on (a partial message, output the peer is not reading) takes one
+ * from conntab_buf_get, in size classes of 256 bytes to 64K, and gives it
+ * back with conntab_buf_put once it is empty. An idle connection costs its
+ * record plus one pointer. Freed records and buffers are kept for reuse,
+ * memory goes back to the system with conntab_destroy.
+ *
+ * Not thread safe, one table per event loop.
+ *
+ * build with : gcc -c conntab.c and link conntab.o into the program
+ */
+
+#define CONNTAB_BUF_MIN  256
+#define CONNTAB_BUF_MAX  (64 * 1024)
+
+typedef struct conntab_s conntab_t;
+
+typedef struct conntab_stats {
+    size_t conns;               /* records in use */
+    size_t table_bytes;         /* the fd index */
+    size_t rec_bytes;           /* record slabs */
+    size_t bufs;                /* buffers handed out */
+    size_t buf_bytes;           /* buffer slabs */
+} conntab_stats_t;
+
+/* records of rec_size bytes, zeroed when handed out */
+conntab_t *conntab_create(size_t rec_size);
+void conntab_destroy(conntab_t *t);
+
+/* a record for fd, NULL when fd already has one or out of memory */
+void *conntab_add(conntab_t *t, int fd);
+/* the record of fd, NULL when it has none */
+void *conntab_get(conntab_t *t, int fd);
+void conntab_del(conntab_t *t, int fd);
+
+/* a buffer of at least size bytes (at most CONNTAB_BUF_MAX), its real
+ * size in *cap; NULL when out of memory */
+void *conntab_buf_get(conntab_t *t, size_t size, size_t *cap);
+/* cap as returned by conntab_buf_get */
+void conntab_buf_put(conntab_t *t, void *buf, size_t cap);
+
+void conntab_stats(conntab_t *t, conntab_stats_t *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* CONNTAB_H */
@@ -0,0 +1,207 @@
+/* delayhttpd.c
+ * a stand-in HTTP server for the scanner benchmarks: every connection is
+ * answered after a delay drawn from a mix given as ms:percent pairs, then
+ * closed, so a few slow hosts can be mixed into a target list of
+ * 127.0.0.1 lines. -n forks that many servers on the listening socket,
+ * so the stand-in keeps up with a multi-threaded scanner.
+ * build with : gcc -O2 -Wall -o delayhttpd delayhttpd.c se.c
+ * run with   : ./delayhttpd -m 1:90,200:9,2000:1 -n 4 8090
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "se.h"
+
+#define MAX_MIX 16
+
+static const char response[] =
+   "HTTP/1.0 200 OK\r\n"
+   "Server: delayhttpd\r\n"
+   "Content-Type: text/html\r\n"
+   "Connection: close\r\n"
+   "\r\n"
+   "<html><head><title>stand-in</title></head><body>ok</body></html>\n";
+
+static struct
+{
+   int ms;
+   int percent;
+} mix[MAX_MIX];
+static int nmix;
+
+static se_loop_t *loop;
+static long long served;
+
+struct client
+{
+   se_ptr_t *ptr;
+   int len;
+   char buf[4096];
+};
+
+static void client_close(struct client *c)
+{
+   close(c->ptr->fd);
+   se_delete(c->ptr);
+   free(c);
+}
+
+static int pick_delay(void)
+{
+   int r = rand() % 100, i;
+
+   for (i = 0; i < nmix; i++)
+   {
+      if (r < mix[i].percent)
+         return mix[i].ms;
+      r -= mix[i].percent;
+   }
+   return 0;
+}
+
+static void on_delay(se_timer_t *timer)
+{
+   struct client *c = timer->data;
+
+   send(c->ptr->fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+   served++;
+   client_close(c);
+}
+
+static int on_read(se_ptr_t *ptr)
+{
+   struct client *c = ptr->data;
+   int n;
+
+   n = recv(ptr->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+   if (n < 0 && (errno == EAGAIN || errno == EINTR))
+   {
+      se_be_read(ptr, on_read);
+      return 0;
+   }
+   if (n <= 0)
+   {
+      client_close(c);
+      return 0;
+   }
+   c->len += n;
+   c->buf[c->len] = '\0';
+   if (strstr(c->buf, "\r\n\r\n") == NULL && c->len < (int)sizeof(c->buf) - 1)
+   {
+      se_be_read(ptr, on_read);
+      return 0;
+   }
+   // the reply goes out from the timer, reading is over
+   se_timer_add(loop, &ptr->timer, pick_delay(), on_delay, c);
+   return 0;
+}
+
+static int on_accept(se_ptr_t *ptr)
+{
+   int fd;
+
+   while ((fd = accept4(ptr->fd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+   {
+      struct client *c = malloc(sizeof(struct client));
+
+      c->len = 0;
+      if ((c->ptr = se_add(loop, fd, c)) == NULL)
+      {
+         close(fd);
+         free(c);
+         continue;
+      }
+      se_be_read(c->ptr, on_read);
+   }
+   se_be_read(ptr, on_accept);
+   return 0;
+}
+
+static int parse_mix(char *arg)
+{
+   char *tok, *save;
+
+   for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+   {
+      if (nmix == MAX_MIX || sscanf(tok, "%d:%d", &mix[nmix].ms, &mix[nmix].percent) != 2)
+         return -1;
+      nmix++;
+   }
+   return 0;
+}
+
+static void report(se_timer_t *timer)
+{
+   static long long last;
+
+   if (served != last)
+      fprintf(stderr, "served %lld\n", served);
+   last = served;
+   se_timer_add(loop, timer, 1000, report, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+   struct sockaddr_in addr;
+   se_timer_t tick = {0};
+   int ch, sock, on = 1, port = 8090, procs = 1;
+   char def[] = "1:90,200:9,2000:1";
+
+   while ((ch = getopt(argc, argv, "m:n:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'n':
+            procs = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+         case 'm':
+            if (parse_mix(optarg) == 0)
+               break;
+            // fall through
+         default:
+            printf("delayhttpd [-m ms:percent,...] [-n procs] [port]\n");
+            exit(1);
+      }
+   }
+   if (nmix == 0)
+      parse_mix(def);
+   if (optind < argc)
+      port = atoi(argv[optind]);
+
+   sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 4096) < 0)
+   {
+      perror("bind");
+      exit(1);
+   }
+
+   // the children share the listener and go away with the parent
+   while (--procs > 0)
+   {
+      if (fork() == 0)
+      {
+         prctl(PR_SET_PDEATHSIG, SIGTERM);
+         break;
+      }
+   }
+   srand(getpid());
+   loop = se_create(1024);
+   se_be_read(se_add(loop, sock, NULL), on_accept);
+   se_timer_add(loop, &tick, 1000, report, NULL);
+   se_loop(loop, -1);
+   return 0;
+}
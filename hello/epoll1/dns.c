@@ -0,0 +1,603 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+
+#define DNS_PORT      53
+#define DNS_BUF       4096          /* EDNS is not used, 512 would do */
+#define DNS_IDS       65536
+#define DNS_NAME_MAX  253
+
+#define TYPE_A        1
+#define CLASS_IN      1
+#define RCODE_NXDOMAIN 3
+
+typedef struct dns_waiter_s dns_waiter_t;
+typedef struct dns_entry_s dns_entry_t;
+
+struct dns_waiter_s {
+    dns_waiter_t *next;
+    dns_proc_t func;
+    void *arg;
+};
+
+enum {
+    ENTRY_QUEUED,               /* waiting for an in-flight slot */
+    ENTRY_INFLIGHT,
+    ENTRY_OK,
+    ENTRY_FAIL
+};
+
+/* one per name: an outstanding query first, the cached answer after */
+struct dns_entry_s {
+    dns_entry_t *hnext;
+    dns_entry_t *qnext;         /* FIFO of queued entries */
+    dns_t *dns;
+    uint32_t hash;
+    int state;
+    int tries;
+    int busy;                   /* callbacks running, keep it */
+    uint16_t id;
+    uint64_t expire;            /* loop clock, ms */
+    struct in_addr addr;
+    dns_waiter_t *waiters;
+    dns_waiter_t **waiters_tail;
+    se_timer_t timer;
+    int name_len;
+    char name[];                /* lower case, without the final dot */
+};
+
+struct dns_s {
+    se_loop_t *loop;
+    se_ptr_t *ptr;
+    int max_inflight;
+    int inflight;
+    int queued;
+    int timeout;
+    uint16_t next_id;
+    dns_entry_t **by_id;
+    dns_entry_t **buckets;
+    uint32_t mask;
+    int count;
+    dns_entry_t *qhead;
+    dns_entry_t *qtail;
+    dns_stats_t stats;
+    unsigned char buf[DNS_BUF];
+};
+
+static uint32_t hash_name(const char *name, int len)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* lower case, drop the final dot, check the label lengths */
+static int normalize(const char *host, char *out)
+{
+    int len = 0, label = 0;
+
+    for (; *host; host++) {
+        char c = *host;
+
+        if (len == DNS_NAME_MAX + 1)
+            return -1;
+        if (c == '.') {
+            if (label == 0)
+                return -1;
+            label = 0;
+        } else if (++label > 63) {
+            return -1;
+        }
+        out[len++] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+    }
+    if (len > 0 && out[len - 1] == '.')
+        len--;
+    if (len == 0 || len > DNS_NAME_MAX)
+        return -1;
+    out[len] = '\0';
+    return len;
+}
+
+static dns_entry_t *entry_find(dns_t *dns, const char *name, int len,
+                               uint32_t hash)
+{
+    dns_entry_t *e;
+
+    for (e = dns->buckets[hash & dns->mask]; e; e = e->hnext)
+        if (e->hash == hash && e->name_len == len &&
+            memcmp(e->name, name, len) == 0)
+            return e;
+    return NULL;
+}
+
+static int entry_done(const dns_entry_t *e)
+{
+    return e->state == ENTRY_OK || e->state == ENTRY_FAIL;
+}
+
+/* drop expired answers; when everything is still fresh, drop all answers,
+ * lookups under way always stay */
+static void cache_sweep(dns_t *dns)
+{
+    uint64_t now = se_now(dns->loop);
+    int pass;
+    uint32_t i;
+
+    for (pass = 0; pass < 2 && dns->count >= DNS_CACHE_MAX; pass++) {
+        for (i = 0; i <= dns->mask; i++) {
+            dns_entry_t **pe = &dns->buckets[i], *e;
+
+            while ((e = *pe) != NULL) {
+                if (entry_done(e) && !e->busy &&
+                    (pass == 1 || e->expire <= now)) {
+                    *pe = e->hnext;
+                    free(e);
+                    dns->count--;
+                } else {
+                    pe = &e->hnext;
+                }
+            }
+        }
+    }
+}
+
+static dns_entry_t *entry_new(dns_t *dns, const char *name, int len,
+                              uint32_t hash)
+{
+    dns_entry_t *e;
+
+    if (dns->count >= DNS_CACHE_MAX)
+        cache_sweep(dns);
+    e = calloc(1, sizeof(dns_entry_t) + len + 1);
+    if (!e) {
+        return NULL;
+    }
+    e->dns = dns;
+    e->state = ENTRY_FAIL;      /* nothing known yet, expired at once */
+    e->hash = hash;
+    e->name_len = len;
+    memcpy(e->name, name, len + 1);
+    e->waiters_tail = &e->waiters;
+    e->hnext = dns->buckets[hash & dns->mask];
+    dns->buckets[hash & dns->mask] = e;
+    dns->count++;
+    return e;
+}
+
+static void query_send(dns_t *dns, dns_entry_t *e);
+static void query_timeout(se_timer_t *timer);
+
+static void query_start(dns_t *dns, dns_entry_t *e)
+{
+    do {
+        /* an odd step visits all 65536 ids before repeating */
+        dns->next_id += 0x9e37;
+    } while (dns->by_id[dns->next_id] != NULL);
+
+    e->id = dns->next_id;
+    e->state = ENTRY_INFLIGHT;
+    e->tries = 0;
+    dns->by_id[e->id] = e;
+    dns->inflight++;
+    query_send(dns, e);
+}
+
+static void query_schedule(dns_t *dns, dns_entry_t *e)
+{
+    if (dns->inflight < dns->max_inflight) {
+        query_start(dns, e);
+        return;
+    }
+    e->state = ENTRY_QUEUED;
+    e->qnext = NULL;
+    if (dns->qtail)
+        dns->qtail->qnext = e;
+    else
+        dns->qhead = e;
+    dns->qtail = e;
+    dns->queued++;
+}
+
+static void query_send(dns_t *dns, dns_entry_t *e)
+{
+    unsigned char pkt[12 + DNS_NAME_MAX + 2 + 4];
+    unsigned char *p = pkt + 12;
+    const char *label = e->name;
+
+    memset(pkt, 0, 12);
+    pkt[0] = e->id >> 8;
+    pkt[1] = e->id & 0xff;
+    pkt[2] = 0x01;              /* RD */
+    pkt[5] = 1;                 /* QDCOUNT */
+
+    for (;;) {
+        const char *dot = memchr(label, '.', e->name + e->name_len - label);
+        int n = dot ? dot - label : e->name + e->name_len - label;
+
+        *p++ = n;
+        memcpy(p, label, n);
+        p += n;
+        if (!dot)
+            break;
+        label = dot + 1;
+    }
+    *p++ = 0;
+    *p++ = 0; *p++ = TYPE_A;
+    *p++ = 0; *p++ = CLASS_IN;
+
+    /* a full socket buffer is just another lost datagram */
+    send(dns->ptr->fd, pkt, p - pkt, 0);
+    dns->stats.sent++;
+    se_timer_add(dns->loop, &e->timer, dns->timeout, query_timeout, e);
+}
+
+static void query_finish(dns_t *dns, dns_entry_t *e,
+                         const struct in_addr *addr, int ttl)
+{
+    dns_waiter_t *w, *next;
+
+    se_timer_del(dns->loop, &e->timer);
+    dns->by_id[e->id] = NULL;
+    dns->inflight--;
+
+    if (addr) {
+        e->state = ENTRY_OK;
+        e->addr = *addr;
+        dns->stats.answered++;
+    } else {
+        e->state = ENTRY_FAIL;
+        dns->stats.failed++;
+    }
+    /* ttl 0 answers only the lookups already waiting */
+    e->expire = se_now(dns->loop) + (uint64_t)ttl * 1000;
+
+    /* refill the window before the callbacks queue more */
+    while (dns->inflight < dns->max_inflight && dns->qhead) {
+        dns_entry_t *q = dns->qhead;
+
+        dns->qhead = q->qnext;
+        if (!dns->qhead)
+            dns->qtail = NULL;
+        dns->queued--;
+        query_start(dns, q);
+    }
+
+    w = e->waiters;
+    e->waiters = NULL;
+    e->waiters_tail = &e->waiters;
+    e->busy = 1;
+    for (; w; w = next) {
+        next = w->next;
+        w->func(e->name, addr ? &e->addr : NULL, w->arg);
+        free(w);
+    }
+    e->busy = 0;
+}
+
+static void query_timeout(se_timer_t *timer)
+{
+    dns_entry_t *e = timer->data;
+    dns_t *dns = e->dns;
+
+    if (++e->tries < DNS_TRIES) {
+        dns->stats.retries++;
+        query_send(dns, e);
+        return;
+    }
+    /* a name that never answers would stall every later line naming it */
+    query_finish(dns, e, NULL, DNS_NEG_TTL);
+}
+
+static int skip_name(const unsigned char *buf, int len, int off)
+{
+    while (off < len) {
+        int c = buf[off];
+
+        if (c == 0)
+            return off + 1;
+        if ((c & 0xc0) == 0xc0)
+            return off + 2 <= len ? off + 2 : -1;
+        off += c + 1;
+    }
+    return -1;
+}
+
+/* does the question at off ask for e->name? */
+static int question_is(const unsigned char *buf, int len, int off,
+                       const dns_entry_t *e)
+{
+    int i = 0;
+
+    while (off < len && buf[off] != 0) {
+        int n = buf[off++], j;
+
+        if (n > 63 || off + n > len)
+            return 0;
+        if (i > 0 && (i >= e->name_len || e->name[i++] != '.'))
+            return 0;
+        for (j = 0; j < n; j++, i++) {
+            char c = buf[off + j];
+
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            if (i >= e->name_len || e->name[i] != c)
+                return 0;
+        }
+        off += n;
+    }
+    return i == e->name_len;
+}
+
+static void parse_response(dns_t *dns, const unsigned char *buf, int len)
+{
+    dns_entry_t *e;
+    int off, qd, an, rcode;
+    uint32_t ttl = DNS_MAX_TTL;
+    struct in_addr addr;
+    int found = 0;
+
+    if (len < 12 || !(buf[2] & 0x80))
+        return;
+    e = dns->by_id[(buf[0] << 8) | buf[1]];
+    qd = (buf[4] << 8) | buf[5];
+    an = (buf[6] << 8) | buf[7];
+    rcode = buf[3] & 0x0f;
+    if (e == NULL || qd != 1 || !question_is(buf, len, 12, e))
+        return;             /* late, spoofed or garbage */
+
+    if (buf[2] & 0x02) {
+        /* truncated, an A answer for one name never is in practice */
+        query_finish(dns, e, NULL, 0);
+        return;
+    }
+    if (rcode == RCODE_NXDOMAIN) {
+        query_finish(dns, e, NULL, DNS_NEG_TTL);
+        return;
+    }
+    if (rcode != 0) {
+        /* SERVFAIL and friends, remembered like NXDOMAIN */
+        query_finish(dns, e, NULL, DNS_NEG_TTL);
+        return;
+    }
+
+    off = skip_name(buf, len, 12);
+    if (off < 0 || (off += 4) > len)
+        return;
+    /* the resolver puts the CNAME chain first, take the first A */
+    while (an-- > 0 && !found) {
+        int type, class, rdlen;
+        uint32_t rttl;
+
+        if ((off = skip_name(buf, len, off)) < 0 || off + 10 > len)
+            return;
+        type = (buf[off] << 8) | buf[off + 1];
+        class = (buf[off + 2] << 8) | buf[off + 3];
+        rttl = ((uint32_t)buf[off + 4] << 24) | (buf[off + 5] << 16) |
+               (buf[off + 6] << 8) | buf[off + 7];
+        rdlen = (buf[off + 8] << 8) | buf[off + 9];
+        off += 10;
+        if (off + rdlen > len)
+            return;
+        if (rttl < ttl)
+            ttl = rttl;
+        if (type == TYPE_A && class == CLASS_IN && rdlen == 4) {
+            memcpy(&addr, buf + off, 4);
+            found = 1;
+        }
+        off += rdlen;
+    }
+
+    if (found)
+        query_finish(dns, e, &addr, ttl);
+    else
+        query_finish(dns, e, NULL, DNS_NEG_TTL);    /* NODATA */
+}
+
+static int dns_be_read(se_ptr_t *ptr)
+{
+    dns_t *dns = ptr->data;
+    int n;
+
+    for (;;) {
+        n = recv(ptr->fd, dns->buf, sizeof(dns->buf), 0);
+        if (n < 0) {
+            /* ECONNREFUSED comes from an ICMP error, the timers handle it */
+            if (errno == ECONNREFUSED || errno == EINTR)
+                continue;
+            break;
+        }
+        parse_response(dns, dns->buf, n);
+    }
+    se_be_read(ptr, dns_be_read);
+    return 0;
+}
+
+static int parse_server(const char *server, struct sockaddr_in *sin)
+{
+    char buf[64], line[256];
+    char *port;
+    FILE *fp;
+
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(DNS_PORT);
+
+    if (server == NULL) {
+        /* the first IPv4 nameserver, else a local one */
+        server = "127.0.0.1";
+        if ((fp = fopen("/etc/resolv.conf", "r")) != NULL) {
+            while (fgets(line, sizeof(line), fp) != NULL) {
+                if (sscanf(line, "nameserver %63s", buf) == 1 &&
+                    inet_pton(AF_INET, buf, &sin->sin_addr) == 1) {
+                    fclose(fp);
+                    return 0;
+                }
+            }
+            fclose(fp);
+        }
+    }
+
+    snprintf(buf, sizeof(buf), "%s", server);
+    if ((port = strchr(buf, ':')) != NULL) {
+        *port++ = '\0';
+        sin->sin_port = htons(atoi(port));
+    }
+    return inet_pton(AF_INET, buf, &sin->sin_addr) == 1 ? 0 : -1;
+}
+
+dns_t *dns_create(se_loop_t *loop, const char *server, int max_inflight,
+                  int timeout_ms)
+{
+    struct sockaddr_in sin;
+    dns_t *dns;
+    uint32_t size = 1;
+    int fd, rcvbuf = 1 << 20;
+
+    if (parse_server(server, &sin) < 0) {
+        return NULL;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    /* connected: ICMP errors are reported and only the server is heard */
+    if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        close(fd);
+        return NULL;
+    }
+    /* room for a whole window of answers arriving at once */
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    dns = calloc(1, sizeof(dns_t));
+    while (size < DNS_CACHE_MAX)
+        size <<= 1;
+    if (dns) {
+        dns->by_id = calloc(DNS_IDS, sizeof(dns_entry_t *));
+        dns->buckets = calloc(size, sizeof(dns_entry_t *));
+    }
+    if (!dns || !dns->by_id || !dns->buckets) {
+        goto failed;
+    }
+    dns->loop = loop;
+    dns->mask = size - 1;
+    dns->timeout = timeout_ms > 0 ? timeout_ms : 1000;
+    /* keep clear of the id space, one id per query on the wire */
+    dns->max_inflight = max_inflight < 1 ? 1 :
+                        max_inflight > DNS_IDS / 2 ? DNS_IDS / 2 : max_inflight;
+    dns->next_id = getpid() ^ se_now(loop);
+
+    dns->ptr = se_add(loop, fd, dns);
+    if (!dns->ptr || se_be_read(dns->ptr, dns_be_read) < 0) {
+        goto failed;
+    }
+    return dns;
+
+failed:
+    if (dns) {
+        if (dns->ptr) se_delete(dns->ptr);
+        free(dns->by_id);
+        free(dns->buckets);
+        free(dns);
+    }
+    close(fd);
+    return NULL;
+}
+
+void dns_destroy(dns_t *dns)
+{
+    uint32_t i;
+
+    /* lookups still under way are dropped without a callback */
+    for (i = 0; i <= dns->mask; i++) {
+        dns_entry_t *e, *next;
+
+        for (e = dns->buckets[i]; e; e = next) {
+            dns_waiter_t *w, *wnext;
+
+            next = e->hnext;
+            se_timer_del(dns->loop, &e->timer);
+            for (w = e->waiters; w; w = wnext) {
+                wnext = w->next;
+                free(w);
+            }
+            free(e);
+        }
+    }
+    close(dns->ptr->fd);
+    se_delete(dns->ptr);
+    free(dns->by_id);
+    free(dns->buckets);
+    free(dns);
+}
+
+int dns_resolve(dns_t *dns, const char *host, dns_proc_t func, void *arg)
+{
+    char name[DNS_NAME_MAX + 2];
+    struct in_addr addr;
+    dns_entry_t *e;
+    dns_waiter_t *w;
+    uint32_t hash;
+    int len;
+
+    dns->stats.lookups++;
+    if (inet_pton(AF_INET, host, &addr) == 1) {
+        dns->stats.literals++;
+        func(host, &addr, arg);
+        return 0;
+    }
+    if ((len = normalize(host, name)) < 0) {
+        dns->stats.failed++;
+        func(host, NULL, arg);
+        return 0;
+    }
+
+    hash = hash_name(name, len);
+    e = entry_find(dns, name, len, hash);
+    if (e && entry_done(e) && e->expire > se_now(dns->loop)) {
+        dns->stats.cache_hits++;
+        func(host, e->state == ENTRY_OK ? &e->addr : NULL, arg);
+        return 0;
+    }
+
+    w = malloc(sizeof(dns_waiter_t));
+    if (!w) {
+        return -1;
+    }
+    if (!e && (e = entry_new(dns, name, len, hash)) == NULL) {
+        free(w);
+        return -1;
+    }
+    w->func = func;
+    w->arg = arg;
+    w->next = NULL;
+    *e->waiters_tail = w;
+    e->waiters_tail = &w->next;
+
+    if (entry_done(e))
+        query_schedule(dns, e);     /* new or expired */
+    else
+        dns->stats.coalesced++;
+    return 0;
+}
+
+int dns_pending(const dns_t *dns)
+{
+    return dns->inflight + dns->queued;
+}
+
+const dns_stats_t *dns_stats(const dns_t *dns)
+{
+    return &dns->stats;
+}
@@ -0,0 +1,62 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <netinet/in.h>    /* for struct in_addr */
+
+#include "se.h"
+
+/*
+ * Non-blocking A record lookups for the scanners, driven by an se loop.
+ *
+ * Queries go out over one UDP socket to a single recursive resolver (the
+ * first nameserver of /etc/resolv.conf unless told otherwise), at most
+ * max_inflight at a time; the rest wait in a FIFO. Answers are kept in an
+ * in-memory cache for their TTL, failures for DNS_NEG_TTL seconds, and
+ * concurrent lookups of the same name share one query. IP literals never
+ * touch the network.
+ *
+ * Lost queries are retried DNS_TRIES times, timeout_ms apart; truncated
+ * answers are treated as failures, there is no TCP fallback.
+ */
+
+#define DNS_TRIES      3
+#define DNS_NEG_TTL    60           /* seconds a failed name is remembered */
+#define DNS_MAX_TTL    86400        /* longer TTLs are clamped */
+#ifndef DNS_CACHE_MAX
+#define DNS_CACHE_MAX  (1 << 17)    /* cached names before a sweep */
+#endif
+
+typedef struct dns_s dns_t;
+
+/* addr is NULL when the name could not be resolved */
+typedef void (*dns_proc_t)(const char *host, const struct in_addr *addr,
+                           void *arg);
+
+typedef struct dns_stats_s {
+    unsigned long lookups;
+    unsigned long literals;     /* answered without a query */
+    unsigned long cache_hits;
+    unsigned long coalesced;    /* joined a query already under way */
+    unsigned long sent;         /* datagrams, retries included */
+    unsigned long retries;
+    unsigned long answered;
+    unsigned long failed;
+} dns_stats_t;
+
+/* server is "ip" or "ip:port", NULL reads /etc/resolv.conf */
+dns_t *dns_create(se_loop_t *loop, const char *server, int max_inflight,
+                  int timeout_ms);
+void dns_destroy(dns_t *dns);
+
+/*
+ * Resolve host and call func exactly once. For IP literals, cached names
+ * and invalid names func runs before dns_resolve returns.
+ */
+int dns_resolve(dns_t *dns, const char *host, dns_proc_t func, void *arg);
+
+/* lookups queued or on the wire */
+int dns_pending(const dns_t *dns);
+
+const dns_stats_t *dns_stats(const dns_t *dns);
+
+#endif    /* DNS_H */
@@ -0,0 +1,282 @@
+/* echo_server.c
+ * a multi-threaded echo server, the epoll baseline for the io_uring echo
+ * servers: every thread has its own SO_REUSEPORT listener and epoll loop,
+ * connections are edge triggered and echo whatever they read. What the
+ * peer does not take right away waits for EPOLLOUT, and past OUT_HIGH
+ * bytes of it we stop reading from that peer. With -u the threads run the
+ * uring.c loop instead.
+ * build with : gcc -O2 -Wall -pthread -o echo_server echo_server.c uring.c
+ * run with   : ./echo_server -t 4 5001
+ *              ./echo_server -u -t 4 5001
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "uring.h"
+
+#define MAX_THREADS 64
+#define MAXEVENTS 256
+#define READ_BUF 65536
+#define OUT_HIGH (64 * 1024)
+
+struct conn
+{
+   int fd;
+   int want_out;          // EPOLLOUT is armed
+   int read_blocked;      // input left unread because of OUT_HIGH
+   char *out;
+   size_t off, len, cap;  // unsent output is out[off..len)
+};
+
+static int port;
+static int use_uring;
+
+static int listen_on(int port)
+{
+   struct sockaddr_in addr;
+   int fd, on = 1;
+
+   fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+   if (fd < 0)
+      return -1;
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+static void conn_close(struct conn *c)
+{
+   close(c->fd);
+   free(c->out);
+   free(c);
+}
+
+static int conn_queue(struct conn *c, const char *buf, size_t len)
+{
+   if (c->off > 0)
+   {
+      memmove(c->out, c->out + c->off, c->len - c->off);
+      c->len -= c->off;
+      c->off = 0;
+   }
+   if (c->len + len > c->cap)
+   {
+      size_t cap = c->cap ? c->cap : 4096;
+      char *p;
+
+      while (cap < c->len + len)
+         cap *= 2;
+      if ((p = realloc(c->out, cap)) == NULL)
+         return -1;
+      c->out = p;
+      c->cap = cap;
+   }
+   memcpy(c->out + c->len, buf, len);
+   c->len += len;
+   return 0;
+}
+
+/* send what is queued, -1 when the connection is broken */
+static int conn_flush(struct conn *c)
+{
+   while (c->off < c->len)
+   {
+      ssize_t n = send(c->fd, c->out + c->off, c->len - c->off, MSG_NOSIGNAL);
+
+      if (n < 0)
+         return errno == EAGAIN ? 0 : -1;
+      c->off += n;
+   }
+   c->off = c->len = 0;
+   return 0;
+}
+
+/* read until EAGAIN and echo it, -1 when the connection is done */
+static int conn_read(struct conn *c, char *buf)
+{
+   c->read_blocked = 0;
+   for (;;)
+   {
+      ssize_t n, sent = 0;
+
+      if (c->len - c->off >= OUT_HIGH)
+      {
+         c->read_blocked = 1;
+         return 0;
+      }
+      n = recv(c->fd, buf, READ_BUF, 0);
+      if (n < 0)
+         return errno == EAGAIN ? 0 : -1;
+      if (n == 0)
+         return -1;
+      if (c->off == c->len)
+      {
+         sent = send(c->fd, buf, n, MSG_NOSIGNAL);
+         if (sent < 0 && errno != EAGAIN)
+            return -1;
+         if (sent < 0)
+            sent = 0;
+      }
+      if (sent < n && conn_queue(c, buf + sent, n - sent) < 0)
+         return -1;
+   }
+}
+
+static int conn_arm(int epfd, struct conn *c)
+{
+   struct epoll_event ev;
+   int want = c->off < c->len;
+
+   if (want == c->want_out)
+      return 0;
+   ev.events = EPOLLIN | EPOLLET | (want ? EPOLLOUT : 0);
+   ev.data.ptr = c;
+   c->want_out = want;
+   return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void epoll_loop(int lfd)
+{
+   struct epoll_event ev, events[MAXEVENTS];
+   char *buf = malloc(READ_BUF);
+   int epfd = epoll_create1(0), n, i;
+
+   ev.events = EPOLLIN | EPOLLET;
+   ev.data.ptr = NULL;
+   if (buf == NULL || epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) < 0)
+   {
+      perror("epoll");
+      exit(1);
+   }
+
+   for (;;)
+   {
+      n = epoll_wait(epfd, events, MAXEVENTS, -1);
+      for (i = 0; i < n; i++)
+      {
+         struct conn *c = events[i].data.ptr;
+         int fd, done = 0;
+
+         if (c == NULL)
+         {
+            while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+            {
+               if ((c = calloc(1, sizeof(struct conn))) == NULL)
+               {
+                  close(fd);
+                  continue;
+               }
+               c->fd = fd;
+               ev.events = EPOLLIN | EPOLLET;
+               ev.data.ptr = c;
+               if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+                  conn_close(c);
+            }
+            continue;
+         }
+
+         if (events[i].events & EPOLLOUT)
+         {
+            done = conn_flush(c) < 0;
+            if (!done && c->read_blocked && c->len - c->off < OUT_HIGH)
+               done = conn_read(c, buf) < 0;
+         }
+         if (!done && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+            done = conn_read(c, buf) < 0;
+         if (done || conn_arm(epfd, c) < 0)
+            conn_close(c);
+      }
+   }
+}
+
+static int echo_data(uring_conn_t *c, const char *buf, size_t len)
+{
+   return uring_send(c, buf, len);
+}
+
+static void *thread_main(void *arg)
+{
+   static const uring_ops_t ops = { NULL, echo_data, NULL };
+   int lfd = listen_on(port);
+
+   (void)arg;
+   if (lfd < 0)
+   {
+      perror("listen");
+      exit(1);
+   }
+   if (use_uring)
+   {
+      uring_loop_t *loop = uring_create(lfd, &ops, 0, 0);
+
+      if (loop == NULL)
+      {
+         perror("io_uring");
+         exit(1);
+      }
+      uring_run(loop);
+      uring_destroy(loop);
+   }
+   else
+   {
+      epoll_loop(lfd);
+   }
+   close(lfd);
+   return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+   pthread_t tids[MAX_THREADS];
+   int ch, i, threads = 1;
+
+   while ((ch = getopt(argc, argv, "t:uh?")) != -1)
+   {
+      switch (ch)
+      {
+         case 't': threads = atoi(optarg); break;
+         case 'u': use_uring = 1; break;
+         default:
+            fprintf(stderr, "echo_server [-t threads] [-u] <port>\n");
+            exit(1);
+      }
+   }
+   if (optind >= argc)
+   {
+      fprintf(stderr, "echo_server [-t threads] [-u] <port>\n");
+      exit(1);
+   }
+   port = atoi(argv[optind]);
+   if (threads < 1 || threads > MAX_THREADS)
+      threads = 1;
+
+   for (i = 0; i < threads; i++)
+   {
+      if (pthread_create(&tids[i], NULL, thread_main, NULL) != 0)
+      {
+         perror("pthread_create");
+         exit(1);
+      }
+   }
+   for (i = 0; i < threads; i++)
+      pthread_join(tids[i], NULL);
+   return 0;
+}
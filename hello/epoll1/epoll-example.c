@@ -1,4 +1,5 @@
 //https://banu.com/blog/2/how-to-use-epoll-a-complete-example-in-c/epoll-example.c
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,9 +10,36 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <time.h>
+
+#include "uring.h"
 
 #define MAXEVENTS 64
 
+/* Connections accepted per listener wakeup (-a, 0 drains the backlog).
+ * The listener is level triggered, so the rest waits for the next
+ * epoll_wait, behind the connections already being read. */
+#define ACCEPT_BUDGET 16
+
+/* At -m connections the listener is MODed to an empty event mask, and
+ * gets EPOLLIN back once an eighth of them have closed. Running out of
+ * descriptors pauses it the same way, until a connection closes or for
+ * ACCEPT_RETRY_MS, as they may be held elsewhere and there may be no
+ * connection of ours to close. */
+#define ACCEPT_RETRY_MS 100
+
+static int nconns, max_conns, paused, resume_below;
+static long retry_at;   /* ms on the monotonic clock, 0 when not due */
+
+static long
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
 static int
 make_socket_non_blocking (int sfd)
 {
@@ -81,21 +109,110 @@ create_and_bind (char *port)
   return sfd;
 }
 
+/* The same server on io_uring (-u): uring.c accepts and receives, the
+ * callback only copies the data out. */
+static int
+uring_data (uring_conn_t *c, const char *buf, size_t len)
+{
+  /* Write the buffer to standard output */
+  if (write (1, buf, len) == -1)
+    {
+      perror ("write");
+      abort ();
+    }
+  return 0;
+}
+
+static void
+listener_set (int efd, int sfd, int events)
+{
+  struct epoll_event event;
+
+  event.data.fd = sfd;
+  event.events = events;
+  if (epoll_ctl (efd, EPOLL_CTL_MOD, sfd, &event) == -1)
+    perror ("epoll_ctl");
+  paused = events == 0;
+  if (!paused)
+    retry_at = 0;
+}
+
+static void
+listener_pause (int efd, int sfd, int below)
+{
+  listener_set (efd, sfd, 0);
+  resume_below = below;
+}
+
+static void
+close_connection (int efd, int sfd, int fd)
+{
+  /* Closing the descriptor will make epoll remove it
+     from the set of descriptors which are monitored. */
+  close (fd);
+  nconns--;
+  if (paused && nconns < resume_below)
+    listener_set (efd, sfd, EPOLLIN);
+}
+
+static int
+uring_main (int sfd)
+{
+  static const uring_ops_t ops = { NULL, uring_data, NULL };
+  uring_loop_t *loop;
+
+  loop = uring_create (sfd, &ops, 0, 0);
+  if (loop == NULL)
+    {
+      perror ("io_uring");
+      abort ();
+    }
+
+  if (uring_run (loop) == -1)
+    perror ("io_uring_enter");
+
+  uring_destroy (loop);
+  close (sfd);
+  return EXIT_SUCCESS;
+}
+
 int
 main (int argc, char *argv[])
 {
-  int sfd, s;
+  int sfd, s, ch;
   int efd;
+  int use_uring = 0;
+  int accept_budget = ACCEPT_BUDGET;
   struct epoll_event event;
   struct epoll_event *events;
 
-  if (argc != 2)
+  while ((ch = getopt (argc, argv, "ua:m:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'u':
+          use_uring = 1;
+          break;
+        case 'a':
+          accept_budget = atoi (optarg);
+          break;
+        case 'm':
+          max_conns = atoi (optarg);
+          break;
+        default:
+          optind = argc + 1;
+          break;
+        }
+    }
+
+  if (argc - optind != 1)
     {
-      fprintf (stderr, "Usage: %s [port]\n", argv[0]);
+      fprintf (stderr, "Usage: %s [-u] [-a accept_budget] [-m max_connections] port\n",
+               argv[0]);
       exit (EXIT_FAILURE);
     }
 
-  sfd = create_and_bind (argv[1]);
+  sfd = create_and_bind (argv[optind]);
   if (sfd == -1)
     abort ();
 
@@ -110,6 +227,9 @@ main (int argc, char *argv[])
       abort ();
     }
 
+  if (use_uring)
+    return uring_main (sfd);
+
   efd = epoll_create1 (0);
   if (efd == -1)
     {
@@ -117,8 +237,9 @@ main (int argc, char *argv[])
       abort ();
     }
 
+  /* Level triggered, unlike the connections: see ACCEPT_BUDGET. */
   event.data.fd = sfd;
-  event.events = EPOLLIN | EPOLLET;
+  event.events = EPOLLIN;
   s = epoll_ctl (efd, EPOLL_CTL_ADD, sfd, &event);
   if (s == -1)
     {
@@ -132,9 +253,18 @@ main (int argc, char *argv[])
   /* The event loop */
   while (1)
     {
-      int n, i;
+      int n, i, timeout = -1;
+
+      if (retry_at != 0)
+        {
+          timeout = retry_at - now_ms ();
+          if (timeout < 0)
+            timeout = 0;
+        }
 
-      n = epoll_wait (efd, events, MAXEVENTS, -1);
+      n = epoll_wait (efd, events, MAXEVENTS, timeout);
+      if (retry_at != 0 && now_ms () >= retry_at)
+        listener_set (efd, sfd, EPOLLIN);
       for (i = 0; i < n; i++)
 	{
 	  if ((events[i].events & EPOLLERR) ||
@@ -144,7 +274,7 @@ main (int argc, char *argv[])
               /* An error has occured on this fd, or the socket is not
                  ready for reading (why were we notified then?) */
 	      fprintf (stderr, "epoll error\n");
-	      close (events[i].data.fd);
+	      close_connection (efd, sfd, events[i].data.fd);
 	      continue;
 	    }
 
@@ -152,15 +282,19 @@ main (int argc, char *argv[])
 	    {
               /* We have a notification on the listening socket, which
                  means one or more incoming connections. */
-              while (1)
+              int budget = accept_budget;
+
+              while (accept_budget == 0 || budget-- > 0)
                 {
-                  struct sockaddr in_addr;
-                  socklen_t in_len;
                   int infd;
-                  char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
 
-                  in_len = sizeof in_addr;
-                  infd = accept (sfd, &in_addr, &in_len);
+                  if (max_conns > 0 && nconns >= max_conns)
+                    {
+                      listener_pause (efd, sfd, max_conns - max_conns / 8);
+                      break;
+                    }
+
+                  infd = accept4 (sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
                   if (infd == -1)
                     {
                       if ((errno == EAGAIN) ||
@@ -170,6 +304,17 @@ main (int argc, char *argv[])
                              connections. */
                           break;
                         }
+                      else if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                      else if (errno == EMFILE || errno == ENFILE)
+                        {
+                          /* Out of descriptors: the listener is level
+                             triggered, so leave the backlog alone until
+                             a connection is closed or the retry is due. */
+                          listener_pause (efd, sfd, nconns);
+                          retry_at = now_ms () + ACCEPT_RETRY_MS;
+                          break;
+                        }
                       else
                         {
                           perror ("accept");
@@ -177,22 +322,6 @@ main (int argc, char *argv[])
                         }
                     }
 
-                  s = getnameinfo (&in_addr, in_len,
-                                   hbuf, sizeof hbuf,
-                                   sbuf, sizeof sbuf,
-                                   NI_NUMERICHOST | NI_NUMERICSERV);
-                  if (s == 0)
-                    {
-                      printf("Accepted connection on descriptor %d "
-                             "(host=%s, port=%s)\n", infd, hbuf, sbuf);
-                    }
-
-                  /* Make the incoming socket non-blocking and add it to the
-                     list of fds to monitor. */
-                  s = make_socket_non_blocking (infd);
-                  if (s == -1)
-                    abort ();
-
                   event.data.fd = infd;
                   event.events = EPOLLIN | EPOLLET;
                   s = epoll_ctl (efd, EPOLL_CTL_ADD, infd, &event);
@@ -201,6 +330,7 @@ main (int argc, char *argv[])
                       perror ("epoll_ctl");
                       abort ();
                     }
+                  nconns++;
                 }
               continue;
             }
@@ -248,14 +378,7 @@ main (int argc, char *argv[])
                 }
 
               if (done)
-                {
-                  printf ("Closed connection on descriptor %d\n",
-                          events[i].data.fd);
-
-                  /* Closing the descriptor will make epoll remove it
-                     from the set of descriptors which are monitored. */
-                  close (events[i].data.fd);
-                }
+                close_connection (efd, sfd, events[i].data.fd);
             }
         }
     }
@@ -9,6 +9,16 @@
 #include<errno.h>
 #include<cstring>
 #include<pthread.h>
+#include<time.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+#include<poll.h>
+#include<sys/stat.h>
+#include<sys/sendfile.h>
+#include<sys/inotify.h>
+#include<sys/resource.h>
+#include<stddef.h>
+#include "twheel.h"
 
 const int EPOLL_SIZE=5000;
 const int EVENT_ARR=5000;
@@ -16,12 +26,56 @@ const int PORT=8002;
 const int BUF_SIZE=5000;
 const int BACK_QUEUE=100;
 const int THREAD_MAX=100;
-static unsigned int s_thread_para[THREAD_MAX][8];   //线程参数
+const int SEND_TIMEOUT_MS=30000;                    //客户端不收数据时最多等多久
+const int HEADER_TIMEOUT_MS=10000;                  //连上之后多久内必须发来请求
+const int IDLE_TIMEOUT_MS=60000;                    //keep-alive 连接最多空闲多久
+const unsigned int QUEUE_SIZE=4096;                 //工作队列长度, 必须是2的幂
+const int CACHE_SHARDS=16;                          //文件缓存分片数
+const int CACHE_BUCKETS=256;                        //每个分片的 hash 桶数
+const int CACHE_SHARD_MAX=512;                      //每个分片最多缓存的文件数
+const int CACHE_PATH_MAX=256;
+const int WATCH_BUCKETS=1024;                       //inotify watch 引用计数表的 hash 桶数
 static pthread_t s_tid[THREAD_MAX];                 //线程ID
-pthread_mutex_t s_mutex[THREAD_MAX]; //线程锁
-int epFd;                            //epoll
+int epFd;                                           //epoll
+
+//epoll 线程和 worker 之间的有界 MPMC 无锁环形队列.
+//每个槽位的 seq 表示它当前可以被第几次 push/pop 使用,
+//push/pop 只需要在 s_enq/s_deq 上做一次 CAS, 不需要锁.
+struct work_item
+{
+    unsigned int seq;
+    int fd;
+    unsigned long long enq_ns;                      //入队时间, 用于统计派发延迟
+};
+static struct work_item s_queue[QUEUE_SIZE];
+static unsigned int s_enq, s_deq;                   //下一个 push/pop 的位置
+//队列空时 worker 睡在 s_pushed 上, 队列满时 epoll 线程睡在 s_popped 上.
+//有人在睡的时候才需要 futex_wake, 忙的时候没有系统调用.
+static int s_pushed, s_popped;
+static int s_pop_waiters, s_push_waiters;
+//派发统计: 入队到被 worker 取出的延迟, 以及没能接受的连接数
+static unsigned long long s_dispatched, s_dispatch_ns, s_dispatch_max_ns, s_dropped;
 struct epoll_event ev,evs[EVENT_ARR];
 
+//连接超时: 每个 fd 一个定时器, 挂在 epoll 线程的时间轮上, 只有 epoll 线程碰它.
+//accept 时开始计请求头超时, 每次把连接交给 worker 时改成空闲超时 (只存一个新的
+//截止时间, 见 twheel.h). 连接在 worker 手里时不算超时, worker 发送时自己有
+//SEND_TIMEOUT_MS. 到期时只 shutdown 不 close: 连接随后变成可读, 由 worker
+//像对端断开一样关闭, fd 不会在别的线程还在用的时候被关掉.
+//worker 关闭连接前置 closed, 之后到期的定时器直接作废, 不计超时也不 shutdown
+//(这个 fd 号可能已经是 worker 打开的文件), 直到 accept 又拿到这个 fd.
+struct conn_timer
+{
+    twheel_timer_t timer;
+    int fd;
+    int busy;                                       //在 worker 手里, worker 处理完清零
+    int closed;                                     //worker 已关闭, accept 时清零
+};
+static struct conn_timer *s_timers;                 //按 fd 下标, RLIMIT_NOFILE 个
+static int s_ntimers;
+static twheel_t *s_wheel;
+static unsigned long long s_expired;
+
 char *get_type(char *url,char *buf)
 {
 
@@ -52,75 +106,682 @@ char *get_type(char *url,char *buf)
       return buf;
 
 }
- void* http_server(int thread_para[])
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+static void futex_wait(int *addr,int val)
+{
+    syscall(SYS_futex,addr,FUTEX_WAIT_PRIVATE,val,NULL,NULL,0);
+}
+
+static void futex_wake(int *addr)
+{
+    syscall(SYS_futex,addr,FUTEX_WAKE_PRIVATE,1,NULL,NULL,0);
+}
+
+static void init_queue(void)
+{
+    for(unsigned int i=0;i<QUEUE_SIZE;i++)
+        s_queue[i].seq=i;
+}
+
+//返回 false 表示队列已满
+static bool queue_push(int fd)
+{
+    unsigned int pos=__atomic_load_n(&s_enq,__ATOMIC_RELAXED);
+    struct work_item *cell;
+    for(;;)
+    {
+        cell=&s_queue[pos&(QUEUE_SIZE-1)];
+        int diff=(int)(__atomic_load_n(&cell->seq,__ATOMIC_ACQUIRE)-pos);
+        if(diff==0)
+        {
+            if(__atomic_compare_exchange_n(&s_enq,&pos,pos+1,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff<0)
+            return false;
+        else
+            pos=__atomic_load_n(&s_enq,__ATOMIC_RELAXED);
+    }
+    cell->fd=fd;
+    cell->enq_ns=now_ns();
+    __atomic_store_n(&cell->seq,pos+1,__ATOMIC_RELEASE);
+    return true;
+}
+
+//返回 false 表示队列为空
+static bool queue_pop(int *fd)
+{
+    unsigned int pos=__atomic_load_n(&s_deq,__ATOMIC_RELAXED);
+    struct work_item *cell;
+    for(;;)
+    {
+        cell=&s_queue[pos&(QUEUE_SIZE-1)];
+        int diff=(int)(__atomic_load_n(&cell->seq,__ATOMIC_ACQUIRE)-(pos+1));
+        if(diff==0)
+        {
+            if(__atomic_compare_exchange_n(&s_deq,&pos,pos+1,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff<0)
+            return false;
+        else
+            pos=__atomic_load_n(&s_deq,__ATOMIC_RELAXED);
+    }
+    *fd=cell->fd;
+    unsigned long long ns=now_ns()-cell->enq_ns;
+    __atomic_store_n(&cell->seq,pos+QUEUE_SIZE,__ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&s_dispatched,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_dispatch_ns,ns,__ATOMIC_RELAXED);
+    unsigned long long max=__atomic_load_n(&s_dispatch_max_ns,__ATOMIC_RELAXED);
+    while(ns>max&&!__atomic_compare_exchange_n(&s_dispatch_max_ns,&max,ns,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+        ;
+    return true;
+}
+
+//epoll 线程: 队列满时等 worker 取走连接, 连接排队而不是被丢弃
+static void queue_push_wait(int fd)
+{
+    while(!queue_push(fd))
+    {
+        int seen=__atomic_load_n(&s_popped,__ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&s_push_waiters,1,__ATOMIC_SEQ_CST);
+        if(queue_push(fd))
+        {
+            __atomic_fetch_sub(&s_push_waiters,1,__ATOMIC_SEQ_CST);
+            break;
+        }
+        futex_wait(&s_popped,seen);
+        __atomic_fetch_sub(&s_push_waiters,1,__ATOMIC_SEQ_CST);
+    }
+    __atomic_fetch_add(&s_pushed,1,__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&s_pop_waiters,__ATOMIC_SEQ_CST)>0)
+        futex_wake(&s_pushed);
+}
+
+//worker: 队列空时睡眠, 直到 epoll 线程放入新的连接
+static int queue_pop_wait(void)
+{
+    int fd;
+    while(!queue_pop(&fd))
+    {
+        int seen=__atomic_load_n(&s_pushed,__ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&s_pop_waiters,1,__ATOMIC_SEQ_CST);
+        if(queue_pop(&fd))
+        {
+            __atomic_fetch_sub(&s_pop_waiters,1,__ATOMIC_SEQ_CST);
+            break;
+        }
+        futex_wait(&s_pushed,seen);
+        __atomic_fetch_sub(&s_pop_waiters,1,__ATOMIC_SEQ_CST);
+    }
+    __atomic_fetch_add(&s_popped,1,__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&s_push_waiters,__ATOMIC_SEQ_CST)>0)
+        futex_wake(&s_popped);
+    return fd;
+}
+
+static void conn_expired(twheel_timer_t *t,void *)
+{
+    struct conn_timer *ct=(struct conn_timer *)((char *)t-offsetof(struct conn_timer,timer));
+    if(__atomic_load_n(&ct->closed,__ATOMIC_ACQUIRE))
+        return;
+    if(__atomic_load_n(&ct->busy,__ATOMIC_ACQUIRE))
+    {
+        twheel_add(s_wheel,&ct->timer,IDLE_TIMEOUT_MS);
+        return;
+    }
+    s_expired++;
+    shutdown(ct->fd,SHUT_RDWR);
+}
+
+static void init_timers(void)
+{
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE,&rl);
+    s_ntimers=rl.rlim_cur;
+    s_timers=(struct conn_timer *)calloc(s_ntimers,sizeof(struct conn_timer));
+    s_wheel=twheel_create(0,0,conn_expired,NULL);
+    if(s_timers==NULL||s_wheel==NULL)
+    {
+        fprintf(stderr,"init timers failed!\n");
+        exit(-1);
+    }
+}
+
+//epoll 线程: 新连接开始计请求头超时
+static void timer_accepted(int fd)
+{
+    if(fd>=s_ntimers)return;
+    s_timers[fd].fd=fd;
+    s_timers[fd].busy=0;
+    s_timers[fd].closed=0;
+    twheel_add(s_wheel,&s_timers[fd].timer,HEADER_TIMEOUT_MS);
+}
+
+//epoll 线程: 连接可读, 交给 worker 之前
+static void timer_dispatched(int fd)
+{
+    if(fd>=s_ntimers)return;
+    __atomic_store_n(&s_timers[fd].busy,1,__ATOMIC_RELEASE);
+    twheel_touch(s_wheel,&s_timers[fd].timer,IDLE_TIMEOUT_MS);
+}
+
+//worker: 连接处理完 (或已关闭)
+static void timer_released(int fd)
+{
+    if(fd<s_ntimers)
+        __atomic_store_n(&s_timers[fd].busy,0,__ATOMIC_RELEASE);
+}
+
+//worker: 连接要关闭了, 在 close 之前调用
+static void timer_closed(int fd)
+{
+    if(fd<s_ntimers)
+        __atomic_store_n(&s_timers[fd].closed,1,__ATOMIC_RELEASE);
+}
+
+//重新打开一个 EPOLLONESHOT 连接的读事件
+static void rearm(int fd)
+{
+    struct epoll_event e;
+    e.data.fd=fd;
+    e.events=EPOLLIN|EPOLLET|EPOLLONESHOT;
+    epoll_ctl(epFd,EPOLL_CTL_MOD,fd,&e);
+}
+
+//打开的文件缓存: path -> 打开的 fd, 大小, mtime, Content-Type 和预先生成的 200 响应头.
+//按 path 的 hash 分成 CACHE_SHARDS 个分片, 每个分片一把锁和一个 LRU 链表,
+//总数受 RLIMIT_NOFILE 限制. 命中时一个请求只剩 send+sendfile 两个系统调用.
+//每个缓存的文件都有 inotify watch, 文件被修改, 替换或删除时由 epoll 线程作废.
+struct file_entry
+{
+    char path[CACHE_PATH_MAX];
+    unsigned int hash;
+    int fd;
+    int wd;                                         //inotify watch
+    off_t size;
+    time_t mtime;
+    char type[64];
+    char header[256];                               //完整文件的 200 响应头
+    int header_len;
+    int refs;                                       //正在使用它的 worker 数
+    bool dead;                                      //已移出缓存, refs 归零时释放
+    struct file_entry *hnext;                       //hash 链
+    struct file_entry *prev,*next;                  //LRU 链, 表头最新
+    struct file_entry *wprev,*wnext;                //同一个 watch 的缓存条目, 在 s_watchLock 里改
+};
+struct cache_shard
+{
+    pthread_mutex_t lock;
+    struct file_entry *buckets[CACHE_BUCKETS];
+    struct file_entry *head,*tail;
+    int count;
+};
+static struct cache_shard s_cache[CACHE_SHARDS];
+static int s_cache_shard_max;                       //每个分片最多缓存的文件数, 0 表示不缓存
+static int s_inotifyFd=-1;
+
+//每个 inotify watch 被几个缓存条目用着: 同一个 inode 的几个 path 拿到的是同一个 wd.
+//add_watch 和计数加一, 计数减到零和 rm_watch 都在 s_watchLock 里做,
+//所以不会删掉别的 worker 刚拿到的 watch. wd 由内核循环分配, 只能用 hash 表.
+//进了缓存的条目还挂在它的 watch 上, inotify 事件只作废这些条目, 不用扫整个缓存.
+//锁的顺序是先分片锁后 s_watchLock, 条目只在持有自己分片锁时挂上或摘下
+struct watch_ref
+{
+    int wd;
+    int refs;
+    struct file_entry *entries;                     //用这个 watch 的缓存条目
+    struct watch_ref *next;
+};
+static struct watch_ref *s_watches[WATCH_BUCKETS];
+static pthread_mutex_t s_watchLock=PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_path(const char *path)
+{
+    unsigned int h=2166136261u;                     //FNV-1a
+    for(;*path;++path)h=(h^(unsigned char)*path)*16777619u;
+    return h;
+}
+
+static void init_cache(void)
+{
+    struct rlimit rl;
+    for(int i=0;i<CACHE_SHARDS;i++)
+        pthread_mutex_init(&s_cache[i].lock,NULL);
+#ifdef NO_FILE_CACHE
+    return;                                         //只用于对比测试: 每个请求都 open/fstat/close
+#endif
+    s_inotifyFd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(s_inotifyFd<0)
+    {
+        perror("inotify_init1, file cache disabled");
+        return;
+    }
+    //缓存最多占用四分之一的文件描述符, 剩下的留给连接
+    getrlimit(RLIMIT_NOFILE,&rl);
+    s_cache_shard_max=rl.rlim_cur/4/CACHE_SHARDS;
+    if(s_cache_shard_max>CACHE_SHARD_MAX)s_cache_shard_max=CACHE_SHARD_MAX;
+}
+
+static void entry_free(struct file_entry *e)
+{
+    close(e->fd);
+    free(e);
+}
+
+//调用者持有 s_watchLock
+static struct watch_ref *watch_find(int wd)
+{
+    struct watch_ref *w;
+    for(w=s_watches[wd%WATCH_BUCKETS];w;w=w->next)
+        if(w->wd==wd)break;
+    return w;
+}
+
+//给 path 加 watch 并加一个引用, 失败返回 -1
+static int watch_get(const char *path)
+{
+    pthread_mutex_lock(&s_watchLock);
+    int wd=inotify_add_watch(s_inotifyFd,path,IN_MODIFY|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF);
+    if(wd>=0)
+    {
+        struct watch_ref *w=watch_find(wd);
+        if(w==NULL&&(w=(struct watch_ref *)calloc(1,sizeof(struct watch_ref)))!=NULL)
+        {
+            w->wd=wd;
+            w->next=s_watches[wd%WATCH_BUCKETS];
+            s_watches[wd%WATCH_BUCKETS]=w;
+        }
+        if(w)w->refs++;
+        else                                        //记不下来的 watch 只能不要
+        {
+            inotify_rm_watch(s_inotifyFd,wd);
+            wd=-1;
+        }
+    }
+    pthread_mutex_unlock(&s_watchLock);
+    return wd;
+}
+
+//条目进了缓存, 挂到它的 watch 上. 调用者持有分片锁
+static void watch_link(struct file_entry *e)
+{
+    pthread_mutex_lock(&s_watchLock);
+    struct watch_ref *w=watch_find(e->wd);
+    e->wprev=NULL;
+    e->wnext=w->entries;
+    if(w->entries)w->entries->wprev=e;
+    w->entries=e;
+    pthread_mutex_unlock(&s_watchLock);
+}
+
+//条目放掉它的 watch 引用 (挂着的话先摘下), 最后一个用它的条目走了才删 watch
+static void watch_put(struct file_entry *e)
+{
+    int wd=e->wd;
+    pthread_mutex_lock(&s_watchLock);
+    for(struct watch_ref **pp=&s_watches[wd%WATCH_BUCKETS];*pp;pp=&(*pp)->next)
+    {
+        struct watch_ref *w=*pp;
+        if(w->wd!=wd)continue;
+        if(e->wprev)e->wprev->wnext=e->wnext;else if(w->entries==e)w->entries=e->wnext;
+        if(e->wnext)e->wnext->wprev=e->wprev;
+        e->wprev=e->wnext=NULL;
+        if(--w->refs==0)
+        {
+            *pp=w->next;
+            free(w);
+            inotify_rm_watch(s_inotifyFd,wd);       //内核已经删掉时 (IN_IGNORED) 返回 EINVAL, 不要紧
+        }
+        break;
+    }
+    pthread_mutex_unlock(&s_watchLock);
+}
+
+//从分片里摘掉并放掉它的 watch 引用, 调用者持有分片锁
+static void entry_unlink(struct cache_shard *sh,struct file_entry *e)
+{
+    struct file_entry **pp=&sh->buckets[(e->hash/CACHE_SHARDS)%CACHE_BUCKETS];
+    while(*pp!=e)pp=&(*pp)->hnext;
+    *pp=e->hnext;
+    if(e->prev)e->prev->next=e->next;else sh->head=e->next;
+    if(e->next)e->next->prev=e->prev;else sh->tail=e->prev;
+    sh->count--;
+    e->dead=true;
+    watch_put(e);
+    if(e->refs==0)entry_free(e);
+}
+
+static void lru_push_front(struct cache_shard *sh,struct file_entry *e)
+{
+    e->prev=NULL;
+    e->next=sh->head;
+    if(sh->head)sh->head->prev=e;else sh->tail=e;
+    sh->head=e;
+}
+
+//打开文件并生成一个新条目, 不放进缓存. watch 在 fstat 之前加上, 之后的修改都会收到通知
+static struct file_entry *entry_open(const char *path,unsigned int hash)
+{
+    struct stat st;
+    struct file_entry *e=(struct file_entry *)calloc(1,sizeof(struct file_entry));
+    if(e==NULL)return NULL;
+    e->wd=-1;
+    e->fd=open(path,O_RDONLY|O_CLOEXEC);
+    if(e->fd<0||fstat(e->fd,&st)<0||!S_ISREG(st.st_mode))
+    {
+        if(e->fd>=0)close(e->fd);
+        free(e);
+        return NULL;
+    }
+    if(strlen(path)<CACHE_PATH_MAX&&s_cache_shard_max>0)
+        e->wd=watch_get(path);
+    //fstat 在 add_watch 之后重新取一次, 两者之间的修改也不会漏掉
+    if(e->wd>=0)fstat(e->fd,&st);
+    snprintf(e->path,sizeof(e->path),"%s",path);
+    e->hash=hash;
+    e->size=st.st_size;
+    e->mtime=st.st_mtime;
+    get_type((char *)path,e->type);
+    e->header_len=snprintf(e->header,sizeof(e->header),"HTTP/1.1 200 OK\r\nContent-Length:%lld\r\nAccept-Ranges:bytes\r\nContent-Type:%s\r\n\r\n",
+                           (long long)e->size,e->type);
+    e->refs=1;
+    return e;
+}
+
+//取得 path 的条目并加一个引用, 用完调用 cache_put
+static struct file_entry *cache_get(const char *path)
+{
+    unsigned int h=hash_path(path);
+    struct cache_shard *sh=&s_cache[h%CACHE_SHARDS];
+    struct file_entry *e;
+
+    pthread_mutex_lock(&sh->lock);
+    for(e=sh->buckets[(h/CACHE_SHARDS)%CACHE_BUCKETS];e;e=e->hnext)
+        if(e->hash==h&&strcmp(e->path,path)==0)break;
+    if(e)
+    {
+        e->refs++;
+        if(sh->head!=e)                             //移到 LRU 表头
+        {
+            e->prev->next=e->next;
+            if(e->next)e->next->prev=e->prev;else sh->tail=e->prev;
+            lru_push_front(sh,e);
+        }
+        pthread_mutex_unlock(&sh->lock);
+        return e;
+    }
+    pthread_mutex_unlock(&sh->lock);
+
+    //没命中, 在锁外打开文件
+    if((e=entry_open(path,h))==NULL)return NULL;
+    if(e->wd<0)
+    {
+        e->dead=true;                               //没有 watch 就不能缓存, 只用这一次
+        return e;
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    struct file_entry *other;                       //别的 worker 可能同时放进去了
+    for(other=sh->buckets[(h/CACHE_SHARDS)%CACHE_BUCKETS];other;other=other->hnext)
+        if(other->hash==h&&strcmp(other->path,path)==0)break;
+    if(other)
+    {
+        pthread_mutex_unlock(&sh->lock);
+        watch_put(e);                               //watch 可能和 other 共用, 只放掉引用
+        e->wd=-1;
+        e->dead=true;
+        return e;
+    }
+    //超过上限时淘汰最久没用的
+    while(sh->count>=s_cache_shard_max&&sh->tail)
+        entry_unlink(sh,sh->tail);
+    struct file_entry **bucket=&sh->buckets[(h/CACHE_SHARDS)%CACHE_BUCKETS];
+    e->hnext=*bucket;
+    *bucket=e;
+    lru_push_front(sh,e);
+    sh->count++;
+    watch_link(e);
+    pthread_mutex_unlock(&sh->lock);
+    return e;
+}
+
+static void cache_put(struct file_entry *e)
+{
+    if(e->dead&&e->wd<0)                            //从来没进过缓存
+    {
+        entry_free(e);
+        return;
+    }
+    struct cache_shard *sh=&s_cache[e->hash%CACHE_SHARDS];
+    pthread_mutex_lock(&sh->lock);
+    bool last=--e->refs==0&&e->dead;
+    pthread_mutex_unlock(&sh->lock);
+    if(last)entry_free(e);
+}
+
+//wd 上第一个在 shard 分片里的条目. 调用者持有这个分片的锁, 所以返回之后它不会被别人摘下
+static struct file_entry *watch_first(int wd,int shard)
+{
+    pthread_mutex_lock(&s_watchLock);
+    struct watch_ref *w=watch_find(wd);
+    struct file_entry *e=w?w->entries:NULL;
+    while(e&&(int)(e->hash%CACHE_SHARDS)!=shard)e=e->wnext;
+    pthread_mutex_unlock(&s_watchLock);
+    return e;
+}
+
+//作废挂在 wd 上的条目, 一次拿一个分片的锁, 只碰这些条目
+static void watch_invalidate(int wd)
+{
+    for(;;)
+    {
+        pthread_mutex_lock(&s_watchLock);
+        struct watch_ref *w=watch_find(wd);
+        int shard=w&&w->entries?(int)(w->entries->hash%CACHE_SHARDS):-1;
+        pthread_mutex_unlock(&s_watchLock);
+        if(shard<0)return;
+        struct cache_shard *sh=&s_cache[shard];
+        pthread_mutex_lock(&sh->lock);
+        for(struct file_entry *e;(e=watch_first(wd,shard))!=NULL;)
+            entry_unlink(sh,e);
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+//epoll 线程: 读出 inotify 事件, 作废对应的条目
+static void cache_invalidate(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while((len=read(s_inotifyFd,buf,sizeof(buf)))>0)
+    {
+        for(char *p=buf;p<buf+len;p+=sizeof(struct inotify_event)+((struct inotify_event *)p)->len)
+        {
+            struct inotify_event *ev=(struct inotify_event *)p;
+            if(ev->mask&IN_IGNORED)continue;        //watch 已经被内核删掉
+            if(ev->mask&IN_Q_OVERFLOW)              //丢了事件, 不知道哪些文件改过, 全部作废
+            {
+                for(int i=0;i<CACHE_SHARDS;i++)
+                {
+                    pthread_mutex_lock(&s_cache[i].lock);
+                    while(s_cache[i].tail)entry_unlink(&s_cache[i],s_cache[i].tail);
+                    pthread_mutex_unlock(&s_cache[i].lock);
+                }
+                continue;
+            }
+            watch_invalidate(ev->wd);
+            //watch 随最后一个条目在 entry_unlink 里删掉. 期间别的 worker 又打开这个
+            //文件时会拿到同一个 wd 和一个新引用, watch 就留给它, 它的 fstat 在那之后
+        }
+    }
+}
+
+//非阻塞 socket 上等到可写, 大文件发送时 worker 在这里等客户端收数据
+static bool wait_writable(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd=fd;
+    pfd.events=POLLOUT;
+    return poll(&pfd,1,SEND_TIMEOUT_MS)==1&&!(pfd.revents&(POLLERR|POLLHUP));
+}
+
+static bool send_all(int fd,const char *buf,size_t len,int flags)
+{
+    while(len>0)
+    {
+        ssize_t n=send(fd,buf,len,flags|MSG_NOSIGNAL);
+        if(n>0){buf+=n;len-=n;continue;}
+        if(n<0&&errno==EINTR)continue;
+        if(n<0&&errno==EAGAIN&&wait_writable(fd))continue;
+        return false;
+    }
+    return true;
+}
+
+//发送文件的 [off, off+len) 部分
+static bool send_body(int fd,int filefd,off_t off,size_t len)
+{
+#ifdef NO_SENDFILE
+    //旧的做法: 整个读进用户态缓冲区再 write, 只用于对比测试
+    char *content=(char *)malloc(len);
+    bool ok=content!=NULL&&pread(filefd,content,len,off)==(ssize_t)len&&send_all(fd,content,len,0);
+    free(content);
+    return ok;
+#else
+    //sendfile 直接从 page cache 发送, 不经过用户态
+    while(len>0)
+    {
+        ssize_t n=sendfile(fd,filefd,&off,len);
+        if(n>0){len-=n;continue;}
+        if(n<0&&errno==EINTR)continue;
+        if(n<0&&errno==EAGAIN&&wait_writable(fd))continue;
+        return false;   //出错, 或者文件在发送时被截短
+    }
+    return true;
+#endif
+}
+
+//解析 "Range: bytes=a-b", "bytes=a-", "bytes=-n", 只支持单个区间.
+//返回 0 没有 Range 头, 1 有效区间, -1 无法满足
+static int parse_range(const char *request,off_t size,off_t *first,off_t *last)
+{
+    const char *r=strcasestr(request,"\nRange:");
+    if(r==NULL)return 0;
+    r+=strlen("\nRange:");
+    while(*r==' ')++r;
+    if(strncasecmp(r,"bytes=",6)!=0)return 0;   //不认识的单位, 按没有 Range 处理
+    r+=6;
+
+    char *e;
+    if(*r=='-')
+    {
+        long long n=strtoll(r+1,&e,10);
+        if(e==r+1||n<=0||size==0)return -1;
+        *first=n>=size?0:size-n;
+        *last=size-1;
+    }
+    else
+    {
+        long long a=strtoll(r,&e,10);
+        if(e==r||*e!='-'||a>=size)return -1;
+        *first=a;
+        r=e+1;
+        long long b=strtoll(r,&e,10);
+        *last=(e==r||b>=size)?size-1:b;
+        if(*last<*first)return -1;
+    }
+    if(*e==',')return 0;   //多个区间, 返回整个文件
+    return 1;
+}
+
+//响应头用 MSG_MORE 发出, 和紧接着 sendfile 的文件内容合并成同一批 TCP 包.
+//返回 false 时调用者关闭连接
+static bool send_file(int clientFd,char *url,const char *request)
+{
+    char header[512];
+    int hlen;
+
+    struct file_entry *e=cache_get(url);
+    if(e==NULL)
+    {
+        const char response[]="HTTP/1.1 404 NOT FOUND\r\nContent-Length:0\r\n\r\n";
+        printf("HTTP/1.1 404 NOT FOUND\r\n\r\n");
+        return send_all(clientFd,response,strlen(response),0);
+    }
+
+    off_t first=0,last=e->size-1;
+    const char *h=e->header;
+    int range=parse_range(request,e->size,&first,&last);
+    hlen=e->header_len;
+    if(range<0)
+    {
+        hlen=snprintf(header,sizeof(header),"HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range:bytes */%lld\r\nContent-Length:0\r\n\r\n",(long long)e->size);
+        cache_put(e);
+        return send_all(clientFd,header,hlen,0);
+    }
+    if(range>0)
+    {
+        hlen=snprintf(header,sizeof(header),"HTTP/1.1 206 Partial Content\r\nContent-Length:%lld\r\nContent-Range:bytes %lld-%lld/%lld\r\nContent-Type:%s\r\n\r\n",
+                      (long long)(last-first+1),(long long)first,(long long)last,(long long)e->size,e->type);
+        h=header;
+    }
+
+    size_t len=e->size?last-first+1:0;
+    bool ok=send_all(clientFd,h,hlen,len?MSG_MORE:0)&&send_body(clientFd,e->fd,first,len);
+    cache_put(e);
+    return ok;
+}
+
+ void* http_server(void *)
 {
-      int pool_index;           //thread pool ID
       int clientFd;             //client socket
       char buf[BUF_SIZE];
       pthread_detach(pthread_self());
-      pool_index=thread_para[7];
 
  wait_unlock:
-         pthread_mutex_lock(s_mutex+pool_index); //wait for thread unlock
-         clientFd=thread_para[1];                //client socket ID
+         clientFd=queue_pop_wait();              //wait for a connection
                               //先进行试探性读取
-           int len=read(clientFd,buf,BUF_SIZE);
+           int len=read(clientFd,buf,BUF_SIZE-1);
+           if(len>=0)buf[len]=0;
               printf("%s",buf);
               if(len>0)
                            {
-             char *token=strtok(buf," ");          //GET
+             char *save;
+             char *token=strtok_r(buf," ",&save);  //GET
            printf("token:%s",token);
-             char type[64];
-           char *url=strtok(NULL," ");           //URL
+           char *url=strtok_r(NULL," ",&save);   //URL
+           if(url==NULL)url=(char *)"/";
            while(*url=='.'||*url=='/')++url;
            printf("url:%s",url);
-           char file[1280000];
-
-           sprintf(file,"%s",url);
-           printf("file:%s",file);
+           char *request=save;                   //URL 之后的请求行和头部
 
-             FILE *fp=fopen(file,"rb");
-
-             if(fp==0)
+             if(!send_file(clientFd,url,request))
                 {
-                char response[]="HTTP/1.1 404 NOT FOUND\r\n\r\n";
-                printf("HTTP/1.1 404 NOT FOUND\r\n\r\n");
-                write(clientFd,response,strlen(response));
+                 timer_closed(clientFd);
+                 epoll_ctl(epFd,EPOLL_CTL_DEL,clientFd,&ev);
+                 close(clientFd);
+                 goto wait_unlock;
                 }
-
-             else
-             {
-
-            int file_size;
-            char *content;
-            char *response;
-            fseek(fp,0,SEEK_END);
-            file_size=ftell(fp);
-            fseek(fp,0,SEEK_SET);
-            content=(char *)malloc(file_size+1);
-            response=(char*)malloc(200);
-            fread(content,file_size,1,fp);
-              content[file_size]=0;
-              sprintf(response,"HTTP/1.1 200 OK\r\nContent-Length:%d\r\nContent-Type:%s\r\n\r\n",file_size,get_type(url,type));
-             // printf("HTTP/1.1 200 OK\r\nContent-Type:%s\r\nContent-Length:%d\r\n\r\n%s",get_type(url,type),file_size,content);
-              write(clientFd,response,strlen(response));
-              write(clientFd,content,file_size);
-              free(content);
-              free(response);
-
-                              }
                            }
               else if(len==0)
                                                {
                                                  //触发了EPOLL事件，却没有读取，表示断线
                    //printf("Client closed at %s\n",inet_ntoa(clientAddr.sin_addr));
+                   timer_closed(clientFd);
                    epoll_ctl(epFd,EPOLL_CTL_DEL,clientFd,&ev);
                    close(clientFd);
-                   int i=thread_para[3];
-                   evs[i].data.fd=-1;
-
+                   goto wait_unlock;
                                                }
-               else if(len==EAGAIN)
+               else if(errno==EAGAIN)
                                             {
                  printf("socket huan cun man le!\n");
 
@@ -129,8 +790,12 @@ char *get_type(char *url,char *buf)
                                             {
                   //client读取出错
                   printf("Client read failed!\n");
+                   timer_closed(clientFd);
+                   close(clientFd);
+                   goto wait_unlock;
                                             }
-       thread_para[0] = 0;//设置线程占用标志为"空闲"
+       timer_released(clientFd);
+       rearm(clientFd);      //EPOLLONESHOT: 处理完才接收这个连接的下一个事件
        goto wait_unlock;
 
        printf("pthread exit!\n");
@@ -141,15 +806,10 @@ char *get_type(char *url,char *buf)
 static int init_thread_pool(void)
 {
     int i,rc;
-    for(i=0;i<THREAD_MAX;i++)
-    {
-     s_thread_para[i][0]=0;  //idle
-     s_thread_para[i][7]=i;   //thread pool ID
-     pthread_mutex_lock(s_mutex+i);   //thread lock
-    }
+    init_queue();
     // create thread pool
     for(i=0;i<THREAD_MAX;i++)
-    {  rc=pthread_create(s_tid+i,0,(void *(*)(void*))&http_server,(void *)(s_thread_para[i]));
+    {  rc=pthread_create(s_tid+i,0,http_server,NULL);
        if(0!=rc)
         { fprintf(stderr,"Create thread failed!\n");
            return -1;
@@ -175,7 +835,7 @@ if((opt=fcntl(sockFd,F_GETFL))<0)  //获取原来的flag;
 
 int main()
 {
-  int serverFd,j;
+  int serverFd;
   serverFd=socket(AF_INET,SOCK_STREAM,0); //创建服务器fd
     setnoblock(serverFd);                   //设置为非阻塞模式
     unsigned int        optval;
@@ -207,6 +867,17 @@ int main()
        exit(-1);
           }
 
+    //文件缓存初始化, inotify 事件也由 epoll 线程处理
+    init_cache();
+    if(s_inotifyFd>=0)
+        {
+        ev.data.fd=s_inotifyFd;
+        ev.events=EPOLLIN;
+        epoll_ctl(epFd,EPOLL_CTL_ADD,s_inotifyFd,&ev);
+        }
+
+    init_timers();
+
     //线程池初始化
     int rc = init_thread_pool();
     if (0 != rc) exit(-1);
@@ -225,54 +896,69 @@ int main()
     sockaddr_in clientAddr;
     socklen_t clientlen;
 
+    unsigned long long last_dispatched=0,last_ns=0;
+    time_t last_report=time(NULL);
     for(;;)
         {
      //等待epoll事件到来，最多取EVENT_ARR个事件
-     int nfds=epoll_wait(epFd,evs,EVENT_ARR,-1);
+     int timeout=twheel_timeout(s_wheel);
+     int nfds=epoll_wait(epFd,evs,EVENT_ARR,timeout<0||timeout>1000?1000:timeout);
+     twheel_update(s_wheel);
+     //每秒打印一次派发延迟和丢弃数
+     if(time(NULL)!=last_report&&s_dispatched!=last_dispatched)
+         {
+         unsigned long long n=s_dispatched,ns=s_dispatch_ns;
+         fprintf(stderr,"dispatched %llu, avg %.1fus, max %.1fus, queued %u, dropped %llu, timed out %llu\n",
+                 n-last_dispatched,(ns-last_ns)/1000.0/(n-last_dispatched),s_dispatch_max_ns/1000.0,
+                 s_enq-s_deq,s_dropped,s_expired);
+         last_dispatched=n;
+         last_ns=ns;
+         last_report=time(NULL);
+         }
      //处理事件
      for(int i=0;i<nfds;i++)
       {
       if(evs[i].data.fd==serverFd&&evs[i].events&EPOLLIN)
             {
-              //如果是serverFd，表明有新连接连入
-          if((clientFd=accept(serverFd,(struct sockaddr*)&clientAddr,&clientlen))<0)
-                               {
-             printf("ACCEPT  failed\n");
-                               }
+              //如果是serverFd，表明有新连接连入, 边沿触发要一直 accept 到 EAGAIN
+          clientlen=sizeof(clientAddr);
+          while((clientFd=accept(serverFd,(struct sockaddr*)&clientAddr,&clientlen))>=0)
+               {
           printf("Connect from %s:%d\n",inet_ntoa(clientAddr.sin_addr),htons(clientAddr.sin_port));
         setnoblock(clientFd);
-                  //注册accept()到的连接
+                  //注册accept()到的连接, EPOLLONESHOT 保证同一个连接同时只在一个 worker 里
         ev.data.fd=clientFd;
-        ev.events=EPOLLIN|EPOLLET;
+        ev.events=EPOLLIN|EPOLLET|EPOLLONESHOT;
         epoll_ctl(epFd,EPOLL_CTL_ADD,clientFd,&ev);
+        timer_accepted(clientFd);
+          clientlen=sizeof(clientAddr);
+               }
+          if(errno!=EAGAIN&&errno!=EWOULDBLOCK)
+                               {
+             s_dropped++;    //连接不再因为线程池满被丢弃, 只剩 accept 失败 (如 EMFILE)
+             printf("ACCEPT  failed\n");
+                               }
             }
+      else if(evs[i].data.fd==s_inotifyFd)
+      {
+          //缓存的文件被修改了
+          cache_invalidate();
+      }
       else if(evs[i].events&EPOLLIN)
       {
                   //如果不是serverFd,则是client的可读
       printf("client can write!\n");
       if((clientFd=evs[i].data.fd)>0)
            {
-             //查询空闲线程对
-
-          for(j = 0; j < THREAD_MAX; j++) {
-              if (0 == s_thread_para[j][0]) break;
-          }
-          if (j >= THREAD_MAX) {
-              fprintf(stderr, "线程池已满, 连接将被放弃\r\n");
-              shutdown(clientFd, SHUT_RDWR);
-              close(clientFd);
-              continue;
-          }
-          //复制有关参数
-          s_thread_para[j][0] = 1;//设置活动标志为"活动"
-          s_thread_para[j][1] = clientFd;//客户端连接
-          s_thread_para[j][2] = serverFd;//服务索引
-          s_thread_para[j][3]=i;             //epoll event id;
-          //线程解锁
-          pthread_mutex_unlock(s_mutex + j);  }
+             //交给 worker 线程, 所有线程都忙时在队列里排队
+          timer_dispatched(clientFd);
+          queue_push_wait(clientFd);
+           }
       else printf("other error!\n");
       }
          }
+     //到期的连接在这一批事件处理完之后再 shutdown
+     twheel_run(s_wheel);
         }
     return 0;
 }
@@ -1,4 +1,5 @@
 //https://github.com/hnakamur/luajit-examples/blob/master/socket/c/epoll-server.c
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -8,10 +9,20 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "http_parser.h"
+#include "master.h"
+#include "twheel.h"
+#include "uring.h"
 
 static int
-create_and_bind (char *port)
+create_and_bind (char *port, int reuseport)
 {
   struct addrinfo hints;
   struct addrinfo *result, *rp;
@@ -35,6 +46,19 @@ create_and_bind (char *port)
       if (sfd == -1)
         continue;
 
+      /* Every reactor binds its own listener to the same port and lets
+       * the kernel spread incoming connections across them. */
+      if (reuseport)
+        {
+          int on = 1;
+          if (setsockopt (sfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1)
+            {
+              perror ("setsockopt(SO_REUSEPORT)");
+              close (sfd);
+              continue;
+            }
+        }
+
       s = bind (sfd, rp->ai_addr, rp->ai_addrlen);
       if (s == 0)
         {
@@ -81,211 +105,983 @@ make_socket_non_blocking (int sfd)
 
 #define MAXEVENTS 64
 
-static const char reply[] =
-"HTTP/1.0 200 OK\r\n"
+#define REPLY_BODY \
+"<html>\n" \
+"<head>\n" \
+"<title>performance test</title>\n" \
+"</head>\n" \
+"<body>\n" \
+"test\n" \
+"</body>\n" \
+"</html>"
+
+static const char reply_keepalive[] =
+"HTTP/1.1 200 OK\r\n"
+"Content-type: text/html\r\n"
+"Connection: keep-alive\r\n"
+"Content-Length: 81\r\n"
+"\r\n"
+REPLY_BODY
+;
+
+static const char reply_close[] =
+"HTTP/1.1 200 OK\r\n"
 "Content-type: text/html\r\n"
 "Connection: close\r\n"
-"Content-Length: 82\r\n"
+"Content-Length: 81\r\n"
 "\r\n"
-"<html>\n"
-"<head>\n"
-"<title>performance test</title>\n"
-"</head>\n"
-"<body>\n"
-"test\n"
-"</body>\n"
-"</html>"
+REPLY_BODY
 ;
 
-int
-main (int argc, char *argv[])
+static const char reply_bad_request[] =
+"HTTP/1.1 400 Bad Request\r\n"
+"Connection: close\r\n"
+"Content-Length: 0\r\n"
+"\r\n"
+;
+
+/* Responses to pipelined requests are collected and handed to the
+ * kernel with a single writev per read. */
+#define IOV_BATCH 64
+#define INBUF_SIZE (HTTP_MAX_HEAD + HTTP_MAX_BODY)
+
+/* Set by -u: every loop runs on io_uring (uring.c) instead of epoll. */
+static int use_uring;
+
+/* Connections accepted per listener wakeup (-a, 0 drains the backlog).
+ * The listener is level triggered, so what is left waits for the next
+ * epoll_wait, behind the events of the connections already served. */
+#define ACCEPT_BUDGET 16
+static int accept_budget = ACCEPT_BUDGET;
+
+/* Connections per reactor (-m, 0 for no limit). At the limit the
+ * listener stops asking for EPOLLIN, new clients wait in the backlog, and
+ * it asks again once an eighth of them have gone. */
+static int max_conns;
+
+/* Connection deadlines in seconds, 0 for none (epoll mode only):
+ *   -h header : from the accept, and from the end of the previous request,
+ *               until the current one is complete; more bytes trickling in
+ *               do not extend it
+ *   -i idle   : a keep-alive connection with nothing pending, every read
+ *               starts it over
+ *   -w write  : pending output must make some progress within this */
+static int header_timeout = 10;
+static int idle_timeout = 60;
+static int write_timeout = 30;
+
+/* Master mode (-p workers): master.c forks the workers and passes each
+ * one its listening socket. A worker told to quit (SIGQUIT, on shutdown
+ * or a binary upgrade) stops accepting, closes connections as they go
+ * idle and leaves when none is left, or after this many seconds. */
+#define QUIT_GRACE 5
+
+/* Out of descriptors, the listener is paused until a connection closes,
+ * and tried again after this long anyway: the descriptors may be held by
+ * other reactors or processes, and this one may have none to close. */
+#define ACCEPT_RETRY_MS 100
+
+/* One reactor: a listening socket, the epoll instance watching it and
+ * every connection accepted from it. */
+struct reactor
 {
-  int sfd, s;
+  int id;
+  char *port;
+  int sfd;
   int efd;
-  struct epoll_event event;
-  struct epoll_event *events;
+  pthread_t tid;
+  int nconns;
+  int paused;         /* EPOLLIN dropped from the listener */
+  int resume_below;   /* ask for EPOLLIN again under this many */
+  twheel_t *wheel;    /* every connection's deadline */
+  twheel_timer_t accept_retry;  /* paused for descriptors, on the wheel */
+  time_t quit_at;     /* stopped accepting, leave by then */
+};
 
-  if (argc != 2)
-    {
-      fprintf (stderr, "Usage: %s [port]\n", argv[0]);
-      exit (EXIT_FAILURE);
-    }
+static int
+setup_listener (char *port, int reuseport)
+{
+  int sfd, s;
 
-  sfd = create_and_bind (argv[1]);
+  sfd = create_and_bind (port, reuseport);
   if (sfd == -1)
-    abort ();
+    return -1;
 
   s = make_socket_non_blocking (sfd);
   if (s == -1)
-    abort ();
+    {
+      close (sfd);
+      return -1;
+    }
 
   s = listen (sfd, SOMAXCONN);
   if (s == -1)
     {
       perror ("listen");
-      abort ();
+      close (sfd);
+      return -1;
     }
 
+  return sfd;
+}
+
+static int
+setup_epoll (int sfd)
+{
+  struct epoll_event event;
+  int efd, s;
+
   efd = epoll_create1 (0);
   if (efd == -1)
     {
       perror ("epoll_create");
-      abort ();
+      return -1;
     }
 
-  event.data.fd = sfd;
-  event.events = EPOLLIN | EPOLLET;
+  /* The listening socket is the only entry without a connection, and
+   * the only level triggered one. */
+  event.data.ptr = NULL;
+  event.events = EPOLLIN;
   s = epoll_ctl (efd, EPOLL_CTL_ADD, sfd, &event);
   if (s == -1)
     {
       perror ("epoll_ctl");
-      abort ();
+      close (efd);
+      return -1;
+    }
+
+  return efd;
+}
+
+/* Output that did not fit into the socket buffer is kept here until
+ * EPOLLOUT tells us the peer is reading again. Past OUTBUF_HIGH we stop
+ * reading from the peer, so a client that never reads can only ever cost
+ * us this much memory and never blocks the reactor. */
+#define OUTBUF_HIGH (64 * 1024)
+
+/* Which deadline a connection's timer stands for. */
+#define DEADLINE_NONE   0
+#define DEADLINE_HEADER 1
+#define DEADLINE_IDLE   2
+#define DEADLINE_WRITE  3
+
+/* Per-connection state, hung off epoll_event.data.ptr. */
+struct connection
+{
+  int fd;
+  int want_write;     /* EPOLLOUT is armed */
+  int read_blocked;   /* input left unread because of OUTBUF_HIGH */
+  int closing;        /* close once the pending output is written */
+  int deadline;       /* DEADLINE_* */
+  twheel_timer_t timer;
+  unsigned long served;   /* requests answered */
+  unsigned long written;  /* bytes the kernel took */
+  http_parser_t parser;
+  char *in;           /* received, not yet parsed requests */
+  size_t in_len;
+  char *out;
+  size_t out_off;     /* first byte not yet written */
+  size_t out_len;     /* end of pending output */
+  size_t out_cap;
+  uring_conn_t *u;    /* io_uring mode, which owns the fd and the output */
+};
+
+static struct connection *
+conn_new (int fd)
+{
+  struct connection *c = calloc (1, sizeof *c);
+
+  if (c != NULL)
+    {
+      c->fd = fd;
+      http_parser_init (&c->parser);
+    }
+  return c;
+}
+
+static void
+conn_close (struct connection *c)
+{
+  /* Closing the descriptor will make epoll remove it
+   * from the set of descriptors which are monitored. */
+  close (c->fd);
+  free (c->in);
+  free (c->out);
+  free (c);
+}
+
+static int
+conn_arm (int efd, struct connection *c, int want_write)
+{
+  struct epoll_event event;
+
+  if (c->want_write == want_write)
+    return 0;
+
+  event.data.ptr = c;
+  event.events = EPOLLIN | EPOLLET | (want_write ? EPOLLOUT : 0);
+  if (epoll_ctl (efd, EPOLL_CTL_MOD, c->fd, &event) == -1)
+    {
+      perror ("epoll_ctl");
+      return -1;
+    }
+  c->want_write = want_write;
+  return 0;
+}
+
+/* Queue LEN bytes of BUF behind whatever is already pending. */
+static int
+conn_queue (struct connection *c, const char *buf, size_t len)
+{
+  if (c->out_off == c->out_len)
+    c->out_off = c->out_len = 0;
+
+  if (c->out_len + len > c->out_cap)
+    {
+      size_t pending = c->out_len - c->out_off;
+      size_t cap = c->out_cap ? c->out_cap : 1024;
+      char *p;
+
+      while (cap < pending + len)
+        cap *= 2;
+
+      if (c->out_off > 0 && pending + len <= c->out_cap)
+        {
+          /* Enough room once the written prefix is dropped. */
+          memmove (c->out, c->out + c->out_off, pending);
+        }
+      else
+        {
+          p = malloc (cap);
+          if (p == NULL)
+            return -1;
+          memcpy (p, c->out + c->out_off, pending);
+          free (c->out);
+          c->out = p;
+          c->out_cap = cap;
+        }
+      c->out_off = 0;
+      c->out_len = pending;
+    }
+
+  memcpy (c->out + c->out_len, buf, len);
+  c->out_len += len;
+  return 0;
+}
+
+/* Write as much pending output as the kernel takes. Returns -1 when the
+ * connection is broken, 0 otherwise. */
+static int
+conn_flush (struct connection *c)
+{
+  while (c->out_off < c->out_len)
+    {
+      ssize_t count;
+
+      count = send (c->fd, c->out + c->out_off, c->out_len - c->out_off,
+                    MSG_NOSIGNAL);
+      if (count == -1)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+          if (errno == EINTR)
+            continue;
+          perror ("write");
+          return -1;
+        }
+      c->out_off += count;
+      c->written += count;
+    }
+  return 0;
+}
+
+/* Send the IOVCNT buffers of IOV, queueing whatever the socket does not
+ * take right away. */
+static int
+conn_writev (struct connection *c, struct iovec *iov, int iovcnt)
+{
+  ssize_t count = 0;
+  int i;
+
+  if (iovcnt == 0)
+    return 0;
+
+  if (c->u != NULL)
+    return uring_sendv (c->u, iov, iovcnt);
+
+  if (c->out_off == c->out_len)
+    {
+      do
+        count = writev (c->fd, iov, iovcnt);
+      while (count == -1 && errno == EINTR);
+
+      if (count == -1)
+        {
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+              perror ("writev");
+              return -1;
+            }
+          count = 0;
+        }
+      c->written += count;
+    }
+
+  /* Skip what the kernel took, queue the rest. */
+  for (i = 0; i < iovcnt; i++)
+    {
+      size_t len = iov[i].iov_len;
+
+      if ((size_t) count >= len)
+        {
+          count -= len;
+          continue;
+        }
+      if (conn_queue (c, (char *) iov[i].iov_base + count, len - count) == -1)
+        return -1;
+      count = 0;
+    }
+  return 0;
+}
+
+static int
+conn_pending (struct connection *c)
+{
+  return c->out_len - c->out_off;
+}
+
+/* Answer every complete request in the input buffer, all responses go
+ * out in one writev. */
+static int
+conn_process (struct connection *c)
+{
+  struct iovec iov[IOV_BATCH];
+  int iovcnt = 0;
+  size_t off = 0;
+
+  while (!c->closing)
+    {
+      http_request_t req;
+      http_parse_t r;
+
+      r = http_parser_execute (&c->parser, c->in + off, c->in_len - off, &req);
+      if (r == HTTP_PARSE_AGAIN)
+        break;
+
+      if (r == HTTP_PARSE_ERROR)
+        {
+          iov[iovcnt].iov_base = (void *) reply_bad_request;
+          iov[iovcnt].iov_len = sizeof reply_bad_request - 1;
+          c->closing = 1;
+        }
+      else if (req.keep_alive)
+        {
+          iov[iovcnt].iov_base = (void *) reply_keepalive;
+          iov[iovcnt].iov_len = sizeof reply_keepalive - 1;
+          off += req.total_len;
+          c->served++;
+        }
+      else
+        {
+          iov[iovcnt].iov_base = (void *) reply_close;
+          iov[iovcnt].iov_len = sizeof reply_close - 1;
+          c->closing = 1;
+        }
+
+      if (++iovcnt == IOV_BATCH)
+        {
+          if (conn_writev (c, iov, iovcnt) == -1)
+            return -1;
+          iovcnt = 0;
+        }
+    }
+
+  if (conn_writev (c, iov, iovcnt) == -1)
+    return -1;
+
+  /* Keep the partial request at the front of the buffer. */
+  if (off > 0)
+    {
+      memmove (c->in, c->in + off, c->in_len - off);
+      c->in_len -= off;
+    }
+  return 0;
+}
+
+/* Read whatever data is available and answer it. We must read until
+ * EAGAIN, as we are running in edge-triggered mode and won't get a
+ * notification again for the same data, unless we deliberately leave it
+ * unread because the peer is not taking our replies. Returns -1 when the
+ * connection should be closed. */
+static int
+conn_read (struct connection *c)
+{
+  c->read_blocked = 0;
+
+  if (c->in == NULL && (c->in = malloc (INBUF_SIZE)) == NULL)
+    {
+      perror ("malloc");
+      return -1;
+    }
+
+  while (!c->closing)
+    {
+      ssize_t count;
+
+      if (conn_pending (c) >= OUTBUF_HIGH)
+        {
+          c->read_blocked = 1;
+          return 0;
+        }
+
+      count = read (c->fd, c->in + c->in_len, INBUF_SIZE - c->in_len);
+      if (count == -1)
+        {
+          /* If errno == EAGAIN, that means we have read all
+           * data. So go back to the main loop. */
+          if (errno == EAGAIN)
+            return 0;
+          if (errno == EINTR)
+            continue;
+          perror ("read");
+          return -1;
+        }
+      else if (count == 0)
+        {
+          /* End of file. The remote has closed the
+           * connection. */
+          return -1;
+        }
+
+      c->in_len += count;
+      if (conn_process (c) == -1)
+        return -1;
+    }
+
+  /* Connection: close was answered, hang up once it is written. */
+  return conn_pending (c) > 0 ? 0 : -1;
+}
+
+static void
+listener_pause (struct reactor *r, int resume_below)
+{
+  struct epoll_event event;
+
+  event.data.ptr = NULL;
+  event.events = 0;
+  if (epoll_ctl (r->efd, EPOLL_CTL_MOD, r->sfd, &event) == -1)
+    perror ("epoll_ctl");
+  r->paused = 1;
+  r->resume_below = resume_below;
+}
+
+static void
+listener_resume (struct reactor *r)
+{
+  struct epoll_event event;
+
+  event.data.ptr = NULL;
+  event.events = EPOLLIN;
+  if (epoll_ctl (r->efd, EPOLL_CTL_MOD, r->sfd, &event) == -1)
+    perror ("epoll_ctl");
+  r->paused = 0;
+  twheel_del (r->wheel, &r->accept_retry);
+}
+
+static void
+reactor_close (struct reactor *r, struct connection *c)
+{
+  twheel_del (r->wheel, &c->timer);
+  conn_close (c);
+  r->nconns--;
+  if (r->paused && r->nconns < r->resume_below)
+    listener_resume (r);
+}
+
+/* Arm the timer for deadline KIND, SECS from now. Staying on the same
+ * deadline only restarts it when RESTART is set. */
+static void
+conn_timer (struct reactor *r, struct connection *c, int kind, int secs,
+            int restart)
+{
+  if (secs <= 0)
+    twheel_del (r->wheel, &c->timer);
+  else if (c->deadline != kind || restart)
+    twheel_touch (r->wheel, &c->timer, secs * 1000);
+  c->deadline = kind;
+}
+
+/* After an event: waiting on the peer to read, to finish a request, or
+ * for the next one. SERVED and WROTE tell whether the event answered a
+ * request or got output out. */
+static void
+conn_deadline (struct reactor *r, struct connection *c, int served,
+               int wrote)
+{
+  if (conn_pending (c) > 0)
+    conn_timer (r, c, DEADLINE_WRITE, write_timeout, wrote);
+  else if (c->in_len > 0)
+    conn_timer (r, c, DEADLINE_HEADER, header_timeout, served);
+  else
+    conn_timer (r, c, DEADLINE_IDLE, idle_timeout, 1);
+}
+
+static void
+conn_expired (twheel_timer_t *t, void *arg)
+{
+  struct reactor *r = arg;
+  struct connection *c;
+
+  /* The one timer on the wheel that is not a connection's. */
+  if (t == &r->accept_retry)
+    {
+      if (r->paused)
+        listener_resume (r);
+      return;
+    }
+
+  c = (struct connection *) ((char *) t - offsetof (struct connection, timer));
+  reactor_close (r, c);
+}
+
+/* Take at most accept_budget connections off the backlog. */
+static void
+accept_connections (struct reactor *r)
+{
+  struct epoll_event event;
+  struct connection *c;
+  int budget = accept_budget;
+  int infd;
+
+  while (accept_budget == 0 || budget-- > 0)
+    {
+      if (max_conns > 0 && r->nconns >= max_conns)
+        {
+          listener_pause (r, max_conns - max_conns / 8);
+          return;
+        }
+
+      infd = accept4 (r->sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (infd == -1)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          /* Out of descriptors: the backlog waits until one is closed,
+           * or for the retry when there is none of ours to close. */
+          if (errno == EMFILE || errno == ENFILE)
+            {
+              listener_pause (r, r->nconns);
+              twheel_add (r->wheel, &r->accept_retry, ACCEPT_RETRY_MS);
+            }
+          else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            perror ("accept");
+          return;
+        }
+
+      c = conn_new (infd);
+      if (c == NULL)
+        {
+          perror ("calloc");
+          close (infd);
+          return;
+        }
+
+      event.data.ptr = c;
+      event.events = EPOLLIN | EPOLLET;
+      if (epoll_ctl (r->efd, EPOLL_CTL_ADD, infd, &event) == -1)
+        {
+          perror ("epoll_ctl");
+          conn_close (c);
+          return;
+        }
+      r->nconns++;
+      conn_timer (r, c, DEADLINE_HEADER, header_timeout, 1);
     }
+}
+
+static void
+event_loop (struct reactor *r)
+{
+  struct epoll_event *events;
 
   /* Buffer where events are returned */
-  events = calloc (MAXEVENTS, sizeof event);
+  events = calloc (MAXEVENTS, sizeof *events);
+
+  r->wheel = twheel_create (0, 0, conn_expired, r);
+  if (events == NULL || r->wheel == NULL)
+    {
+      perror ("calloc");
+      abort ();
+    }
 
   /* The event loop */
   while (1)
     {
-      int n, i;
+      int n, i, timeout;
+
+      if (master_quit_requested () && r->quit_at == 0)
+        {
+          /* Leave the backlog to the other workers. */
+          if (epoll_ctl (r->efd, EPOLL_CTL_DEL, r->sfd, NULL) == -1)
+            perror ("epoll_ctl");
+          /* Gone from the set, so reactor_close must not resume it. */
+          r->paused = 0;
+          twheel_del (r->wheel, &r->accept_retry);
+          r->quit_at = time (NULL) + QUIT_GRACE;
+        }
+      if (r->quit_at != 0 && (r->nconns == 0 || time (NULL) >= r->quit_at))
+        break;
+
+      timeout = twheel_timeout (r->wheel);
+      if (r->quit_at != 0 && (timeout < 0 || timeout > 1000))
+        timeout = 1000;
 
-      n = epoll_wait (efd, events, MAXEVENTS, -1);
+      n = epoll_wait (r->efd, events, MAXEVENTS, timeout);
+      twheel_update (r->wheel);
       for (i = 0; i < n; i++)
 	{
-	  if ((events[i].events & EPOLLERR) ||
-              (events[i].events & EPOLLHUP) ||
-              (!(events[i].events & EPOLLIN)))
-	    {
-              /* An error has occured on this fd, or the socket is not
-               * ready for reading (why were we notified then?) */
-	      fprintf (stderr, "epoll error. events=%u\n", events[i].events);
-	      close (events[i].data.fd);
-	      continue;
-	    }
+          struct connection *c = events[i].data.ptr;
 
-	  else if (sfd == events[i].data.fd)
+	  if (c == NULL)
 	    {
               /* We have a notification on the listening socket, which
                * means one or more incoming connections. */
-              while (1)
-                {
-                  struct sockaddr in_addr;
-                  socklen_t in_len;
-                  int infd;
-#if 0
-                  char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
-#endif
-
-                  in_len = sizeof in_addr;
-                  infd = accept (sfd, &in_addr, &in_len);
-                  if (infd == -1)
-                    {
-printf("errno=%d, EAGAIN=%d, EWOULDBLOCK=%d\n", errno, EAGAIN, EWOULDBLOCK);
-                      if ((errno == EAGAIN) ||
-                          (errno == EWOULDBLOCK))
-                        {
-                          /* We have processed all incoming
-                           * connections. */
-                          printf ("processed all incoming connections.\n");
-                          break;
-                        }
-                      else
-                        {
-                          perror ("accept");
-                          break;
-                        }
-                    }
-
-#if 0
-                  s = getnameinfo (&in_addr, in_len,
-                                   hbuf, sizeof hbuf,
-                                   sbuf, sizeof sbuf,
-                                   NI_NUMERICHOST | NI_NUMERICSERV);
-                  if (s == 0)
-                    {
-                      printf("Accepted connection on descriptor %d "
-                             "(host=%s, port=%s)\n", infd, hbuf, sbuf);
-                    }
-#endif
-
-                  /* Make the incoming socket non-blocking and add it to the
-                   * list of fds to monitor. */
-                  s = make_socket_non_blocking (infd);
-                  if (s == -1)
-                    abort ();
-
-                  event.data.fd = infd;
-                  event.events = EPOLLIN | EPOLLET;
-printf("set events %u, infd=%d\n", event.events, infd);
-                  s = epoll_ctl (efd, EPOLL_CTL_ADD, infd, &event);
-                  if (s == -1)
-                    {
-                      perror ("epoll_ctl");
-                      abort ();
-                    }
-                }
-/*              continue; */
+              accept_connections (r);
             }
+	  else if ((events[i].events & EPOLLERR) ||
+                   (events[i].events & EPOLLHUP))
+	    {
+              /* An error has occured on this fd. */
+	      reactor_close (r, c);
+	    }
           else
             {
-              /* We have data on the fd waiting to be read. Read and
-               * display it. We must read whatever data is available
-               * completely, as we are running in edge-triggered mode
-               * and won't get a notification again for the same
-               * data. */
+              unsigned long served = c->served, written = c->written;
               int done = 0;
 
-              while (1)
+              if (events[i].events & EPOLLOUT)
                 {
-                  ssize_t count;
-                  char buf[512];
-
-                  count = read (events[i].data.fd, buf, sizeof buf);
-                  if (count == -1)
-                    {
-                      /* If errno == EAGAIN, that means we have read all
-                       * data. So go back to the main loop. */
-                      if (errno != EAGAIN)
-                        {
-                          perror ("read");
-                          done = 1;
-                        }
-                      break;
-                    }
-                  else if (count == 0)
-                    {
-                      /* End of file. The remote has closed the
-                       * connection. */
-                      done = 1;
-                      break;
-                    }
-
-                  /* Write the reply to connection */
-                  s = write (events[i].data.fd, reply, sizeof(reply));
-                  if (s == -1)
-                    {
-                      perror ("write");
-                      abort ();
-                    }
-                }
+                  done = conn_flush (c) == -1;
 
-              if (done)
-                {
-                  printf ("Closed connection on descriptor %d\n",
-                          events[i].data.fd);
+                  if (!done && c->closing)
+                    done = conn_pending (c) == 0;
 
-                  /* Closing the descriptor will make epoll remove it
-                   * from the set of descriptors which are monitored. */
-                  close (events[i].data.fd);
+                  /* The peer drained its replies, pick up the requests
+                   * we left in the socket for it. */
+                  if (!done && c->read_blocked &&
+                      conn_pending (c) < OUTBUF_HIGH)
+                    done = conn_read (c) == -1;
                 }
+
+              if (!done && (events[i].events & EPOLLIN))
+                done = conn_read (c) == -1;
+
+              /* Only ask for EPOLLOUT while something is pending. */
+              if (!done)
+                done = conn_arm (r->efd, c, conn_pending (c) > 0) == -1;
+
+              /* Quitting: a connection goes once its replies are out. */
+              if (!done && r->quit_at != 0)
+                done = conn_pending (c) == 0 && c->in_len == 0;
+
+              if (done)
+                reactor_close (r, c);
+              else
+                conn_deadline (r, c, c->served != served,
+                               c->written != written);
             }
         }
+
+      /* After the batch, so no connection of it is freed under it. */
+      twheel_run (r->wheel);
     }
 
+  twheel_destroy (r->wheel);
   free (events);
+}
+
+/* The io_uring loop: uring.c accepts, receives and sends, we only parse
+ * what arrives and queue the replies with conn_process. */
+static int
+uring_open (uring_conn_t *u)
+{
+  struct connection *c = conn_new (u->fd);
+
+  if (c == NULL)
+    return -1;
+  c->u = u;
+  u->data = c;
+  return 0;
+}
+
+static int
+uring_data (uring_conn_t *u, const char *buf, size_t len)
+{
+  struct connection *c = u->data;
+
+  if (c->in == NULL && (c->in = malloc (INBUF_SIZE)) == NULL)
+    {
+      perror ("malloc");
+      return -1;
+    }
+
+  /* Same as a read into a full buffer in conn_read. */
+  if (len > INBUF_SIZE - c->in_len)
+    return -1;
+
+  memcpy (c->in + c->in_len, buf, len);
+  c->in_len += len;
+  if (conn_process (c) == -1)
+    return -1;
+
+  if (c->closing)
+    uring_close (u);
+  return 0;
+}
+
+static void
+uring_closed (uring_conn_t *u)
+{
+  struct connection *c = u->data;
+
+  free (c->in);
+  free (c);
+}
+
+/* Master mode: on SIGQUIT (a graceful stop or an upgrade) leave the
+ * backlog to the other workers and drain, as event_loop does. */
+static void
+uring_wake (uring_loop_t *loop)
+{
+  if (master_quit_requested ())
+    uring_drain (loop, QUIT_GRACE * 1000);
+}
+
+static void
+uring_event_loop (int sfd)
+{
+  static const uring_ops_t ops = { uring_open, uring_data, uring_closed };
+  uring_loop_t *loop;
+
+  loop = uring_create (sfd, &ops, 0, 0);
+  if (loop == NULL)
+    {
+      perror ("io_uring");
+      abort ();
+    }
+  uring_set_wake (loop, uring_wake);
+
+  if (uring_run (loop) == -1)
+    perror ("io_uring_enter");
+
+  uring_destroy (loop);
+}
+
+/* Pin the calling reactor thread to one core, wrapping around when there
+ * are more reactors than online CPUs. */
+static void
+pin_to_cpu (int id)
+{
+  cpu_set_t mask;
+  int ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (ncpu < 1)
+    return;
+
+  CPU_ZERO (&mask);
+  CPU_SET (id % ncpu, &mask);
+  if (pthread_setaffinity_np (pthread_self (), sizeof mask, &mask) != 0)
+    fprintf (stderr, "reactor %d: could not set cpu affinity\n", id);
+}
+
+static void *
+reactor_main (void *arg)
+{
+  struct reactor *r = arg;
+
+  pin_to_cpu (r->id);
+
+  r->sfd = setup_listener (r->port, 1);
+  if (r->sfd == -1)
+    abort ();
+
+  if (use_uring)
+    {
+      uring_event_loop (r->sfd);
+      close (r->sfd);
+      return NULL;
+    }
+
+  r->efd = setup_epoll (r->sfd);
+  if (r->efd == -1)
+    abort ();
+
+  event_loop (r);
+
+  close (r->efd);
+  close (r->sfd);
+  return NULL;
+}
+
+/* A worker process of master mode: the classic loop on the socket the
+ * master hands over. */
+static int
+worker_main (int id, int sfd)
+{
+  struct reactor r;
+
+  memset (&r, 0, sizeof r);
+  r.id = id;
+  r.sfd = sfd;
+
+  if (use_uring)
+    {
+      uring_event_loop (sfd);
+      return EXIT_SUCCESS;
+    }
+
+  r.efd = setup_epoll (sfd);
+  if (r.efd == -1)
+    return EXIT_FAILURE;
+
+  event_loop (&r);
+
+  close (r.efd);
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct reactor classic;
+  int i, ch, nreactors = 0;
+  struct reactor *reactors;
+  master_conf_t master;
+  int use_master = 0;
+  char *port;
+
+  memset (&master, 0, sizeof master);
+  master.worker = worker_main;
+
+  while ((ch = getopt (argc, argv, "ua:m:h:i:w:p:RdNI:")) != -1)
+    {
+      switch (ch)
+        {
+        case 'u':
+          use_uring = 1;
+          break;
+        case 'p':
+          use_master = 1;
+          master.workers = atoi (optarg);
+          break;
+        case 'R':
+          master.reuseport = 1;
+          break;
+        case 'd':
+          master.daemon = 1;
+          break;
+        case 'N':
+          master.numa = 1;
+          break;
+        case 'I':
+          master.numa = 1;
+          master.irq_if = optarg;
+          break;
+        case 'a':
+          accept_budget = atoi (optarg);
+          break;
+        case 'm':
+          max_conns = atoi (optarg);
+          break;
+        case 'h':
+          header_timeout = atoi (optarg);
+          break;
+        case 'i':
+          idle_timeout = atoi (optarg);
+          break;
+        case 'w':
+          write_timeout = atoi (optarg);
+          break;
+        default:
+          optind = argc + 1;
+          break;
+        }
+    }
+
+  if (argc - optind != 1 && argc - optind != 2)
+    {
+      fprintf (stderr, "Usage: %s [-u] [-a accept_budget] [-m max_connections] "
+               "[-h header_s] [-i idle_s] [-w write_s] "
+               "[-p workers [-R] [-d] [-N] [-I nic]] port [reactors]\n",
+               argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  port = argv[optind];
+
+  if (use_master)
+    {
+      /* Master mode: -p 0 runs a worker per online CPU, -R gives each
+       * one its own SO_REUSEPORT socket, -d detaches, -N spreads them
+       * over the NUMA nodes and -I also moves the NIC's interrupts. */
+      master.port = port;
+      return master_run (argc, argv, &master) == 0 ? EXIT_SUCCESS
+                                                    : EXIT_FAILURE;
+    }
+
+  if (argc - optind == 2)
+    nreactors = atoi (argv[optind + 1]);
+
+  if (nreactors <= 0)
+    {
+      /* Classic mode: a single epoll loop on the main thread. */
+      memset (&classic, 0, sizeof classic);
+      classic.port = port;
+      classic.sfd = setup_listener (port, 0);
+      if (classic.sfd == -1)
+        abort ();
+
+      if (use_uring)
+        {
+          uring_event_loop (classic.sfd);
+          close (classic.sfd);
+          return EXIT_SUCCESS;
+        }
+
+      classic.efd = setup_epoll (classic.sfd);
+      if (classic.efd == -1)
+        abort ();
+
+      event_loop (&classic);
+
+      close (classic.efd);
+      close (classic.sfd);
+      return EXIT_SUCCESS;
+    }
+
+  /* Multi-reactor mode: every thread owns an SO_REUSEPORT listener and
+   * an epoll instance, nothing is shared between them. */
+  reactors = calloc (nreactors, sizeof *reactors);
+  if (reactors == NULL)
+    {
+      perror ("calloc");
+      abort ();
+    }
+
+  for (i = 0; i < nreactors; i++)
+    {
+      reactors[i].id = i;
+      reactors[i].port = port;
+      if (pthread_create (&reactors[i].tid, NULL, reactor_main, &reactors[i]) != 0)
+        {
+          fprintf (stderr, "Could not start reactor %d\n", i);
+          abort ();
+        }
+    }
+
+  for (i = 0; i < nreactors; i++)
+    pthread_join (reactors[i].tid, NULL);
 
-  close (sfd);
+  free (reactors);
 
   return EXIT_SUCCESS;
 }
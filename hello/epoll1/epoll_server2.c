@@ -13,8 +13,155 @@
 #include <strings.h>    
 #include <fcntl.h>    
 #include <errno.h>     
+#include <sys/uio.h>    
+#include "http_parser.h"    
+#include "uring.h"    
 #define MAX_EVENTS 10    
 #define PORT 823   
+#define IOV_BATCH 64    
+    
+static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nHello World";    
+static const char response_close[] = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 11\r\n\r\nHello World";    
+    
+//每个连接的状态, 放在 epoll_event.data.ptr 里    
+struct conn {    
+    int fd;    
+    http_parser_t parser;    
+    char in[HTTP_MAX_HEAD + HTTP_MAX_BODY];    
+    int in_len;    
+    int nresp;      //还没发完的响应数 (pipelining)    
+    int sent;       //第一个响应已经发出的字节数    
+    int closing;    //发完之后关闭连接    
+    unsigned int events;  //当前注册的事件    
+};    
+    
+static void conn_close(struct conn *c) {    
+    close(c->fd);    
+    free(c);    
+}    
+    
+//解析缓冲区里所有完整的请求, 每个请求欠一个响应    
+static void conn_parse(struct conn *c) {    
+    http_request_t req;    
+    http_parse_t r;    
+    int off = 0;    
+    
+    while (!c->closing) {    
+        r = http_parser_execute(&c->parser, c->in + off, c->in_len - off, &req);    
+        if (r == HTTP_PARSE_AGAIN)    
+            break;    
+        if (r == HTTP_PARSE_ERROR) {    
+            c->closing = 1;    
+            break;    
+        }    
+        off += req.total_len;    
+        c->nresp++;    
+        if (!req.keep_alive)    
+            c->closing = 1;    
+    }    
+    memmove(c->in, c->in + off, c->in_len - off);    
+    c->in_len -= off;    
+}    
+    
+//欠下的响应 (最多 IOV_BATCH 个) 填进 iov, 返回个数    
+static int conn_iov(struct conn *c, struct iovec *iov) {    
+    int k, cnt;    
+    
+    cnt = c->nresp < IOV_BATCH ? c->nresp : IOV_BATCH;    
+    for (k = 0; k < cnt; k++) {    
+        if (c->closing && k == c->nresp - 1) {    
+            iov[k].iov_base = (void *)response_close;    
+            iov[k].iov_len = sizeof(response_close) - 1;    
+        } else {    
+            iov[k].iov_base = (void *)response;    
+            iov[k].iov_len = sizeof(response) - 1;    
+        }    
+    }    
+    return cnt;    
+}    
+    
+//所有欠下的响应用一次 writev 发出, 返回 -1 表示连接出错    
+static int conn_flush(struct conn *c) {    
+    struct iovec iov[IOV_BATCH];    
+    int k, cnt, nwrite;    
+    
+    while (c->nresp > 0) {    
+        cnt = conn_iov(c, iov);    
+        iov[0].iov_base = (char *)iov[0].iov_base + c->sent;    
+        iov[0].iov_len -= c->sent;    
+    
+        nwrite = writev(c->fd, iov, cnt);    
+        if (nwrite == -1) {    
+            if (errno == EAGAIN)    
+                return 0;    
+            perror("write error");    
+            return -1;    
+        }    
+        for (k = 0; k < cnt && nwrite >= (int)iov[k].iov_len; k++) {    
+            nwrite -= iov[k].iov_len;    
+            c->nresp--;    
+            c->sent = 0;    
+        }    
+        if (k < cnt) {    
+            c->sent += nwrite;    
+            return 0;    
+        }    
+    }    
+    return 0;    
+}    
+//io_uring 模式 (-u): accept/recv/send 都由 uring.c 批量提交, 这里只解析请求, 排队响应    
+static int uring_open(uring_conn_t *u) {    
+    struct conn *c = calloc(1, sizeof(struct conn));    
+    
+    if (c == NULL)    
+        return -1;    
+    c->fd = u->fd;    
+    http_parser_init(&c->parser);    
+    u->data = c;    
+    return 0;    
+}    
+    
+static int uring_data(uring_conn_t *u, const char *buf, size_t len) {    
+    struct conn *c = u->data;    
+    struct iovec iov[IOV_BATCH];    
+    int cnt;    
+    
+    if (len > sizeof(c->in) - c->in_len)    
+        return -1;    
+    memcpy(c->in + c->in_len, buf, len);    
+    c->in_len += len;    
+    conn_parse(c);    
+    while (c->nresp > 0) {    
+        cnt = conn_iov(c, iov);    
+        if (uring_sendv(u, iov, cnt) == -1)    
+            return -1;    
+        c->nresp -= cnt;    
+    }    
+    if (c->closing)    
+        uring_close(u);    
+    return 0;    
+}    
+    
+static void uring_closed(uring_conn_t *u) {    
+    free(u->data);    
+}    
+    
+static int uring_main(int listenfd) {    
+    static const uring_ops_t ops = { uring_open, uring_data, uring_closed };    
+    uring_loop_t *loop;    
+    
+    loop = uring_create(listenfd, &ops, 0, 0);    
+    if (loop == NULL) {    
+        perror("io_uring");    
+        exit(EXIT_FAILURE);    
+    }    
+    if (uring_run(loop) == -1)    
+        perror("io_uring_enter");    
+    uring_destroy(loop);    
+    close(listenfd);    
+    return 0;    
+}    
+    
 //设置socket连接为非阻塞模式    
 void setnonblocking(int sockfd) {    
     int opts;    
@@ -31,11 +178,12 @@ void setnonblocking(int sockfd) {
     }    
 }    
     
-int main(){    
+int main(int argc, char *argv[]){    
     struct epoll_event ev, events[MAX_EVENTS];    
-    int addrlen, listenfd, conn_sock, nfds, epfd, fd, i, nread, n;    
+    int listenfd, conn_sock, nfds, epfd, i, nread, on;    
+    socklen_t addrlen;    
     struct sockaddr_in local, remote;    
-    char buf[BUFSIZ];    
+    struct conn *c;    
     
     //创建listen socket    
     if( (listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {    
@@ -43,6 +191,9 @@ int main(){
         exit(1);    
     }    
     setnonblocking(listenfd);    
+    //端口固定, 重启时不要被上一次的连接挡住 bind    
+    on = 1;    
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));    
     bzero(&local, sizeof(local));    
     local.sin_family = AF_INET;    
     local.sin_addr.s_addr = htonl(INADDR_ANY);;    
@@ -53,13 +204,17 @@ int main(){
     }    
     listen(listenfd, 20);    
     
+    //-u: 用 io_uring 代替 epoll    
+    if (argc > 1 && strcmp(argv[1], "-u") == 0)    
+        return uring_main(listenfd);    
+    
     epfd = epoll_create(MAX_EVENTS);    
     if (epfd == -1) {    
         perror("epoll_create");    
         exit(EXIT_FAILURE);    
     }      
     ev.events = EPOLLIN;    
-    ev.data.fd = listenfd;    
+    ev.data.ptr = NULL;  //只有 listen socket 没有 struct conn    
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) == -1) {    
         perror("epoll_ctl: listen_sock");    
         exit(EXIT_FAILURE);    
@@ -73,12 +228,18 @@ int main(){
         }    
     
         for (i = 0; i < nfds; ++i) {    
-            fd = events[i].data.fd;    
-            if (fd == listenfd) {    
-                while ((conn_sock = accept(listenfd,(struct sockaddr *) &remote,(size_t *)&addrlen)) > 0) {    
+            if (events[i].data.ptr == NULL) {    
+                while ((addrlen = sizeof(remote), conn_sock = accept(listenfd,(struct sockaddr *) &remote, &addrlen)) > 0) {    
                     setnonblocking(conn_sock); //设置连接socket为非阻塞   
-                    ev.events = EPOLLIN | EPOLLET; //边沿触发要求套接字为非阻塞模式；水平触发可以是阻塞或非阻塞模式   
-                    ev.data.fd = conn_sock;    
+                    c = calloc(1, sizeof(struct conn));    
+                    if (c == NULL) {    
+                        close(conn_sock);    
+                        continue;    
+                    }    
+                    c->fd = conn_sock;    
+                    http_parser_init(&c->parser);    
+                    c->events = ev.events = EPOLLIN | EPOLLET; //边沿触发要求套接字为非阻塞模式；水平触发可以是阻塞或非阻塞模式   
+                    ev.data.ptr = c;    
                     if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn_sock,&ev) == -1) {    
                         perror("epoll_ctl: add");    
                         exit(EXIT_FAILURE);    
@@ -90,35 +251,38 @@ int main(){
                 }    
                 continue;    
             }      
+            c = events[i].data.ptr;    
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {    
+                conn_close(c);    
+                continue;    
+            }    
             if (events[i].events & EPOLLIN) {    
-                n = 0;    
-                while ((nread = read(fd, buf + n, BUFSIZ-1)) > 0) {    
-                    n += nread;    
+                nread = 0;    
+                while (!c->closing && (nread = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len)) > 0) {    
+                    c->in_len += nread;    
+                    conn_parse(c);    
+                }    
+                if (nread == 0 && !c->closing) {    
+                    conn_close(c);  //对端关闭    
+                    continue;    
                 }    
                 if (nread == -1 && errno != EAGAIN) {    
                     perror("read error");    
-                }    
-                ev.data.fd = fd;    
-                ev.events = events[i].events | EPOLLOUT;    
-                if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {    
-                    perror("epoll_ctl: mod");    
+                    conn_close(c);    
+                    continue;    
                 }    
             }    
-            if (events[i].events & EPOLLOUT) {    
-                sprintf(buf, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\nHello World", 11);    
-                int nwrite, data_size = strlen(buf);    
-                n = data_size;    
-                while (n > 0) {    
-                    nwrite = write(fd, buf + data_size - n, n);    
-                    if (nwrite < n) {    
-                        if (nwrite == -1 && errno != EAGAIN) {    
-                            perror("write error");    
-                        }    
-                        break;    
-                    }    
-                    n -= nwrite;    
-                }    
-                close(fd);    
+            //一次 writev 发出所有 pipelined 请求的响应, 写不完再等 EPOLLOUT    
+            if (conn_flush(c) == -1 || (c->closing && c->nresp == 0)) {    
+                conn_close(c);    
+                continue;    
+            }    
+            ev.data.ptr = c;    
+            ev.events = EPOLLIN | EPOLLET | (c->nresp > 0 ? EPOLLOUT : 0);    
+            if (ev.events != c->events) {    
+                if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1)    
+                    perror("epoll_ctl: mod");    
+                c->events = ev.events;    
             }    
         }    
     } 
@@ -0,0 +1,196 @@
+/* fakedns.c
+ * a stub DNS server for testing the resolver in dns.c: answers every A
+ * query with an address derived from the name (or the one given with
+ * -a), after -l milliseconds, and can answer NXDOMAIN or stay silent for
+ * a given percentage of the names.
+ * build with : gcc -O2 -Wall -o fakedns fakedns.c se.c
+ * run with   : ./fakedns -l 2 -x 5 -d 1 5353
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "se.h"
+
+struct reply
+{
+   se_timer_t timer;
+   struct sockaddr_in peer;
+   int len;
+   unsigned char pkt[];
+};
+
+static struct config
+{
+   int port;
+   int latency;          // ms before answering
+   int nxdomain;         // percent of names answered NXDOMAIN
+   int drop;             // percent of queries never answered
+   int ttl;
+   struct in_addr fixed; // answer with this address when set
+} cfg;
+
+static se_loop_t *loop;
+static int sock;
+static long long queries, answers;
+
+static uint32_t hash_name(const unsigned char *p, int len)
+{
+   uint32_t h = 2166136261u;
+   int i;
+
+   for (i = 0; i < len; i++)
+   {
+      h ^= p[i] | 0x20;
+      h *= 16777619u;
+   }
+   return h;
+}
+
+static void send_reply(se_timer_t *timer)
+{
+   struct reply *r = timer->data;
+
+   sendto(sock, r->pkt, r->len, 0, (struct sockaddr *)&r->peer, sizeof(r->peer));
+   answers++;
+   free(r);
+}
+
+/* turn the query in buf into its answer, returns the length or -1 */
+static int build_reply(unsigned char *buf, int len, int size)
+{
+   int off = 12, qend;
+   uint32_t h, addr;
+
+   if (len < 12 || (buf[2] & 0x80) || buf[5] != 1 || buf[4] != 0)
+      return -1;
+   while (off < len && buf[off] != 0)
+      off += buf[off] + 1;
+   qend = off + 5;
+   if (qend > len || qend + 16 > size)
+      return -1;
+   h = hash_name(buf + 12, off - 12);
+   if ((int)(h % 100) < cfg.drop)
+      return 0;
+
+   buf[2] = 0x81;        // QR, RD
+   buf[3] = 0x80;        // RA
+   buf[6] = buf[7] = 0;  // ANCOUNT
+   memset(buf + 8, 0, 4);
+   if ((int)(h / 100 % 100) < cfg.nxdomain)
+   {
+      buf[3] |= 3;
+      return qend;
+   }
+
+   buf[7] = 1;
+   len = qend;
+   buf[len++] = 0xc0; buf[len++] = 12;      // name: pointer to the question
+   buf[len++] = 0; buf[len++] = 1;          // A
+   buf[len++] = 0; buf[len++] = 1;          // IN
+   buf[len++] = cfg.ttl >> 24; buf[len++] = cfg.ttl >> 16;
+   buf[len++] = cfg.ttl >> 8; buf[len++] = cfg.ttl;
+   buf[len++] = 0; buf[len++] = 4;
+   addr = cfg.fixed.s_addr ? cfg.fixed.s_addr : htonl(0x0a000000 | (h & 0xffffff));
+   memcpy(buf + len, &addr, 4);
+   return len + 4;
+}
+
+static int on_query(se_ptr_t *ptr)
+{
+   unsigned char buf[1024];
+   struct sockaddr_in peer;
+   socklen_t plen;
+   int n;
+
+   for (;;)
+   {
+      plen = sizeof(peer);
+      n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&peer, &plen);
+      if (n < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      queries++;
+      if ((n = build_reply(buf, n, sizeof(buf))) <= 0)
+         continue;
+      if (cfg.latency == 0)
+      {
+         sendto(sock, buf, n, 0, (struct sockaddr *)&peer, plen);
+         answers++;
+         continue;
+      }
+
+      struct reply *r = malloc(sizeof(struct reply) + n);
+
+      if (r == NULL)
+         continue;
+      r->peer = peer;
+      r->len = n;
+      memcpy(r->pkt, buf, n);
+      r->timer.next = NULL;
+      se_timer_add(loop, &r->timer, cfg.latency, send_reply, r);
+   }
+   se_be_read(ptr, on_query);
+   return 0;
+}
+
+static void report(se_timer_t *timer)
+{
+   fprintf(stderr, "queries %lld answers %lld\n", queries, answers);
+   se_timer_add(loop, timer, 1000, report, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+   struct sockaddr_in addr;
+   se_timer_t tick = {0};
+   int ch, size = 4 << 20;
+
+   cfg.port = 5353;
+   cfg.ttl = 300;
+   while ((ch = getopt(argc, argv, "a:l:x:d:t:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 'a': inet_aton(optarg, &cfg.fixed); break;
+         case 'l': cfg.latency = atoi(optarg); break;
+         case 'x': cfg.nxdomain = atoi(optarg); break;
+         case 'd': cfg.drop = atoi(optarg); break;
+         case 't': cfg.ttl = atoi(optarg); break;
+         default:
+            printf("fakedns [-a ip] [-l latency ms] [-x nxdomain %%] [-d drop %%] [-t ttl] [port]\n");
+            exit(1);
+      }
+   }
+   if (optind < argc)
+      cfg.port = atoi(argv[optind]);
+
+   sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+   setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+   setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(cfg.port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+   {
+      perror("bind");
+      exit(1);
+   }
+
+   loop = se_create(64);
+   se_be_read(se_add(loop, sock, NULL), on_query);
+   se_timer_add(loop, &tick, 1000, report, NULL);
+   se_loop(loop, -1);
+   return 0;
+}
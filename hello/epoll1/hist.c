@@ -0,0 +1,155 @@
+#include <string.h>
+
+#include "hist.h"
+
+#define HALF (HIST_SUB / 2)
+
+static int value_index(uint64_t v)
+{
+    int shift;
+
+    if (v < HIST_SUB)
+        return (int)v;
+    /* keep the top HIST_SUB_BITS bits, their first one is always set */
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+    return (shift + 1) * HALF + (int)(v >> shift) - HALF;
+}
+
+/* lowest and highest value that land in bucket i */
+static uint64_t index_low(int i)
+{
+    int shift;
+
+    if (i < HIST_SUB)
+        return i;
+    shift = i / HALF - 1;
+    return (uint64_t)(i - shift * HALF) << shift;
+}
+
+static uint64_t index_high(int i)
+{
+    return i + 1 < HIST_BUCKETS ? index_low(i + 1) - 1 : UINT64_MAX;
+}
+
+void hist_init(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+void hist_record(hist_t *h, uint64_t value)
+{
+    int i = value_index(value);
+
+    STORE(h->counts[i], h->counts[i] + 1);
+    STORE(h->total, h->total + 1);
+    STORE(h->sum, h->sum + value);
+    if (value < h->min)
+        STORE(h->min, value);
+    if (value > h->max)
+        STORE(h->max, value);
+}
+
+void hist_copy(hist_t *dst, const hist_t *src)
+{
+    int i;
+
+    dst->total = 0;
+    dst->sum = LOAD(src->sum);
+    dst->min = LOAD(src->min);
+    dst->max = LOAD(src->max);
+    /* the writer keeps going: the total is whatever the buckets hold */
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] = LOAD(src->counts[i]);
+        dst->total += dst->counts[i];
+    }
+}
+
+void hist_add(hist_t *dst, const hist_t *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+void hist_sub(hist_t *dst, const hist_t *a, const hist_t *b)
+{
+    int i, lo = -1, hi = -1;
+
+    dst->total = 0;
+    dst->sum = a->sum - b->sum;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] = a->counts[i] - b->counts[i];
+        dst->total += dst->counts[i];
+        if (dst->counts[i]) {
+            if (lo < 0)
+                lo = i;
+            hi = i;
+        }
+    }
+    dst->min = lo < 0 ? UINT64_MAX : index_low(lo);
+    dst->max = hi < 0 ? 0 : index_high(hi);
+    if (hi >= 0 && dst->max > a->max)
+        dst->max = a->max;
+}
+
+uint64_t hist_percentile(const hist_t *h, double p)
+{
+    uint64_t want, seen = 0;
+    int i;
+
+    if (h->total == 0)
+        return 0;
+    want = (uint64_t)(p / 100 * h->total + 0.5);
+    if (want < 1)
+        want = 1;
+    if (want > h->total)
+        want = h->total;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want)
+            return index_high(i) < h->max ? index_high(i) : h->max;
+    }
+    return h->max;
+}
+
+void hist_print(const hist_t *h, FILE *out, double scale)
+{
+    double p, step;
+    int level, tick;
+
+    fprintf(out, "%14s %12s %12s %18s\n", "Value", "Percentile",
+            "TotalCount", "1/(1-Percentile)");
+    if (h->total == 0)
+        return;
+    for (level = 0; level < 20; level++) {
+        step = 100.0 / (2 << level) / 5;
+        for (tick = 0; tick < 5; tick++) {
+            uint64_t v;
+
+            p = 100.0 - 100.0 / (1 << level) + tick * step;
+            v = hist_percentile(h, p);
+            fprintf(out, "%14.3f %12.6f %12llu %18.2f\n", v / scale, p / 100,
+                    (unsigned long long)(p / 100 * h->total + 0.5),
+                    1 / (1 - p / 100));
+            if (v >= h->max)
+                goto done;
+        }
+    }
+done:
+    fprintf(out, "%14.3f %12.6f %12llu %18s\n", h->max / scale, 1.0,
+            (unsigned long long)h->total, "inf");
+    fprintf(out, "#[Mean = %.3f, Min = %.3f, Max = %.3f, Total count = %llu]\n",
+            (double)h->sum / h->total / scale, h->min / scale, h->max / scale,
+            (unsigned long long)h->total);
+}
@@ -0,0 +1,54 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * hist: log-linear latency histogram in the spirit of HdrHistogram.
+ *
+ * Every power of two is split into HIST_SUB / 2 linear buckets, so any
+ * recorded value is known to within 1 / (HIST_SUB / 2) (0.8%) over the
+ * whole 64-bit range, in a fixed array with no allocation.
+ *
+ * A histogram has a single writer: hist_record bumps the counts with
+ * relaxed atomic stores, no locked instructions. Any thread may take a
+ * consistent-enough copy at any time with hist_copy; two copies taken a
+ * second apart and subtracted with hist_sub give the distribution of
+ * that second.
+ */
+
+#define HIST_SUB_BITS  8
+#define HIST_SUB       (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS   ((64 - HIST_SUB_BITS + 1) * (HIST_SUB / 2) + HIST_SUB / 2)
+
+typedef struct hist_s {
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;               /* exact, UINT64_MAX when empty */
+    uint64_t max;               /* exact */
+    uint64_t counts[HIST_BUCKETS];
+} hist_t;
+
+void hist_init(hist_t *h);
+
+/* single writer per histogram */
+void hist_record(hist_t *h, uint64_t value);
+
+/* readers, from any thread */
+void hist_copy(hist_t *dst, const hist_t *src);
+void hist_add(hist_t *dst, const hist_t *src);
+
+/* dst = a - b, b an older copy of a; min and max become bucket bounds */
+void hist_sub(hist_t *dst, const hist_t *a, const hist_t *b);
+
+/* highest value of the bucket holding the p-th percentile (0..100) */
+uint64_t hist_percentile(const hist_t *h, double p);
+
+/*
+ * Percentile distribution, five lines per halving of the remaining
+ * distance to 100%, values divided by scale (1000 prints ns as us).
+ */
+void hist_print(const hist_t *h, FILE *out, double scale);
+
+#endif    /* HIST_H */
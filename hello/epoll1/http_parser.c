@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+
+#include "http_parser.h"
+
+void http_parser_init(http_parser_t *parser)
+{
+    parser->scanned = 0;
+    parser->head_len = 0;
+}
+
+/* Case-insensitive match of a header name, `name' includes the colon */
+static int header_is(const char *line, size_t len, const char *name)
+{
+    size_t n = strlen(name);
+
+    return len >= n && strncasecmp(line, name, n) == 0;
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+/* Does the comma separated header value contain `token'? */
+static int has_token(const char *p, const char *end, const char *token)
+{
+    size_t n = strlen(token);
+
+    while (p < end) {
+        const char *comma = memchr(p, ',', end - p);
+        const char *e = comma ? comma : end;
+
+        p = skip_space(p, e);
+        while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+            e--;
+        if ((size_t)(e - p) == n && strncasecmp(p, token, n) == 0)
+            return 1;
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+static http_parse_t parse_head(const char *buf, size_t head_len,
+                               http_request_t *req)
+{
+    const char *p = buf, *end = buf + head_len;
+    const char *eol, *sp;
+    int conn_close = 0, conn_keep = 0;
+
+    /* Request line: METHOD SP PATH SP HTTP/1.x CRLF */
+    eol = memchr(p, '\r', end - p);
+    if (eol[1] != '\n')
+        return HTTP_PARSE_ERROR;
+    if ((sp = memchr(p, ' ', eol - p)) == NULL || sp == p)
+        return HTTP_PARSE_ERROR;
+    req->method = p;
+    req->method_len = sp - p;
+
+    p = sp + 1;
+    if ((sp = memchr(p, ' ', eol - p)) == NULL || sp == p)
+        return HTTP_PARSE_ERROR;
+    req->path = p;
+    req->path_len = sp - p;
+
+    p = sp + 1;
+    if (eol - p != 8 || memcmp(p, "HTTP/1.", 7) != 0 ||
+        p[7] < '0' || p[7] > '9')
+        return HTTP_PARSE_ERROR;
+    req->minor = p[7] - '0';
+    req->content_length = 0;
+
+    /* Headers, up to the empty line */
+    for (p = eol + 2; p < end - 2; p = eol + 2) {
+        size_t len;
+
+        eol = memchr(p, '\r', end - p);
+        if (eol[1] != '\n')
+            return HTTP_PARSE_ERROR;
+        len = eol - p;
+
+        if (header_is(p, len, "Connection:")) {
+            const char *v = p + sizeof("Connection:") - 1;
+
+            conn_close |= has_token(v, eol, "close");
+            conn_keep |= has_token(v, eol, "keep-alive");
+        } else if (header_is(p, len, "Content-Length:")) {
+            const char *v = skip_space(p + sizeof("Content-Length:") - 1, eol);
+            size_t n = 0;
+
+            if (v == eol)
+                return HTTP_PARSE_ERROR;
+            for (; v < eol && *v >= '0' && *v <= '9'; v++) {
+                n = n * 10 + (*v - '0');
+                if (n > HTTP_MAX_BODY)
+                    return HTTP_PARSE_ERROR;
+            }
+            if (skip_space(v, eol) != eol)
+                return HTTP_PARSE_ERROR;
+            req->content_length = n;
+        } else if (header_is(p, len, "Transfer-Encoding:")) {
+            /* Chunked request bodies are not supported */
+            return HTTP_PARSE_ERROR;
+        }
+    }
+
+    /* HTTP/1.1 defaults to persistent connections, HTTP/1.0 does not */
+    if (req->minor >= 1)
+        req->keep_alive = !conn_close;
+    else
+        req->keep_alive = conn_keep && !conn_close;
+
+    req->head_len = head_len;
+    req->total_len = head_len + req->content_length;
+    return HTTP_PARSE_OK;
+}
+
+http_parse_t http_parser_execute(http_parser_t *parser, const char *buf,
+                                 size_t len, http_request_t *req)
+{
+    http_parse_t ret;
+
+    if (parser->head_len == 0) {
+        size_t from;
+        const char *end;
+
+        /* Restart the search a few bytes back, the terminator may
+         * straddle two reads */
+        from = parser->scanned > 3 ? parser->scanned - 3 : 0;
+        end = memmem(buf + from, len - from, "\r\n\r\n", 4);
+        if (end == NULL) {
+            parser->scanned = len;
+            return len >= HTTP_MAX_HEAD ? HTTP_PARSE_ERROR : HTTP_PARSE_AGAIN;
+        }
+        if (end + 4 - buf > HTTP_MAX_HEAD)
+            return HTTP_PARSE_ERROR;
+        parser->head_len = end + 4 - buf;
+    }
+
+    ret = parse_head(buf, parser->head_len, req);
+    if (ret != HTTP_PARSE_OK)
+        return ret;
+
+    /* The body must be in the buffer as well; it is simply skipped */
+    if (len < req->total_len)
+        return HTTP_PARSE_AGAIN;
+
+    http_parser_init(parser);
+    return HTTP_PARSE_OK;
+}
@@ -0,0 +1,52 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>    /* for size_t type */
+
+/*
+ * Incremental HTTP/1.x request parser shared by the epoll servers.
+ *
+ * Feed it the unconsumed part of a connection's input buffer every time
+ * more data arrives. It remembers how far it already looked for the end
+ * of the request head, so a request trickling in byte by byte is still
+ * scanned only once. Nothing is copied: the fields of http_request_t
+ * point into the caller's buffer and stay valid until it is modified.
+ */
+
+#define HTTP_MAX_HEAD 8192    /* larger request heads are rejected */
+#define HTTP_MAX_BODY 8192    /* and so are larger request bodies */
+
+typedef enum {
+    HTTP_PARSE_OK,       /* a complete request is in `req' */
+    HTTP_PARSE_AGAIN,    /* need more data */
+    HTTP_PARSE_ERROR     /* malformed or unsupported, close the connection */
+} http_parse_t;
+
+typedef struct http_request {
+    const char *method;
+    size_t method_len;
+    const char *path;
+    size_t path_len;
+    int minor;                  /* HTTP/1.<minor> */
+    int keep_alive;             /* connection may carry another request */
+    size_t content_length;
+    size_t head_len;            /* request line and headers, with final CRLF */
+    size_t total_len;           /* head_len + content_length */
+} http_request_t;
+
+typedef struct http_parser {
+    size_t scanned;             /* bytes searched for the end of head so far */
+    size_t head_len;            /* once found, while waiting for the body */
+} http_parser_t;
+
+void http_parser_init(http_parser_t *parser);
+
+/*
+ * Parse the request at the start of buf[0..len). On HTTP_PARSE_OK the
+ * caller consumes req->total_len bytes and calls again for the next
+ * pipelined request; the parser resets itself.
+ */
+http_parse_t http_parser_execute(http_parser_t *parser, const char *buf,
+                                 size_t len, http_request_t *req);
+
+#endif    /* HTTP_PARSER_H */
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_resp.h"
+
+enum {
+    RESP_STATUS,
+    RESP_HEADER,
+    RESP_BODY,                  /* Content-Length or until close */
+    RESP_CHUNK_SIZE,
+    RESP_CHUNK_DATA,
+    RESP_CHUNK_END,             /* the CRLF after chunk data */
+    RESP_TRAILER,
+    RESP_DONE
+};
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        for (c = i, k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+uint32_t http_resp_crc32(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    if (crc_table[1] == 0)
+        crc_init();
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void http_resp_init(http_resp_t *r, int want_crc)
+{
+    memset(r, 0, sizeof(*r));
+    r->want_crc = want_crc;
+    if (want_crc && crc_table[1] == 0)
+        crc_init();
+}
+
+/* a whole head line is in r->line (without CRLF, maybe cut short) */
+static int head_line(http_resp_t *r)
+{
+    char *p = r->line;
+    size_t len = r->line_len;
+
+    if (len > 0 && p[len - 1] == '\r')
+        len--;
+    p[len] = '\0';
+    r->line_len = 0;
+
+    if (r->state == RESP_STATUS) {
+        /* HTTP/1.x SP 3DIGIT */
+        if (len < 12 || memcmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ')
+            return -1;
+        r->status = atoi(p + 9);
+        if (r->status < 100 || r->status > 999)
+            return -1;
+        r->state = RESP_HEADER;
+        return 0;
+    }
+    if (r->state == RESP_TRAILER) {
+        if (len == 0)
+            r->state = RESP_DONE;
+        return 0;
+    }
+    if (len > 0) {
+        if (strncasecmp(p, "content-length:", 15) == 0) {
+            char *end;
+
+            r->length = strtoull(p + 15, &end, 10);
+            if (end == p + 15)
+                return -1;
+            r->has_length = 1;
+        } else if (strncasecmp(p, "transfer-encoding:", 18) == 0 &&
+                   strstr(p + 18, "chunked") != NULL) {
+            r->chunked = 1;
+        }
+        return 0;
+    }
+
+    /* end of head: 1xx, 204 and 304 carry no body */
+    if ((r->status >= 100 && r->status < 200) || r->status == 204 ||
+        r->status == 304) {
+        if (r->status < 200) {
+            r->state = RESP_STATUS;     /* the real answer follows */
+            r->chunked = r->has_length = 0;
+            r->length = 0;
+            return 0;
+        }
+        r->state = RESP_DONE;
+    } else if (r->chunked) {
+        r->state = RESP_CHUNK_SIZE;
+    } else if (r->has_length) {
+        r->left = r->length;
+        r->state = r->left ? RESP_BODY : RESP_DONE;
+    } else {
+        r->until_close = 1;
+        r->state = RESP_BODY;
+    }
+    return 0;
+}
+
+static void body_bytes(http_resp_t *r, const char *p, size_t n)
+{
+    r->body += n;
+    if (r->want_crc)
+        r->crc = http_resp_crc32(r->crc, p, n);
+}
+
+http_resp_status_t http_resp_feed(http_resp_t *r, const char *buf, size_t len,
+                                  size_t *used)
+{
+    const char *p = buf, *end = buf + len;
+
+    while (p < end && r->state != RESP_DONE) {
+        size_t n = end - p;
+        const char *nl;
+
+        switch (r->state) {
+        case RESP_STATUS:
+        case RESP_HEADER:
+        case RESP_TRAILER:
+        case RESP_CHUNK_SIZE:
+            nl = memchr(p, '\n', n);
+            n = nl ? (size_t)(nl - p) : n;
+            /* keep what fits of the line, skip the rest */
+            if (r->line_len < HTTP_RESP_LINE - 1) {
+                size_t keep = HTTP_RESP_LINE - 1 - r->line_len;
+
+                memcpy(r->line + r->line_len, p, n < keep ? n : keep);
+                r->line_len += n < keep ? n : keep;
+            }
+            p += n;
+            if (nl == NULL)
+                break;
+            p++;
+            if (r->state != RESP_CHUNK_SIZE) {
+                if (head_line(r) != 0)
+                    goto error;
+                break;
+            }
+            r->line[r->line_len] = '\0';
+            r->line_len = 0;
+            {
+                char *e;
+
+                r->left = strtoull(r->line, &e, 16);
+                if (e == r->line)
+                    goto error;
+            }
+            r->state = r->left ? RESP_CHUNK_DATA : RESP_TRAILER;
+            break;
+
+        case RESP_BODY:
+        case RESP_CHUNK_DATA:
+            if (!r->until_close && n > r->left)
+                n = r->left;
+            body_bytes(r, p, n);
+            p += n;
+            if (r->until_close)
+                break;
+            r->left -= n;
+            if (r->left == 0)
+                r->state = r->state == RESP_BODY ? RESP_DONE : RESP_CHUNK_END;
+            break;
+
+        case RESP_CHUNK_END:
+            /* CR LF, tolerate a bare LF */
+            if (*p == '\n')
+                r->state = RESP_CHUNK_SIZE;
+            else if (*p != '\r')
+                goto error;
+            p++;
+            break;
+        }
+    }
+    *used = p - buf;
+    return r->state == RESP_DONE ? HTTP_RESP_DONE : HTTP_RESP_AGAIN;
+
+error:
+    *used = p - buf;
+    return HTTP_RESP_ERROR;
+}
+
+http_resp_status_t http_resp_eof(http_resp_t *r)
+{
+    if (r->state == RESP_DONE || (r->state == RESP_BODY && r->until_close))
+        return HTTP_RESP_DONE;
+    return HTTP_RESP_ERROR;
+}
@@ -0,0 +1,54 @@
+#ifndef HTTP_RESP_H
+#define HTTP_RESP_H
+
+#include <stddef.h>    /* for size_t type */
+#include <stdint.h>
+
+/*
+ * Streaming HTTP/1.x response framing and checks for the load generators.
+ *
+ * Feed it whatever recv returned; it walks the status line and headers a
+ * byte at a time, then skips through the body by Content-Length or by
+ * chunk sizes, keeping only a few counters and, when asked, a CRC32 of
+ * the body. Nothing is buffered, so a response may be any size.
+ */
+
+#define HTTP_RESP_LINE 256    /* head bytes kept per line, the rest skipped */
+
+typedef enum {
+    HTTP_RESP_AGAIN,          /* need more data */
+    HTTP_RESP_DONE,           /* a whole response went by */
+    HTTP_RESP_ERROR           /* not a response we can frame */
+} http_resp_status_t;
+
+typedef struct http_resp {
+    int state;
+    int status;                 /* status code */
+    int chunked;
+    int has_length;             /* Content-Length seen */
+    int until_close;            /* no length: the body ends with the connection */
+    int want_crc;
+    uint32_t crc;               /* of the body, when want_crc */
+    uint64_t length;            /* Content-Length */
+    uint64_t body;              /* body bytes so far, chunk framing excluded */
+    uint64_t left;              /* of the body or of the current chunk */
+    size_t line_len;
+    char line[HTTP_RESP_LINE];
+} http_resp_t;
+
+void http_resp_init(http_resp_t *r, int want_crc);
+
+/*
+ * Consume buf[0..len). *used is set to the bytes that belong to this
+ * response, anything after it on HTTP_RESP_DONE is the next one's.
+ */
+http_resp_status_t http_resp_feed(http_resp_t *r, const char *buf, size_t len,
+                                  size_t *used);
+
+/* the peer closed: DONE when the response was close-delimited */
+http_resp_status_t http_resp_eof(http_resp_t *r);
+
+/* the usual CRC32 (as in zlib), crc is 0 to start */
+uint32_t http_resp_crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif    /* HTTP_RESP_H */
@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "http_scan.h"
+
+enum {
+    SCAN_STATUS,                /* status line */
+    SCAN_HEADERS,
+    SCAN_BODY,                  /* looking for <title> */
+    SCAN_TITLE,                 /* looking for </title> */
+    SCAN_DONE
+};
+
+void http_scan_init(http_scan_t *scan)
+{
+    memset(scan, 0, sizeof(*scan));
+}
+
+static int lower(int c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+}
+
+/* Case-insensitive prefix test, `word' is lower case */
+static int has_prefix(const char *p, size_t len, const char *word, size_t n)
+{
+    size_t i;
+
+    if (len < n)
+        return 0;
+    for (i = 0; i < n; i++)
+        if (lower((unsigned char)p[i]) != word[i])
+            return 0;
+    return 1;
+}
+
+static void head_line(http_scan_t *scan, const char *p, size_t len)
+{
+    if (len > 0 && p[len - 1] == '\r')
+        len--;
+
+    if (scan->state == SCAN_STATUS) {
+        /* HTTP/1.x SP 3DIGIT */
+        if (len >= 12 && memcmp(p, "HTTP/", 5) == 0) {
+            scan->status.p = p + 9;
+            scan->status.len = 3;
+        }
+        scan->state = SCAN_HEADERS;
+    } else if (len == 0) {
+        scan->state = SCAN_BODY;
+    } else if (has_prefix(p, len, "server:", 7)) {
+        const char *v = p + 7, *end = p + len;
+
+        while (v < end && (*v == ' ' || *v == '\t'))
+            v++;
+        while (end > v && (end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        scan->server.p = v;
+        scan->server.len = end - v;
+    }
+}
+
+/*
+ * First '<' followed by `c' (compared with bit 0x20 set, so 't' matches
+ * 'T' too) in [p, end), 16 or 8 bytes at a time: the head of a page is
+ * full of '<' but rarely "<t", so this beats stopping at every tag.
+ */
+static const char *find_pair(const char *p, const char *end, int c)
+{
+#ifdef __SSE2__
+    const __m128i lt = _mm_set1_epi8('<'), want = _mm_set1_epi8(c);
+    const __m128i fold = _mm_set1_epi8(0x20);
+
+    while (end - p >= 17) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+        int hit = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, lt),
+                      _mm_cmpeq_epi8(_mm_or_si128(b, fold), want)));
+
+        if (hit)
+            return p + __builtin_ctz(hit);
+        p += 16;
+    }
+#else
+    const uint64_t ones = 0x0101010101010101ULL, lows = ones * 0x7f;
+
+    while (end - p >= 9) {
+        uint64_t a, b, x;
+
+        memcpy(&a, p, 8);
+        memcpy(&b, p + 1, 8);
+        /* a byte of x is zero where p[i] == '<' and p[i + 1] matches */
+        x = (a ^ ones * '<') | ((b | ones * 0x20) ^ ones * c);
+        if (~(((x & lows) + lows) | x | lows)) {
+            int i;
+
+            for (i = 0; i < 8; i++)
+                if (p[i] == '<' && (p[i + 1] | 0x20) == c)
+                    return p + i;
+        }
+        p += 8;
+    }
+#endif
+    for (; end - p >= 2; p++)
+        if (p[0] == '<' && (p[1] | 0x20) == c)
+            return p;
+    return NULL;
+}
+
+/*
+ * Find `tag' (lower case, "<title" or "</title") in buf[from..len) in any
+ * case. Returns its offset, or len when absent; *resume is where the next
+ * call must start so a tag cut by the end of the data is not missed.
+ */
+static size_t find_tag(const char *buf, size_t from, size_t len,
+                       const char *tag, size_t n, size_t *resume)
+{
+    const char *p = buf + from, *end = buf + len;
+
+    while ((p = find_pair(p, end, tag[1])) != NULL) {
+        if ((size_t)(end - p) < n) {
+            *resume = p - buf;
+            return len;
+        }
+        if (has_prefix(p, end - p, tag, n))
+            return p - buf;
+        p++;
+    }
+    /* a lone '<' at the very end may still become a tag */
+    *resume = len > from && buf[len - 1] == '<' ? len - 1 : len;
+    return len;
+}
+
+/* <title> seen, its text starts after the '>' */
+static int open_title(http_scan_t *scan, const char *buf, size_t len,
+                      size_t at)
+{
+    const char *gt = memchr(buf + at + 6, '>', len - at - 6);
+
+    if (gt == NULL) {
+        scan->off = at;         /* wait for the rest of the tag */
+        return 0;
+    }
+    if (gt != buf + at + 6 && buf[at + 6] != ' ' && buf[at + 6] != '\t') {
+        scan->off = at + 1;     /* <titlefoo> is another tag */
+        return 1;
+    }
+    scan->title = scan->off = gt + 1 - buf;
+    scan->state = SCAN_TITLE;
+    return 1;
+}
+
+static void close_title(http_scan_t *scan, const char *buf, size_t at)
+{
+    scan->title_view.p = buf + scan->title;
+    scan->title_view.len = at - scan->title;
+    scan->state = SCAN_DONE;
+}
+
+int http_scan_execute(http_scan_t *scan, const char *buf, size_t len)
+{
+    while (scan->off < len) {
+        size_t at, resume;
+        const char *nl;
+
+        switch (scan->state) {
+        case SCAN_STATUS:
+        case SCAN_HEADERS:
+            nl = memchr(buf + scan->off, '\n', len - scan->off);
+            if (nl == NULL) {
+                scan->off = len;
+                return 0;
+            }
+            head_line(scan, buf + scan->line, nl - (buf + scan->line));
+            scan->line = scan->off = nl + 1 - buf;
+            break;
+
+        case SCAN_BODY:
+            at = find_tag(buf, scan->off, len, "<title", 6, &resume);
+            if (at == len) {
+                scan->off = resume;
+                return 0;
+            }
+            if (!open_title(scan, buf, len, at))
+                return 0;
+            break;
+
+        case SCAN_TITLE:
+            at = find_tag(buf, scan->off, len, "</title", 7, &resume);
+            if (at == len) {
+                scan->off = resume;
+                return 0;
+            }
+            close_title(scan, buf, at);
+            return 1;
+
+        default:
+            return 1;
+        }
+    }
+    return scan->state == SCAN_DONE;
+}
+
+void http_matcher_init(http_matcher_t *m, const char *pat)
+{
+    size_t i;
+
+    m->pat = pat;
+    m->len = strlen(pat);
+    for (i = 0; i < 256; i++)
+        m->shift[i] = m->len;
+    for (i = 0; i + 1 < m->len; i++)
+        m->shift[(unsigned char)pat[i]] = m->len - 1 - i;
+}
+
+int http_matcher_find(const http_matcher_t *m, const char *text, size_t len)
+{
+    size_t i = 0, last = m->len - 1;
+
+    if (m->len == 0)
+        return 1;
+    while (i + m->len <= len) {
+        unsigned char c = text[i + last];
+
+        if (c == (unsigned char)m->pat[last] &&
+            memcmp(text + i, m->pat, last) == 0)
+            return 1;
+        i += m->shift[c];
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>    /* for size_t type */
+
+/*
+ * Incremental HTTP response scanner for the scanners (t2.c).
+ *
+ * The response is received into one fixed buffer per connection; call
+ * http_scan_execute with the whole buffer after every read; it carries on
+ * where the previous call stopped, so the response is scanned in a single
+ * pass. Nothing is copied or allocated: the status code, the Server
+ * header and the <title> come back as views into the buffer.
+ */
+
+#define HTTP_SCAN_ARENA 16384   /* bytes of a response worth reading */
+
+typedef struct http_view {
+    const char *p;              /* NULL when not seen */
+    size_t len;
+} http_view_t;
+
+typedef struct http_scan {
+    int state;
+    size_t off;                 /* scanned up to here */
+    size_t line;                /* start of the current head line */
+    size_t title;               /* start of the title text */
+    http_view_t status;
+    http_view_t server;
+    http_view_t title_view;
+} http_scan_t;
+
+void http_scan_init(http_scan_t *scan);
+
+/*
+ * Scan buf[0..len), of which the first scan->off bytes were seen by the
+ * previous call. Returns 1 once the title has been found, after which
+ * the rest of the response does not matter.
+ */
+int http_scan_execute(http_scan_t *scan, const char *buf, size_t len);
+
+/* Horspool substring search, compiled once per pattern */
+typedef struct http_matcher {
+    const char *pat;
+    size_t len;
+    size_t shift[256];
+} http_matcher_t;
+
+void http_matcher_init(http_matcher_t *m, const char *pat);
+int http_matcher_find(const http_matcher_t *m, const char *text, size_t len);
+
+#endif    /* HTTP_SCAN_H */
@@ -14,33 +14,71 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "se.h"
+#include "dns.h"
+#include "http_scan.h"
 
 #define MAX_LINE 1024
+#define MAX_THREADS 64
+#define OUT_BUF 65536
+#define OUT_VIEW 512    /* longest server/title written per host */
 
 
 
 static struct config {
 	char *path;
 	char *file;	
+	char *dns;
     int port;
+    int queries;
     int threads;
+    int connections;
     bool dynamic;
 } cfg;
 
 typedef struct event_ptr {
 	int fd;
-	int rein;
-	char addr[16];
+	int sent;
+	int total_size;
+	http_scan_t scan;
+	char addr[256];
+	char arena[HTTP_SCAN_ARENA];
 }event_ptr;
 
+/*
+ * One scanner thread: its own slice of the host file, epoll instance,
+ * resolver and output buffer, so the threads share nothing but stdout.
+ */
+typedef struct worker {
+	pthread_t tid;
+	const char *next, *end;         /* lines still to scan */
+	int epfd;
+	se_loop_t *dns_loop;
+	dns_t *dns;
+	event_ptr *conns;               /* cfg.connections slots */
+	int nconns;                     /* slots used by this batch */
+	long hosts, responses;
+	size_t out_len;
+	char out[OUT_BUF];
+} worker_t;
+
 static void usage() {
     printf("Usage: httpv <options> <url> \n"
            " Options: \n"
            " -p, --path <P> path of url \n"
            " -P, --port <P> port of host \n"
-           " -t, --threads <N> Number of threads to use \n"
+           " -t, --threads <N> Number of threads to use, default 1 \n"
+           " -c, --connections <N> Connections per thread, default 1000 \n"
            " \n"
            " -f, --file <F> Load ip file \n"
+           " -D, --dns <S> DNS server ip[:port], default from /etc/resolv.conf \n"
+           " -q, --queries <N> DNS queries in flight per thread, default 256 \n"
            " -H, --header <H> Add header to request \n"
            " --latency Print latency statistics \n"
            " --timeout <T> Socket/request timeout \n"
@@ -59,16 +97,21 @@ static int parse_args(struct config *cfg, char **headers, int argc, char* argv[]
     cfg->port = 80;
     cfg->file = NULL;
     cfg->dynamic = false;
-    cfg->threads = 1000;
+    cfg->threads = 1;
+    cfg->connections = 1000;
+    cfg->queries = 256;
 
-    while ((c = getopt(argc, argv, "f:P:p:t:H:d:h?")) != -1) {
+    while ((c = getopt(argc, argv, "f:P:p:t:c:H:D:q:d:h?")) != -1) {
         switch (c) {
         case 'f':
         	cfg->file = optarg;
         	break;
         case 'P': cfg->port = atoi(optarg); break;
         case 't': cfg->threads = atoi(optarg); break;        
+        case 'c': cfg->connections = atoi(optarg); break;
         case 'p': cfg->path = optarg; break;
+        case 'D': cfg->dns = optarg; break;
+        case 'q': cfg->queries = atoi(optarg); break;
         case 'H':
         	*header++ = optarg;
         	break;
@@ -79,84 +122,140 @@ static int parse_args(struct config *cfg, char **headers, int argc, char* argv[]
         }
     }
     *header = NULL;
+    if (cfg->threads < 1 || cfg->threads > MAX_THREADS || cfg->connections < 1)
+        return -1;
     return 0;
 }
 
-static int create_and_connect( char *host , int *epfd)
+static char *request;
+static int request_len;
+
+/* each write(2) is one whole chunk of lines, at most PIPE_BUF on a pipe */
+static size_t out_chunk = OUT_BUF;
+
+static void out_flush(worker_t *w)
+{
+	size_t off = 0;
+
+	while (off < w->out_len) {
+		ssize_t n = write(STDOUT_FILENO, w->out + off, w->out_len - off);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+	w->out_len = 0;
+}
+
+#define VIEW_LEN(v) (int)((v).p ? ((v).len < OUT_VIEW ? (v).len : OUT_VIEW) : 6)
+#define VIEW_ARGS(v) VIEW_LEN(v), ((v).p ? (v).p : "(null)")
+
+static void report(worker_t *w, event_ptr *ptr)
+{
+	http_scan_t *scan = &ptr->scan;
+
+	/* addr, status and two capped views always fit in half a PIPE_BUF */
+	if (w->out_len + sizeof(ptr->addr) + 2 * OUT_VIEW + 16 > out_chunk)
+		out_flush(w);
+	w->out_len += snprintf(w->out + w->out_len, out_chunk - w->out_len,
+	                       "%s\t%.*s\t%.*s\t%.*s\n", ptr->addr, VIEW_ARGS(scan->status),
+	                       VIEW_ARGS(scan->server), VIEW_ARGS(scan->title_view));
+	w->responses++;
+}
+
+static void conn_close(worker_t *w, event_ptr *ptr)
+{
+	if (ptr->fd < 0)
+		return;
+	if (ptr->total_size > 0)
+		report(w, ptr);
+	close(ptr->fd);     // closing also drops it from epfd
+	ptr->fd = -1;
+}
+
+static int create_and_connect( const char *host, const struct in_addr *in, worker_t *w)
 {
-	struct hostent *hp;
 	struct sockaddr_in addr;
 
 	// epoll mask that contain the list of epoll events attached to a network socket
-	static struct epoll_event event;
+	struct epoll_event event;
+	struct event_ptr *ptr;
    	
 	int sock;
 	int on = 1;
 	
-    if((hp = gethostbyname(host)) == NULL) {
-       fprintf(stderr,"[NetTools] Invalid server name: %s\n", host);
-       return -1;
-    }
-    bcopy(hp->h_addr, &addr.sin_addr, hp->h_length);
+	if (w->nconns == cfg.connections)
+		return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr = *in;
     addr.sin_port = htons(cfg.port);
     addr.sin_family = AF_INET;
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-	// set socket to non blocking and allow port reuse
-	if ( (setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(int)) ||
-	  fcntl(sock, F_SETFL, O_NONBLOCK)) == -1)
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	// allow port reuse
+	if (sock == -1 || setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(int)) == -1)
 	{
-	  perror("setsockopt || fcntl");
+	  perror("socket || setsockopt");
 	  exit(1);
 	}    
    if( connect(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr)) == -1
       && errno != EINPROGRESS)
    {
-      // connect doesn't work, are we running out of available ports ? if yes, destruct the socket
-      if (errno == EAGAIN || errno == EWOULDBLOCK)
-      {
-         perror("connect is EAGAIN");
-         //close(sock);
-         exit(1);
-      }
+      // connect doesn't work, are we running out of available ports ?
+      if (errno == EAGAIN || errno == EADDRNOTAVAIL)
+         perror("connect");
+      close(sock);
+      return -1;
    }
-   else
+
+   /* epoll will wake up for the following events :
+    *
+    * EPOLLIN : The associated file is available for read(2) operations.
+    *
+    * EPOLLOUT : The associated file is available for write(2) operations.
+    *
+    * EPOLLRDHUP : Stream socket peer closed connection, or shut down writing 
+    * half of connection. (This flag is especially useful for writing simple 
+    * code to detect peer shutdown when using Edge Triggered monitoring.)
+    *
+    * EPOLLERR : Error condition happened on the associated file descriptor. 
+    * epoll_wait(2) will always wait for this event; it is not necessary to set it in events.
+    */
+   event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLET;
+
+   // slots are handed out once per batch, no allocation per host
+   ptr = &w->conns[w->nconns++];
+   ptr->fd = sock;
+   ptr->sent = 0;
+   ptr->total_size = 0;
+   http_scan_init(&ptr->scan);
+   snprintf(ptr->addr, sizeof(ptr->addr), "%s", host);
+   event.data.ptr = ptr;
+
+   // add the socket to the epoll file descriptors
+   if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, sock, &event) != 0)
    {
-      /* epoll will wake up for the following events :
-       *
-       * EPOLLIN : The associated file is available for read(2) operations.
-       *
-       * EPOLLOUT : The associated file is available for write(2) operations.
-       *
-       * EPOLLRDHUP : Stream socket peer closed connection, or shut down writing 
-       * half of connection. (This flag is especially useful for writing simple 
-       * code to detect peer shutdown when using Edge Triggered monitoring.)
-       *
-       * EPOLLERR : Error condition happened on the associated file descriptor. 
-       * epoll_wait(2) will always wait for this event; it is not necessary to set it in events.
-       */
-      event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLET;
-      //Edgvent.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
-      
-      event.data.ptr = malloc(sizeof(event_ptr));
-      
-      struct event_ptr *ptr = event.data.ptr;
-      bzero(ptr, sizeof(event_ptr));
-      ptr->fd = sock;
-      ptr->rein = 0;
-      strcpy(ptr->addr, host);
-      //ptr->addr[strlen(host)] = '\0';
-
-      // add the socket to the epoll file descriptors
-      if(epoll_ctl((int)*epfd, EPOLL_CTL_ADD, sock, &event) != 0)
-      {
-         perror("epoll_ctl, adding socket\n");
-         exit(1);
-      }
+      perror("epoll_ctl, adding socket\n");
+      exit(1);
    }
 
    return 0;	
 }
 
+/* dns stage: connect as soon as a name is resolved */
+static void host_resolved(const char *host, const struct in_addr *addr, void *arg)
+{
+	worker_t *w = arg;
+
+	if (addr == NULL)
+		fprintf(stderr,"[NetTools] Invalid server name: %s\n", host);
+	else if (create_and_connect(host, addr, w) != 0)
+		fprintf (stderr, "create and connect : %s\n", host);
+	if (dns_pending(w->dns) == 0)
+		se_stop(w->dns_loop);
+}
+
 /* reading waiting errors on the socket
  * return 0 if there's no, 1 otherwise
  */
@@ -164,7 +263,7 @@ int socket_check(int fd)
 {
    int ret;
    int code;
-   int len = sizeof(int);
+   socklen_t len = sizeof(int);
 
    ret = getsockopt(fd, SOL_SOCKET, SO_ERROR, &code, &len);
 
@@ -187,36 +286,200 @@ void stringlink(char *s, char *t)
     *s = '\0';
 }
 
-char* substring(const char* str, size_t begin, size_t len)
+/* socket is ready for writing: send what is left of the request */
+static void conn_write(worker_t *w, event_ptr *ptr)
 {
-  if (str == 0 || strlen(str) == 0 || strlen(str) < begin || strlen(str) < (begin+len))
-    return 0;
+	struct epoll_event event;
+
+	// verify the socket is connected and doesn't return an error
+	if (socket_check(ptr->fd) != 0) {
+		conn_close(w, ptr);
+		return;
+	}
+	while (ptr->sent < request_len) {
+		int datacount = send(ptr->fd, request + ptr->sent, request_len - ptr->sent, MSG_NOSIGNAL);
+
+		if (datacount < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				conn_close(w, ptr);
+			return;     // EPOLLOUT comes again once there is room
+		}
+		ptr->sent += datacount;
+	}
+	event.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
+	event.data.ptr = ptr;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, ptr->fd, &event) != 0) {
+		perror("epoll_ctl, modify socket");
+		conn_close(w, ptr);
+	}
+}
 
-  return strndup(str + begin, len);
-} 
+/* socket is ready for reading: drain it, the edge does not come again */
+static void conn_read(worker_t *w, event_ptr *ptr)
+{
+	while (ptr->total_size < HTTP_SCAN_ARENA) {
+		int datacount = recv(ptr->fd, ptr->arena + ptr->total_size,
+		                     HTTP_SCAN_ARENA - ptr->total_size, 0);
+
+		if (datacount < 0 && errno == EINTR)
+			continue;
+		if (datacount < 0 && errno == EAGAIN)
+			return;
+		if (datacount <= 0)
+			break;
+		ptr->total_size += datacount;
+		// the title is all we want, skip the rest of the page
+		if (http_scan_execute(&ptr->scan, ptr->arena, ptr->total_size))
+			break;
+	}
+	conn_close(w, ptr);
+}
 
-char *substr(char *haystack, char *begin, char *end)
+/* run the connections of one batch until they finish or go quiet */
+static void epoll_worker(worker_t *w, struct epoll_event *events)
 {
-   char *ret, *r;
-   char *b = strstr(haystack, begin);
-   if (b) {
-   	char *e = strstr(b, end);
-      if(e) {
-      	int offset = e - b;
-      	int retlen = offset - strlen(begin);
-		  if ((ret = malloc(retlen + 1)) == NULL)
-			return NULL;      	
-      	  strncpy(ret, b + strlen(begin), retlen);
-      	return ret;
-      }
-   }
-   return NULL;
+	int count, i, open = w->nconns;
+
+	while (open > 0) {
+		count = epoll_wait(w->epfd, events, cfg.connections, 500);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			break;
+		for (i = 0; i < count; i++) {
+			event_ptr *ptr = events[i].data.ptr;
+
+			if (ptr->fd < 0)
+				continue;
+			if (events[i].events & EPOLLOUT)
+				conn_write(w, ptr);
+			if (ptr->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+				conn_read(w, ptr);
+			if (ptr->fd < 0)
+				open--;
+		}
+	}
+	// whoever has not answered in time is dropped with what it sent
+	for (i = 0; i < w->nconns; i++)
+		conn_close(w, &w->conns[i]);
+	w->nconns = 0;
+}
+
+/* copy the next line of this worker's slice into buf, NULL at its end */
+static char *next_line(worker_t *w, char *buf)
+{
+	const char *nl;
+	size_t len;
+
+	if (w->next >= w->end)
+		return NULL;
+	nl = memchr(w->next, '\n', w->end - w->next);
+	len = nl ? (size_t)(nl - w->next) : (size_t)(w->end - w->next);
+	memcpy(buf, w->next, len < MAX_LINE ? len : MAX_LINE - 1);
+	buf[len < MAX_LINE ? len : MAX_LINE - 1] = '\0';
+	buf[strcspn(buf, "\r")] = '\0';
+	w->next += len + 1;
+	return buf;
+}
+
+static void *worker_main(void *arg)
+{
+	worker_t *w = arg;
+	struct epoll_event *events;
+	char buf[MAX_LINE];
+
+	// names are resolved on the worker's own loop, a batch at a time
+	w->dns_loop = se_create(64);
+	if (w->dns_loop == NULL || (w->dns = dns_create(w->dns_loop, cfg.dns, cfg.queries, 1000)) == NULL)
+	{
+	  perror("dns_create");
+	  exit(1);
+	}
+
+	// create the special epoll file descriptor
+	w->epfd = epoll_create(cfg.connections);
+	w->conns = malloc(cfg.connections * sizeof(event_ptr));
+	// allocate enough memory to store all the events in the "events" structure
+	if (w->epfd == -1 || w->conns == NULL ||
+	    NULL == (events = calloc(cfg.connections, sizeof(struct epoll_event))))
+	{
+	  perror("calloc events");
+	  exit(1);
+	};
+
+	while (w->next < w->end) {
+		int rn = 0;
+
+		while(rn < cfg.connections && next_line(w, buf) != NULL) {
+			if(strlen(buf) >= 7)
+			{
+				dns_resolve(w->dns, buf, host_resolved, w);
+				++w->hosts;
+				++rn;
+			}
+		}
+		// wait for the names still being resolved, their sockets get connected
+		if (dns_pending(w->dns) > 0)
+			se_loop(w->dns_loop, -1);
+		epoll_worker(w, events);
+	}
+	out_flush(w);
+
+	free(events);
+	free(w->conns);
+	close(w->epfd);
+	dns_destroy(w->dns);
+	se_destroy(w->dns_loop);
+	return NULL;
+}
+
+/* the whole host file, mapped when it is a regular file */
+static char *load_file(const char *file, size_t *size)
+{
+	struct stat st;
+	char *data = NULL;
+	size_t cap = 0, len = 0;
+	ssize_t n;
+	int fd = open(file, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			close(fd);
+			*size = st.st_size;
+			return data;
+		}
+		data = NULL;
+	}
+	do {
+		if (len == cap && (data = realloc(data, cap = cap * 2 + 65536)) == NULL)
+			break;
+		n = read(fd, data + len, cap - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+	close(fd);
+	*size = len;
+	return data ? data : strdup("");
 }
 
-void main(int argc, char* argv[])
+static double now_sec(void)
 {
-	char *url, **headers;
-	headers = malloc((argc / 2) * sizeof(char *));
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+	char **headers;
+	headers = malloc((argc / 2 + 1) * sizeof(char *));
 	
     if (parse_args(&cfg, headers, argc, argv)) {
         usage();
@@ -228,50 +491,24 @@ void main(int argc, char* argv[])
 	char header_value[200];
 	char header[1024];
 	char header_tmp[232];
-  event_ptr * ptr;
-  
-	if (cfg.file) {
-		FILE *fp;
-		char buf[MAX_LINE];  /*缓冲区*/
-		int n, len ;
-		fp = fopen(cfg.file, "r");
-		if (fp == NULL) {
-			printf("file not exist :%s\n", cfg.file);
-			exit(1);
-		}
-		n = 0;
-		int epfd;
-		static struct epoll_event *events;
-
-		// create the special epoll file descriptor
-		epfd = epoll_create(cfg.threads);
-
-		// allocate enough memory to store all the events in the "events" structure
-		if (NULL == (events = calloc(cfg.threads, sizeof(struct epoll_event))))
-		{
-		  perror("calloc events");
-		  exit(1);
-		};
-		int rn = 0;	
-master_worker:		
-		while(fgets(buf, MAX_LINE, fp) != NULL) {
-			len = strlen(buf);
-			buf[len-1] = '\0'; /* 去掉换行符 */
-			  if(strlen(buf) >= 7 && create_and_connect(buf, &epfd) != 0)
-			  {
-				 fprintf (stderr, "create and connect : %s\n", buf);
-			  }			
-			++n;
-			++rn;
-			if(rn > cfg.threads) goto epoll_worker;
-		}
-		if (rn == 0) exit(0);
-		
+	static worker_t workers[MAX_THREADS];
+	struct stat st;
+	char *data;
+	size_t size, from;
+	long hosts = 0, responses = 0;
+	double start;
+	int i;
+
+	if (!cfg.file) {
+		usage();
+		exit(1);
+	}
+	if ((data = load_file(cfg.file, &size)) == NULL) {
+		printf("file not exist :%s\n", cfg.file);
+		exit(1);
+	}
 
-epoll_worker:
-	
 	sprintf(header, "GET %s HTTP/1.1\r\n", cfg.path);
-	rn = 0;
 	for (h = headers; *h; h++) {
 		char *p = strchr(*h, ':');
 		if (p && p[1] == ' ') {
@@ -286,136 +523,43 @@ epoll_worker:
 		}
 	}
 	stringlink(header, "\r\n");
-	int header_len = strlen(header);
-	char *hhh  = malloc( header_len * sizeof(char) + 1);
-	strcpy(hhh, header);
+	request = header;
+	request_len = strlen(header);
+	fprintf(stderr, "%s", request);
+
+	// lines interleave on a pipe only when a write is bigger than PIPE_BUF
+	if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode))
+		out_chunk = PIPE_BUF;
+
+	// one slice of whole lines per thread
+	for (i = 0, from = 0; i < cfg.threads; i++) {
+		size_t to = size * (i + 1) / cfg.threads;
+		const char *nl;
+
+		if (to < from)
+			to = from;
+		if (to < size && (nl = memchr(data + to, '\n', size - to)) != NULL)
+			to = nl + 1 - data;
+		else if (to < size)
+			to = size;
+		workers[i].next = data + from;
+		workers[i].end = data + to;
+		from = to;
+	}
 
-	printf("%s", hhh);
-	
-   char buffer[2049];
-   int buffersize = 2048;
-   int count, i, datacount;	
-   int http_status;
-  char *http_servername = NULL;
-   char *http_title = NULL;
-   	while(1) {
-			count = epoll_wait(epfd, events, cfg.threads, 500);
-			if(count == 0) break;
-		for(i=0;i<count;i++) {	
- 		ptr = events[i].data.ptr;
-		//printf("count=%d,fd=%d ,ip=%s, events[i].events=%d\n", count, ptr->fd, ptr->addr, events[i].events);
-	  if ((events[i].events & (EPOLLHUP |  EPOLLERR)) || strlen(ptr->addr) == 0)
-	    {
-
-          epoll_ctl(epfd, EPOLL_CTL_DEL, ptr->fd, NULL);
-
-	      //fprintf (stderr, "epoll error %d\n", ptr->fd);
-	      continue;
-	    }				
-         if (events[i].events & EPOLLOUT) //socket is ready for writing
-         {
-            // verify the socket is connected and doesn't return an error
-            if(socket_check(ptr->fd) != 0)
-            {
-               perror("write socket_check");
-               continue;
-            }
-            else
-            {
-              
-              int total = header_len;
-              while(1) {
-              	datacount = send(ptr->fd, hhh, header_len, 0);
-              	if(datacount < 0) {
-              		if (errno == EINTR || errno == EAGAIN) {
-              			usleep(1000);
-              			continue;
-              		} 
-              	}
-              	if (datacount == total) {
-                  events[i].events = EPOLLIN  | EPOLLHUP | EPOLLERR;
-
-                  if(epoll_ctl(epfd, EPOLL_CTL_MOD, ptr->fd, events) != 0)
-                  {
-                     perror("epoll_ctl, modify socket");
-                     continue;
-                  }
-                  break;           	
-              	}
-              	total -= datacount;
-              	hhh += datacount;
-              }
-
-            }
-         }
-
-         if (events[i].events & (EPOLLIN )) //socket is ready for reading
-         {
-            // verify the socket is connected and doesn't return an error
-            if(socket_check(ptr->fd) != 0)
-            {
-               fprintf (stderr, " [ %s->%d] read socket_check : [%d]%s\n", ptr->addr, ptr->fd, errno, strerror(errno));
-               //epoll_ctl(epfd, EPOLL_CTL_DEL, ptr->fd, NULL);
-               continue;
-
-            }
-            else 
-            {
-               memset(buffer,0x0,buffersize);
-
-               int n = 0;
-               while (1) {
-               datacount = read(ptr->fd, buffer +n , buffersize);
-		      	if(datacount == -1) {
-		      		++ptr->rein;
-		      		if (ptr->rein > 5) {
-		      			epoll_ctl(epfd, EPOLL_CTL_DEL, ptr->fd, NULL);
-		      			break;
-		      		}
-		      		if (errno == EAGAIN) {
-		      			usleep(1000);
-		      			continue;
-		      		}
-		      	
-
-		      	}else if(datacount == 0) {
-		      		break;
-		      	}
-              //printf("%s=%d=%d\n", buffer, n, datacount);
-		      	               
-                n += datacount;
-              }
-
-
-              /*            
-               if((datacount = recv(ptr->fd, buffer, buffersize, 0)) < 0 )
-               {
-               	  ++ptr->rein;
-                  fprintf (stderr, "[ %s->%d] recv failed : %s\n", ptr->addr, ptr->fd, strerror(errno));
-                  if(ptr->rein > 5) {
-                  	epoll_ctl(epfd, EPOLL_CTL_DEL, ptr->fd, NULL);
-                  }
-                  continue;
-               }
-              */  
-				printf("%s\n", buffer);
-               char *http_status = substring(buffer, 9, 3);
-               http_servername = substr(buffer, "Server: ", "\r\n");
-               http_title = substr(buffer, "<title>", "</title>");
-               fprintf (stdout, "%s\t%s\t%s\t%s\n", ptr->addr, http_status, http_servername, http_title);
-               if(http_status != NULL) free(http_status);
-               if(http_servername != NULL) free(http_servername);
-               if(http_title != NULL) free(http_title); 
-
-               epoll_ctl(epfd, EPOLL_CTL_DEL, ptr->fd, NULL);
-               //usleep(10000);
-            }
-         }
-
-         }			
+	start = now_sec();
+	for (i = 0; i < cfg.threads; i++) {
+		if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
 		}
-		goto master_worker;
 	}
-	
-    //printf("headers: %s\npath: %s\nport: %d\n", *headers, cfg.path, cfg.port);
+	for (i = 0; i < cfg.threads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		hosts += workers[i].hosts;
+		responses += workers[i].responses;
+	}
+	fprintf(stderr, "%ld hosts, %ld responses in %.2fs, %.0f hosts/s\n", hosts,
+	        responses, now_sec() - start, hosts / (now_sec() - start));
+	return 0;
 }
@@ -0,0 +1,747 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h> //va_start va_end
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "logger.h"
+
+#define FG_WHITE     	"\x1B[0;m"   /* white */
+#define FG_RED      	"\033[0;31m"  /* 0 -> normal ; 31 -> red */
+#define FG_RED_BOLD 	"\033[1;31m" /* 1 -> bold ; 31 -> red */
+#define FG_GREEN    	"\033[0;32m"  /* 4 -> underline ; 32 -> green */
+#define FG_GREEN_BOLD   "\033[1;32m"
+#define FG_YELLOW 		"\033[0;33m"  /* 0 -> normal ; 33 -> yellow */
+#define FG_YELLOW_BOLD	"\033[1;33m"
+#define FG_BLUE     	"\033[0;34m"  /* 9 -> strike ; 34 -> blue */
+#define FG_BLUE_BOLD    "\033[1;34m"
+#define FG_CYAN     	"\033[0;36m" /* 0 -> normal ; 36 -> cyan */
+#define FG_CYAN_BOLD	"\033[0;36m"
+#define FG_DEFAULT  "\033[39m"
+#define RESET_COLOR    "\033[0m" /* to flush the previous property */
+
+#define REC_ALIGN    8
+#define REC_PAD      (-1)       /* level of the filler before a wrap */
+#define BATCH_IOVS   1023       /* under IOV_MAX */
+#define BATCH_BYTES  (256 * 1024) /* formatted lines */
+#define IDLE_NS      1000000    /* the writer's nap when the rings are empty */
+
+#define ALIGN(n) (((n) + REC_ALIGN - 1) & ~(size_t)(REC_ALIGN - 1))
+
+/* what the caller writes, the arguments follow */
+typedef struct log_rec {
+    uint32_t size;              /* the whole record, aligned */
+    uint16_t len;               /* argument bytes */
+    int16_t level;
+    int line;
+    time_t sec;
+    const char *file;
+    const char *func;
+    const char *fmt;
+} log_rec_t;
+
+#define REC_HDR ALIGN(sizeof(log_rec_t))
+
+/* how a conversion's argument is kept */
+enum {
+    ARG_NONE,                   /* %% */
+    ARG_INT,                    /* any integer, as a long long */
+    ARG_DBL,
+    ARG_LDBL,
+    ARG_PTR,
+    ARG_STR,                    /* copied: a length, the bytes and a NUL */
+    ARG_ERRNO,                  /* %m, strerror(errno) at the call, copied */
+    ARG_SKIP                    /* %n and wide strings: taken, not kept */
+};
+
+/* one conversion of a printf format */
+typedef struct fmt_spec {
+    size_t len;                 /* from the '%' through the conversion */
+    int prec;                   /* -1 when none or '*' */
+    char length;                /* 0, 'H' (hh), 'h', 'l', 'q' (ll), 'L', 'j', 'z', 't' */
+    char conv;                  /* 0 when not one we know */
+    char star_width;
+    char star_prec;
+} fmt_spec_t;
+
+typedef struct log_ring {
+    uint64_t head;              /* written by the thread that logs */
+    uint64_t tail_seen;         /* its last look at tail */
+    unsigned long dropped;
+    char pad1[64 - 2 * sizeof(uint64_t) - sizeof(unsigned long)];
+    uint64_t tail;              /* written by the writer thread */
+    unsigned long reported;     /* of dropped */
+    int dead;                   /* the thread is gone */
+    struct log_ring *next;
+    char buf[LOG_RING_SIZE];
+} log_ring_t;
+
+int _20131025_log_level = 1;
+
+static int log_on;              /* callers log */
+static int log_fd = -1;         /* the writer writes here */
+static int log_color;
+static pid_t log_pid;
+
+static log_ring_t *rings;       /* pushed by new threads, pruned by the writer */
+static __thread log_ring_t *my_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static int writer_running;
+static int stopping;
+static unsigned long dropped_total;
+
+/* the writer's */
+static struct iovec iov[BATCH_IOVS];
+static int niov;
+static char batch[BATCH_BYTES];
+static size_t batch_len;
+static time_t ts_sec = -1;
+static char ts[32];
+
+const char* LOG_SET_COLOR(int level, int is_end)
+{
+	if (log_color) {
+		if (is_end) {
+			return RESET_COLOR;
+		} else {
+			switch (level) {
+				case LOG_INFO : return FG_DEFAULT; break;
+				case LOG_WARN : return FG_YELLOW; break;
+				case LOG_ERROR : return FG_RED; break;
+				case LOG_DEBUG : return FG_CYAN; break;
+				default : return FG_BLUE_BOLD; break;
+			}
+		}
+	}
+	return "";
+}
+
+static void fmt_parse(const char *f, fmt_spec_t *s)
+{
+    const char *p = f + 1;
+
+    memset(s, 0, sizeof(*s));
+    s->prec = -1;
+    while (*p && strchr("-+ #0'I", *p) != NULL)
+        p++;
+    if (*p == '*') {
+        s->star_width = 1;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->star_prec = 1;
+            p++;
+        } else {
+            s->prec = 0;
+            while (*p >= '0' && *p <= '9')
+                s->prec = s->prec * 10 + *p++ - '0';
+        }
+    }
+    switch (*p) {
+        case 'h' : s->length = p[1] == 'h' ? 'H' : 'h'; p += 1 + (p[1] == 'h'); break;
+        case 'l' : s->length = p[1] == 'l' ? 'q' : 'l'; p += 1 + (p[1] == 'l'); break;
+        case 'q' : case 'L' : case 'j' : case 'z' : case 't' : s->length = *p++; break;
+        case 'Z' : s->length = 'z'; p++; break;
+    }
+    if (*p && strchr("diouxXcCeEfFgGaAsSpnm%", *p) != NULL)
+        s->conv = *p++;
+    s->len = p - f;
+}
+
+static int fmt_kind(const fmt_spec_t *s)
+{
+    switch (s->conv) {
+        case '%' : return ARG_NONE;
+        case 'e' : case 'E' : case 'f' : case 'F' :
+        case 'g' : case 'G' : case 'a' : case 'A' :
+            return s->length == 'L' ? ARG_LDBL : ARG_DBL;
+        case 's' : return s->length == 'l' ? ARG_SKIP : ARG_STR;
+        case 'S' : case 'n' : return ARG_SKIP;
+        case 'p' : return ARG_PTR;
+        case 'm' : return ARG_ERRNO;
+        default : return ARG_INT;
+    }
+}
+
+static long long int_arg(const fmt_spec_t *s, va_list *ap)
+{
+    switch (s->length) {
+        case 'l' : return va_arg(*ap, long);
+        case 'q' : case 'L' : return va_arg(*ap, long long);
+        case 'j' : return va_arg(*ap, intmax_t);
+        case 'z' : return (long long)va_arg(*ap, size_t);
+        case 't' : return va_arg(*ap, ptrdiff_t);
+        default : return va_arg(*ap, int);
+    }
+}
+
+static char *put(char *q, const char *end, const void *v, size_t n)
+{
+    if (q == NULL || (size_t)(end - q) < ALIGN(n))
+        return NULL;
+    memcpy(q, v, n);
+    return q + ALIGN(n);
+}
+
+static char *put_str(char *q, const char *end, const char *str, int prec)
+{
+    uint32_t n;
+
+    if (str == NULL)
+        str = "(null)";
+    n = (uint32_t)strnlen(str, prec >= 0 && prec < LOG_MAX_MSG_LEN ? prec : LOG_MAX_MSG_LEN);
+    if (q == NULL || (size_t)(end - q) < ALIGN(sizeof(n) + n + 1))
+        return NULL;
+    memcpy(q, &n, sizeof(n));
+    memcpy(q + sizeof(n), str, n);
+    q[sizeof(n) + n] = '\0';
+    return q + ALIGN(sizeof(n) + n + 1);
+}
+
+/* the arguments, raw, in the order the format takes them; NULL when they
+ * do not fit before end */
+static char *capture(char *q, const char *end, const char *fmt, va_list *ap,
+                     int err)
+{
+    const char *f;
+    fmt_spec_t s;
+
+    for (f = strchr(fmt, '%'); f != NULL; f = strchr(f + s.len, '%')) {
+        long long i;
+        double d;
+        long double ld;
+        void *p;
+        int star;
+
+        fmt_parse(f, &s);
+        if (s.conv == 0)
+            break;              /* the writer stops here too */
+        if (s.star_width) {
+            star = va_arg(*ap, int);
+            q = put(q, end, &star, sizeof(star));
+        }
+        if (s.star_prec) {
+            star = va_arg(*ap, int);
+            q = put(q, end, &star, sizeof(star));
+            s.prec = star;
+        }
+        switch (fmt_kind(&s)) {
+            case ARG_INT : i = int_arg(&s, ap); q = put(q, end, &i, sizeof(i)); break;
+            case ARG_DBL : d = va_arg(*ap, double); q = put(q, end, &d, sizeof(d)); break;
+            case ARG_LDBL : ld = va_arg(*ap, long double); q = put(q, end, &ld, sizeof(ld)); break;
+            case ARG_PTR : p = va_arg(*ap, void *); q = put(q, end, &p, sizeof(p)); break;
+            case ARG_STR : q = put_str(q, end, va_arg(*ap, const char *), s.prec); break;
+            case ARG_ERRNO : q = put_str(q, end, strerror(err), -1); break;
+            case ARG_SKIP : (void)va_arg(*ap, void *); break;
+        }
+        if (q == NULL)
+            return NULL;
+    }
+    return q;
+}
+
+static void ring_release(void *arg)
+{
+    log_ring_t *r = (log_ring_t *)arg;
+
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void ring_key_init(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static log_ring_t *ring_new(void)
+{
+    log_ring_t *r;
+
+    pthread_once(&ring_once, ring_key_init);
+    r = (log_ring_t *)calloc(1, sizeof(log_ring_t));
+    if (r == NULL)
+        return NULL;
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+/* contiguous room at head, wrapping to the start of the ring when that
+ * gives more; NULL when there is not even a header's worth */
+static char *ring_reserve(log_ring_t *r, size_t *room, int wrap)
+{
+    uint64_t head = r->head;    /* only this thread moves it */
+    size_t off = head & (LOG_RING_SIZE - 1);
+    size_t contig = LOG_RING_SIZE - off;
+    size_t avail = LOG_RING_SIZE - (size_t)(head - r->tail_seen);
+
+    if (avail < contig + (wrap ? REC_HDR + 1 : 0)) {
+        r->tail_seen = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        avail = LOG_RING_SIZE - (size_t)(head - r->tail_seen);
+    }
+    if (wrap && avail > contig + REC_HDR) {
+        log_rec_t *pad = (log_rec_t *)(r->buf + off);
+
+        pad->size = (uint32_t)contig;
+        pad->level = REC_PAD;
+        __atomic_store_n(&r->head, head + contig, __ATOMIC_RELEASE);
+        avail -= contig;
+        off = 0;
+        contig = LOG_RING_SIZE;
+    }
+    *room = avail < contig ? avail : contig;
+    return *room >= REC_HDR ? r->buf + off : NULL;
+}
+
+void LOG_WRITER(int level, const char *file, const char *func, int line,
+                const char *fmt, ...)
+{
+    log_ring_t *r = my_ring;
+    int err = errno;
+    struct timespec now;
+    log_rec_t *rec;
+    size_t room, len;
+    va_list ap;
+    char *p, *end;
+    int wrap;
+
+    if ((level & ~_20131025_log_level) != 0 || !log_on)
+        return;
+    if (r == NULL && (r = my_ring = ring_new()) == NULL)
+        return;
+
+    for (wrap = 0; wrap < 2; wrap++) {
+        p = ring_reserve(r, &room, wrap);
+        if (p == NULL)
+            continue;
+        len = room - REC_HDR < UINT16_MAX ? room - REC_HDR : UINT16_MAX & ~(REC_ALIGN - 1);
+        va_start(ap, fmt);
+        end = capture(p + REC_HDR, p + REC_HDR + len, fmt, &ap, err);
+        va_end(ap);
+        if (end == NULL)
+            continue;
+
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        rec = (log_rec_t *)p;
+        rec->size = (uint32_t)(end - p);
+        rec->len = (uint16_t)(end - p - REC_HDR);
+        rec->level = (int16_t)level;
+        rec->line = line;
+        rec->sec = now.tv_sec;
+        rec->file = file;
+        rec->func = func;
+        rec->fmt = fmt;
+        __atomic_store_n(&r->head, r->head + rec->size, __ATOMIC_RELEASE);
+        errno = err;
+        return;
+    }
+    __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+    errno = err;
+}
+
+/* where the writer prints a line, the message is cut to LOG_MAX_MSG_LEN - 1
+ * as the 4K buffer of LOG_WRITER did before */
+typedef struct out {
+    char *buf;
+    size_t len;
+    size_t cap;
+} out_t;
+
+static void out_printed(out_t *o, int n)
+{
+    if (n < 0)
+        return;
+    o->len += (size_t)n < o->cap - o->len ? (size_t)n : o->cap - o->len - 1;
+}
+
+static void out_text(out_t *o, const char *s, size_t n)
+{
+    if (n > o->cap - o->len - 1)
+        n = o->cap - o->len - 1;
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+#define EMIT(o, sub, s, w, pr, v) \
+    out_printed(o, (s).star_width && (s).star_prec ? snprintf((o)->buf + (o)->len, (o)->cap - (o)->len, sub, w, pr, v) : \
+                   (s).star_width ? snprintf((o)->buf + (o)->len, (o)->cap - (o)->len, sub, w, v) : \
+                   (s).star_prec ? snprintf((o)->buf + (o)->len, (o)->cap - (o)->len, sub, pr, v) : \
+                   snprintf((o)->buf + (o)->len, (o)->cap - (o)->len, sub, v))
+
+static void emit_int(out_t *o, const char *sub, const fmt_spec_t *s, int w, int pr, long long v)
+{
+    switch (s->length) {
+        case 'l' : EMIT(o, sub, *s, w, pr, (long)v); break;
+        case 'q' : case 'L' : EMIT(o, sub, *s, w, pr, v); break;
+        case 'j' : EMIT(o, sub, *s, w, pr, (intmax_t)v); break;
+        case 'z' : EMIT(o, sub, *s, w, pr, (size_t)v); break;
+        case 't' : EMIT(o, sub, *s, w, pr, (ptrdiff_t)v); break;
+        default : EMIT(o, sub, *s, w, pr, (int)v); break;
+    }
+}
+
+/* the message of rec: its format run again over the arguments it kept */
+static void format_rec(out_t *o, const log_rec_t *rec)
+{
+    const char *a = (const char *)rec + REC_HDR;
+    const char *f = rec->fmt, *pct;
+    char sub[32];
+    fmt_spec_t s;
+
+    for (; (pct = strchr(f, '%')) != NULL; f = pct + s.len) {
+        int w = 0, pr = 0;
+        uint32_t n;
+        long long i;
+        double d;
+        long double ld;
+        void *p;
+
+        out_text(o, f, pct - f);
+        fmt_parse(pct, &s);
+        if (s.conv == 0) {
+            f = pct;
+            break;
+        }
+        if (s.star_width) {
+            memcpy(&w, a, sizeof(w));
+            a += ALIGN(sizeof(w));
+        }
+        if (s.star_prec) {
+            memcpy(&pr, a, sizeof(pr));
+            a += ALIGN(sizeof(pr));
+        }
+        /* a conversion too long to copy is taken but not printed */
+        if (s.len < sizeof(sub)) {
+            memcpy(sub, pct, s.len);
+            sub[s.len] = '\0';
+        } else {
+            sub[0] = '\0';
+        }
+        switch (fmt_kind(&s)) {
+            case ARG_NONE :
+                out_text(o, "%", 1);
+                break;
+            case ARG_INT :
+                memcpy(&i, a, sizeof(i));
+                a += ALIGN(sizeof(i));
+                if (sub[0])
+                    emit_int(o, sub, &s, w, pr, i);
+                break;
+            case ARG_DBL :
+                memcpy(&d, a, sizeof(d));
+                a += ALIGN(sizeof(d));
+                if (sub[0])
+                    EMIT(o, sub, s, w, pr, d);
+                break;
+            case ARG_LDBL :
+                memcpy(&ld, a, sizeof(ld));
+                a += ALIGN(sizeof(ld));
+                if (sub[0])
+                    EMIT(o, sub, s, w, pr, ld);
+                break;
+            case ARG_PTR :
+                memcpy(&p, a, sizeof(p));
+                a += ALIGN(sizeof(p));
+                if (sub[0])
+                    EMIT(o, sub, s, w, pr, p);
+                break;
+            case ARG_STR :
+            case ARG_ERRNO :
+                memcpy(&n, a, sizeof(n));
+                if (sub[0]) {
+                    sub[s.len - 1] = 's';
+                    EMIT(o, sub, s, w, pr, a + sizeof(n));
+                }
+                a += ALIGN(sizeof(n) + n + 1);
+                break;
+            case ARG_SKIP :
+                break;
+        }
+    }
+    out_text(o, f, strlen(f));
+}
+
+/* writev until everything is out */
+static void flush_batch(void)
+{
+    struct iovec *v = iov;
+    int left = niov;
+
+    while (left > 0) {
+        ssize_t n = writev(log_fd, v, left);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        while (left > 0 && (size_t)n >= v->iov_len) {
+            n -= v->iov_len;
+            v++;
+            left--;
+        }
+        if (left > 0) {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+    niov = 0;
+    batch_len = 0;
+}
+
+/* a piece that follows the last one in memory extends it */
+static void add_iov(const void *base, size_t len)
+{
+    if (niov > 0 && (const char *)iov[niov - 1].iov_base + iov[niov - 1].iov_len == base) {
+        iov[niov - 1].iov_len += len;
+        return;
+    }
+    iov[niov].iov_base = (void *)base;
+    iov[niov].iov_len = len;
+    niov++;
+}
+
+/* a line into the batch: the prefix, then the message of rec, or msg when
+ * rec is NULL */
+static void add_line(int level, time_t sec, const char *file, const char *func,
+                     int line, const log_rec_t *rec, const char *msg)
+{
+    const char *c = "IWEDX";
+    const char *end = log_color ? RESET_COLOR "\n" : "\n";
+    out_t o;
+    int cl;
+
+    /* room for the longest line, else write out the batch first */
+    if (niov + 2 > BATCH_IOVS ||
+        batch_len + 128 + strlen(file) + strlen(func) + LOG_MAX_MSG_LEN > sizeof(batch))
+        flush_batch();
+
+    switch (level) {
+        case LOG_INFO : cl = 0; break;
+        case LOG_WARN : cl = 1; break;
+        case LOG_ERROR : cl = 2; break;
+        case LOG_DEBUG : cl = 3; break;
+        default : cl = 4; break;
+    }
+
+    /* the time string is made once a second */
+    if (sec != ts_sec) {
+        struct tm tm;
+
+        localtime_r(&sec, &tm);
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+        ts_sec = sec;
+    }
+
+    o.buf = batch + batch_len;
+    o.len = 0;
+    o.cap = sizeof(batch) - batch_len;
+    out_printed(&o, snprintf(o.buf, o.cap, "%s%s[%d][%s(%s):%d] %c, ",
+                             LOG_SET_COLOR(level, 0), ts, (int)log_pid,
+                             file, func, line, c[cl]));
+    add_iov(o.buf, o.len);
+    batch_len += o.len;
+
+    /* the message on its own is held to LOG_MAX_MSG_LEN */
+    o.buf += o.len;
+    o.cap = LOG_MAX_MSG_LEN;
+    o.len = 0;
+    if (rec != NULL)
+        format_rec(&o, rec);
+    else
+        out_text(&o, msg, strlen(msg));
+    add_iov(o.buf, o.len);
+    batch_len += o.len;
+    add_iov(end, strlen(end));
+}
+
+/* one pass over the rings, returns how many lines it wrote */
+static int drain(void)
+{
+    log_ring_t *r, **prev;
+    int lines = 0;
+    char note[64];
+
+    /* only the head is shared with threads pushing new rings */
+    for (prev = &rings, r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL;
+         r = prev == &rings ? __atomic_load_n(&rings, __ATOMIC_ACQUIRE) : *prev) {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = r->tail;
+        unsigned long dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+
+        if (dead)
+            head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+        /* the lines are made in the batch, the records go at once */
+        while (tail < head) {
+            log_rec_t *rec = (log_rec_t *)(r->buf + (tail & (LOG_RING_SIZE - 1)));
+
+            if (rec->level != REC_PAD) {
+                add_line(rec->level, rec->sec, rec->file, rec->func, rec->line,
+                         rec, NULL);
+                lines++;
+            }
+            tail += rec->size;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        if (dropped != r->reported) {
+            snprintf(note, sizeof(note), "%lu log messages dropped",
+                     dropped - r->reported);
+            __atomic_fetch_add(&dropped_total, dropped - r->reported, __ATOMIC_RELAXED);
+            r->reported = dropped;
+            add_line(LOG_WARN, time(NULL), __FILE__, __FUNCTION__, __LINE__,
+                     NULL, note);
+        }
+
+        /* the thread is gone and everything it logged is out */
+        if (dead) {
+            log_ring_t *next = r->next;
+
+            if (prev == &rings) {
+                log_ring_t *expected = r;
+
+                if (!__atomic_compare_exchange_n(&rings, &expected, next, 0,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                    /* a new thread pushed in front of it */
+                    log_ring_t *before = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+
+                    while (before->next != r)
+                        before = before->next;
+                    before->next = next;
+                    prev = &before->next;
+                }
+            } else {
+                *prev = next;
+            }
+            free(r);
+            continue;
+        }
+        prev = &r->next;
+    }
+
+    if (niov > 0)
+        flush_batch();
+    return lines;
+}
+
+static void *writer_main(void *arg)
+{
+    struct timespec nap = { 0, IDLE_NS };
+
+    (void)arg;
+    for (;;) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+
+        if (drain() == 0) {
+            if (stop)
+                break;
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* In a forked child only the forking thread is left and there is no
+ * writer. What the parent had not written yet is the parent's to write,
+ * so the rings are dropped, not drained, and the child logs nothing until
+ * it calls LOG_INIT. */
+static void fork_child(void)
+{
+    log_ring_t *r, *next;
+
+    if (my_ring != NULL)
+        pthread_setspecific(ring_key, NULL);
+    for (r = rings; r != NULL; r = next) {
+        next = r->next;
+        free(r);
+    }
+    rings = NULL;
+    my_ring = NULL;
+    log_on = 0;
+    if (log_fd >= 0 && log_fd != STDOUT_FILENO)
+        close(log_fd);
+    log_fd = -1;
+    writer_running = 0;
+    stopping = 0;
+    dropped_total = 0;
+    niov = 0;
+    batch_len = 0;
+    ts_sec = -1;
+}
+
+static void fork_init(void)
+{
+    pthread_atfork(NULL, NULL, fork_child);
+}
+
+void LOG_INIT(const char *device)
+{
+    pthread_once(&fork_once, fork_init);
+    LOG_DESTORY();
+
+    if (device == NULL) {
+        log_fd = STDOUT_FILENO;
+        log_color = 1;
+    } else {
+        log_fd = open(device, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        log_color = 0;
+        if (log_fd < 0)
+            return;
+    }
+    log_pid = getpid();
+    stopping = 0;
+    writer_running = pthread_create(&writer, NULL, writer_main, NULL) == 0;
+    if (!writer_running) {
+        if (log_fd != STDOUT_FILENO)
+            close(log_fd);
+        log_fd = -1;
+        return;
+    }
+    log_on = 1;
+}
+
+void LOG_DESTORY(void)
+{
+    if (!writer_running)
+        return;
+    /* later calls return at once, the writer empties what is there */
+    log_on = 0;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    writer_running = 0;
+    if (log_fd != STDOUT_FILENO)
+        close(log_fd);
+    log_fd = -1;
+}
+
+void LOG_LEVEL(int level)
+{
+	_20131025_log_level = level;
+}
+
+unsigned long LOG_DROPPED(void)
+{
+    return __atomic_load_n(&dropped_total, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,91 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * logger: logtest.c's LOG_* macros on an asynchronous backend.
+ *
+ * A log call does not touch the device. Every thread that logs gets a ring
+ * of its own (LOG_RING_SIZE bytes, one producer and one consumer, no lock).
+ * The message is not formatted by the caller: the format pointer and the
+ * raw arguments are copied into the ring (strings and %m by value), behind
+ * a small binary header: level, file, function, line and the second it was
+ * logged, from CLOCK_REALTIME_COARSE. A background thread started by
+ * LOG_INIT empties the rings in batches. It formats the messages, writes
+ * each line's prefix, with the timestamp string made once per second, and
+ * hands the lines to the kernel with one writev per batch.
+ *
+ * A full ring does not block the caller: the message is dropped, counted,
+ * and the count is logged once there is room again. LOG_DESTORY writes what
+ * is left and stops the thread. A forked child starts empty: it does not
+ * write what the parent had not written yet, and logs nothing until it
+ * calls LOG_INIT again. The file, the function and the format must
+ * be string literals, as __FILE__ and __FUNCTION__ are: the writer reads
+ * them later. %n, %ls and %lc are not supported.
+ *
+ * A level turned off with LOG_LEVEL costs one test of a global before the
+ * arguments are evaluated. Define LOG_MIN_LEVEL (LOG_DEBUG, LOG_INFO,
+ * LOG_WARN or LOG_ERROR, in that order) before including this file to
+ * compile the levels below it out, arguments and all.
+ *
+ * build with : gcc -c logger.c and link logger.o into the program, with -pthread
+ */
+
+#define LOG_INFO (1<<0) //1
+#define LOG_WARN (1<<1) //2
+#define LOG_ERROR (1<<2) //4
+#define LOG_DEBUG (1<<3) //8
+#define LOG_ALL ((2<<16)-1)
+
+/* the levels compiled in */
+#if !defined(LOG_MIN_LEVEL) || LOG_MIN_LEVEL == LOG_DEBUG
+#define LOG_COMPILE_MASK LOG_ALL
+#elif LOG_MIN_LEVEL == LOG_INFO
+#define LOG_COMPILE_MASK (LOG_ALL & ~LOG_DEBUG)
+#elif LOG_MIN_LEVEL == LOG_WARN
+#define LOG_COMPILE_MASK (LOG_ALL & ~(LOG_DEBUG | LOG_INFO))
+#elif LOG_MIN_LEVEL == LOG_ERROR
+#define LOG_COMPILE_MASK LOG_ERROR
+#else
+#error "LOG_MIN_LEVEL must be LOG_DEBUG, LOG_INFO, LOG_WARN or LOG_ERROR"
+#endif
+
+/* the levels let through, set by LOG_LEVEL */
+extern int _20131025_log_level;
+
+#define LOG_ON(l) (((l) & ~LOG_COMPILE_MASK) == 0 && \
+                   __builtin_expect(((l) & ~_20131025_log_level) == 0, 0))
+
+#define INFO(f...)  do { if (LOG_ON(LOG_INFO)) LOG_WRITER(LOG_INFO, __FILE__, __FUNCTION__, __LINE__, f); } while (0)
+#define WARN(f...)  do { if (LOG_ON(LOG_WARN)) LOG_WRITER(LOG_WARN, __FILE__, __FUNCTION__, __LINE__, f); } while (0)
+#define ERROR(f...) do { if (LOG_ON(LOG_ERROR)) LOG_WRITER(LOG_ERROR, __FILE__, __FUNCTION__, __LINE__, f); } while (0)
+#define DEBUG(f...) do { if (LOG_ON(LOG_DEBUG)) LOG_WRITER(LOG_DEBUG, __FILE__, __FUNCTION__, __LINE__, f); } while (0)
+#define DBG(l,f...) do { if (LOG_ON(l)) LOG_WRITER(l, __FILE__, __FUNCTION__, __LINE__, f); } while (0)
+
+#define LOG_MAX_MSG_LEN 4098
+
+/* per thread, a power of 2 */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE (64 * 1024)
+#endif
+
+/* NULL for stdout, in colour */
+void LOG_INIT(const char *device);
+void LOG_DESTORY(void);
+/* the levels let through, a mask */
+void LOG_LEVEL(int level);
+const char *LOG_SET_COLOR(int level, int is_end);
+void LOG_WRITER(int level, const char *file, const char *func, int line,
+                const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+/* messages dropped on full rings, as far as the writer has logged them:
+ * all of them once LOG_DESTORY has returned */
+unsigned long LOG_DROPPED(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* LOGGER_H */
@@ -0,0 +1,370 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "master.h"
+#include "processtitle.h"
+#include "topo.h"
+
+#define LISTEN_FDS_ENV  "MASTER_LISTEN_FDS"
+#define MAX_WORKERS     200     /* as forkProcess */
+#define RESPAWN_DELAY   1       /* seconds, for a worker that died young */
+
+typedef struct worker_slot {
+    pid_t pid;                  /* 0 when not running */
+    time_t started;
+    time_t respawn_at;          /* 0 when not waiting for a respawn */
+} worker_slot_t;
+
+static volatile sig_atomic_t quit_requested;
+
+static const master_conf_t *conf;
+static worker_slot_t slots[MAX_WORKERS];
+static int nworkers;
+static int listen_fds[MAX_WORKERS];
+static int nlisten;
+static pid_t master_pid;
+static pid_t reload_pid;        /* the new master, during an upgrade */
+static int stopping;            /* no more respawns, exit when all are gone */
+
+int master_quit_requested(void)
+{
+    return quit_requested;
+}
+
+static void on_quit(int sig)
+{
+    (void)sig;
+    quit_requested = 1;
+}
+
+static int make_listener(const char *port, int reuseport)
+{
+    struct addrinfo hints, *result, *rp;
+    int s, fd = -1, on = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    s = getaddrinfo(NULL, port, &hints, &result);
+    if (s != 0) {
+        fprintf(stderr, "master: getaddrinfo: %s\n", gai_strerror(s));
+        return -1;
+    }
+
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK,
+                    rp->ai_protocol);
+        if (fd == -1)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (reuseport &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+            perror("master: SO_REUSEPORT");
+            close(fd);
+            fd = -1;
+            break;
+        }
+        if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0 &&
+            listen(fd, SOMAXCONN) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd == -1)
+        fprintf(stderr, "master: could not listen on port %s\n", port);
+    return fd;
+}
+
+/* the sockets of the master we replace, "3,4,5" */
+static void inherit_listeners(const char *env)
+{
+    char *end;
+
+    while (*env && nlisten < MAX_WORKERS) {
+        long fd = strtol(env, &end, 10);
+
+        if (end == env)
+            break;
+        if (fcntl((int)fd, F_GETFD) != -1)
+            listen_fds[nlisten++] = (int)fd;
+        env = *end == ',' ? end + 1 : end;
+    }
+}
+
+static int open_listeners(const char *port, int wanted)
+{
+    while (nlisten < wanted) {
+        int fd = make_listener(port, conf->reuseport);
+
+        if (fd == -1)
+            return -1;
+        listen_fds[nlisten++] = fd;
+    }
+    /* inherited from a master that ran more workers, nobody would accept
+     * on the surplus */
+    while (nlisten > wanted)
+        close(listen_fds[--nlisten]);
+    return 0;
+}
+
+static void spawn(int id)
+{
+    worker_slot_t *slot = &slots[id];
+    struct sigaction sa;
+    sigset_t all;
+    char title[64];
+    pid_t pid;
+    int i, fd = listen_fds[conf->reuseport ? id : 0];
+
+    pid = fork();
+    if (pid == -1) {
+        perror("master: fork");
+        slot->respawn_at = time(NULL) + RESPAWN_DELAY;
+        return;
+    }
+    if (pid > 0) {
+        slot->pid = pid;
+        slot->started = time(NULL);
+        slot->respawn_at = 0;
+        return;
+    }
+
+    /* the worker: the master's signals back to their defaults, SIGQUIT
+     * asks for a graceful exit, and the master going away takes it along */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = on_quit;
+    sigaction(SIGQUIT, &sa, NULL);
+    sigfillset(&all);
+    sigprocmask(SIG_UNBLOCK, &all, NULL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != master_pid)
+        _exit(0);
+
+    for (i = 0; i < nlisten; i++)
+        if (listen_fds[i] != fd)
+            close(listen_fds[i]);
+
+    if (conf->numa)
+        topo_place(id);
+    else
+        active_cpu(id);
+    snprintf(title, sizeof(title), "worker process %d", id);
+    setProcTitle(title, 0);
+
+    exit(conf->worker(id, fd));
+}
+
+/* fork the new binary with the listening sockets left open across the exec */
+static void reload(void)
+{
+    char env[MAX_WORKERS * 12];
+    size_t len = 0;
+    sigset_t all;
+    pid_t pid;
+    int i;
+
+    if (reload_pid > 0) {
+        fprintf(stderr, "master: an upgrade is already under way\n");
+        return;
+    }
+
+    for (i = 0; i < nlisten; i++)
+        len += snprintf(env + len, sizeof(env) - len, "%s%d",
+                        i ? "," : "", listen_fds[i]);
+
+    pid = fork();
+    if (pid == -1) {
+        perror("master: fork");
+        return;
+    }
+    if (pid > 0) {
+        reload_pid = pid;
+        return;
+    }
+
+    sigfillset(&all);
+    sigprocmask(SIG_UNBLOCK, &all, NULL);
+    setenv(LISTEN_FDS_ENV, env, 1);
+    execv(process_exe, _argv_copy);
+    perror("master: execv");
+    _exit(1);
+}
+
+static void signal_workers(int sig)
+{
+    int i;
+
+    for (i = 0; i < nworkers; i++)
+        if (slots[i].pid > 0)
+            kill(slots[i].pid, sig);
+}
+
+static int running_workers(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < nworkers; i++)
+        n += slots[i].pid > 0;
+    return n;
+}
+
+static void reap(void)
+{
+    pid_t pid;
+    int status, i;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == reload_pid) {
+            fprintf(stderr, "master: the new binary exited (status %d), "
+                    "going on with this one\n", status);
+            reload_pid = 0;
+            continue;
+        }
+        for (i = 0; i < nworkers; i++) {
+            worker_slot_t *slot = &slots[i];
+
+            if (slot->pid != pid)
+                continue;
+            slot->pid = 0;
+            if (stopping)
+                break;
+            if (WIFSIGNALED(status))
+                fprintf(stderr, "master: worker %d (pid %d) killed by "
+                        "signal %d, respawning\n", i, pid, WTERMSIG(status));
+            else
+                fprintf(stderr, "master: worker %d (pid %d) exited with %d, "
+                        "respawning\n", i, pid, WEXITSTATUS(status));
+            /* no fork loop when it dies at startup */
+            if (time(NULL) - slot->started < RESPAWN_DELAY)
+                slot->respawn_at = time(NULL) + RESPAWN_DELAY;
+            else
+                spawn(i);
+            break;
+        }
+    }
+}
+
+static void respawn_due(void)
+{
+    time_t now = time(NULL);
+    int i;
+
+    for (i = 0; i < nworkers; i++)
+        if (slots[i].respawn_at && slots[i].respawn_at <= now)
+            spawn(i);
+}
+
+int master_run(int argc, char **argv, const master_conf_t *c)
+{
+    struct timespec tick = { 1, 0 };
+    siginfo_t info;
+    sigset_t set;
+    const char *env;
+    char *port;
+    int i, sig;
+
+    conf = c;
+    nworkers = c->workers > 0 ? c->workers
+                              : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > MAX_WORKERS)
+        nworkers = MAX_WORKERS;
+
+    /* before the title is written over argv, where irq_if may live */
+    if (c->numa) {
+        topo_init(c->irq_if);
+        if (c->irq_if != NULL && topo_irq_affine(c->irq_if, nworkers) == -1)
+            fprintf(stderr, "master: could not move the interrupts of %s\n",
+                    c->irq_if);
+    }
+
+    /* the title is written over argv, and the port may live there */
+    port = strdup(c->port);
+    initproctitle(argc, argv);
+    setProcTitle("master process", 1);
+
+    env = getenv(LISTEN_FDS_ENV);
+    if (env != NULL) {
+        inherit_listeners(env);
+        unsetenv(LISTEN_FDS_ENV);
+    } else if (c->daemon) {
+        daemonize();
+    }
+    master_pid = getpid();
+    if (open_listeners(port, c->reuseport ? nworkers : 1) == -1) {
+        free(port);
+        return -1;
+    }
+    free(port);
+
+    /* daemonize ignores SIGCHLD, which would reap the workers for us */
+    signal(SIGCHLD, SIG_DFL);
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGQUIT);
+    sigaddset(&set, SIGUSR2);
+    sigaddset(&set, SIGHUP);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    for (i = 0; i < nworkers; i++)
+        spawn(i);
+
+    /* an upgrade: the old master hands over once our workers are up */
+    if (env != NULL && getppid() != 1)
+        kill(getppid(), SIGQUIT);
+
+    while (!stopping || running_workers() > 0) {
+        sig = sigtimedwait(&set, &info, &tick);
+        switch (sig) {
+        case SIGCHLD:
+            reap();
+            break;
+        case SIGTERM:
+        case SIGINT:
+            stopping = 1;
+            signal_workers(SIGTERM);
+            break;
+        case SIGQUIT:
+            stopping = 1;
+            signal_workers(SIGQUIT);
+            break;
+        case SIGUSR2:
+            if (!stopping)
+                reload();
+            break;
+        default:
+            break;
+        }
+        if (!stopping)
+            respawn_due();
+    }
+
+    for (i = 0; i < nlisten; i++)
+        close(listen_fds[i]);
+    return 0;
+}
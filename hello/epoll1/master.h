@@ -0,0 +1,62 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * master: a pre-fork master/worker supervisor for the epoll servers, on
+ * top of processtitle.c.
+ *
+ * The master binds the listening sockets, one shared by every worker or
+ * one SO_REUSEPORT socket per worker, and forks one worker per core, each
+ * pinned with active_cpu and titled "worker process N". The sockets stay
+ * open in the master, so connections that arrive while a worker is down
+ * wait in its backlog for the replacement. With numa set the workers are
+ * placed with topo.c instead: spread over the NUMA nodes, each on the
+ * memory of its own node, and the interrupts of the NIC irq_if (when
+ * given) are pointed at their CPUs.
+ *
+ * The master only handles signals:
+ *   SIGCHLD          a worker that died is forked again, on the same cpu
+ *                    and socket (after a second if it died young)
+ *   SIGTERM, SIGINT  workers get SIGTERM, the master exits once they did
+ *   SIGQUIT          graceful: workers get SIGQUIT, stop accepting and
+ *                    leave when their connections are done
+ *   SIGUSR2          binary upgrade: the master re-executes its binary
+ *                    with the listening sockets passed in MASTER_LISTEN_FDS;
+ *                    the new master starts its workers on the same
+ *                    sockets and then sends SIGQUIT to the old one. No
+ *                    connection is refused at any point.
+ *
+ * A worker runs conf->worker(id, listen_fd) with the signals back to
+ * their defaults, and exits with its return value. It should stop
+ * accepting on SIGQUIT (see master_quit_requested).
+ *
+ * build with : gcc -c master.c processtitle.c topo.c and link them into the program
+ */
+
+typedef struct master_conf {
+    const char *port;
+    int workers;                /* 0 for one per online cpu */
+    int reuseport;              /* a listening socket per worker */
+    int daemon;                 /* detach with daemonize() */
+    int numa;                   /* place the workers with topo_place */
+    const char *irq_if;         /* NIC whose interrupts follow the workers */
+    int (*worker)(int id, int listen_fd);
+} master_conf_t;
+
+/* argc and argv as main got them: the master re-executes them on
+ * SIGUSR2 and writes the titles over them. Returns when the master is
+ * done, non-zero when it could not start. */
+int master_run(int argc, char **argv, const master_conf_t *conf);
+
+/* in a worker: SIGQUIT arrived */
+int master_quit_requested(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* MASTER_H */
@@ -14,31 +14,40 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
+#include <stddef.h>
 #include <iostream>
 
 #include "lxx_net.h"
+#include "uring.h"
+#include "conntab.h"
+#include "twheel.h"
 
 using namespace std;
 #define MAX_EPOLL_SIZE 500
-#define MAX_CLIENT_SIZE 500
 #define MAX_IP_LEN      16
-#define MAX_CLIENT_BUFF_LEN 1024
 #define QUEUE_LEN 500
 #define BUFF_LEN 1024
+#define IDLE_TIMEOUT_MS  60000      // Nothing received for this long
+#define WRITE_TIMEOUT_MS 30000      // An echo the peer does not take
 int fd_epoll = -1;
 int fd_listen = -1;
 
-// The customer end connection
+// The customer end connection, found by its fd in the connection table.
+// It only holds a buffer while the peer has not taken all of its echo.
 typedef struct {
   int fd;                           // The connection handle
-  char host[MAX_IP_LEN];           // IP address
   int port;                         // Port
-  int len;                          // Data buffer size
-  char buff[MAX_CLIENT_BUFF_LEN];   // Buffer data
-  bool  status;                     // State
+  char host[MAX_IP_LEN];           // IP address
+  char *buff;                       // Unsent data, NULL when there is none
+  size_t cap;                       // Size of buff
+  size_t off;                       // Sent so far
+  size_t len;                       // Data in buff
+  twheel_timer_t timer;             // Idle or write stall deadline
 } client_t;
 
-client_t *ptr_cli = NULL;
+conntab_t *clients = NULL;
+twheel_t *timers = NULL;
 
 // Join epoll
 int epoll_add(int fd_epoll, int fd, struct epoll_event *ev) {
@@ -72,26 +81,109 @@ int epoll_del(int fd_epoll, int fd) {
   return 0;
 }
 
+int epoll_mod(int fd_epoll, int fd, uint32_t events) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(fd_epoll, EPOLL_CTL_MOD, fd, &ev) <0) {
+    fprintf(stderr, "epoll_mod failed(epoll_ctl)[fd_epoll:%d,fd:%d][%s]\n",
+          fd_epoll, fd, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static void client_close(client_t *cli) {
+  int fd = cli->fd;
+
+  epoll_del(fd_epoll, fd);
+  twheel_del(timers, &cli->timer);
+  conntab_buf_put(clients, cli->buff, cli->cap);
+  conntab_del(clients, fd);
+}
+
+// Echo data. What the peer does not take goes to a pooled buffer, and the
+// connection waits for EPOLLOUT instead of reading until it is sent.
+static int client_send(client_t *cli, const char *data, size_t n) {
+  ssize_t sent = send(cli->fd, data, n, MSG_NOSIGNAL);
+
+  if (sent <0) {
+    if (errno != EAGAIN) {
+      return -1;
+    }
+    sent = 0;
+  }
+  if ((size_t)sent == n) {
+    return 0;
+  }
+  cli->buff = (char *)conntab_buf_get(clients, n - sent, &cli->cap);
+  if (cli->buff == NULL) {
+    return -1;
+  }
+  memcpy(cli->buff, data + sent, n - sent);
+  cli->off = 0;
+  cli->len = n - sent;
+  twheel_add(timers, &cli->timer, WRITE_TIMEOUT_MS);
+  return epoll_mod(fd_epoll, cli->fd, EPOLLOUT);
+}
+
 // Receive data
-void do_read_data(int idx) {
-  if (idx >= MAX_CLIENT_SIZE) {
+void do_read_data(int fd) {
+  client_t *cli = (client_t *)conntab_get(clients, fd);
+  char buf[BUFF_LEN];
+
+  if (cli == NULL) {
     return;
   }
-  int n;
-  size_t pos = ptr_cli[idx].len;
+  ssize_t n = recv(fd, buf, sizeof(buf), 0);
+  if (n > 0) { // Buffer data have been received
+    fprintf(stdout, "[IP:%s,port:%d], data:%.*s\n", cli->host, cli->port, (int)n, buf);
+    twheel_touch(timers, &cli->timer, IDLE_TIMEOUT_MS);
+    if (client_send(cli, buf, n) <0) {
+      client_close(cli);
+    }
+  } else if (n == 0 || errno != EAGAIN) {  // To end the connection is closed
+    fprintf(stdout, "The Client closed(read)[IP:%s,port:%d]\n", cli->host, cli->port);
+    client_close(cli);
+  }
+}
+
+// Send what is left of an echo, and go back to reading once it is out
+void do_write_data(int fd) {
+  client_t *cli = (client_t *)conntab_get(clients, fd);
 
-  if ((n = recv(ptr_cli[idx].fd, ptr_cli[idx].buff+pos, MAX_CLIENT_BUFF_LEN-pos, 0))) { // Buffer data have been received
-    fprintf(stdout, "[IP:%s,port:%d], data:%s\n", ptr_cli[idx].host, ptr_cli[idx].port, ptr_cli[idx].buff);
-    send(ptr_cli[idx].fd, ptr_cli[idx].buff, pos+1, 0);
-  } else if (n > 0) { // Buffer zone and data readability
-    ptr_cli[idx].len += n;
-  } else if (errno != EAGAIN) {  // To end the connection is closed
-    fprintf(stdout, "The Client closed(read)[IP:%s,port:%d]\n", ptr_cli[idx].host, ptr_cli[idx].port);
-    epoll_del(fd_epoll, ptr_cli[idx].fd);
-    ptr_cli[idx].status = false;
+  if (cli == NULL || cli->buff == NULL) {
+    return;
+  }
+  ssize_t sent = send(fd, cli->buff + cli->off, cli->len - cli->off, MSG_NOSIGNAL);
+  if (sent <0) {
+    if (errno != EAGAIN) {
+      client_close(cli);
+    }
+    return;
+  }
+  cli->off += sent;
+  if (cli->off == cli->len) {
+    conntab_buf_put(clients, cli->buff, cli->cap);
+    cli->buff = NULL;
+    cli->cap = cli->off = cli->len = 0;
+    twheel_add(timers, &cli->timer, IDLE_TIMEOUT_MS);
+    if (epoll_mod(fd_epoll, fd, EPOLLIN) <0) {
+      client_close(cli);
+    }
+  } else if (sent > 0) {
+    twheel_touch(timers, &cli->timer, WRITE_TIMEOUT_MS);
   }
 }
 
+// A client that went quiet, or stopped taking its echo
+static void client_expired(twheel_timer_t *t, void *) {
+  client_t *cli = (client_t *)((char *)t - offsetof(client_t, timer));
+
+  fprintf(stdout, "The Client timed out[IP:%s,port:%d]\n", cli->host, cli->port);
+  client_close(cli);
+}
+
 // Accept new connections
 static void do_accept_client() {
   struct epoll_event ev;
@@ -107,36 +199,26 @@ static void do_accept_client() {
       return;
     }
 
-    int i = 0;
-    bool flag = true;
-
-    // Looking for the right.
-    for (i = 0; i <MAX_CLIENT_SIZE; i++) {
-      if (!ptr_cli[i].status) {
-        ptr_cli[i].port = cliaddr.sin_port;
-        snprintf(ptr_cli[i].host, sizeof(ptr_cli[i].host), inet_ntoa(cliaddr.sin_addr));
-        ptr_cli[i].len = 0;
-        ptr_cli[i].fd = conn_fd;
-        ptr_cli[i].status = true;
-        flag = false;
-        break;
-      }
-    }
+    client_t *cli = (client_t *)conntab_add(clients, conn_fd);
 
-    if (flag) {// No connection available
+    if (cli == NULL) {// No memory for the connection
       close(conn_fd);
-      fprintf(stderr, "do_accept_client failed(not found unuse client)[%s:%d]\n",
+      fprintf(stderr, "do_accept_client failed(conntab_add)[%s:%d]\n",
                     inet_ntoa(cliaddr.sin_addr), cliaddr.sin_port);
     } else {
+      cli->port = cliaddr.sin_port;
+      snprintf(cli->host, sizeof(cli->host), "%s", inet_ntoa(cliaddr.sin_addr));
+      cli->fd = conn_fd;
       ev.events = EPOLLIN;
-      ev.data.u32 = i | 0x10000000;
+      ev.data.fd = conn_fd;
       if (epoll_add(fd_epoll, conn_fd, &ev) <0) {
-        ptr_cli[i].status = false;
-        close(ptr_cli[i].fd);
+        conntab_del(clients, conn_fd);
+        close(conn_fd);
         fprintf(stderr, "do_accept_client failed(epoll_add)[%s:%d]",
         inet_ntoa(cliaddr.sin_addr), cliaddr.sin_port);
         return;
       }
+      twheel_add(timers, &cli->timer, IDLE_TIMEOUT_MS);
 
       fprintf(stdout, "do_accept_client success[%s:%d]",
             inet_ntoa(cliaddr.sin_addr), cliaddr.sin_port);
@@ -144,9 +226,66 @@ static void do_accept_client() {
   }
 }
 
+// io_uring backend (-u): uring.c accepts, receives and sends (and keeps
+// the output), the client record lives in uring_conn_t.data
+static int uring_open(uring_conn_t *c) {
+  struct sockaddr_in cliaddr;
+  socklen_t cliaddr_len = sizeof(cliaddr);
+  client_t *cli = (client_t *)conntab_add(clients, c->fd);
+
+  getpeername(c->fd, (struct sockaddr *)&cliaddr, &cliaddr_len);
+  if (cli == NULL) {
+    fprintf(stderr, "do_accept_client failed(conntab_add)[%s:%d]\n",
+          inet_ntoa(cliaddr.sin_addr), cliaddr.sin_port);
+    return -1;
+  }
+  cli->port = cliaddr.sin_port;
+  snprintf(cli->host, sizeof(cli->host), "%s", inet_ntoa(cliaddr.sin_addr));
+  cli->fd = c->fd;
+  c->data = cli;
+  return 0;
+}
+
+// Echo what arrived
+static int uring_data(uring_conn_t *c, const char *buf, size_t len) {
+  client_t *cli = (client_t *)c->data;
+
+  fprintf(stdout, "[IP:%s,port:%d], data:%.*s\n", cli->host, cli->port, (int)len, buf);
+  return uring_send(c, buf, len);
+}
+
+static void uring_closed(uring_conn_t *c) {
+  client_t *cli = (client_t *)c->data;
+
+  fprintf(stdout, "The Client closed(read)[IP:%s,port:%d]\n", cli->host, cli->port);
+  conntab_del(clients, c->fd);
+}
+
+static int uring_main() {
+  static const uring_ops_t ops = { uring_open, uring_data, uring_closed };
+  uring_loop_t *loop = uring_create(fd_listen, &ops, 0, 0);
+
+  if (loop == NULL) {
+    fprintf(stderr, "create io_uring failed[%s]\n", strerror(errno));
+    close(fd_listen);
+    return -1;
+  }
+  if (uring_run(loop) <0) {
+    fprintf(stderr, "io_uring_enter failed[%s]\n", strerror(errno));
+  }
+  uring_destroy(loop);
+  close(fd_listen);
+  return 0;
+}
 
 int main(int argc, char **argv) {
   unsigned short port = 12345;
+  bool use_uring = false;
+  if (argc >= 2 && strcmp(argv[1], "-u") == 0) {
+    use_uring = true;
+    argv++;
+    argc--;
+  }
   if(argc == 2){
       port = atoi(argv[1]);
   }
@@ -155,6 +294,15 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+  if ((clients = conntab_create(sizeof(client_t))) == NULL) {
+    fprintf(stderr, "create connection table failed\n");
+    close(fd_listen);
+    return -1;
+  }
+  if (use_uring) {
+    return uring_main();
+  }
+
   fd_epoll = epoll_create(MAX_EPOLL_SIZE);
   if (fd_epoll <0) {
     fprintf(stderr, "create epoll failed.%d\n", fd_epoll);
@@ -175,10 +323,17 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  ptr_cli = new client_t[MAX_CLIENT_SIZE];
+  if ((timers = twheel_create(0, 0, client_expired, NULL)) == NULL) {
+    fprintf(stderr, "create timer wheel failed\n");
+    close(fd_epoll);
+    close(fd_listen);
+    return -1;
+  }
+
   struct epoll_event events[MAX_EPOLL_SIZE];
   for (;;) {
-    int nfds = epoll_wait(fd_epoll, events, MAX_EPOLL_SIZE, 10);
+    int nfds = epoll_wait(fd_epoll, events, MAX_EPOLL_SIZE, twheel_timeout(timers));
+    twheel_update(timers);
 
     if (nfds <0) {
       int err = errno;
@@ -189,14 +344,20 @@ int main(int argc, char **argv) {
     }
 
     for (int i = 0; i <nfds; i++) {
-      if (events[i].data.u32 & 0x10000000) {
-        // Receive data
-        do_read_data(events[i].data.u32 & 0x0FFFFFFF);
-      } else if(events[i].data.fd == fd_listen) {
+      if (events[i].data.fd == fd_listen) {
         // Accept new connections
         do_accept_client();
+      } else if (events[i].events & EPOLLOUT) {
+        // Send the rest of an echo
+        do_write_data(events[i].data.fd);
+      } else {
+        // Receive data
+        do_read_data(events[i].data.fd);
       }
     }
+
+    // Expired clients are closed once the batch is done with
+    twheel_run(timers);
   }
   return 0;
 }
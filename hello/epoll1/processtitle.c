@@ -10,20 +10,16 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <sched.h>
-//#include "setproctitle.h"
+#include "processtitle.h"
 char *process_char_last;
 char process_chdir[924];
 char process_name[100];
+char process_exe[1024];
 char **_argv;
+char **_argv_copy;
 int _argc;
 static int _signal_handler = 0;
 extern char **environ;
-extern void initproctitle (int argc, char **argv);
-extern void setProcTitle (const char *title, int is_master);
-void daemonize();
-void signal_handler ( int sig );
-void active_cpu ( uint32_t active_cpu );
-//end h
 #ifdef linux
 
 static inline void print_cpu_mask ( cpu_set_t cpu_mask )
@@ -94,7 +90,10 @@ void initproctitle (int argc, char **argv)
     size_t n = 0;
 	//get process name
 #ifdef linux
-    n = readlink ( "/proc/self/exe" , process_chdir , sizeof ( process_chdir ) );
+    ssize_t len = readlink ( "/proc/self/exe" , process_chdir , sizeof ( process_chdir ) - 1 );
+
+    n = len > 0 ? len : 0;
+    process_chdir[n] = '\0';
 #else
     uint32_t new_argv0_s = sizeof ( process_chdir );
 
@@ -104,6 +103,7 @@ void initproctitle (int argc, char **argv)
 
 #endif
 	    i = n;
+    snprintf ( process_exe, sizeof ( process_exe ), "%s", process_chdir );
 
     while ( n > 1 ) if ( process_chdir[n--] == '/' ) {
             strncpy ( process_name, ( ( char * ) process_chdir ) + n + 2, i - n );
@@ -113,28 +113,31 @@ void initproctitle (int argc, char **argv)
 
     chdir ( process_chdir );
 
-    n = 0;
+    /* argv and the environment strings are one block, the title may use
+     * all of it: keep a copy of argv (for the master's title and for
+     * re-executing), and move the environment out of the way */
+    process_char_last = argv[0];
 
-    for ( i = 0; argv[i]; ++i ) {
-        n += strlen ( argv[i] ) + 1;
+    for ( i = 0; i < argc; ++i ) {
+        process_char_last += strlen ( argv[i] ) + 1;
     }
 
-    char *raw = malloc ( n );
-
-    for ( i = 0; argv[i]; ++i ) {
-        memcpy ( raw, argv[i], strlen ( argv[i] ) + 1 );
-        environ[i] = raw;
-        raw += strlen ( environ[i] ) + 1;
+    for ( i = 0; environ[i]; ++i ) {
+        if ( environ[i] == process_char_last ) {
+            process_char_last += strlen ( environ[i] ) + 1;
+        }
     }
 
-    process_char_last = argv[0];
+    _argv_copy = malloc ( ( argc + 1 ) * sizeof ( char * ) );
 
     for ( i = 0; i < argc; ++i ) {
-        process_char_last += strlen ( argv[i] ) + 1;
+        _argv_copy[i] = strdup ( argv[i] );
     }
 
+    _argv_copy[argc] = NULL;
+
     for ( i = 0; environ[i]; ++i ) {
-        process_char_last += strlen ( environ[i] ) + 1;
+        environ[i] = strdup ( environ[i] );
     }
 
    // return process_chdir;
@@ -147,11 +150,11 @@ void setProcTitle ( const char *title, int is_master )
     memset ( p, 0x00, process_char_last - p );
 
     if ( is_master ) {
-        snprintf ( p, process_char_last - p, "%s: %s %s", process_name, title, process_chdir );
+        size_t len = snprintf ( p, process_char_last - p, "%s: %s %s", process_name, title, process_chdir );
         int i = 1;
 
-        for ( i = 1; i < _argc; i++ ) {
-            sprintf ( p, "%s %s", p, environ[i] );
+        for ( i = 1; i < _argc && len < ( size_t ) ( process_char_last - p ); i++ ) {
+            len += snprintf ( p + len, process_char_last - p - len, " %s", _argv_copy[i] );
         }
 
     } else {
@@ -219,6 +222,7 @@ int forkProcess ( void ( *func ) () )
     return ret;
 }
 
+#ifdef PROCESSTITLE_DEMO
 static void worker_main (  )
 {
 
@@ -238,3 +242,4 @@ int main(int argc, char *argv[])
 	sleep(300);  // you can ps now
     return 0;
 }
+#endif
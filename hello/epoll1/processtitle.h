@@ -0,0 +1,38 @@
+#ifndef PROCESSTITLE_H
+#define PROCESSTITLE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * processtitle: process titles, daemonizing and cpu pinning, from alilua.
+ *
+ * initproctitle must run before anything else looks at argv's memory: it
+ * copies argv to _argv_copy, moves the environment out of the way, and
+ * changes to the directory of the executable (process_exe is its full
+ * path). setProcTitle then writes over the old argv block, so ps shows
+ * "name: title".
+ *
+ * build with : gcc -c processtitle.c and link processtitle.o into the program,
+ *              or gcc -DPROCESSTITLE_DEMO processtitle.c for the demo
+ */
+
+extern char process_exe[];
+extern char **_argv_copy;
+
+void initproctitle (int argc, char **argv);
+void setProcTitle (const char *title, int is_master);
+void daemonize();
+void signal_handler ( int sig );
+/* pin the calling process to cpu active_cpu modulo the online cpus */
+void active_cpu ( uint32_t active_cpu );
+int forkProcess ( void ( *func ) () );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* PROCESSTITLE_H */
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reqtmpl.h"
+
+typedef struct pool_s {
+    char name[32];
+    int range;                  /* lo..hi rather than a list */
+    long long lo, hi;
+    char **values;
+    int nvalues;
+} pool_t;
+
+typedef struct tmpl_s {
+    char *src;                  /* with {{name}} still in it */
+    size_t src_len;
+    int copies;                 /* rendered, 1 when there is nothing to fill */
+    char *out;                  /* the copies, back to back */
+    size_t *off;                /* copies + 1 offsets into out */
+} tmpl_t;
+
+struct reqtmpl_s {
+    pool_t vars[REQTMPL_MAX_VARS];
+    int nvars;
+    tmpl_t seq[REQTMPL_MAX_SEQ];
+    int nseq;
+};
+
+reqtmpl_t *reqtmpl_create(void)
+{
+    return calloc(1, sizeof(reqtmpl_t));
+}
+
+void reqtmpl_destroy(reqtmpl_t *t)
+{
+    int i, j;
+
+    for (i = 0; i < t->nvars; i++) {
+        for (j = 0; j < t->vars[i].nvalues; j++)
+            free(t->vars[i].values[j]);
+        free(t->vars[i].values);
+    }
+    for (i = 0; i < t->nseq; i++) {
+        free(t->seq[i].src);
+        free(t->seq[i].out);
+        free(t->seq[i].off);
+    }
+    free(t);
+}
+
+static int hexval(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+int reqtmpl_unescape(char *s)
+{
+    char *out = s, *in = s;
+
+    while (*in) {
+        if (*in != '\\' || in[1] == '\0') {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        switch (*in) {
+        case 'r': *out++ = '\r'; in++; break;
+        case 'n': *out++ = '\n'; in++; break;
+        case 't': *out++ = '\t'; in++; break;
+        case 'x':
+            if (hexval(in[1]) >= 0 && hexval(in[2]) >= 0) {
+                *out++ = hexval(in[1]) * 16 + hexval(in[2]);
+                in += 3;
+                break;
+            }
+            /* fall through */
+        default: *out++ = *in++; break;
+        }
+    }
+    *out = '\0';
+    return out - s;
+}
+
+static int pool_push(pool_t *p, const char *v, size_t len)
+{
+    char **values = realloc(p->values, (p->nvalues + 1) * sizeof(char *));
+
+    if (values == NULL)
+        return -1;
+    p->values = values;
+    if ((p->values[p->nvalues] = strndup(v, len)) == NULL)
+        return -1;
+    p->nvalues++;
+    return 0;
+}
+
+int reqtmpl_var(reqtmpl_t *t, const char *spec)
+{
+    const char *eq = strchr(spec, '=');
+    pool_t *p;
+
+    if (eq == NULL || eq == spec || (size_t)(eq - spec) >= sizeof(p->name)) {
+        fprintf(stderr, "reqtmpl: want name=values, got %s\n", spec);
+        return -1;
+    }
+    if (t->nvars == REQTMPL_MAX_VARS) {
+        fprintf(stderr, "reqtmpl: more than %d variables\n", REQTMPL_MAX_VARS);
+        return -1;
+    }
+    p = &t->vars[t->nvars];
+    memset(p, 0, sizeof(*p));
+    memcpy(p->name, spec, eq - spec);
+    spec = eq + 1;
+
+    if (sscanf(spec, "%lld..%lld", &p->lo, &p->hi) == 2 && strstr(spec, "..")) {
+        if (p->hi < p->lo) {
+            fprintf(stderr, "reqtmpl: empty range for %s\n", p->name);
+            return -1;
+        }
+        p->range = 1;
+    } else if (spec[0] == '@') {
+        char line[4096];
+        FILE *fp = fopen(spec + 1, "r");
+
+        if (fp == NULL) {
+            perror(spec + 1);
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            size_t len = strcspn(line, "\r\n");
+
+            if (len > 0 && pool_push(p, line, len) != 0)
+                break;
+        }
+        fclose(fp);
+    } else {
+        while (*spec) {
+            size_t len = strcspn(spec, ",");
+
+            if (pool_push(p, spec, len) != 0)
+                break;
+            spec += len + (spec[len] == ',');
+        }
+    }
+    if (!p->range && p->nvalues == 0) {
+        fprintf(stderr, "reqtmpl: no values for %s\n", p->name);
+        return -1;
+    }
+    t->nvars++;
+    return 0;
+}
+
+int reqtmpl_add(reqtmpl_t *t, const char *text, size_t len)
+{
+    tmpl_t *q;
+
+    if (len == 0) {
+        fprintf(stderr, "reqtmpl: empty request\n");
+        return -1;
+    }
+    if (t->nseq == REQTMPL_MAX_SEQ) {
+        fprintf(stderr, "reqtmpl: more than %d requests\n", REQTMPL_MAX_SEQ);
+        return -1;
+    }
+    q = &t->seq[t->nseq];
+    memset(q, 0, sizeof(*q));
+    if ((q->src = malloc(len + 1)) == NULL)
+        return -1;
+    memcpy(q->src, text, len);
+    q->src[len] = '\0';
+    q->src_len = len;
+    t->nseq++;
+    return 0;
+}
+
+int reqtmpl_load(reqtmpl_t *t, const char *file)
+{
+    char line[8192], *req = NULL;
+    size_t len = 0, cap = 0;
+    int ret = 0;
+    FILE *fp = fopen(file, "r");
+
+    if (fp == NULL) {
+        perror(file);
+        return -1;
+    }
+    for (;;) {
+        char *got = fgets(line, sizeof(line) - 2, fp);
+        size_t n;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (got == NULL || strcmp(line, "%%") == 0) {
+            if (len > 0 && (ret = reqtmpl_add(t, req, len)) != 0)
+                break;
+            len = 0;
+            if (got == NULL)
+                break;
+            continue;
+        }
+        if (line[0] == '#')
+            continue;
+        n = reqtmpl_unescape(line);
+        line[n++] = '\r';
+        line[n++] = '\n';
+        if (len + n > cap) {
+            char *p = realloc(req, cap = (len + n) * 2);
+
+            if (p == NULL) {
+                ret = -1;
+                break;
+            }
+            req = p;
+        }
+        memcpy(req + len, line, n);
+        len += n;
+    }
+    free(req);
+    fclose(fp);
+    if (ret == 0 && t->nseq == 0) {
+        fprintf(stderr, "reqtmpl: no request in %s\n", file);
+        ret = -1;
+    }
+    return ret;
+}
+
+static pool_t *find_var(reqtmpl_t *t, const char *name, size_t len)
+{
+    int i;
+
+    for (i = 0; i < t->nvars; i++)
+        if (strlen(t->vars[i].name) == len && memcmp(t->vars[i].name, name, len) == 0)
+            return &t->vars[i];
+    return NULL;
+}
+
+/* append v to q->out, growing it */
+static int emit(tmpl_t *q, size_t *cap, const char *v, size_t len)
+{
+    size_t used = q->off[q->copies + 1];
+
+    if (used + len > *cap) {
+        char *out = realloc(q->out, *cap = (used + len) * 2 + 256);
+
+        if (out == NULL)
+            return -1;
+        q->out = out;
+    }
+    memcpy(q->out + used, v, len);
+    q->off[q->copies + 1] += len;
+    return 0;
+}
+
+static int render_one(reqtmpl_t *t, tmpl_t *q, size_t *cap, unsigned int *seed)
+{
+    const char *p = q->src, *end = q->src + q->src_len;
+
+    while (p < end) {
+        const char *open = strstr(p, "{{"), *close;
+        char num[32];
+        pool_t *v;
+
+        if (open == NULL || (close = strstr(open + 2, "}}")) == NULL)
+            return emit(q, cap, p, end - p);
+        if (emit(q, cap, p, open - p) != 0)
+            return -1;
+        if ((v = find_var(t, open + 2, close - open - 2)) == NULL) {
+            fprintf(stderr, "reqtmpl: no values for {{%.*s}}\n",
+                    (int)(close - open - 2), open + 2);
+            return -1;
+        }
+        if (v->range) {
+            unsigned long long span = v->hi - v->lo + 1;
+            unsigned long long r = (unsigned long long)rand_r(seed) << 31 | rand_r(seed);
+            int n = snprintf(num, sizeof(num), "%lld",
+                             v->lo + (long long)(span ? r % span : r));
+
+            if (emit(q, cap, num, n) != 0)
+                return -1;
+        } else {
+            /* high bits, rand_r is weak in the low ones */
+            char *s = v->values[(long long)rand_r(seed) * v->nvalues / ((long long)RAND_MAX + 1)];
+
+            if (emit(q, cap, s, strlen(s)) != 0)
+                return -1;
+        }
+        p = close + 2;
+    }
+    return 0;
+}
+
+int reqtmpl_render(reqtmpl_t *t, int count, unsigned int seed)
+{
+    int i, j;
+
+    for (i = 0; i < t->nseq; i++) {
+        tmpl_t *q = &t->seq[i];
+        size_t cap = 0;
+
+        /* a template without placeholders needs a single copy */
+        q->copies = 0;
+        j = strstr(q->src, "{{") ? (count > 0 ? count : 1) : 1;
+        free(q->off);
+        if ((q->off = calloc(j + 1, sizeof(size_t))) == NULL)
+            return -1;
+        while (q->copies < j) {
+            q->off[q->copies + 1] = q->off[q->copies];
+            if (render_one(t, q, &cap, &seed) != 0)
+                return -1;
+            q->copies++;
+        }
+    }
+    return 0;
+}
+
+int reqtmpl_seq(const reqtmpl_t *t)
+{
+    return t->nseq;
+}
+
+const char *reqtmpl_get(const reqtmpl_t *t, int seq, unsigned int n, int *len)
+{
+    const tmpl_t *q = &t->seq[seq];
+
+    n %= q->copies;
+    *len = (int)(q->off[n + 1] - q->off[n]);
+    return q->out + q->off[n];
+}
@@ -0,0 +1,50 @@
+#ifndef REQTMPL_H
+#define REQTMPL_H
+
+#include <stddef.h>    /* for size_t type */
+
+/*
+ * Request templates for the load generators (sockevent.c).
+ *
+ * A template is a request with {{name}} placeholders; a sequence of them
+ * is what every connection sends in turn. Each placeholder draws from a
+ * pool of values declared with reqtmpl_var. All the formatting happens in
+ * reqtmpl_render, which writes `count' finished copies of every request
+ * up front, each with its own random pick from the pools; sending then
+ * only indexes into that table.
+ *
+ * Pools are declared as
+ *   name=lo..hi     the integers lo to hi
+ *   name=@file      one value per line of file
+ *   name=a,b,c      the listed values
+ *
+ * A template file holds the requests of the sequence separated by lines
+ * holding only %%. Every other line is one line of the request and is
+ * sent followed by CRLF, so a blank line ends the head; lines starting
+ * with # are comments, and \r \n \t \xHH escapes work as on the command
+ * line.
+ */
+
+#define REQTMPL_MAX_SEQ   16
+#define REQTMPL_MAX_VARS  32
+
+typedef struct reqtmpl_s reqtmpl_t;
+
+reqtmpl_t *reqtmpl_create(void);
+void reqtmpl_destroy(reqtmpl_t *t);
+
+/* these return -1 after printing what is wrong */
+int reqtmpl_var(reqtmpl_t *t, const char *spec);
+int reqtmpl_add(reqtmpl_t *t, const char *text, size_t len);
+int reqtmpl_load(reqtmpl_t *t, const char *file);
+int reqtmpl_render(reqtmpl_t *t, int count, unsigned int seed);
+
+int reqtmpl_seq(const reqtmpl_t *t);
+
+/* the n-th rendering of request seq, n taken modulo the count rendered */
+const char *reqtmpl_get(const reqtmpl_t *t, int seq, unsigned int n, int *len);
+
+/* \r \n \t \\ and \xHH to bytes, in place, returns the new length */
+int reqtmpl_unescape(char *s);
+
+#endif    /* REQTMPL_H */
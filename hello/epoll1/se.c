@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "se.h"
+
+#ifndef EPOLLRDHUP
+#define EPOLLRDHUP 0x2000
+#endif
+
+/*
+ * Timer wheel, the classic kernel layout: the first level has 256 slots of
+ * one tick, each of the three next levels 64 slots covering the whole
+ * previous level. A timer sits in the level matching how far away it is
+ * and is cascaded one level down whenever the level below wraps, so adding
+ * and deleting are O(1) and every timer moves at most three times. The
+ * range is 2^26 ms, about 18 hours; later timers are clamped.
+ */
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TV_LEVELS 3
+#define MAX_TVAL ((1ULL << (TVR_BITS + TV_LEVELS * TVN_BITS)) - 1)
+
+typedef struct se_task_s se_task_t;
+
+struct se_task_s {
+    se_task_t *next;
+    se_task_proc_t func;
+    void *arg;
+};
+
+struct se_loop_s {
+    int epfd;
+    int size;
+    struct epoll_event *events;
+    int stop;
+
+    uint64_t now;               /* ms, CLOCK_MONOTONIC */
+    uint64_t timer_ticks;       /* the wheel has run up to here */
+    int ntimers;
+    int fired;                  /* timers run in this iteration */
+    se_timer_t tv1[TVR_SIZE];   /* list heads */
+    se_timer_t tvn[TV_LEVELS][TVN_SIZE];
+
+    se_ptr_t *free_list;        /* deleted in this batch, freed after it */
+
+    se_ptr_t wakeup;            /* eventfd, readable when tasks are posted */
+    se_task_t *tasks;           /* lock-free stack pushed by se_post */
+};
+
+static uint64_t clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_init(se_timer_t *head)
+{
+    head->prev = head->next = head;
+}
+
+static void list_add_tail(se_timer_t *head, se_timer_t *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(se_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+static void internal_add_timer(se_loop_t *loop, se_timer_t *t)
+{
+    uint64_t expire = t->expire;
+    uint64_t idx = expire - loop->timer_ticks;
+    se_timer_t *head;
+
+    if ((int64_t)idx < 0) {
+        /* already due, run it on the next tick */
+        head = &loop->tv1[loop->timer_ticks & TVR_MASK];
+    } else if (idx < TVR_SIZE) {
+        head = &loop->tv1[expire & TVR_MASK];
+    } else if (idx < 1ULL << (TVR_BITS + TVN_BITS)) {
+        head = &loop->tvn[0][(expire >> TVR_BITS) & TVN_MASK];
+    } else if (idx < 1ULL << (TVR_BITS + 2 * TVN_BITS)) {
+        head = &loop->tvn[1][(expire >> (TVR_BITS + TVN_BITS)) & TVN_MASK];
+    } else {
+        if (idx > MAX_TVAL) {
+            expire = loop->timer_ticks + MAX_TVAL;
+            t->expire = expire;
+        }
+        head = &loop->tvn[2][(expire >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK];
+    }
+    list_add_tail(head, t);
+}
+
+/* move every timer of one upper slot into the levels below, returns the
+ * slot index so the caller knows whether this level wrapped as well */
+static int cascade(se_loop_t *loop, int level, int index)
+{
+    se_timer_t *head = &loop->tvn[level][index];
+    se_timer_t *t = head->next, *next;
+
+    list_init(head);
+    for (; t != head; t = next) {
+        next = t->next;
+        internal_add_timer(loop, t);
+    }
+    return index;
+}
+
+#define TV_INDEX(loop, n) \
+    (((loop)->timer_ticks >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+static void run_timers(se_loop_t *loop)
+{
+    /* nothing to cascade, skip the idle stretch in one go */
+    if (loop->ntimers == 0) {
+        loop->timer_ticks = loop->now + 1;
+        return;
+    }
+
+    while (loop->timer_ticks <= loop->now) {
+        int index = loop->timer_ticks & TVR_MASK;
+        se_timer_t work, *t;
+
+        if (index == 0 &&
+            cascade(loop, 0, TV_INDEX(loop, 0)) == 0 &&
+            cascade(loop, 1, TV_INDEX(loop, 1)) == 0)
+            cascade(loop, 2, TV_INDEX(loop, 2));
+        loop->timer_ticks++;
+
+        /* detach the slot first, callbacks may add to it again */
+        if (loop->tv1[index].next == &loop->tv1[index])
+            continue;
+        work.next = loop->tv1[index].next;
+        work.prev = loop->tv1[index].prev;
+        work.next->prev = work.prev->next = &work;
+        list_init(&loop->tv1[index]);
+
+        while ((t = work.next) != &work) {
+            list_del(t);
+            loop->ntimers--;
+            loop->fired++;
+            t->func(t);
+        }
+    }
+}
+
+/* epoll_wait timeout: up to the next occupied first level slot, or the
+ * next cascade, or waitout when no timer is pending */
+static int next_timeout(se_loop_t *loop, int waitout)
+{
+    uint64_t i, limit;
+
+    if (loop->ntimers == 0)
+        return waitout;
+
+    /* at slot 0 the upper levels have not been cascaded yet, stop there */
+    limit = TVR_SIZE - (loop->timer_ticks & TVR_MASK);
+    if (limit == TVR_SIZE)
+        limit = 0;
+    for (i = 0; i < limit; i++) {
+        se_timer_t *head = &loop->tv1[(loop->timer_ticks + i) & TVR_MASK];
+
+        if (head->next != head)
+            break;
+    }
+    /* timer_ticks is now + 1 after run_timers, slot i is due in i + 1 ms */
+    i += loop->timer_ticks - loop->now;
+    if (waitout >= 0 && (uint64_t)waitout < i)
+        return waitout;
+    return (int)i;
+}
+
+uint64_t se_now(se_loop_t *loop)
+{
+    return loop->now;
+}
+
+void se_timer_add(se_loop_t *loop, se_timer_t *timer, int ms,
+                  se_timer_proc_t func, void *data)
+{
+    if (se_timer_pending(timer))
+        se_timer_del(loop, timer);
+    timer->func = func;
+    timer->data = data;
+    timer->expire = loop->now + (ms > 0 ? ms : 0);
+    internal_add_timer(loop, timer);
+    loop->ntimers++;
+}
+
+void se_timer_del(se_loop_t *loop, se_timer_t *timer)
+{
+    if (!se_timer_pending(timer))
+        return;
+    list_del(timer);
+    loop->ntimers--;
+}
+
+int se_timer_pending(const se_timer_t *timer)
+{
+    return timer->next != NULL;
+}
+
+static void ptr_timeout(se_timer_t *timer)
+{
+    se_ptr_t *ptr = timer->data;
+
+    if (!ptr->deleted && ptr->tfunc)
+        ptr->tfunc(ptr);
+}
+
+void se_set_timeout(se_ptr_t *ptr, int ms, se_rw_proc_t func)
+{
+    if (ms <= 0) {
+        se_timer_del(ptr->loop, &ptr->timer);
+        return;
+    }
+    ptr->tfunc = func;
+    se_timer_add(ptr->loop, &ptr->timer, ms, ptr_timeout, ptr);
+}
+
+static void run_tasks(se_loop_t *loop)
+{
+    se_task_t *list, *prev = NULL, *next;
+
+    list = __atomic_exchange_n(&loop->tasks, NULL, __ATOMIC_ACQUIRE);
+    /* the stack is newest first, run them in posting order */
+    for (; list; list = next) {
+        next = list->next;
+        list->next = prev;
+        prev = list;
+    }
+    for (list = prev; list; list = next) {
+        next = list->next;
+        list->func(list->arg);
+        free(list);
+    }
+}
+
+static int wakeup_read(se_ptr_t *ptr)
+{
+    uint64_t count;
+
+    while (read(ptr->fd, &count, sizeof(count)) > 0)
+        ;
+    run_tasks(ptr->loop);
+    return 0;
+}
+
+int se_post(se_loop_t *loop, se_task_proc_t func, void *arg)
+{
+    se_task_t *task = malloc(sizeof(se_task_t));
+    uint64_t one = 1;
+
+    if (!task) {
+        return -1;
+    }
+    task->func = func;
+    task->arg = arg;
+    task->next = __atomic_load_n(&loop->tasks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&loop->tasks, &task->next, task, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    /* only the first task after a drain needs to wake the loop up */
+    if (task->next == NULL && write(loop->wakeup.fd, &one, sizeof(one)) < 0
+        && errno != EAGAIN)
+        return -1;
+    return 0;
+}
+
+se_loop_t *se_create(int event_size)
+{
+    se_loop_t *loop;
+    struct epoll_event ev;
+    int i, j;
+
+    if (event_size <= 0) {
+        event_size = 1024;
+    }
+    loop = calloc(1, sizeof(se_loop_t));
+    if (!loop) {
+        return NULL;
+    }
+    loop->size = event_size;
+    loop->events = malloc(sizeof(struct epoll_event) * event_size);
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!loop->events || loop->epfd < 0 || loop->wakeup.fd < 0) {
+        goto failed;
+    }
+
+    for (i = 0; i < TVR_SIZE; i++)
+        list_init(&loop->tv1[i]);
+    for (i = 0; i < TV_LEVELS; i++)
+        for (j = 0; j < TVN_SIZE; j++)
+            list_init(&loop->tvn[i][j]);
+    loop->now = clock_ms();
+    loop->timer_ticks = loop->now + 1;
+
+    loop->wakeup.loop = loop;
+    loop->wakeup.rfunc = wakeup_read;
+    ev.data.ptr = &loop->wakeup;
+    ev.events = EPOLLIN;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakeup.fd, &ev) < 0) {
+        goto failed;
+    }
+    return loop;
+
+failed:
+    if (loop->epfd >= 0) close(loop->epfd);
+    if (loop->wakeup.fd >= 0) close(loop->wakeup.fd);
+    free(loop->events);
+    free(loop);
+    return NULL;
+}
+
+static void free_deleted(se_loop_t *loop)
+{
+    se_ptr_t *ptr;
+
+    while ((ptr = loop->free_list) != NULL) {
+        loop->free_list = ptr->next_free;
+        free(ptr);
+    }
+}
+
+void se_destroy(se_loop_t *loop)
+{
+    run_tasks(loop);
+    free_deleted(loop);
+    close(loop->wakeup.fd);
+    close(loop->epfd);
+    free(loop->events);
+    free(loop);
+}
+
+void se_stop(se_loop_t *loop)
+{
+    loop->stop = 1;
+}
+
+se_ptr_t *se_add(se_loop_t *loop, int fd, void *data)
+{
+    struct epoll_event ev;
+    se_ptr_t *ptr = calloc(1, sizeof(se_ptr_t));
+
+    if(!ptr) {
+        return ptr;
+    }
+
+    ptr->loop = loop;
+    ptr->fd = fd;
+    ptr->data = data;
+
+    ev.data.ptr = ptr;
+    ev.events = EPOLLPRI;
+
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        free(ptr);
+        ptr = NULL;
+    }
+    return ptr;
+}
+
+int se_delete(se_ptr_t *ptr)
+{
+    struct epoll_event ev;
+
+    if(!ptr || ptr->deleted) {
+        return -1;
+    }
+
+    /* the fd may already be closed, that removed it from the set too */
+    epoll_ctl(ptr->loop->epfd, EPOLL_CTL_DEL, ptr->fd, &ev);
+    se_timer_del(ptr->loop, &ptr->timer);
+
+    /* events for it may still be pending in the current batch */
+    ptr->deleted = 1;
+    ptr->next_free = ptr->loop->free_list;
+    ptr->loop->free_list = ptr;
+
+    return 0;
+}
+
+int se_loop(se_loop_t *loop, int waitout)
+{
+    int n = 0, i = 0;
+    uint64_t idle_since;
+    se_ptr_t *ptr = NULL;
+
+    loop->stop = 0;
+    loop->now = clock_ms();
+    idle_since = loop->now;
+    /* catch up with timers added while the loop was not running */
+    run_timers(loop);
+    free_deleted(loop);
+
+    while(!loop->stop) {
+
+        n = epoll_wait(loop->epfd, loop->events, loop->size,
+                       next_timeout(loop, waitout));
+        if(n == -1 && errno != EINTR) {
+            return -1;
+        }
+        loop->now = clock_ms();
+        loop->fired = 0;
+
+        for(i = 0; i < n; i++) {
+            uint32_t events = loop->events[i].events;
+
+            ptr = loop->events[i].data.ptr;
+            if(ptr->deleted) {
+                continue;
+            }
+
+            if (events & (EPOLLHUP | EPOLLERR)) {
+                /* let the owner see the error and close the fd */
+                if(ptr->rfunc) {
+                    ptr->rfunc(ptr);
+                } else if(ptr->wfunc) {
+                    ptr->wfunc(ptr);
+                } else {
+                    se_delete(ptr);
+                }
+            } else if(events & EPOLLIN && ptr->rfunc) {
+                ptr->rfunc(ptr);
+
+            } else if(events & EPOLLOUT && ptr->wfunc) {
+                ptr->wfunc(ptr);
+            }
+        }
+
+        run_timers(loop);
+        free_deleted(loop);
+
+        if(n > 0 || loop->fired > 0) {
+            idle_since = loop->now;
+        } else if(waitout >= 0 && loop->now - idle_since >= (uint64_t)waitout) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int ptr_ctl(se_ptr_t *ptr, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.data.ptr = ptr;
+    ev.events = events;
+
+    return epoll_ctl(ptr->loop->epfd, EPOLL_CTL_MOD, ptr->fd, &ev);
+}
+
+int se_be_read(se_ptr_t *ptr, se_rw_proc_t func)
+{
+    ptr->rfunc = func;
+    ptr->wfunc = NULL;
+
+    return ptr_ctl(ptr, EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLONESHOT);
+}
+
+int se_be_write(se_ptr_t *ptr, se_rw_proc_t func)
+{
+    ptr->rfunc = NULL;
+    ptr->wfunc = func;
+
+    return ptr_ctl(ptr, EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLET);
+}
+
+int se_be_pri(se_ptr_t *ptr, se_rw_proc_t func)
+{
+    ptr->rfunc = func;
+    ptr->wfunc = NULL;
+
+    return ptr_ctl(ptr, EPOLLPRI);
+}
+
+int se_be_rw(se_ptr_t *ptr, se_rw_proc_t rfunc, se_rw_proc_t wfunc)
+{
+    ptr->rfunc = rfunc;
+    ptr->wfunc = wfunc;
+
+    return ptr_ctl(ptr, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+}
@@ -0,0 +1,84 @@
+#ifndef SE_H
+#define SE_H
+
+#include <stdint.h>
+
+/*
+ * se: a small epoll reactor, grown out of the se_* functions in t2.c.
+ *
+ * Every fd is wrapped in an se_ptr_t carrying a read and a write callback;
+ * se_be_read/se_be_write/se_be_rw switch which events it waits for.
+ * On top of that a loop has
+ *   - a hierarchical timer wheel (1 ms ticks, O(1) add and delete), with a
+ *     per-fd shortcut se_set_timeout for connect/read timeouts,
+ *   - se_post, which queues a function to run on the loop's thread and
+ *     wakes it through an eventfd; it is the only call that is safe from
+ *     other threads,
+ *   - deferred freeing: se_delete may be called from inside any callback,
+ *     even for another fd of the same event batch, the memory is released
+ *     once the batch is done.
+ *
+ * build with : gcc -c se.c and link se.o into the program
+ */
+
+typedef struct se_loop_s se_loop_t;
+typedef struct se_ptr_s se_ptr_t;
+typedef struct se_timer_s se_timer_t;
+
+typedef int (*se_rw_proc_t)(se_ptr_t *ptr);
+typedef void (*se_timer_proc_t)(se_timer_t *timer);
+typedef void (*se_task_proc_t)(void *arg);
+
+struct se_timer_s {
+    se_timer_t *prev;
+    se_timer_t *next;
+    uint64_t expire;            /* absolute, in loop ticks (ms) */
+    se_timer_proc_t func;
+    void *data;
+};
+
+struct se_ptr_s {
+    se_loop_t *loop;
+    int fd;
+    se_rw_proc_t rfunc;
+    se_rw_proc_t wfunc;
+    se_rw_proc_t tfunc;         /* timeout callback, see se_set_timeout */
+    void *data;                 /* free for the caller */
+    se_timer_t timer;
+    int deleted;
+    se_ptr_t *next_free;
+};
+
+/* event_size is the max number of events fetched per epoll_wait */
+se_loop_t *se_create(int event_size);
+void se_destroy(se_loop_t *loop);
+
+/* run until se_stop, or until nothing happened for waitout ms (-1: never) */
+int se_loop(se_loop_t *loop, int waitout);
+void se_stop(se_loop_t *loop);
+
+se_ptr_t *se_add(se_loop_t *loop, int fd, void *data);
+int se_delete(se_ptr_t *ptr);   /* does not close the fd */
+
+int se_be_read(se_ptr_t *ptr, se_rw_proc_t func);   /* one shot */
+int se_be_write(se_ptr_t *ptr, se_rw_proc_t func);  /* edge triggered */
+int se_be_pri(se_ptr_t *ptr, se_rw_proc_t func);
+int se_be_rw(se_ptr_t *ptr, se_rw_proc_t rfunc, se_rw_proc_t wfunc);
+
+/* milliseconds on the loop's clock, updated once per iteration */
+uint64_t se_now(se_loop_t *loop);
+
+/* (re)arm a timer, ms from now; a pending timer is moved. A timer must
+ * be zeroed (or embedded in zeroed memory) before its first use */
+void se_timer_add(se_loop_t *loop, se_timer_t *timer, int ms,
+                  se_timer_proc_t func, void *data);
+void se_timer_del(se_loop_t *loop, se_timer_t *timer);
+int se_timer_pending(const se_timer_t *timer);
+
+/* call func(ptr) if no se_set_timeout comes within ms; ms <= 0 cancels */
+void se_set_timeout(se_ptr_t *ptr, int ms, se_rw_proc_t func);
+
+/* thread-safe: run func(arg) on the loop's thread */
+int se_post(se_loop_t *loop, se_task_proc_t func, void *arg);
+
+#endif    /* SE_H */
@@ -1,7 +1,21 @@
 //https://jve.linuxwall.info/ressources/code/sockevent.c
 /* sockevent.c
  * create TCP socket and store then in a epoll file descriptor
- * build with : gcc -O3 -g -falign-functions=4 -falign-jumps -falign-loops -Wall -o sockevent sockevent.c
+ *
+ * Closed loop by default: every connection sends its next request once the
+ * previous answer is in. With -R the load is open loop instead: requests
+ * are due at a fixed rate whatever the server does, and latency counts
+ * from the time a request was due, so a stalled server shows up in the
+ * percentiles instead of just slowing the generator down.
+ *
+ * Requests come from -m or from a template file (-T) whose {{variables}}
+ * are filled from pools (-V) ahead of time, see reqtmpl.h. With -H the
+ * responses are framed as HTTP and checked as they stream in: status,
+ * body length and CRC32; only the ones that pass count as responses.
+ *
+ * build with : gcc -O3 -g -falign-functions=4 -falign-jumps -falign-loops -Wall -o sockevent sockevent.c hist.c reqtmpl.c http_resp.c -lpthread
+ * run with   : ./sockevent -t 4 -R 200000 -k -d 10 127.0.0.1:8080 1000
+ *              ./sockevent -k -H -s 200 -T get.tmpl -V id=1..100000 127.0.0.1:8080 100
  */
 
 
@@ -14,58 +28,170 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hist.h"
+#include "reqtmpl.h"
+#include "http_resp.h"
+
+#define MAX_THREADS 64
+#define TICK_NS 1000000      // timerfd period of the open loop schedule
+#define RECV_BUF 65536
 
 
 /* catch SIGINT and set stop to signal_id
  */
-int stop;
+volatile sig_atomic_t stop;
 void interrupt(int signal_id)
 {
    stop = signal_id;
 }
 
    // init struct for statistics
+   // one writer (the worker's epoll loop), read by the stats thread with atomic loads
 struct statistics
 {
-   int reqsent;
-   int bytessent;
-   int reprecv;
-   int bytesrecv;
-   int error;
-   int nbsock;
+   uint64_t reqsent;
+   uint64_t bytessent;
+   uint64_t reprecv;
+   uint64_t bytesrecv;
+   uint64_t error;
+   uint64_t invalid;    // whole responses that failed the checks
+   uint64_t nbsock;
+   hist_t latency;      // ns from send (or from when it was due, open loop) to a whole response
+};
+
+#define STAT_GET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STAT_ADD(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+
+// the request sequence and how it is driven, shared read only by the workers
+static struct
+{
+   struct sockaddr_in target;
+   reqtmpl_t *tmpl;     // the request sequence, rendered before the start
+   int nseq;
+   int threads;
+   double rate;         // requests/s over all threads, 0: closed loop
+   int keepalive;
+   int maxreq;          // requests per connection with keepalive, 0: no limit
+   int resplen;         // bytes that make a response, 0: the first read
+   int http;            // frame responses as HTTP
+   int status;          // expected status, 0: any 2xx
+   long long bodylen;   // expected body (whole response without -H) length, -1: any
+   int want_crc;
+   uint32_t crc;        // expected CRC32 of the body (of the response without -H)
+} cfg;
+
+struct conn
+{
+   int fd;
+   int connected;
+   int busy;            // a request is out
+   int seq;             // next payload of the sequence
+   int nreq;            // requests done on this connection
+   const char *req;     // the current request
+   int reqlen;
+   int sendoff;         // bytes of the current request already sent
+   int got;             // bytes of the current response
+   uint32_t crc;        // of the current response, without -H
+   uint64_t start;      // latency origin of the current request
+   http_resp_t resp;    // with -H
+   struct conn *next_idle;
 };
 
-void printstats(struct statistics *stats)
+struct worker
+{
+   pthread_t tid;
+   int epfd;
+   int tfd;
+   struct conn *conns;
+   int nconns;
+   struct conn *idle;   // connected and waiting for the schedule
+   uint64_t t0;         // open loop: request k is due at t0 + k * interval
+   double interval;
+   uint64_t next;       // next request of the schedule
+   unsigned int reqno;  // picks the next rendering of the templates
+   struct statistics stats;
+};
+
+static struct worker workers[MAX_THREADS];
+
+static uint64_t now_ns(void)
 {
-   struct statistics previous;
-   previous.reqsent = 0;
-   previous.reprecv = 0;
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define BANNER "\nreprecv\tbytes\t^hit\treqsent\tbytes\t^req\tErrors\tInvalid\tActive\tp50\tp90\tp99\tp99.9\tmax(us)\n"
+
+// the counters of every worker, summed
+static void sumstats(struct statistics *sum)
+{
+   static hist_t copy;
+   int i;
+
+   memset(sum, 0, sizeof(*sum) - sizeof(sum->latency));
+   hist_init(&sum->latency);
+   for (i = 0; i < cfg.threads; i++)
+   {
+      struct statistics *s = &workers[i].stats;
+
+      sum->reqsent += STAT_GET(s->reqsent);
+      sum->bytessent += STAT_GET(s->bytessent);
+      sum->reprecv += STAT_GET(s->reprecv);
+      sum->bytesrecv += STAT_GET(s->bytesrecv);
+      sum->error += STAT_GET(s->error);
+      sum->invalid += STAT_GET(s->invalid);
+      sum->nbsock += STAT_GET(s->nbsock);
+      hist_copy(&copy, &s->latency);
+      hist_add(&sum->latency, &copy);
+   }
+}
+
+void *printstats(void *arg)
+{
+   // cumulative sums a second apart, their difference is the last second
+   static struct statistics now, before;
+   static hist_t second;
    int banner = 0;
 
-   printf("\nreprecv\tbytes\t^hit\treqsent\tbytes\t^req\tErrors\tActive\n");
+   (void)arg;
+   hist_init(&before.latency);
+   printf(BANNER);
 
    for(;;)
       {
          sleep(1);
          if(banner == 10)
             {
-               printf("\nreprecv\tbytes\t^hit\treqsent\tbytes\t^req\tErrors\tActive\n");
+               printf(BANNER);
                banner = 0;
             }
          else
             banner++;
 
+         sumstats(&now);
+         hist_sub(&second, &now.latency, &before.latency);
 
-         printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", stats->reprecv, stats->bytesrecv, stats->reprecv - previous.reprecv,stats->reqsent, stats->bytessent, stats->reqsent - previous.reqsent, stats->error, stats->nbsock);
+         printf("%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\n",
+            (unsigned long long)now.reprecv, (unsigned long long)now.bytesrecv,
+            (unsigned long long)(now.reprecv - before.reprecv), (unsigned long long)now.reqsent,
+            (unsigned long long)now.bytessent, (unsigned long long)(now.reqsent - before.reqsent),
+            (unsigned long long)now.error, (unsigned long long)now.invalid, (unsigned long long)now.nbsock,
+            hist_percentile(&second, 50) / 1e3, hist_percentile(&second, 90) / 1e3,
+            hist_percentile(&second, 99) / 1e3, hist_percentile(&second, 99.9) / 1e3,
+            hist_percentile(&second, 100) / 1e3);
 
-         previous.reqsent = stats->reqsent;
-         previous.reprecv = stats->reprecv;
+         before = now;
       }
-
+   return NULL;
 }
 
 
@@ -103,67 +229,66 @@ struct sockaddr_in str2sa(char *str)
 /* create a TCP socket with non blocking options and connect it to the target
 * if succeed, add the socket in the epoll list and exit with 0
 */
-int create_and_connect( struct sockaddr_in target , int *epfd)
+int create_and_connect(struct worker *w, struct conn *c)
 {
    int yes = 1;
    int sock;
 
    // epoll mask that contain the list of epoll events attached to a network socket
-   static struct epoll_event Edgvent;
+   struct epoll_event Edgvent;
 
 
-   if( (sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+   if( (sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
    {
       perror("socket");
       exit(1);
    }
 
-   // set socket to non blocking and allow port reuse
-   if ( (setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof(int)) ||
-      fcntl(sock, F_SETFL, O_NONBLOCK)) == -1)
+   // allow port reuse
+   if (setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof(int)) == -1)
    {
-      perror("setsockopt || fcntl");
+      perror("setsockopt");
       exit(1);
    }
 
-   if( connect(sock, (struct sockaddr *)&target, sizeof(struct sockaddr)) == -1
+   if( connect(sock, (struct sockaddr *)&cfg.target, sizeof(struct sockaddr)) == -1
       && errno != EINPROGRESS)
    {
       // connect doesn't work, are we running out of available ports ? if yes, destruct the socket
-      if (errno == EAGAIN)
-      {
-         perror("connect is EAGAIN");
-         close(sock);
-         exit(1);
-      }
+      if (errno == EAGAIN || errno == EADDRNOTAVAIL)
+         perror("connect");
+      close(sock);
+      return -1;
    }
-   else
-   {
-      /* epoll will wake up for the following events :
-       *
-       * EPOLLIN : The associated file is available for read(2) operations.
-       *
-       * EPOLLOUT : The associated file is available for write(2) operations.
-       *
-       * EPOLLRDHUP : Stream socket peer closed connection, or shut down writing 
-       * half of connection. (This flag is especially useful for writing simple 
-       * code to detect peer shutdown when using Edge Triggered monitoring.)
-       *
-       * EPOLLERR : Error condition happened on the associated file descriptor. 
-       * epoll_wait(2) will always wait for this event; it is not necessary to set it in events.
-       */
-      Edgvent.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET ;
-      //Edgvent.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLERR;
-
-      Edgvent.data.fd = sock;
 
-      // add the socket to the epoll file descriptors
-      if(epoll_ctl((int)epfd, EPOLL_CTL_ADD, sock, &Edgvent) != 0)
-      {
-         perror("epoll_ctl, adding socket\n");
-         exit(1);
-      }
+   /* epoll will wake up for the following events :
+    *
+    * EPOLLIN : The associated file is available for read(2) operations.
+    *
+    * EPOLLOUT : The associated file is available for write(2) operations.
+    *
+    * EPOLLRDHUP : Stream socket peer closed connection, or shut down writing
+    * half of connection. (This flag is especially useful for writing simple
+    * code to detect peer shutdown when using Edge Triggered monitoring.)
+    *
+    * EPOLLERR : Error condition happened on the associated file descriptor.
+    * epoll_wait(2) will always wait for this event; it is not necessary to set it in events.
+    *
+    * Edge triggered, the mask never changes: no epoll_ctl per request.
+    */
+   Edgvent.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET ;
+   Edgvent.data.ptr = c;
+
+   memset(c, 0, sizeof(*c));
+   c->fd = sock;
+
+   // add the socket to the epoll file descriptors
+   if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, sock, &Edgvent) != 0)
+   {
+      perror("epoll_ctl, adding socket\n");
+      exit(1);
    }
+   STAT_ADD(w->stats.nbsock, 1);
 
    return 0;
 }
@@ -189,215 +314,429 @@ int socket_check(int fd)
 }
 
 
+static void conn_reconnect(struct worker *w, struct conn *c)
+{
+   close(c->fd);     // also drops it from epfd
+   STAT_ADD(w->stats.nbsock, -1);
+   c->fd = -1;
+   if (!stop && create_and_connect(w, c) != 0)
+      STAT_ADD(w->stats.error, 1);
+}
 
-
-int main(int argc, char *argv[])
+/* push what is left of the current request, 0 once it is all out */
+static int conn_flush(struct worker *w, struct conn *c)
 {
-   
-   if(argc!=3)
+   int datacount;
+
+   while (c->sendoff < c->reqlen)
    {
-      printf("gatlinject <ip:port> <num socket>\n");
-      exit(1);
+      datacount = send(c->fd, c->req + c->sendoff, c->reqlen - c->sendoff, MSG_NOSIGNAL);
+      if (datacount < 0)
+      {
+         if (errno == EAGAIN)
+            return 1;     // EPOLLOUT brings us back
+         if (errno == EINTR)
+            continue;
+         STAT_ADD(w->stats.error, 1);
+         conn_reconnect(w, c);
+         return -1;
+      }
+      c->sendoff += datacount;
+      STAT_ADD(w->stats.bytessent, datacount);
    }
+   return 0;
+}
 
-   struct sockaddr_in target = str2sa((char *) argv[1]); // convert target information
-   int maxconn = atoi(argv[2]); //number of sockets to connect to the target
-
-   // internal variables definition
-   int i, count, datacount;
+static void conn_send(struct worker *w, struct conn *c, uint64_t start)
+{
+   c->busy = 1;
+   // a precomputed rendering, nothing is formatted here
+   c->req = reqtmpl_get(cfg.tmpl, c->seq, w->reqno++, &c->reqlen);
+   c->sendoff = 0;
+   c->got = 0;
+   c->crc = 0;
+   if (cfg.http)
+      http_resp_init(&c->resp, cfg.want_crc);
+   c->start = start;
+   STAT_ADD(w->stats.reqsent, 1);
+   conn_flush(w, c);
+}
 
-   char message[] = "hello\n\n";
-   int messagelength = strlen(message);
+/* open loop: hand every request that is due to an idle connection */
+static void dispatch(struct worker *w)
+{
+   uint64_t now = now_ns();
 
-   char buffer[1500];
-   int buffersize = strlen(buffer);
+   while (w->idle != NULL)
+   {
+      uint64_t due = w->t0 + (uint64_t)(w->next * w->interval);
+      struct conn *c;
+
+      if (due > now)
+         break;
+      c = w->idle;
+      w->idle = c->next_idle;
+      w->next++;
+      // late requests keep their due time: the wait is part of the latency
+      conn_send(w, c, due);
+   }
+}
 
-   struct statistics stats;
-   memset(&stats,0x0,6 * sizeof(int));
-   pthread_t Statsthread;
-   
+/* ready for the next request: send it now, or wait for the schedule */
+static void conn_ready(struct worker *w, struct conn *c)
+{
+   if (cfg.rate == 0)
+   {
+      conn_send(w, c, now_ns());
+      return;
+   }
+   c->next_idle = w->idle;
+   w->idle = c;
+   dispatch(w);
+}
 
-   // time
-   struct timeval start;
-   struct timeval current;
-   float elapsedtime;
+/* a whole response is in: does it pass? */
+static int conn_valid(struct conn *c)
+{
+   if (!cfg.http)
+      return (cfg.bodylen < 0 || c->got == cfg.bodylen) && (!cfg.want_crc || c->crc == cfg.crc);
+   if (cfg.status ? c->resp.status != cfg.status : c->resp.status / 100 != 2)
+      return 0;
+   if (cfg.bodylen >= 0 && c->resp.body != (uint64_t)cfg.bodylen)
+      return 0;
+   return !cfg.want_crc || c->resp.crc == cfg.crc;
+}
 
-   // catch SIGINT to exit in a clean way
-   struct sigaction sa;
-   memset(&sa, 0, sizeof(struct sigaction *));
-   sa.sa_handler = interrupt;
-   sa.sa_flags = 0;
-   sigemptyset (&(sa.sa_mask));
-   if(sigaction (SIGINT, &sa, NULL)!= 0)
+// only the responses that pass count, and only they have a latency
+static void conn_tally(struct worker *w, struct conn *c)
+{
+   c->busy = 0;
+   if (conn_valid(c))
    {
-      perror("sigaction failed");
-      exit(1);
+      hist_record(&w->stats.latency, now_ns() - c->start);
+      STAT_ADD(w->stats.reprecv, 1);
    }
+   else
+      STAT_ADD(w->stats.invalid, 1);
+}
 
-   // the epoll file descriptor
-   int epfd;
+static void conn_done(struct worker *w, struct conn *c)
+{
+   conn_tally(w, c);
+   c->nreq++;
+   c->seq = (c->seq + 1) % cfg.nseq;
+   if (!cfg.keepalive || (cfg.maxreq && c->nreq >= cfg.maxreq))
+      conn_reconnect(w, c);
+   else
+      conn_ready(w, c);
+}
+
+static void conn_read(struct worker *w, struct conn *c)
+{
+   static __thread char buffer[RECV_BUF];
+   int datacount, take;
+   size_t used;
+
+   for (;;)
+   {
+      datacount = recv(c->fd, buffer, sizeof(buffer), 0);
+      if (datacount < 0 && errno == EINTR)
+         continue;
+      if (datacount < 0 && errno == EAGAIN)
+         return;
+      if (datacount <= 0)
+      {
+         // hangup: a request still out is lost, unless the close ends its body
+         if (c->busy && cfg.http && datacount == 0 && http_resp_eof(&c->resp) == HTTP_RESP_DONE)
+            conn_tally(w, c);
+         else if (c->busy)
+            STAT_ADD(w->stats.error, 1);
+         conn_reconnect(w, c);
+         return;
+      }
+      STAT_ADD(w->stats.bytesrecv, datacount);
+      if (!c->busy)
+         continue;     // nobody asked, drop it
 
-   // epoll structure that will contain the current network socket and event when epoll wakes up
-   static struct epoll_event *events;
-   static struct epoll_event event_mask;
+      if (cfg.http)
+      {
+         switch (http_resp_feed(&c->resp, buffer, datacount, &used))
+         {
+            case HTTP_RESP_AGAIN:
+               continue;
+            case HTTP_RESP_ERROR:
+               // framing is lost, so is the connection
+               STAT_ADD(w->stats.invalid, 1);
+               c->busy = 0;
+               conn_reconnect(w, c);
+               return;
+            case HTTP_RESP_DONE:
+               conn_done(w, c);
+               break;
+         }
+      }
+      else
+      {
+         take = c->got + datacount > cfg.resplen ? cfg.resplen - c->got : datacount;
+         if (cfg.want_crc)
+            c->crc = http_resp_crc32(c->crc, buffer, take);
+         c->got += take;
+         if (c->got >= cfg.resplen)
+            conn_done(w, c);
+      }
+      if (c->fd < 0)
+         return;
+   }
+}
 
-   // create the special epoll file descriptor
-   epfd = epoll_create(maxconn);
+static void *worker_main(void *arg)
+{
+   struct worker *w = arg;
+   struct epoll_event *events;
+   struct itimerspec its;
+   uint64_t ticks;
+   int i, count;
 
    // allocate enough memory to store all the events in the "events" structure
-   if (NULL == (events = calloc(maxconn, sizeof(struct epoll_event))))
+   if (NULL == (events = calloc(w->nconns + 1, sizeof(struct epoll_event))))
    {
       perror("calloc events");
       exit(1);
    };
 
-   // create and connect as much as needed
-   for(i=0;i<maxconn;i++)
-      if(create_and_connect(target, (int *) epfd) != 0)
+   // the schedule ticks through a timerfd in the same epoll set, data.ptr NULL
+   if (cfg.rate > 0)
+   {
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+      w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_nsec = its.it_interval.tv_nsec = TICK_NS;
+      if (w->tfd < 0 || timerfd_settime(w->tfd, 0, &its, NULL) != 0 ||
+         epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->tfd, &ev) != 0)
       {
-         perror("create and connect");
+         perror("timerfd");
          exit(1);
       }
-      else
-         stats.nbsock++;
-
-   // start the thread that prints the statistics
-   if( 0!= pthread_create (&Statsthread, NULL, (void *)printstats, &stats) ){
-      perror("stats thread");
-      exit(1);
+      w->interval = 1e9 * cfg.threads / cfg.rate;
+      // spread the threads over one interval instead of all firing at once
+      w->t0 = now_ns() + (uint64_t)(w->interval * (w - workers) / cfg.threads);
    }
 
-   gettimeofday(&start, NULL);
+   // create and connect as much as needed
+   for(i=0;i<w->nconns;i++)
+      if(create_and_connect(w, &w->conns[i]) != 0)
+      {
+         perror("create and connect");
+         exit(1);
+      }
 
-   do
+   while (!stop)
    {
       /* wait for events on the file descriptors added into epfd
        *
        * if one of the socket that's contained into epfd is available for reading, writing,
-       * is closed or have an error, this socket will be return in events[i].data.fd
+       * is closed or have an error, this socket will be return in events[i].data.ptr
        * and events[i].events will be set to the corresponding event
        *
        * count contain the number of returned events
        */
-      count = epoll_wait(epfd, events, maxconn, 1000);
+      count = epoll_wait(w->epfd, events, w->nconns + 1, 1000);
 
       for(i=0;i<count;i++)
       {
-         if (events[i].events & EPOLLOUT) //socket is ready for writing
+         struct conn *c = events[i].data.ptr;
+
+         if (c == NULL)
          {
-            // verify the socket is connected and doesn't return an error
-            if(socket_check(events[i].data.fd) != 0)
-            {
-               perror("write socket_check");
-               continue;
-            }
-            else
-            {
-               if((datacount = send(events[i].data.fd, message, messagelength, 0)) < 0)
-               {
-                  stats.error++;
-                  perror("send failed");
-                  continue;
-               }
-               else
-               {
-                  /* we just wrote on this socket, we don't want to write on it anymore
-                   * but we still want to read on it, so we modify the event mask to
-                   * remove EPOLLOUT from the events list
-                   */
-                  event_mask.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
-                  event_mask.data.fd = events[i].data.fd;
-
-                  if(epoll_ctl(epfd, EPOLL_CTL_MOD, events[i].data.fd, &event_mask) != 0)
-                  {
-                     perror("epoll_ctl, modify socket\n");
-                     exit(1);
-                  }
-
-                  stats.reqsent++;
-                  stats.bytessent += datacount;
-               }
-            }
+            if (read(w->tfd, &ticks, sizeof(ticks)) > 0)
+               dispatch(w);
+            continue;
          }
+         if (c->fd < 0)
+            continue;
 
-         if (events[i].events & EPOLLIN) //socket is ready for writing
+         if (events[i].events & (EPOLLERR | EPOLLHUP))
          {
-            // verify the socket is connected and doesn't return an error
-            if(socket_check(events[i].data.fd) != 0)
-            {
-               perror("read socket_check");
-               continue;
-            }
-            else 
-            {
-               memset(buffer,0x0,buffersize);
-
-               if((datacount = recv(events[i].data.fd, buffer, buffersize, 0)) < 0)
-               {
-                  stats.error++;
-                  perror("recv failed");
-                  continue;
-               }
-               else
-               {
-                  stats.bytesrecv += datacount;
-                  stats.reprecv++;
-
-               }
-            }
+            STAT_ADD(w->stats.error, 1);
+            conn_reconnect(w, c);
+            continue;
          }
 
-         if (events[i].events & (EPOLLRDHUP | EPOLLHUP)) //socket closed, delete and create a new one
+         if (events[i].events & EPOLLOUT) //socket is ready for writing
          {
-            // socket is closed, remove the socket from epoll and create a new one
-            epoll_ctl(epfd, EPOLL_CTL_DEL, events[i].data.fd, NULL);
-
-            if(close(events[i].data.fd)!=0)
+            if (!c->connected)
             {
-               perror("close");
-               continue;
+               // verify the socket is connected and doesn't return an error
+               if(socket_check(c->fd) != 0)
+               {
+                  STAT_ADD(w->stats.error, 1);
+                  conn_reconnect(w, c);
+                  continue;
+               }
+               c->connected = 1;
+               conn_ready(w, c);
             }
-            else
-               stats.nbsock--;
-
-            if(create_and_connect(target, (int *) epfd) != 0)
-            {
-               perror("create and connect");
+            else if (c->busy && conn_flush(w, c) < 0)
                continue;
-            }
-            else
-               stats.nbsock++;
          }
-         if (events[i].events & EPOLLERR)
-         {
-            perror("epoll");
-            continue;
-         }
-      }
-   } while(!stop);
-
-   gettimeofday(&current, NULL);
-
-   elapsedtime = (current.tv_sec * 1000000 + current.tv_usec) -  (start.tv_sec * 1000000 + start.tv_usec);
 
-   printf("\n\nTime: %4.6f\nRequests sent: %d\nBytes sent: %d\nReponses received: %d\nBytes received: %d\nRates out: %4.6freq/s, %4.6fbytes/s\nRates in : %4.6frep/s, %4.6fbytes/s\nErrors: %d\n", elapsedtime/1000000, stats.reqsent, stats.bytessent, stats.reprecv, stats.bytesrecv, stats.reqsent/(elapsedtime/1000000), stats.bytessent/(elapsedtime/1000000), stats.reprecv/(elapsedtime/1000000), stats.bytesrecv/(elapsedtime/1000000), stats.error);
-
-   return 0;
+         if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLRDHUP))) //socket is ready for reading
+            conn_read(w, c);
+      }
+   }
+   free(events);
+   return NULL;
 }
 
 
+int main(int argc, char *argv[])
+{
+   int ch, i, maxconn, pool = 4096;
+   double duration = 0;
+   char def[] = "hello\n\n";
 
+   cfg.threads = 1;
+   cfg.bodylen = -1;
+   if ((cfg.tmpl = reqtmpl_create()) == NULL)
+   {
+      perror("reqtmpl_create");
+      exit(1);
+   }
+   while ((ch = getopt(argc, argv, "t:R:d:m:T:V:P:kn:r:Hs:l:c:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 't': cfg.threads = atoi(optarg); break;
+         case 'R': cfg.rate = atof(optarg); break;
+         case 'd': duration = atof(optarg); break;
+         case 'm':
+            if (reqtmpl_add(cfg.tmpl, optarg, reqtmpl_unescape(optarg)) != 0)
+               exit(1);
+            break;
+         case 'T':
+            if (reqtmpl_load(cfg.tmpl, optarg) != 0)
+               exit(1);
+            break;
+         case 'V':
+            if (reqtmpl_var(cfg.tmpl, optarg) != 0)
+               exit(1);
+            break;
+         case 'P': pool = atoi(optarg); break;
+         case 'k': cfg.keepalive = 1; break;
+         case 'n': cfg.maxreq = atoi(optarg); break;
+         case 'r': cfg.resplen = atoi(optarg); break;
+         case 'H': cfg.http = 1; break;
+         case 's': cfg.http = 1; cfg.status = atoi(optarg); break;
+         case 'l': cfg.bodylen = atoll(optarg); break;
+         case 'c': cfg.want_crc = 1; cfg.crc = strtoul(optarg, NULL, 16); break;
+         default: goto usage;
+      }
+   }
 
+   if(argc - optind != 2 || cfg.threads < 1 || cfg.threads > MAX_THREADS || cfg.rate < 0)
+   {
+usage:
+      printf("gatlinject [options] <ip:port> <num socket>\n"
+             " -t threads   worker threads, each with its own epoll and share of the sockets (1)\n"
+             " -R rate      open loop: requests/s over all threads, latency counted from when\n"
+             "              a request was due; without it every socket sends as soon as it can\n"
+             " -d seconds   stop after this long, default on ^C\n"
+             " -m payload   request, \\r \\n \\t \\xHH escapes; repeat for a sequence sent in turn\n"
+             "              on each connection (default \"hello\\n\\n\")\n"
+             " -T file      requests from a template file, {{name}} filled from -V pools\n"
+             " -V name=lo..hi|name=@file|name=a,b,c   a pool of values for {{name}}\n"
+             " -P count     renderings made of each template before the start (4096)\n"
+             " -k           keep-alive, send the next request on the same connection\n"
+             " -n count     with -k, reconnect after count requests (default never)\n"
+             " -r bytes     bytes that make a whole response (default the first read)\n"
+             " -H           responses are HTTP, framed by Content-Length or chunks\n"
+             " -s status    expected status, implies -H (default any 2xx)\n"
+             " -l bytes     expected body length (response length without -H)\n"
+             " -c crc32     expected CRC32 of the body (of the response without -H), in hex\n");
+      exit(1);
+   }
 
+   cfg.target = str2sa((char *) argv[optind]); // convert target information
+   maxconn = atoi(argv[optind + 1]); //number of sockets to connect to the target
+   if (reqtmpl_seq(cfg.tmpl) == 0 && reqtmpl_add(cfg.tmpl, def, strlen(def)) != 0)
+      exit(1);
+   // all the formatting happens here, before the first request
+   if (reqtmpl_render(cfg.tmpl, pool, 1) != 0)
+      exit(1);
+   cfg.nseq = reqtmpl_seq(cfg.tmpl);
+   if (cfg.resplen < 1)
+      cfg.resplen = cfg.bodylen > 0 && !cfg.http ? cfg.bodylen : 1;
+   if (maxconn < cfg.threads)
+      maxconn = cfg.threads;
 
+   pthread_t Statsthread;
+   struct statistics total;
 
+   // time
+   uint64_t start;
+   double elapsedtime;
 
+   // catch SIGINT to exit in a clean way, SIGALRM ends a -d run
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(struct sigaction));
+   sa.sa_handler = interrupt;
+   sa.sa_flags = 0;
+   sigemptyset (&(sa.sa_mask));
+   if(sigaction (SIGINT, &sa, NULL)!= 0 || sigaction (SIGALRM, &sa, NULL)!= 0)
+   {
+      perror("sigaction failed");
+      exit(1);
+   }
+
+   // every worker gets its own epoll file descriptor and its share of the sockets
+   for (i = 0; i < cfg.threads; i++)
+   {
+      struct worker *w = &workers[i];
 
+      w->nconns = maxconn / cfg.threads + (i < maxconn % cfg.threads);
+      w->epfd = epoll_create(w->nconns + 1);
+      hist_init(&w->stats.latency);
+      if (w->epfd < 0 || NULL == (w->conns = calloc(w->nconns, sizeof(struct conn))))
+      {
+         perror("epoll_create || calloc");
+         exit(1);
+      }
+   }
 
+   start = now_ns();
+   for (i = 0; i < cfg.threads; i++)
+      if (0 != pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]))
+      {
+         perror("worker thread");
+         exit(1);
+      }
 
+   // start the thread that prints the statistics
+   if( 0!= pthread_create (&Statsthread, NULL, printstats, NULL) ){
+      perror("stats thread");
+      exit(1);
+   }
 
+   if (duration > 0)
+   {
+      struct itimerval it = { { 0, 0 }, { (long)duration, (long)((duration - (long)duration) * 1e6) } };
 
+      setitimer(ITIMER_REAL, &it, NULL);
+   }
+   for (i = 0; i < cfg.threads; i++)
+      pthread_join(workers[i].tid, NULL);
 
+   elapsedtime = (now_ns() - start) / 1e9;
+   sumstats(&total);
 
+   printf("\n\nTime: %4.6f\nRequests sent: %llu\nBytes sent: %llu\nReponses received: %llu\nBytes received: %llu\nRates out: %4.6freq/s, %4.6fbytes/s\nRates in : %4.6frep/s, %4.6fbytes/s\nErrors: %llu\nInvalid responses: %llu\n", elapsedtime,
+      (unsigned long long)total.reqsent, (unsigned long long)total.bytessent, (unsigned long long)total.reprecv, (unsigned long long)total.bytesrecv,
+      total.reqsent/elapsedtime, total.bytessent/elapsedtime, total.reprecv/elapsedtime, total.bytesrecv/elapsedtime, (unsigned long long)total.error,
+      (unsigned long long)total.invalid);
 
+   printf("\nLatency distribution (us):\n");
+   hist_print(&total.latency, stdout, 1e3);
 
+   return 0;
+}
@@ -0,0 +1,248 @@
+/* syscount.c
+ * counts the system calls a server makes, for bench_uring.sh. Preloaded
+ * into the server it wraps the socket, epoll, fcntl and close calls the
+ * servers here make through libc, and syscall(2), which uring.c uses for
+ * io_uring_enter. The counts go to stderr, or to $SYSCOUNT_OUT, when the
+ * process exits or gets SIGTERM or SIGINT.
+ * build with : gcc -O2 -shared -fPIC -o syscount.so syscount.c -ldl
+ * run with   : LD_PRELOAD=./syscount.so ./epoll_server 8080
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#define CALLS \
+   X(read) X(write) X(readv) X(writev) X(recv) X(send) X(recvfrom) X(sendto) \
+   X(recvmsg) X(sendmsg) X(accept) X(accept4) X(epoll_wait) X(epoll_pwait) \
+   X(epoll_ctl) X(fcntl) X(close) X(io_uring_enter) X(syscall)
+
+enum
+{
+#define X(name) C_##name,
+   CALLS
+#undef X
+   C_MAX
+};
+
+static const char *names[C_MAX] =
+{
+#define X(name) #name,
+   CALLS
+#undef X
+};
+
+static unsigned long counts[C_MAX];
+
+static void count(int c)
+{
+   __atomic_fetch_add(&counts[c], 1, __ATOMIC_RELAXED);
+}
+
+#define REAL(name) \
+   static __typeof__(name) *real; \
+   if (real == NULL) \
+      real = (__typeof__(name) *)dlsym(RTLD_NEXT, #name)
+
+ssize_t read(int fd, void *buf, size_t n)
+{
+   REAL(read);
+   count(C_read);
+   return real(fd, buf, n);
+}
+
+ssize_t write(int fd, const void *buf, size_t n)
+{
+   REAL(write);
+   count(C_write);
+   return real(fd, buf, n);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int cnt)
+{
+   REAL(readv);
+   count(C_readv);
+   return real(fd, iov, cnt);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int cnt)
+{
+   REAL(writev);
+   count(C_writev);
+   return real(fd, iov, cnt);
+}
+
+ssize_t recv(int fd, void *buf, size_t n, int flags)
+{
+   REAL(recv);
+   count(C_recv);
+   return real(fd, buf, n, flags);
+}
+
+ssize_t send(int fd, const void *buf, size_t n, int flags)
+{
+   REAL(send);
+   count(C_send);
+   return real(fd, buf, n, flags);
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t n, int flags, struct sockaddr *addr, socklen_t *len)
+{
+   REAL(recvfrom);
+   count(C_recvfrom);
+   return real(fd, buf, n, flags, addr, len);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t n, int flags, const struct sockaddr *addr, socklen_t len)
+{
+   REAL(sendto);
+   count(C_sendto);
+   return real(fd, buf, n, flags, addr, len);
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+   REAL(recvmsg);
+   count(C_recvmsg);
+   return real(fd, msg, flags);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+   REAL(sendmsg);
+   count(C_sendmsg);
+   return real(fd, msg, flags);
+}
+
+int accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+   REAL(accept);
+   count(C_accept);
+   return real(fd, addr, len);
+}
+
+int accept4(int fd, struct sockaddr *addr, socklen_t *len, int flags)
+{
+   REAL(accept4);
+   count(C_accept4);
+   return real(fd, addr, len, flags);
+}
+
+int epoll_wait(int epfd, struct epoll_event *ev, int max, int timeout)
+{
+   REAL(epoll_wait);
+   count(C_epoll_wait);
+   return real(epfd, ev, max, timeout);
+}
+
+int epoll_pwait(int epfd, struct epoll_event *ev, int max, int timeout, const sigset_t *mask)
+{
+   REAL(epoll_pwait);
+   count(C_epoll_pwait);
+   return real(epfd, ev, max, timeout, mask);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+   REAL(epoll_ctl);
+   count(C_epoll_ctl);
+   return real(epfd, op, fd, ev);
+}
+
+int close(int fd)
+{
+   REAL(close);
+   count(C_close);
+   return real(fd);
+}
+
+/* every fcntl argument fits a pointer */
+static int do_fcntl(const char *name, int fd, int cmd, void *arg)
+{
+   static int (*real)(int, int, ...);
+
+   if (real == NULL)
+      real = (int (*)(int, int, ...))dlsym(RTLD_NEXT, name);
+   count(C_fcntl);
+   return real(fd, cmd, arg);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+   va_list ap;
+   void *arg;
+
+   va_start(ap, cmd);
+   arg = va_arg(ap, void *);
+   va_end(ap);
+   return do_fcntl("fcntl", fd, cmd, arg);
+}
+
+int fcntl64(int fd, int cmd, ...)
+{
+   va_list ap;
+   void *arg;
+
+   va_start(ap, cmd);
+   arg = va_arg(ap, void *);
+   va_end(ap);
+   return do_fcntl("fcntl64", fd, cmd, arg);
+}
+
+long syscall(long number, ...)
+{
+   va_list ap;
+   long a[6];
+   int i;
+
+   REAL(syscall);
+   va_start(ap, number);
+   for (i = 0; i < 6; i++)
+      a[i] = va_arg(ap, long);
+   va_end(ap);
+   count(number == __NR_io_uring_enter ? C_io_uring_enter : C_syscall);
+   return real(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+static void dump(void)
+{
+   static int done;
+   char *path = getenv("SYSCOUNT_OUT");
+   FILE *f = path ? fopen(path, "w") : stderr;
+   unsigned long total = 0;
+   int i;
+
+   if (__atomic_exchange_n(&done, 1, __ATOMIC_ACQ_REL) || f == NULL)
+      return;
+   for (i = 0; i < C_MAX; i++)
+   {
+      total += counts[i];
+      fprintf(f, "%s %lu\n", names[i], counts[i]);
+   }
+   fprintf(f, "total %lu\n", total);
+   if (f != stderr)
+      fclose(f);
+}
+
+static void on_signal(int sig)
+{
+   (void)sig;
+   dump();
+   _exit(0);
+}
+
+__attribute__((constructor)) static void syscount_init(void)
+{
+   signal(SIGTERM, on_signal);
+   signal(SIGINT, on_signal);
+   atexit(dump);
+}
@@ -8,9 +8,16 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <errno.h>
 #include <signal.h>
 
+#include "se.h"
+#include "dns.h"
+#include "http_scan.h"
+
 #define MAX_LINE 1024
 #ifndef EPOLLRDHUP
 #define EPOLLRDHUP 0x2000
@@ -42,31 +49,40 @@ static struct config {
     char *file; 
     char *servername;
     char *title;
+    char *dns;
     int port;
+    int queries;
     int threads;
+    int timeout;
     bool dynamic;
+    bool batch;
 } cfg;
 
-typedef struct se_ptr_s se_ptr_t;
-typedef int (*se_rw_proc_t)(se_ptr_t *ptr);
-
-struct se_ptr_s {
-    int loop_fd;
-    int fd;
-    se_rw_proc_t rfunc;
-    se_rw_proc_t wfunc;    
-    char addr[16];
-};
+/* recycled through free_targets, a scan allocates nothing per response */
+typedef struct target_s {
+    struct target_s *next_free;
+    int total_size;
+    http_scan_t scan;
+    char addr[256];
+    char arena[HTTP_SCAN_ARENA];
+} target_t;
 
-static struct epoll_event events[4096], ev;
+static target_t *free_targets;
+static http_matcher_t title_matcher, server_matcher;
 
+/* printf arguments for a "%.*s" of a view, "(null)" when it was not seen */
+#define VIEW_ARGS(v) (int)((v).p ? (v).len : 6), ((v).p ? (v).p : "(null)")
 
 static void usage() {
     printf("Usage: httpv <options> \n"
            " Options: \n"
            " -b, --body <b> data for socket, default <'GET / HTTP/1.1\\r\\nHost: localhost\\r\\n\\r\\n'> \n"
            " -P, --port <P> port of host \n"
-           " -t, --threads <N> Number of threads to use \n"
+           " -t, --threads <N> Number of connections in flight \n"
+           " -B, --batch open -t targets at a time and wait for all of them \n"
+           " -T, --timeout <T> connect and read timeout in ms, default 3000 \n"
+           " -D, --dns <S> DNS server ip[:port], default from /etc/resolv.conf \n"
+           " -q, --queries <N> DNS queries in flight, default 256 \n"
            " -f, --file <F> Load ip file \n"
            " -0, --title <T> match title \n"
            " -1, --servername <S> match server \n"
@@ -80,17 +96,24 @@ static int parse_args(struct config *cfg,  int argc, char* argv[])
     cfg->port = 80;
     cfg->file = NULL;
     cfg->dynamic = false;
+    cfg->batch = false;
     cfg->threads = 1000;
+    cfg->timeout = 3000;
+    cfg->queries = 256;
     cfg->servername = NULL;
     cfg->title = NULL;
 
-    while ((c = getopt(argc, argv, "0:1:f:P:b:t:d:h?")) != -1) {
+    while ((c = getopt(argc, argv, "0:1:f:P:b:t:T:D:q:Bd:h?")) != -1) {
         switch (c) {
         case 'f':
             cfg->file = optarg;
             break;
         case 'P': cfg->port = atoi(optarg); break;
         case 't': cfg->threads = atoi(optarg); break;        
+        case 'T': cfg->timeout = atoi(optarg); break;
+        case 'D': cfg->dns = optarg; break;
+        case 'q': cfg->queries = atoi(optarg); break;
+        case 'B': cfg->batch = true; break;
         case 'b': cfg->body = optarg; break;
         case '0': cfg->title = optarg; break;
         case '1': cfg->servername = optarg; break;
@@ -103,33 +126,6 @@ static int parse_args(struct config *cfg,  int argc, char* argv[])
     return 0;
 }
 
-char* substring(const char* str, size_t begin, size_t len)
-{
-  if (str == 0 || strlen(str) == 0 || strlen(str) < begin || strlen(str) < (begin+len))
-    return 0;
-
-  return strndup(str + begin, len);
-} 
-
-char *substr(char *haystack, char *begin, char *end)
-{
-   char *ret, *r;
-   char *b = strstr(haystack, begin);
-   if (b) {
-    char *e = strstr(b, end);
-      if(e) {
-        int offset = e - b;
-        int retlen = offset - strlen(begin);
-          if ((ret = malloc(retlen + 1)) == NULL)
-            return NULL;
-            ret[retlen] = '\0';
-          strncpy(ret, b + strlen(begin), retlen);
-        return ret;
-      }
-   }
-   return NULL;
-}
-
 bool setnonblocking(int sockfd) {    
     int opts;    
    
@@ -146,9 +142,8 @@ bool setnonblocking(int sockfd) {
     return true;
 }
 
-static int connected( char *host)
+static int connected(const struct in_addr *in)
 {
-    struct hostent *hp;
     struct sockaddr_in addr;
 
     // epoll mask that contain the list of epoll events attached to a network socket
@@ -157,12 +152,8 @@ static int connected( char *host)
     int sock;
     int on = 1;
     
-    if((hp = gethostbyname(host)) == NULL) {
-       fprintf(stderr,"[NetTools] Invalid server name: %s\n", host);
-       return -1;
-    }
     memset(&addr, 0, sizeof (addr));
-    bcopy(hp->h_addr, &addr.sin_addr, hp->h_length);
+    addr.sin_addr = *in;
     addr.sin_port = htons(cfg.port);
     addr.sin_family = AF_INET;
     sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -203,248 +194,303 @@ int socket_check(int fd)
 
    return 0;
 }
-int se_create(int event_size)
+static void target_done(target_t *t);
+
+static void target_close(se_ptr_t *ptr)
 {
-    return epoll_create(event_size);
+    target_t *t = ptr->data;
+
+    close(ptr->fd);
+    se_delete(ptr);
+    target_done(t);
 }
 
-se_ptr_t *se_add(int loop_fd, int fd)
+static void target_report(se_ptr_t *ptr)
 {
-    se_ptr_t *ptr = malloc(sizeof(se_ptr_t));
-
-    if(!ptr) {
-        return ptr;
+    target_t *t = ptr->data;
+    http_scan_t *scan = &t->scan;
+
+    if(t->total_size > 0) {
+        if (cfg.title != NULL && (scan->title_view.p == NULL ||
+            !http_matcher_find(&title_matcher, scan->title_view.p, scan->title_view.len)))
+            return;
+        if (cfg.servername != NULL && (scan->server.p == NULL ||
+            !http_matcher_find(&server_matcher, scan->server.p, scan->server.len)))
+            return;
+        fprintf(stdout, "%s\t%.*s\t%.*s\t%.*s\n", t->addr, VIEW_ARGS(scan->status),
+                VIEW_ARGS(scan->server), VIEW_ARGS(scan->title_view));
     }
+}
 
-    ptr->loop_fd = loop_fd;
-    ptr->fd = fd;
-
-    ev.data.ptr = ptr;
-    ev.events = EPOLLPRI;
-
-    int ret = epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+/* connect or read took longer than cfg.timeout, report what came so far */
+int network_timeout(se_ptr_t *ptr)
+{
+    target_t *t = ptr->data;
 
-    if(ret < 0) {
-        free(ptr);
-        ptr = NULL;
-    }
-    return ptr;
+    if (t->total_size == 0)
+        fprintf (stderr, " [ %s->%d] timeout\n", t->addr, ptr->fd);
+    target_report(ptr);
+    target_close(ptr);
+    return 1;
 }
 
-int se_delete(se_ptr_t *ptr)
+int network_be_read(se_ptr_t *ptr)
 {
-    if(!ptr) {
-        return -1;
-    }
-
-    if(epoll_ctl(ptr->loop_fd, EPOLL_CTL_DEL, ptr->fd, &ev) < 0) {
-        return -1;
+    target_t *t = ptr->data;
+    int read_size;
+    if (socket_check(ptr->fd) == 1)
+    {
+        fprintf (stderr, " [ %s->%d] read socket_check : [%d]%s\n", t->addr, ptr->fd, errno, strerror(errno));
+        target_close(ptr);
+        return 1;
     }
+	// the arena holds what a title search needs, the rest is not read
+	while( t->total_size < HTTP_SCAN_ARENA &&
+	       (read_size = recv(ptr->fd , t->arena + t->total_size ,
+	                         HTTP_SCAN_ARENA - t->total_size , 0) ))
+	{
+		if (read_size < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK || errno == EAGAIN) {
+				// wait for the rest, the read timeout starts over
+				se_be_read(ptr, network_be_read);
+				se_set_timeout(ptr, cfg.timeout, network_timeout);
+				return 0;
+			}
+			break;
+		}
+		t->total_size += read_size;
+		// with the title found there is nothing left to wait for
+		if (http_scan_execute(&t->scan, t->arena, t->total_size))
+			break;
+	}
+    target_report(ptr);
+    read_size = t->total_size;
+    target_close(ptr);
+    return read_size;
 
-    free(ptr);
+}
+int network_be_write(se_ptr_t *ptr)
+{
+    target_t *t = ptr->data;
+    int rs;
 
+    if (socket_check(ptr->fd) == 1)
+    {
+        fprintf (stderr, " [ %s->%d] write socket_check : [%d]%s\n", t->addr, ptr->fd, errno, strerror(errno));
+        target_close(ptr);
+        return 1;
+    }
+    rs = send(ptr->fd, cfg.body, strlen(cfg.body), 0);
+    if (rs < 0) {
+        printf("send error [%d]%s\n", errno, strerror(errno));
+        target_close(ptr);
+        return 1;
+    }
+    se_be_read(ptr, network_be_read);
+    se_set_timeout(ptr, cfg.timeout, network_timeout);
     return 0;
 }
-
-int se_loop(int loop_fd, int waitout)
+static se_loop_t *loop;
+static dns_t *dns;
+
+/* the target file, mapped when it is a regular file, read otherwise */
+static struct source {
+    char *map;
+    size_t size;
+    size_t off;
+    FILE *fp;
+} src;
+
+static long active, started, done;
+static int feeding, eof;
+static uint64_t start_ms;
+static se_timer_t report_timer;
+
+static int open_source(const char *file)
 {
-    int n = 0, i = 0;
-    se_ptr_t *ptr = NULL;
-
-    while(1) {
-
-        n = epoll_wait(loop_fd, events, 4096, waitout);
-        if(n == 0) break;
-        for(i = 0; i < n; i++) {
-            ptr = events[i].data.ptr;
-
-            if (events[i].events & ( EPOLLHUP | EPOLLERR))
-            {
-                se_delete(ptr);
-            } else if(events[i].events & (EPOLLIN) && ptr->rfunc) {
-                //printf("rfunc\n");
-                ptr->rfunc(ptr);
-
-            } else if(events[i].events & (EPOLLOUT) && ptr->wfunc) {
-                //printf("wfunc\n");
-                ptr->wfunc(ptr);
-            }
-        }
+    struct stat st;
+    int fd = open(file, O_RDONLY);
 
-        if(n == -1 && errno != EINTR) {
-            printf("exit\n");
-            break;
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        src.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (src.map != MAP_FAILED) {
+            src.size = st.st_size;
+            madvise(src.map, src.size, MADV_SEQUENTIAL);
+            close(fd);
+            return 0;
         }
+        src.map = NULL;
     }
-
-    return 0;
+    src.fp = fdopen(fd, "r");
+    return src.fp ? 0 : -1;
 }
 
-int se_be_read(se_ptr_t *ptr, se_rw_proc_t func)
+/* next line without its newline, NULL at the end of the file */
+static char *next_line(char *buf)
 {
-    ptr->rfunc = func;
-    ptr->wfunc = NULL;
-
-    ev.data.ptr = ptr;
-    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLONESHOT;
+    if (src.map) {
+        char *p = src.map + src.off, *nl;
+        size_t len;
 
-    return epoll_ctl(ptr->loop_fd, EPOLL_CTL_MOD, ptr->fd, &ev);
+        if (src.off >= src.size)
+            return NULL;
+        nl = memchr(p, '\n', src.size - src.off);
+        len = nl ? (size_t)(nl - p) : src.size - src.off;
+        src.off += len + 1;
+        if (len >= MAX_LINE)
+            len = MAX_LINE - 1;
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+    } else if (fgets(buf, MAX_LINE, src.fp) == NULL) {
+        return NULL;
+    }
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return buf;
 }
 
-int se_be_write(se_ptr_t *ptr, se_rw_proc_t func)
-{
-    ptr->rfunc = NULL;
-    ptr->wfunc = func;
+static void target_resolved(const char *host, const struct in_addr *addr, void *arg);
 
-    ev.data.ptr = ptr;
-    ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLET;
+static void target_start(const char *line)
+{
+    target_t *t = free_targets;
 
-    return epoll_ctl(ptr->loop_fd, EPOLL_CTL_MOD, ptr->fd, &ev);
+    if (t != NULL)
+        free_targets = t->next_free;
+    else if ((t = malloc(sizeof(target_t))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    t->total_size = 0;
+    http_scan_init(&t->scan);
+    snprintf(t->addr, sizeof(t->addr), "%s", line);
+    active++;
+    started++;
+    dns_resolve(dns, line, target_resolved, t);
 }
 
-int se_be_pri(se_ptr_t *ptr, se_rw_proc_t func)
+/* keep cfg.threads targets in flight, called whenever one finishes */
+static void feed(void)
 {
-    ptr->rfunc = func;
-    ptr->wfunc = NULL;
-
-    ev.data.ptr = ptr;
-    ev.events = EPOLLPRI;
-
-    return epoll_ctl(ptr->loop_fd, EPOLL_CTL_MOD, ptr->fd, &ev);
+    char buf[MAX_LINE];
+
+    if (feeding)
+        return;
+    feeding = 1;
+    while (!eof && active < cfg.threads) {
+        if (next_line(buf) == NULL) {
+            eof = 1;
+            break;
+        }
+        if (strlen(buf) >= 7)
+            target_start(buf);
+    }
+    feeding = 0;
+    if (eof && active == 0)
+        se_stop(loop);
 }
 
-int se_be_rw(se_ptr_t *ptr, se_rw_proc_t rfunc, se_rw_proc_t wfunc)
+static void target_done(target_t *t)
 {
-    ptr->rfunc = rfunc;
-    ptr->wfunc = wfunc;
+    t->next_free = free_targets;
+    free_targets = t;
+    active--;
+    done++;
+    if (!cfg.batch)
+        feed();
+}
 
-    ev.data.ptr = ptr;
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+static void report(se_timer_t *timer)
+{
+    static long last;
 
-    return epoll_ctl(ptr->loop_fd, EPOLL_CTL_MOD, ptr->fd, &ev);
+    fprintf(stderr, "targets: %ld done, %ld in flight, %ld/s\n",
+            done, active, done - last);
+    last = done;
+    se_timer_add(loop, timer, 1000, report, NULL);
 }
 
-int network_be_read(se_ptr_t *ptr)
+/* the dns stage is done with a target, connect it or drop it */
+static void target_resolved(const char *host, const struct in_addr *addr, void *arg)
 {
-    char *response = NULL;
-    char buffer[1500];
-    int read_size , total_size = 0;
-    if (socket_check(ptr->fd) == 1)
-    {
-        fprintf (stderr, " [ %s->%d] read socket_check : [%d]%s\n", ptr->addr, ptr->fd, errno, strerror(errno));
-        //se_be_read(ptr, network_be_read);
-        return 1;
-    }
-    bzero(buffer, 1500);
-	while( (read_size = recv(ptr->fd , buffer , sizeof(buffer) , 0) ))
-	{
-		if((errno == EINTR || errno == EWOULDBLOCK || errno == EAGAIN)) {
-			fprintf (stderr, " recv[%d] : [%d]%s\n",read_size, errno, strerror(errno));
-			continue;
-		}
-		response = realloc(response , read_size + total_size);
-		if(response == NULL)
-		{
-			printf("realloc failed");
-			exit(1);
-		}
-		memcpy((response + total_size) , buffer , read_size);
-		total_size += read_size;
-	}
-	response = realloc(response , total_size + 1);
-	*(response + total_size) = '\0';
-     if(total_size > 0) {
-        int m0 = 0;
-        int m1 = 0;
-        //printf("read %d=%d: %s\n", n, nread, buffer);
-        char *http_status = substring(buffer, 9, 3);
-        char *http_servername = substr(buffer, "Server: ", "\r\n");
-        char *http_title = substr(buffer, "<title>", "</title>");
-        if (cfg.title != NULL) {
-            ++m0;
-            if (http_title != NULL && strstr(http_title, cfg.title) != NULL)++m1;
+    target_t *t = arg;
+    se_ptr_t *ptr;
+    int sockfd;
+
+    if (addr == NULL) {
+        fprintf(stderr,"[NetTools] Invalid server name: %s\n", t->addr);
+    } else if ((sockfd = connected(addr)) > 0) {
+        if ((ptr = se_add(loop, sockfd, t)) != NULL) {
+            se_be_write(ptr, network_be_write);
+            se_set_timeout(ptr, cfg.timeout, network_timeout);
+            return;
         }
-        if (cfg.servername != NULL) {
-            ++m0;
-            if (http_servername != NULL && strstr(http_servername, cfg.servername) != NULL)++m1;
-        }  
-
-        if( m0 == m1)fprintf(stdout, "%s\t%s\t%s\t%s\n", ptr->addr, http_status, http_servername, http_title);
-        if(http_status != NULL) free(http_status);
-        if(http_servername != NULL) free(http_servername);
-        if(http_title != NULL) free(http_title);     
+        perror("se_add");
+        close(sockfd);
     }
-    if(response != NULL) free(response);
-    close(ptr->fd);
-    se_delete(ptr);
-    return total_size;
-
+    target_done(t);
 }
-int network_be_write(se_ptr_t *ptr)
-{
-    int rs;
-
-    if (socket_check(ptr->fd) == 1)
-    {
-        fprintf (stderr, " [ %s->%d] write socket_check : [%d]%s\n", ptr->addr, ptr->fd, errno, strerror(errno));
-        se_delete(ptr);
-        //se_be_write(ptr, network_be_write);
-        return 1;
-    }
-    rs = send(ptr->fd, cfg.body, strlen(cfg.body), 0);
-    if (rs < 0) {
-        printf("send error [%d]%s\n", errno, strerror(errno));
-        se_delete(ptr);
-        return 1;
-    }
-    se_be_read(ptr, network_be_read);
 
-}
 void main(int argc, char* argv[])
 {
-    int epfd;
+    double secs;
     signal(SIGPIPE, SIG_IGN); //oops strace 
     if (parse_args(&cfg, argc, argv)) {
         usage();
         exit(1);
     }
     if (cfg.file) {
-        FILE *fp;
         char buf[MAX_LINE];
-        int n, len ;
-        fp = fopen(cfg.file, "r");
-        if (fp == NULL) {
+        int n;
+        if (open_source(cfg.file) < 0) {
             printf("file not exist :%s\n", cfg.file);
             exit(1);
         }
         n = 0;
-        epfd = se_create(1024);
+        if (cfg.title != NULL)
+            http_matcher_init(&title_matcher, cfg.title);
+        if (cfg.servername != NULL)
+            http_matcher_init(&server_matcher, cfg.servername);
+        loop = se_create(1024);
+        if (loop == NULL ||
+            (dns = dns_create(loop, cfg.dns, cfg.queries, 1000)) == NULL) {
+            perror("se_create");
+            exit(1);
+        }
+        start_ms = se_now(loop);
+        if (!cfg.batch) {
+            // sliding window: a finished target makes room for the next line
+            se_timer_add(loop, &report_timer, 1000, report, NULL);
+            feed();
+            if (active > 0)
+                se_loop(loop, -1);
+            goto work_done;
+        }
         int rn = 0;
 master_worker:
-        while(fgets(buf, MAX_LINE, fp) != NULL) {
-            len = strlen(buf);
-            buf[len-1] = '\0';
+        while(next_line(buf) != NULL) {
               if(strlen(buf) >= 7)
               {
-                int sockfd = connected(buf);
-                if (sockfd > 0)
-                {
-                    se_ptr_t *ptr = se_add(epfd, sockfd);
-                    strcpy(ptr->addr, buf);
-                    se_be_write(ptr, network_be_write);
-                }
+                target_start(buf);
                 //fprintf (stderr, "create and connect : %s=%d\n", buf, sockfd);
               }         
             ++n;
             ++rn;
             if(rn > cfg.threads) goto epoll_worker;
         }
-        if (rn == 0) exit(0);
+        if (rn == 0) goto work_done;
  epoll_worker:
         fprintf (stderr, "work line: %d - %d\n", (n-cfg.threads) < 0 ? 1 : (n-cfg.threads), n);   
         rn = 0;    
-        se_loop(epfd, 4000);
+        se_loop(loop, 4000);
         goto master_worker;
+ work_done:
+        secs = (se_now(loop) - start_ms) / 1000.0;
+        fprintf (stderr, "targets: %ld in %.2fs, %.0f/s\n", done, secs,
+                 secs > 0 ? done / secs : 0);
     }
     fprintf (stderr, "work done\n");
 }
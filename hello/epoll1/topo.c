@@ -0,0 +1,302 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#include "topo.h"
+
+#define NODE_DIR   "/sys/devices/system/node"
+#define MAX_NODES  1024         /* bits in a node mask */
+#define MAX_CPUS   4096
+#define MAX_IRQS   256
+
+typedef struct topo_node {
+    int id;
+    int ncpus;
+    int *cpus;
+} topo_node_t;
+
+static topo_node_t *nodes;      /* in dealing order */
+static int nnodes;
+static int cpu_node[MAX_CPUS];  /* node + 1, 0 when not known */
+static int max_cpu = -1;        /* highest cpu of any node */
+
+static long sys_set_mempolicy(int mode, const unsigned long *mask, unsigned long maxnode)
+{
+    return syscall(__NR_set_mempolicy, mode, mask, maxnode);
+}
+
+static long sys_mbind(void *addr, unsigned long len, int mode,
+                      const unsigned long *mask, unsigned long maxnode,
+                      unsigned flags)
+{
+    return syscall(__NR_mbind, addr, len, mode, mask, maxnode, flags);
+}
+
+static long sys_move_pages(int pid, unsigned long count, void **pages,
+                           const int *to, int *status, int flags)
+{
+    return syscall(__NR_move_pages, pid, count, pages, to, status, flags);
+}
+
+static int read_line(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+        return -1;
+    if (fgets(buf, (int)size, f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* "0-3,8-11" into cpus[], returns how many */
+static int parse_list(const char *s, int *out, int max)
+{
+    int n = 0;
+
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10), b;
+
+        if (end == s)
+            break;
+        b = a;
+        if (*end == '-')
+            b = strtol(end + 1, &end, 10);
+        for (; a <= b && n < max; a++)
+            out[n++] = (int)a;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static int add_node(int id, const int *cpus, int ncpus)
+{
+    topo_node_t *t = (topo_node_t *)realloc(nodes, (nnodes + 1) * sizeof(*nodes));
+    int i;
+
+    if (t == NULL)
+        return -1;
+    nodes = t;
+    t = &nodes[nnodes];
+    t->cpus = (int *)malloc(ncpus * sizeof(int));
+    if (t->cpus == NULL)
+        return -1;
+    memcpy(t->cpus, cpus, ncpus * sizeof(int));
+    t->ncpus = ncpus;
+    t->id = id;
+    for (i = 0; i < ncpus; i++) {
+        if (cpus[i] < MAX_CPUS)
+            cpu_node[cpus[i]] = id + 1;
+        if (cpus[i] > max_cpu)
+            max_cpu = cpus[i];
+    }
+    nnodes++;
+    return 0;
+}
+
+static int nic_node(const char *ifname)
+{
+    char path[256], buf[32];
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+    if (read_line(path, buf, sizeof(buf)) == -1)
+        return -1;
+    return atoi(buf);
+}
+
+int topo_init(const char *ifname)
+{
+    static int cpus[MAX_CPUS];
+    char path[256], buf[4096];
+    int online[MAX_NODES];
+    int i, n, first;
+
+    for (i = 0; i < nnodes; i++)
+        free(nodes[i].cpus);
+    free(nodes);
+    nodes = NULL;
+    nnodes = 0;
+    max_cpu = -1;
+    memset(cpu_node, 0, sizeof(cpu_node));
+
+    n = read_line(NODE_DIR "/online", buf, sizeof(buf)) == 0 ?
+        parse_list(buf, online, MAX_NODES) : 0;
+    for (i = 0; i < n; i++) {
+        int ncpus;
+
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", online[i]);
+        if (read_line(path, buf, sizeof(buf)) == -1)
+            continue;
+        /* memory-only nodes get no workers */
+        ncpus = parse_list(buf, cpus, MAX_CPUS);
+        if (ncpus > 0 && add_node(online[i], cpus, ncpus) == -1)
+            break;
+    }
+
+    if (nnodes == 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (ncpus < 1)
+            ncpus = 1;
+        if (ncpus > MAX_CPUS)
+            ncpus = MAX_CPUS;
+        for (i = 0; i < ncpus; i++)
+            cpus[i] = i;
+        add_node(0, cpus, (int)ncpus);
+        return nnodes;
+    }
+
+    /* the NIC's node deals first */
+    first = ifname ? nic_node(ifname) : -1;
+    for (i = 1; i < nnodes && first >= 0; i++) {
+        if (nodes[i].id == first) {
+            topo_node_t t = nodes[i];
+
+            memmove(&nodes[1], &nodes[0], i * sizeof(*nodes));
+            nodes[0] = t;
+            break;
+        }
+    }
+    return nnodes;
+}
+
+int topo_nodes(void)
+{
+    return nnodes;
+}
+
+int topo_node_of_cpu(int cpu)
+{
+    if (cpu < 0 || cpu >= MAX_CPUS)
+        return -1;
+    return cpu_node[cpu] - 1;
+}
+
+int topo_worker_cpu(int id)
+{
+    topo_node_t *t;
+
+    if (nnodes == 0)
+        topo_init(NULL);
+    t = &nodes[id % nnodes];
+    return t->cpus[(id / nnodes) % t->ncpus];
+}
+
+int topo_place(int id)
+{
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+    int cpu = topo_worker_cpu(id);
+    int node = topo_node_of_cpu(cpu);
+    /* a cpu_set_t only has room for 1024 cpus */
+    cpu_set_t *set = CPU_ALLOC(max_cpu + 1);
+    size_t size = CPU_ALLOC_SIZE(max_cpu + 1);
+    int ret;
+
+    if (set == NULL)
+        return -1;
+    CPU_ZERO_S(size, set);
+    CPU_SET_S(cpu, size, set);
+    ret = sched_setaffinity(0, size, set);
+    CPU_FREE(set);
+    if (ret == -1)
+        return -1;
+
+    /* one node: the default policy is already local */
+    if (nnodes < 2 || node < 0)
+        return node;
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    if (sys_set_mempolicy(MPOL_PREFERRED, mask, MAX_NODES + 1) == -1)
+        return -1;
+    return node;
+}
+
+int topo_mbind(void *addr, size_t len, int node)
+{
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned long start = (unsigned long)addr & ~(page - 1);
+
+    if (node < 0 || node >= MAX_NODES)
+        return -1;
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return (int)sys_mbind((void *)start, (unsigned long)addr + len - start,
+                          MPOL_PREFERRED, mask, MAX_NODES + 1, MPOL_MF_MOVE);
+}
+
+int topo_node_of_addr(void *addr)
+{
+    int status = -1;
+
+    /* no target nodes: only ask where the page is */
+    if (sys_move_pages(0, 1, &addr, NULL, &status, 0) == -1)
+        return -1;
+    return status >= 0 ? status : -1;
+}
+
+/* the NIC's MSI interrupts, one per queue on a multiqueue NIC */
+static int nic_irqs(const char *ifname, int *irqs, int max)
+{
+    char path[256];
+    struct dirent *d;
+    DIR *dir;
+    int n = 0, i, j;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", ifname);
+    dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+    while ((d = readdir(dir)) != NULL && n < max)
+        if (d->d_name[0] >= '0' && d->d_name[0] <= '9')
+            irqs[n++] = atoi(d->d_name);
+    closedir(dir);
+
+    /* in order, so queue k is the kth */
+    for (i = 1; i < n; i++)
+        for (j = i; j > 0 && irqs[j - 1] > irqs[j]; j--) {
+            int t = irqs[j];
+
+            irqs[j] = irqs[j - 1];
+            irqs[j - 1] = t;
+        }
+    return n;
+}
+
+int topo_irq_affine(const char *ifname, int nworkers)
+{
+    int irqs[MAX_IRQS];
+    int n, i, moved = 0;
+
+    n = nic_irqs(ifname, irqs, MAX_IRQS);
+    if (n == 0 || nworkers < 1)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        char path[64];
+        FILE *f;
+
+        snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irqs[i]);
+        f = fopen(path, "w");
+        if (f == NULL)
+            continue;
+        fprintf(f, "%d\n", topo_worker_cpu(i % nworkers));
+        if (fclose(f) == 0)
+            moved++;
+    }
+    return moved ? moved : -1;
+}
@@ -0,0 +1,59 @@
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <stddef.h>    /* for size_t type */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * topo: NUMA-aware placement of worker processes, on raw syscalls (no
+ * libnuma).
+ *
+ * topo_init reads the nodes and their CPUs from /sys/devices/system/node;
+ * without it (or on a kernel without NUMA) everything is one node holding
+ * every online CPU. Workers are dealt out across the nodes in turn, worker
+ * id going to the (id / nodes)th CPU of node id % nodes, so a few workers
+ * do not all land on the first socket as with active_cpu(id) on CPUs
+ * numbered node by node. When the NIC's node is known it is dealt first.
+ *
+ * topo_place pins the calling process to its worker's CPU and sets its
+ * memory policy to that node (set_mempolicy MPOL_PREFERRED), so what it
+ * allocates from then on, connection buffers included, comes from local
+ * memory, and stays there if the scheduler or a later call moves the
+ * process. topo_mbind moves memory that was touched before the placement.
+ *
+ * topo_irq_affine spreads the NIC's queue interrupts over the workers'
+ * CPUs, queue k to worker k's CPU, so received packets are handled (and
+ * their socket buffers allocated) on the worker's node. It needs root to
+ * write /proc/irq/N/smp_affinity_list, and irqbalance may undo it.
+ *
+ * build with : gcc -c topo.c and link topo.o into the program
+ */
+
+/* discover the topology, ifname (or NULL) is the NIC whose node goes
+ * first; returns the number of nodes */
+int topo_init(const char *ifname);
+int topo_nodes(void);
+/* -1 when not known */
+int topo_node_of_cpu(int cpu);
+/* the CPU worker id runs on */
+int topo_worker_cpu(int id);
+
+/* pin and bind the calling process as worker id, returns its node or -1 */
+int topo_place(int id);
+/* prefer node for [addr, addr + len) and move what is already there */
+int topo_mbind(void *addr, size_t len, int node);
+/* the node the page at addr is on, -1 when not known (or not touched) */
+int topo_node_of_addr(void *addr);
+
+/* point the NIC's interrupts at the CPUs of nworkers workers, returns how
+ * many were moved or -1 */
+int topo_irq_affine(const char *ifname, int nworkers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* TOPO_H */
@@ -0,0 +1,199 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <time.h>
+
+#include "twheel.h"
+
+#define DEF_SLOTS     1024
+#define DEF_TICK_MS   100
+#define LOOKAHEAD     64        /* slots twheel_timeout looks at */
+
+struct twheel_s {
+    uint64_t now;               /* ticks, as of the last twheel_update */
+    uint64_t ticks;             /* the next slot to walk is ticks & mask */
+    unsigned tick_ms;
+    unsigned mask;
+    unsigned nslots;
+    int ntimers;
+    twheel_proc_t func;
+    void *arg;
+    twheel_timer_t *slots;      /* list heads */
+};
+
+static uint64_t clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_init(twheel_timer_t *head)
+{
+    head->prev = head->next = head;
+}
+
+static void list_add_tail(twheel_timer_t *head, twheel_timer_t *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(twheel_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+/* a timer already due goes to the next slot walked, not a round later */
+static void internal_add_timer(twheel_t *w, twheel_timer_t *t)
+{
+    uint64_t at = t->expire < w->ticks ? w->ticks : t->expire;
+
+    list_add_tail(&w->slots[at & w->mask], t);
+}
+
+/* now is the tick under way, the deadline is the first tick that starts
+ * at least ms from any point of it */
+static uint64_t deadline(twheel_t *w, unsigned ms)
+{
+    return w->now + 1 + (ms + w->tick_ms - 1) / w->tick_ms;
+}
+
+twheel_t *twheel_create(unsigned slots, unsigned tick_ms,
+                        twheel_proc_t func, void *arg)
+{
+    twheel_t *w = (twheel_t *)calloc(1, sizeof(twheel_t));
+    unsigned i, n = 1;
+
+    if (w == NULL)
+        return NULL;
+    if (slots == 0)
+        slots = DEF_SLOTS;
+    while (n < slots)
+        n <<= 1;
+    w->slots = (twheel_timer_t *)calloc(n, sizeof(twheel_timer_t));
+    if (w->slots == NULL) {
+        free(w);
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+        list_init(&w->slots[i]);
+    w->nslots = n;
+    w->mask = n - 1;
+    w->tick_ms = tick_ms ? tick_ms : DEF_TICK_MS;
+    w->func = func;
+    w->arg = arg;
+    w->now = clock_ms() / w->tick_ms;
+    w->ticks = w->now + 1;
+    return w;
+}
+
+void twheel_destroy(twheel_t *w)
+{
+    free(w->slots);
+    free(w);
+}
+
+void twheel_add(twheel_t *w, twheel_timer_t *timer, unsigned ms)
+{
+    if (twheel_pending(timer))
+        twheel_del(w, timer);
+    timer->expire = deadline(w, ms);
+    internal_add_timer(w, timer);
+    w->ntimers++;
+}
+
+void twheel_touch(twheel_t *w, twheel_timer_t *timer, unsigned ms)
+{
+    uint64_t expire = deadline(w, ms);
+
+    /* the slot it hangs in comes up no later than the old deadline, the
+     * walk moves it on from there */
+    if (twheel_pending(timer) && expire >= timer->expire) {
+        timer->expire = expire;
+        return;
+    }
+    twheel_add(w, timer, ms);
+}
+
+void twheel_del(twheel_t *w, twheel_timer_t *timer)
+{
+    if (!twheel_pending(timer))
+        return;
+    list_del(timer);
+    w->ntimers--;
+}
+
+int twheel_pending(const twheel_timer_t *timer)
+{
+    return timer->next != NULL;
+}
+
+void twheel_update(twheel_t *w)
+{
+    w->now = clock_ms() / w->tick_ms;
+}
+
+int twheel_timeout(twheel_t *w)
+{
+    unsigned i;
+
+    if (w->ntimers == 0)
+        return -1;
+    for (i = 0; i < LOOKAHEAD; i++) {
+        twheel_timer_t *head = &w->slots[(w->ticks + i) & w->mask];
+
+        if (head->next != head)
+            break;
+    }
+    /* ticks is now + 1 after twheel_run */
+    return (int)((w->ticks + i - w->now) * w->tick_ms);
+}
+
+int twheel_run(twheel_t *w)
+{
+    int fired = 0;
+
+    /* nothing pending, skip the idle stretch in one go */
+    if (w->ntimers == 0) {
+        w->ticks = w->now + 1;
+        return 0;
+    }
+    /* after a long stall one walk of every slot finds everything due */
+    if (w->now >= w->ticks + w->nslots)
+        w->ticks = w->now + 1 - w->nslots;
+
+    while (w->ticks <= w->now) {
+        twheel_timer_t *head = &w->slots[w->ticks & w->mask];
+        twheel_timer_t work, *t;
+
+        w->ticks++;
+
+        /* detach the slot first, callbacks may add to it again */
+        if (head->next == head)
+            continue;
+        work.next = head->next;
+        work.prev = head->prev;
+        work.next->prev = work.prev->next = &work;
+        list_init(head);
+
+        while ((t = work.next) != &work) {
+            list_del(t);
+            if (t->expire > w->now) {
+                /* a later round, or touched since it was hashed here */
+                internal_add_timer(w, t);
+                continue;
+            }
+            w->ntimers--;
+            fired++;
+            w->func(t, w->arg);
+        }
+    }
+    return fired;
+}
@@ -0,0 +1,73 @@
+#ifndef TWHEEL_H
+#define TWHEEL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * twheel: a hashed timing wheel for connection timeouts (idle, header read,
+ * write stall), for the epoll servers that do not run on se.c.
+ *
+ * A timer with deadline D (in ticks) hangs in slot D % slots. Every tick
+ * one slot is walked: due timers fire, the others wait for a later round.
+ * Adding, moving and cancelling a timer are O(1) list operations.
+ *
+ * Connection timeouts are refreshed on every read and hardly ever fire, so
+ * twheel_touch only stores the new deadline when it is not earlier than
+ * the old one; the timer is moved to its new slot when the walk reaches the
+ * old one. A refresh is then a compare and a store, and a timer moves at
+ * most once per timeout period however often it is refreshed.
+ *
+ * The timer is three words embedded in the connection: one callback per
+ * wheel gets the timer and the wheel's argument, offsetof finds the rest.
+ * Time is CLOCK_MONOTONIC_COARSE in ticks, read by twheel_update. Drive
+ * the wheel with twheel_timeout as the epoll_wait timeout, twheel_update
+ * as soon as it returns and twheel_run once the batch of events is handled,
+ * so no timer fires under an event still to be handled. A timer never
+ * fires early, and at most a tick late. Not thread safe, one wheel per
+ * event loop.
+ *
+ * build with : gcc -c twheel.c and link twheel.o into the program
+ */
+
+typedef struct twheel_s twheel_t;
+typedef struct twheel_timer_s twheel_timer_t;
+
+/* the timer is no longer pending when this runs, it may be re-armed */
+typedef void (*twheel_proc_t)(twheel_timer_t *timer, void *arg);
+
+struct twheel_timer_s {
+    twheel_timer_t *prev;
+    twheel_timer_t *next;       /* NULL when not pending */
+    uint64_t expire;            /* deadline, in ticks */
+};
+
+/* slots is rounded up to a power of 2 (0 picks 1024), tick_ms 0 picks 100 */
+twheel_t *twheel_create(unsigned slots, unsigned tick_ms,
+                        twheel_proc_t func, void *arg);
+void twheel_destroy(twheel_t *w);
+
+/* (re)arm a timer, ms from now, moving it if it is pending. A timer must be
+ * zeroed (or embedded in zeroed memory) before its first use */
+void twheel_add(twheel_t *w, twheel_timer_t *timer, unsigned ms);
+/* push the deadline to ms from now, lazily when it only moves later */
+void twheel_touch(twheel_t *w, twheel_timer_t *timer, unsigned ms);
+void twheel_del(twheel_t *w, twheel_timer_t *timer);
+int twheel_pending(const twheel_timer_t *timer);
+
+/* read the clock, deadlines set from now on count from here */
+void twheel_update(twheel_t *w);
+/* ms until the next slot holding a timer (looking a bounded way ahead),
+ * -1 when no timer is pending */
+int twheel_timeout(twheel_t *w);
+/* fire what is due as of the last twheel_update, returns how many fired */
+int twheel_run(twheel_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* TWHEEL_H */
@@ -0,0 +1,714 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+#define SQ_ENTRIES 4096
+#define CQ_ENTRIES (SQ_ENTRIES * 4)
+#define DEF_NBUFS 1024
+#define DEF_BUF_SIZE 4096
+#define BGID 1                  /* the loop's only buffer group */
+#define WAKE_MS 1000            /* longest wait while a wake callback is set */
+
+/* user_data is the connection pointer with the operation in the low bits */
+#define OP_ACCEPT 0             /* with a NULL pointer */
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_IGNORE 3             /* cancel and close, nothing to do */
+#define OP_MASK 3
+
+struct uring_loop_s {
+    int ring_fd;
+    int listen_fd;
+    const uring_ops_t *ops;
+    int stop;
+    int accept_armed;
+    int ext_arg;                /* io_uring_enter takes a timeout */
+    void (*on_wake)(uring_loop_t *l);
+    uring_conn_t *conns;
+    int draining;
+    long long drain_end;        /* ms, CLOCK_MONOTONIC */
+
+    /* submission queue */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_khead;
+    unsigned *sq_ktail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_tail;           /* ours, published on submit */
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    /* completion queue, in the same mapping when the kernel allows */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* provided buffers */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *bufs;
+    unsigned nbufs;
+    unsigned buf_size;
+    unsigned short br_tail;
+
+    uring_stats_t stats;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                     void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int ring_map(uring_loop_t *l, struct io_uring_params *p)
+{
+    char *sq, *cq;
+
+    l->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    l->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (l->cq_ring_size > l->sq_ring_size)
+            l->sq_ring_size = l->cq_ring_size;
+        l->cq_ring_size = 0;
+    }
+
+    sq = mmap(NULL, l->sq_ring_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    l->sq_ring = sq;
+
+    if (l->cq_ring_size) {
+        cq = mmap(NULL, l->cq_ring_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+        l->cq_ring = cq;
+    } else {
+        cq = sq;
+    }
+
+    l->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    l->sqes = mmap(NULL, l->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_SQES);
+    if (l->sqes == MAP_FAILED) {
+        l->sqes = NULL;
+        return -1;
+    }
+
+    l->sq_khead = (unsigned *)(sq + p->sq_off.head);
+    l->sq_ktail = (unsigned *)(sq + p->sq_off.tail);
+    l->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+    l->sq_entries = *(unsigned *)(sq + p->sq_off.ring_entries);
+    l->sq_array = (unsigned *)(sq + p->sq_off.array);
+    l->sq_tail = *l->sq_ktail;
+
+    l->cq_khead = (unsigned *)(cq + p->cq_off.head);
+    l->cq_ktail = (unsigned *)(cq + p->cq_off.tail);
+    l->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+    l->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+static void buf_put(uring_loop_t *l, unsigned short bid)
+{
+    struct io_uring_buf *b = &l->br->bufs[l->br_tail & (l->nbufs - 1)];
+
+    /* field by field: the ring tail lives in bufs[0].resv */
+    b->addr = (unsigned long)(l->bufs + (size_t)bid * l->buf_size);
+    b->len = l->buf_size;
+    b->bid = bid;
+    l->br_tail++;
+}
+
+static void buf_publish(uring_loop_t *l)
+{
+    __atomic_store_n(&l->br->tail, l->br_tail, __ATOMIC_RELEASE);
+}
+
+static int bufs_setup(uring_loop_t *l)
+{
+    struct io_uring_buf_reg reg;
+    unsigned i;
+
+    l->br_size = l->nbufs * sizeof(struct io_uring_buf);
+    l->br = mmap(NULL, l->br_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (l->br == MAP_FAILED) {
+        l->br = NULL;
+        return -1;
+    }
+    l->bufs = malloc((size_t)l->nbufs * l->buf_size);
+    if (l->bufs == NULL)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)l->br;
+    reg.ring_entries = l->nbufs;
+    reg.bgid = BGID;
+    if (sys_register(l->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    for (i = 0; i < l->nbufs; i++)
+        buf_put(l, i);
+    buf_publish(l);
+    return 0;
+}
+
+uring_loop_t *uring_create(int listen_fd, const uring_ops_t *ops,
+                           unsigned nbufs, unsigned buf_size)
+{
+    struct io_uring_params p;
+    uring_loop_t *l;
+    int err;
+
+    if (nbufs == 0)
+        nbufs = DEF_NBUFS;
+    if (buf_size == 0)
+        buf_size = DEF_BUF_SIZE;
+    if (nbufs & (nbufs - 1) || nbufs > 32768) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    l = calloc(1, sizeof(uring_loop_t));
+    if (l == NULL)
+        return NULL;
+    l->listen_fd = listen_fd;
+    l->ops = ops;
+    l->nbufs = nbufs;
+    l->buf_size = buf_size;
+
+    /* Completions are only run when we ask for them in io_uring_enter,
+     * which is once per loop anyway; older kernels get a plain ring. */
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = CQ_ENTRIES;
+    l->ring_fd = sys_setup(SQ_ENTRIES, &p);
+    if (l->ring_fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = CQ_ENTRIES;
+        l->ring_fd = sys_setup(SQ_ENTRIES, &p);
+    }
+    if (l->ring_fd < 0)
+        goto fail;
+
+    if (ring_map(l, &p) == -1 || bufs_setup(l) == -1)
+        goto fail;
+    l->ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+    return l;
+
+fail:
+    err = errno;
+    uring_destroy(l);
+    errno = err;
+    return NULL;
+}
+
+void uring_stop(uring_loop_t *l)
+{
+    l->stop = 1;
+}
+
+void uring_set_wake(uring_loop_t *l, void (*on_wake)(uring_loop_t *l))
+{
+    l->on_wake = on_wake;
+}
+
+const uring_stats_t *uring_stats(uring_loop_t *l)
+{
+    return &l->stats;
+}
+
+static unsigned sq_unsubmitted(uring_loop_t *l)
+{
+    return l->sq_tail - __atomic_load_n(l->sq_khead, __ATOMIC_ACQUIRE);
+}
+
+static int submit(uring_loop_t *l, unsigned wait)
+{
+    unsigned n;
+    int ret;
+
+    __atomic_store_n(l->sq_ktail, l->sq_tail, __ATOMIC_RELEASE);
+    n = sq_unsubmitted(l);
+    l->stats.enters++;
+    if (wait && (l->on_wake || l->stop) && l->ext_arg) {
+        /* a signal that lands just before the wait does not break it,
+         * so do not sleep for longer than WAKE_MS; uring_destroy relies
+         * on the same bound once the loop is stopped */
+        struct __kernel_timespec ts = { WAKE_MS / 1000, WAKE_MS % 1000 * 1000000LL };
+        struct io_uring_getevents_arg arg;
+
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long)&ts;
+        ret = sys_enter(l->ring_fd, n, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg, sizeof(arg));
+    } else {
+        ret = sys_enter(l->ring_fd, n, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+    if (ret > 0)
+        l->stats.sqes += ret;
+    return ret;
+}
+
+static struct io_uring_sqe *get_sqe(uring_loop_t *l)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    /* full: hand what we have to the kernel and take the slots back */
+    if (sq_unsubmitted(l) >= l->sq_entries && submit(l, 0) < 0)
+        return NULL;
+
+    idx = l->sq_tail & l->sq_mask;
+    sqe = &l->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    l->sq_array[idx] = idx;
+    l->sq_tail++;
+    return sqe;
+}
+
+static unsigned long user_data(uring_conn_t *c, int op)
+{
+    return (unsigned long)c | op;
+}
+
+static void arm_accept(uring_loop_t *l)
+{
+    struct io_uring_sqe *sqe = get_sqe(l);
+
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = l->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data(NULL, OP_ACCEPT);
+    l->accept_armed = 1;
+}
+
+static void arm_recv(uring_conn_t *c)
+{
+    struct io_uring_sqe *sqe = get_sqe(c->loop);
+
+    if (sqe == NULL) {
+        c->dead = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGID;
+    sqe->user_data = user_data(c, OP_RECV);
+    c->recv_armed = 1;
+    c->recv_cancel = 0;
+}
+
+static void start_send(uring_conn_t *c)
+{
+    struct io_uring_sqe *sqe = get_sqe(c->loop);
+
+    if (sqe == NULL) {
+        c->dead = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (unsigned long)(c->out + c->out_off);
+    sqe->len = c->out_len - c->out_off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data(c, OP_SEND);
+    c->send_busy = 1;
+    c->send_buf = c->out;
+}
+
+/* cancel the recv only, or with ALL set everything on the fd */
+static void cancel(uring_conn_t *c, int all)
+{
+    struct io_uring_sqe *sqe = get_sqe(c->loop);
+
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    if (all) {
+        sqe->fd = c->fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    } else {
+        sqe->addr = user_data(c, OP_RECV);
+    }
+    sqe->user_data = user_data(NULL, OP_IGNORE);
+}
+
+static void conn_free(uring_conn_t *c)
+{
+    struct io_uring_sqe *sqe;
+
+    if (c->loop->ops->on_close)
+        c->loop->ops->on_close(c);
+
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        c->loop->conns = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+
+    sqe = get_sqe(c->loop);
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = c->fd;
+        sqe->user_data = user_data(NULL, OP_IGNORE);
+    } else {
+        close(c->fd);
+    }
+    free(c->out_old);
+    free(c->out);
+    free(c);
+}
+
+/* Bring the requests in flight in line with the connection's state after
+ * anything happened to it. */
+static void conn_update(uring_conn_t *c)
+{
+    size_t pending;
+
+    if (!c->dead && c->out_off < c->out_len && !c->send_busy)
+        start_send(c);
+
+    pending = c->out_len - c->out_off;
+    if (!c->dead && c->closing && pending == 0 && !c->send_busy)
+        c->dead = 1;
+
+    if (c->dead) {
+        if (!c->recv_armed && !c->send_busy) {
+            conn_free(c);
+        } else if (!c->cancelled) {
+            cancel(c, 1);
+            c->cancelled = 1;
+        }
+        return;
+    }
+
+    /* stop reading from a peer that does not take its replies */
+    if (c->closing || pending >= URING_OUT_HIGH) {
+        if (c->recv_armed && !c->recv_cancel) {
+            cancel(c, 0);
+            c->recv_cancel = 1;
+        }
+    } else if (!c->recv_armed) {
+        arm_recv(c);
+    }
+}
+
+static void conn_open(uring_loop_t *l, int fd)
+{
+    uring_conn_t *c = calloc(1, sizeof(uring_conn_t));
+    int one = 1;
+
+    if (c == NULL) {
+        close(fd);
+        return;
+    }
+    c->loop = l;
+    c->fd = fd;
+    /* sends go out one at a time, so without this a send shorter than the
+     * MSS waits for the peer's delayed ACK of the one before */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (l->ops->on_open && l->ops->on_open(c) == -1) {
+        free(c);
+        close(fd);
+        return;
+    }
+    l->stats.accepts++;
+    c->next = l->conns;
+    if (l->conns)
+        l->conns->prev = c;
+    l->conns = c;
+    if (l->draining)
+        c->closing = 1;
+    conn_update(c);
+}
+
+static void on_recv(uring_conn_t *c, struct io_uring_cqe *cqe)
+{
+    uring_loop_t *l = c->loop;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        c->recv_armed = 0;
+
+    if (cqe->res > 0) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        l->stats.recvs++;
+        if (!c->dead && !c->closing &&
+            l->ops->on_data(c, l->bufs + (size_t)bid * l->buf_size, cqe->res) == -1)
+            c->dead = 1;
+        buf_put(l, bid);
+    } else if (cqe->res == -ENOBUFS) {
+        /* every buffer is taken, conn_update arms it again */
+        l->stats.nobufs++;
+    } else if (cqe->res != -ECANCELED) {
+        /* end of file, or an error */
+        c->dead = 1;
+    }
+    conn_update(c);
+}
+
+static void on_send(uring_conn_t *c, struct io_uring_cqe *cqe)
+{
+    c->send_busy = 0;
+    free(c->out_old);
+    c->out_old = NULL;
+
+    if (cqe->res > 0) {
+        c->loop->stats.sends++;
+        c->out_off += cqe->res;
+        if (c->out_off == c->out_len)
+            c->out_off = c->out_len = 0;
+    } else {
+        c->dead = 1;
+    }
+    conn_update(c);
+}
+
+static void on_accept(uring_loop_t *l, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        l->accept_armed = 0;
+
+    if (cqe->res >= 0)
+        conn_open(l, cqe->res);
+    else if (cqe->res != -ECANCELED)
+        fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+}
+
+static void cancel_accept(uring_loop_t *l)
+{
+    struct io_uring_sqe *sqe;
+
+    if (l->accept_armed && (sqe = get_sqe(l)) != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = user_data(NULL, OP_ACCEPT);
+        sqe->user_data = user_data(NULL, OP_IGNORE);
+    }
+}
+
+void uring_drain(uring_loop_t *l, int grace_ms)
+{
+    uring_conn_t *c, *next;
+
+    if (l->draining)
+        return;
+    l->draining = 1;
+    l->drain_end = now_ms() + grace_ms;
+
+    cancel_accept(l);
+    for (c = l->conns; c != NULL; c = next) {
+        next = c->next;
+        c->closing = 1;
+        conn_update(c);
+    }
+}
+
+static void reap(uring_loop_t *l)
+{
+    unsigned head = *l->cq_khead;
+    unsigned tail = __atomic_load_n(l->cq_ktail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &l->cqes[head & l->cq_mask];
+        uring_conn_t *c = (uring_conn_t *)(unsigned long)(cqe->user_data & ~(unsigned long)OP_MASK);
+
+        l->stats.cqes++;
+        switch (cqe->user_data & OP_MASK) {
+        case OP_ACCEPT:
+            on_accept(l, cqe);
+            break;
+        case OP_RECV:
+            on_recv(c, cqe);
+            break;
+        case OP_SEND:
+            on_send(c, cqe);
+            break;
+        }
+    }
+    __atomic_store_n(l->cq_khead, head, __ATOMIC_RELEASE);
+    buf_publish(l);
+}
+
+int uring_run(uring_loop_t *l)
+{
+    while (!l->stop) {
+        if (l->draining && (l->conns == NULL || now_ms() >= l->drain_end))
+            break;
+        if (!l->accept_armed && !l->draining)
+            arm_accept(l);
+
+        if (submit(l, 1) < 0 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY && errno != ETIME)
+            return -1;
+        if (l->on_wake)
+            l->on_wake(l);
+        reap(l);
+    }
+    return 0;
+}
+
+/* uring_run may return with connections left, after the grace period of
+ * a drain or on uring_stop, and their multishot recvs still write into
+ * the provided buffers. Drop them and cancel everything, and wait until
+ * nothing is in flight; -1 when the ring does not get there. */
+static int quiesce(uring_loop_t *l)
+{
+    long long end = now_ms() + WAKE_MS;
+    uring_conn_t *c, *next;
+
+    l->stop = 1;
+    l->draining = 1;            /* an accept that lands now is closed at once */
+    cancel_accept(l);
+    for (c = l->conns; c != NULL; c = next) {
+        next = c->next;
+        c->dead = 1;
+        conn_update(c);
+    }
+
+    while (l->conns != NULL || l->accept_armed) {
+        if (now_ms() >= end)
+            return -1;
+        if (submit(l, 1) < 0 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY && errno != ETIME)
+            return -1;
+        reap(l);
+    }
+    /* the closes conn_free queued */
+    submit(l, 0);
+    return 0;
+}
+
+void uring_destroy(uring_loop_t *l)
+{
+    /* the kernel may still write into the buffers: leak them */
+    if (l->sqes && (l->conns != NULL || l->accept_armed) && quiesce(l) == -1) {
+        l->br = NULL;
+        l->bufs = NULL;
+    }
+
+    if (l->sqes)
+        munmap(l->sqes, l->sqes_size);
+    if (l->cq_ring)
+        munmap(l->cq_ring, l->cq_ring_size);
+    if (l->sq_ring)
+        munmap(l->sq_ring, l->sq_ring_size);
+    if (l->br)
+        munmap(l->br, l->br_size);
+    free(l->bufs);
+    if (l->ring_fd >= 0)
+        close(l->ring_fd);
+    free(l);
+}
+
+/* Make room for LEN more bytes of output. The bytes of a send in flight
+ * must stay where they are until it completes, so a buffer the kernel
+ * may still be reading from is replaced, not moved or reallocated. */
+static int conn_reserve(uring_conn_t *c, size_t len)
+{
+    size_t pending = c->out_len - c->out_off;
+    size_t cap = c->out_cap ? c->out_cap : 1024;
+    char *p;
+
+    if (c->out_len + len <= c->out_cap)
+        return 0;
+
+    if (!c->send_busy && pending + len <= c->out_cap) {
+        memmove(c->out, c->out + c->out_off, pending);
+    } else {
+        while (cap < pending + len)
+            cap *= 2;
+        p = malloc(cap);
+        if (p == NULL)
+            return -1;
+        memcpy(p, c->out + c->out_off, pending);
+        if (c->send_busy && c->out == c->send_buf && c->out_old == NULL)
+            c->out_old = c->out;
+        else
+            free(c->out);
+        c->out = p;
+        c->out_cap = cap;
+    }
+    c->out_off = 0;
+    c->out_len = pending;
+    return 0;
+}
+
+int uring_send(uring_conn_t *c, const void *buf, size_t len)
+{
+    if (conn_reserve(c, len) == -1)
+        return -1;
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+    return 0;
+}
+
+int uring_sendv(uring_conn_t *c, const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (conn_reserve(c, len) == -1)
+        return -1;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(c->out + c->out_len, iov[i].iov_base, iov[i].iov_len);
+        c->out_len += iov[i].iov_len;
+    }
+    return 0;
+}
+
+size_t uring_pending(uring_conn_t *c)
+{
+    return c->out_len - c->out_off;
+}
+
+void uring_close(uring_conn_t *c)
+{
+    c->closing = 1;
+}
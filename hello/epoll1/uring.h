@@ -0,0 +1,114 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>    /* for size_t type */
+#include <sys/uio.h>   /* for struct iovec */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * uring: an io_uring backend for the epoll servers, on raw syscalls (no
+ * liburing).
+ *
+ * One loop serves one listening socket:
+ *   - a single multishot accept stays armed for the life of the loop,
+ *   - every connection has one multishot recv armed, reading into a
+ *     provided buffer ring shared by the whole loop, so no memory is tied
+ *     up in idle connections,
+ *   - sends are queued per connection and go out one at a time,
+ *   - everything prepared while a batch of completions is handled is
+ *     submitted with the wait for the next batch, in one io_uring_enter.
+ *
+ * The server only sees the bytes: on_data gets each received chunk, and
+ * answers with uring_send/uring_sendv, which copy into the connection's
+ * output buffer. Past URING_OUT_HIGH bytes of unsent output the recv is
+ * cancelled until the peer reads again, as epoll_server does with
+ * OUTBUF_HIGH.
+ *
+ * uring_drain stops a loop gracefully: the accept is cancelled, so the
+ * backlog is left to whoever shares the socket, every connection is closed
+ * once its output is written, and uring_run returns when none is left or
+ * the grace period is over. A wake callback set with uring_set_wake runs
+ * after every wait, at least once a second and after a signal, which is
+ * where a server notices it was asked to quit.
+ *
+ * build with : gcc -c uring.c and link uring.o into the program
+ */
+
+#define URING_OUT_HIGH (64 * 1024)
+
+typedef struct uring_loop_s uring_loop_t;
+typedef struct uring_conn_s uring_conn_t;
+
+struct uring_conn_s {
+    uring_loop_t *loop;
+    int fd;
+    void *data;                 /* free for the server */
+    char *out;                  /* queued output, out_off..out_len unsent */
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+    char *send_buf;             /* the buffer the send in flight reads */
+    char *out_old;              /* replaced while a send read it */
+    int recv_armed;             /* a multishot recv is live */
+    int recv_cancel;            /* and a cancel for it was queued */
+    int send_busy;              /* a send is in flight */
+    int closing;                /* close once the output is sent */
+    int dead;                   /* close now, drop the output */
+    int cancelled;              /* everything on the fd was cancelled */
+    uring_conn_t *prev;         /* the loop's connections */
+    uring_conn_t *next;
+};
+
+typedef struct uring_ops {
+    /* a connection was accepted, return -1 to refuse it */
+    int (*on_open)(uring_conn_t *c);
+    /* LEN bytes arrived, return -1 to drop the connection */
+    int (*on_data)(uring_conn_t *c, const char *buf, size_t len);
+    /* the connection is going away, release c->data */
+    void (*on_close)(uring_conn_t *c);
+} uring_ops_t;
+
+typedef struct uring_stats {
+    unsigned long enters;       /* io_uring_enter calls */
+    unsigned long sqes;         /* requests submitted */
+    unsigned long cqes;         /* completions reaped */
+    unsigned long accepts;
+    unsigned long recvs;        /* recv completions carrying data */
+    unsigned long sends;
+    unsigned long nobufs;       /* recvs that ran out of provided buffers */
+} uring_stats_t;
+
+/* nbufs (a power of 2) provided buffers of buf_size bytes each; 0 picks
+ * the defaults. Returns NULL and sets errno when io_uring is unusable. */
+uring_loop_t *uring_create(int listen_fd, const uring_ops_t *ops,
+                           unsigned nbufs, unsigned buf_size);
+/* drops the connections left (on_close runs for each) and waits for the
+ * kernel to be done with them before the buffers go */
+void uring_destroy(uring_loop_t *loop);
+
+/* run until uring_stop or an error of the ring itself (-1, errno set) */
+int uring_run(uring_loop_t *loop);
+void uring_stop(uring_loop_t *loop);
+/* no more accepts, close the connections as their output goes out, and
+ * stop once they are gone or after grace_ms */
+void uring_drain(uring_loop_t *loop, int grace_ms);
+void uring_set_wake(uring_loop_t *loop, void (*on_wake)(uring_loop_t *loop));
+const uring_stats_t *uring_stats(uring_loop_t *loop);
+
+/* queue output, -1 when out of memory. Only from the callbacks of the
+ * same connection: the send is started when the callback returns. */
+int uring_send(uring_conn_t *c, const void *buf, size_t len);
+int uring_sendv(uring_conn_t *c, const struct iovec *iov, int iovcnt);
+size_t uring_pending(uring_conn_t *c);
+
+/* close once the queued output is written */
+void uring_close(uring_conn_t *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* URING_H */
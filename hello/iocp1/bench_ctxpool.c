@@ -0,0 +1,287 @@
+/* bench_ctxpool.c
+ * connection churn for the IOCP servers' context handling: every
+ * iteration accepts a connection (a PER_SOCKET_CONTEXT and its 8K
+ * PER_IO_CONTEXT, put on the connection list) and closes another one
+ * (off the list, both freed). The connection closed is whatever sat in a
+ * random slot of a table shared by all threads, so most are closed by a
+ * thread other than the one that accepted them, as with completions that
+ * land on any worker.
+ *   malloc  : the original code, zeroed heap blocks and one global list
+ *             behind one lock (which CtxtAllocate also holds)
+ *   ctxpool : ctxpool.c, per-thread caches and the sharded registry
+ * build with : gcc -O2 -Wall -pthread -o bench_ctxpool bench_ctxpool.c ctxpool.c
+ * run with   : ./bench_ctxpool [-t threads] [-w window] [-d seconds] [-m malloc|ctxpool]
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ctxpool.h"
+
+#define MAX_THREADS 256
+#define MAX_BUFF_SIZE 8192
+
+/* the server's structures, with what the Winsock types take */
+typedef struct io_ctx
+{
+   char overlapped[32];
+   char buffer[MAX_BUFF_SIZE];
+   char *buf;
+   unsigned long len;
+   int total, sent, op;
+   int sock_accept;
+   struct io_ctx *forward;
+} io_ctx_t;
+
+typedef struct sock_ctx
+{
+   int sock;
+   io_ctx_t *io;
+   ctxreg_link_t link;
+   struct sock_ctx *back, *forward;
+} sock_ctx_t;
+
+struct worker
+{
+   pthread_t tid;
+   unsigned seed;
+   unsigned long ops;
+};
+
+static int use_pool;
+static volatile int stop;
+static sock_ctx_t **slots;
+static unsigned nslots;
+
+static ctxpool_t *sock_pool, *io_pool;
+static ctxreg_t *reg;
+
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static sock_ctx_t *list_head;
+
+static double now_sec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static sock_ctx_t *open_malloc(int sd)
+{
+   sock_ctx_t *s;
+
+   pthread_mutex_lock(&list_lock);
+   s = calloc(1, sizeof(sock_ctx_t));
+   if (s != NULL && (s->io = calloc(1, sizeof(io_ctx_t))) == NULL)
+   {
+      free(s);
+      s = NULL;
+   }
+   pthread_mutex_unlock(&list_lock);
+   if (s == NULL)
+      return NULL;
+   s->sock = sd;
+   s->io->buf = s->io->buffer;
+   s->io->len = MAX_BUFF_SIZE;
+
+   pthread_mutex_lock(&list_lock);
+   s->back = list_head;
+   if (list_head != NULL)
+      list_head->forward = s;
+   list_head = s;
+   pthread_mutex_unlock(&list_lock);
+   return s;
+}
+
+static void close_malloc(sock_ctx_t *s)
+{
+   pthread_mutex_lock(&list_lock);
+   if (s->forward != NULL)
+      s->forward->back = s->back;
+   else
+      list_head = s->back;
+   if (s->back != NULL)
+      s->back->forward = s->forward;
+   free(s->io);
+   free(s);
+   pthread_mutex_unlock(&list_lock);
+}
+
+static sock_ctx_t *open_pool(int sd)
+{
+   sock_ctx_t *s = ctxpool_alloc(sock_pool);
+
+   if (s == NULL)
+      return NULL;
+   memset(s, 0, sizeof(*s));
+   if ((s->io = ctxpool_alloc(io_pool)) == NULL)
+   {
+      ctxpool_free(sock_pool, s);
+      return NULL;
+   }
+   memset(s->io, 0, offsetof(io_ctx_t, buffer));
+   s->io->buf = s->io->buffer;
+   s->io->len = MAX_BUFF_SIZE;
+   s->io->total = s->io->sent = s->io->op = 0;
+   s->io->forward = NULL;
+   s->sock = sd;
+   ctxreg_add(reg, &s->link);
+   return s;
+}
+
+static void close_pool(sock_ctx_t *s)
+{
+   ctxreg_remove(reg, &s->link);
+   ctxpool_free(io_pool, s->io);
+   ctxpool_free(sock_pool, s);
+}
+
+static void *worker_main(void *arg)
+{
+   struct worker *w = arg;
+   int sd = 0;
+
+   while (!stop)
+   {
+      sock_ctx_t *s = use_pool ? open_pool(sd) : open_malloc(sd);
+      unsigned i;
+
+      if (s == NULL)
+      {
+         perror("alloc");
+         exit(1);
+      }
+      /* the first recv lands in the buffer */
+      memset(s->io->buffer, sd, 64);
+      sd++;
+      w->seed = w->seed * 1103515245 + 12345;
+      i = (w->seed >> 8) % nslots;
+      s = __atomic_exchange_n(&slots[i], s, __ATOMIC_ACQ_REL);
+      if (s != NULL)
+      {
+         if (use_pool)
+            close_pool(s);
+         else
+            close_malloc(s);
+      }
+      w->ops++;
+   }
+   return NULL;
+}
+
+static void run(const char *label, int threads, double secs)
+{
+   static struct worker w[MAX_THREADS];
+   unsigned long ops = 0;
+   double t0, t1;
+   unsigned i;
+   int k;
+
+   stop = 0;
+   t0 = now_sec();
+   for (k = 0; k < threads; k++)
+   {
+      w[k].seed = k + 1;
+      w[k].ops = 0;
+      if (pthread_create(&w[k].tid, NULL, worker_main, &w[k]) != 0)
+      {
+         perror("pthread_create");
+         exit(1);
+      }
+   }
+   usleep((useconds_t)(secs * 1e6));
+   stop = 1;
+   for (k = 0; k < threads; k++)
+   {
+      pthread_join(w[k].tid, NULL);
+      ops += w[k].ops;
+   }
+   t1 = now_sec();
+
+   /* what is left open is closed by the main thread, like CtxtListFree */
+   for (i = 0; i < nslots; i++)
+   {
+      if (slots[i] == NULL)
+         continue;
+      if (use_pool)
+         close_pool(slots[i]);
+      else
+         close_malloc(slots[i]);
+      slots[i] = NULL;
+   }
+   if ((use_pool && ctxreg_count(reg) != 0) || (!use_pool && list_head != NULL))
+   {
+      fprintf(stderr, "%s: connections left on the list\n", label);
+      exit(1);
+   }
+
+   printf("%-8s %3d threads %10.0f conn/s %8.1f ns/conn/thread", label, threads,
+      ops / (t1 - t0), (t1 - t0) * 1e9 * threads / (ops ? ops : 1));
+   if (use_pool)
+   {
+      ctxpool_stats_t st;
+
+      ctxpool_stats(io_pool, &st);
+      printf("  io slabs %lu, depot %lu in %lu out", st.slabs, st.flushes, st.refills);
+   }
+   printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *mode = NULL;
+   int ch, threads = 16, window = 64;
+   double secs = 5;
+
+   while ((ch = getopt(argc, argv, "t:w:d:m:h?")) != -1)
+   {
+      switch (ch)
+      {
+         case 't': threads = atoi(optarg); break;
+         case 'w': window = atoi(optarg); break;
+         case 'd': secs = atof(optarg); break;
+         case 'm': mode = optarg; break;
+         default:
+            fprintf(stderr, "bench_ctxpool [-t threads] [-w window] [-d seconds] [-m malloc|ctxpool]\n");
+            exit(1);
+      }
+   }
+   if (threads < 1 || threads > MAX_THREADS)
+      threads = 16;
+   if (window < 1)
+      window = 64;
+
+   nslots = threads * window;
+   slots = calloc(nslots, sizeof(*slots));
+   sock_pool = ctxpool_create(sizeof(sock_ctx_t), 0);
+   io_pool = ctxpool_create(sizeof(io_ctx_t), 0);
+   reg = ctxreg_create(0);
+   if (slots == NULL || sock_pool == NULL || io_pool == NULL || reg == NULL)
+   {
+      perror("init");
+      exit(1);
+   }
+
+   printf("%d threads, %u connections open, %.0f seconds each\n", threads, nslots, secs);
+   if (mode == NULL || strcmp(mode, "malloc") == 0)
+   {
+      use_pool = 0;
+      run("malloc", threads, secs);
+   }
+   if (mode == NULL || strcmp(mode, "ctxpool") == 0)
+   {
+      use_pool = 1;
+      run("ctxpool", threads, secs);
+   }
+
+   ctxreg_destroy(reg);
+   ctxpool_destroy(io_pool);
+   ctxpool_destroy(sock_pool);
+   free(slots);
+   return 0;
+}
@@ -0,0 +1,492 @@
+// Module:
+//      iocpclient_linux.c
+//
+// Abstract:
+//      The iocpclient.cpp stress client for Linux. iocpclient runs one
+//      thread per connection, each doing a blocking SendBuffer/RecvBuffer
+//      of -b bytes and comparing the first and last byte of the echo. Here
+//      each thread multiplexes -c connections with edge-triggered epoll,
+//      so a handful of threads keep thousands of connections busy:
+//
+//      - every connection keeps -o messages outstanding (1 gives
+//        iocpclient's send, wait for the echo, send again);
+//      - a message is a slice of a random pattern, starting at an offset
+//        that depends on the connection and the message number, and every
+//        byte coming back is compared with what was sent, not only the
+//        first and the last;
+//      - the round trip of each message, from its first byte sent to its
+//        last byte received, goes into a per-thread histogram (hist.c).
+//
+//      Every second it prints messages/s, MB/s echoed and the percentiles
+//      of that second, and at the end the totals and the whole distribution.
+//
+//  Usage:
+//      iocpclient_linux -n:127.0.0.1 -e:5001 -t:4 -c:1000 -s:64 -d:10
+//
+//  Build:
+//      gcc -O2 -Wall -pthread -I../../epoll1 -o iocpclient_linux iocpclient_linux.c ../../epoll1/hist.c
+//
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "hist.h"
+
+#define MAXTHREADS          64
+#define MAX_OUTSTANDING     64
+#define MAXEVENTS           256
+#define RECV_BUF            65536
+#define PATTERN_SLACK       4096    // message start offsets are below this
+
+typedef struct _OPTIONS {
+    char szHostname[64];
+    char *port;
+    int nTotalThreads;
+    int nConnections;           // per thread
+    int nBufSize;
+    int nOutstanding;           // messages in flight per connection
+    int nSeconds;               // 0 runs until CTRL-C
+    int bVerbose;
+} OPTIONS;
+
+typedef enum _CONN_STATE {
+    ConnConnecting,
+    ConnEstablished,
+    ConnClosed
+} CONN_STATE;
+
+//
+// one echo connection
+//
+typedef struct _ECHO_CONN {
+    int                         sd;
+    int                         id;
+    CONN_STATE                  state;
+    unsigned long long          nSent;          // messages started
+    unsigned long long          nRecv;          // messages fully echoed
+    int                         nSendOffset;    // into message nSent - 1
+    int                         nRecvOffset;    // into message nRecv
+    unsigned long long          SendTime[MAX_OUTSTANDING];
+} ECHO_CONN, *PECHO_CONN;
+
+typedef struct _WORKER {
+    int                         id;
+    pthread_t                   thread;
+    int                         epfd;
+    PECHO_CONN                  pConns;
+    char                        *pRecvBuf;
+    unsigned long long          nMsgs;
+    unsigned long long          nBytes;
+    unsigned long               nConnected;
+    unsigned long               nErrors;        // failed connects, resets
+    unsigned long               nMismatch;      // echoes that differ
+    hist_t                      Rtt;            // ns
+} WORKER, *PWORKER;
+
+static OPTIONS g_Options = {"localhost", "5001", 1, 100, 4096, 1, 0, 0};
+static WORKER g_Workers[MAXTHREADS];
+static struct addrinfo *g_pAddr;
+static char *g_Pattern;
+static volatile int g_bEndClient = 0;
+
+static unsigned long long NowNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+// message nMsg of connection id is g_Pattern[MsgOffset(...)], nBufSize long
+//
+static int MsgOffset(int id, unsigned long long nMsg) {
+    return (int)(((unsigned long long)id * 131 + nMsg * 61) % PATTERN_SLACK);
+}
+
+static void CloseConn(PWORKER pWorker, PECHO_CONN pConn, int bError) {
+    if( pConn->state == ConnClosed )
+        return;
+    if( bError )
+        pWorker->nErrors++;
+    close(pConn->sd);
+    pConn->sd = -1;
+    pConn->state = ConnClosed;
+}
+
+//
+// Abstract:
+//     Start new messages and push out what is pending until the socket
+//     is full or every connection has nOutstanding messages in flight.
+//
+static int SendPending(PECHO_CONN pConn) {
+    for( ;; ) {
+        const char *bufp;
+        ssize_t nSend;
+
+        if( pConn->nSendOffset == g_Options.nBufSize || pConn->nSent == 0 ) {
+            if( pConn->nSent - pConn->nRecv >= (unsigned long long)g_Options.nOutstanding )
+                return 0;
+            pConn->SendTime[pConn->nSent % MAX_OUTSTANDING] = NowNs();
+            pConn->nSent++;
+            pConn->nSendOffset = 0;
+        }
+        bufp = g_Pattern + MsgOffset(pConn->id, pConn->nSent - 1) + pConn->nSendOffset;
+        nSend = send(pConn->sd, bufp, g_Options.nBufSize - pConn->nSendOffset, MSG_NOSIGNAL);
+        if( nSend < 0 )
+            return errno == EAGAIN ? 0 : -1;
+        pConn->nSendOffset += (int)nSend;
+    }
+}
+
+//
+// Abstract:
+//     Read until EAGAIN, check every byte against what was sent, and time
+//     each message as its last byte comes back.
+//
+static int RecvEcho(PWORKER pWorker, PECHO_CONN pConn) {
+    for( ;; ) {
+        ssize_t nRecv = recv(pConn->sd, pWorker->pRecvBuf, RECV_BUF, 0);
+        char *bufp = pWorker->pRecvBuf;
+        unsigned long long now = 0;
+
+        if( nRecv < 0 )
+            return errno == EAGAIN ? 0 : -1;
+        if( nRecv == 0 )
+            return -1;
+
+        while( nRecv > 0 ) {
+            int nLeft = g_Options.nBufSize - pConn->nRecvOffset;
+            int n = nRecv < nLeft ? (int)nRecv : nLeft;
+            const char *expect = g_Pattern + MsgOffset(pConn->id, pConn->nRecv) + pConn->nRecvOffset;
+
+            if( pConn->nRecv >= pConn->nSent || memcmp(bufp, expect, n) != 0 ) {
+                if( g_Options.bVerbose )
+                    printf("nak(thread %d, connection %d) message %llu offset %d\n",
+                           pWorker->id, pConn->id, pConn->nRecv, pConn->nRecvOffset);
+                pWorker->nMismatch++;
+                return -1;
+            }
+            pWorker->nBytes += n;
+            pConn->nRecvOffset += n;
+            bufp += n;
+            nRecv -= n;
+            if( pConn->nRecvOffset == g_Options.nBufSize ) {
+                if( now == 0 )
+                    now = NowNs();
+                hist_record(&pWorker->Rtt, now - pConn->SendTime[pConn->nRecv % MAX_OUTSTANDING]);
+                pWorker->nMsgs++;
+                pConn->nRecv++;
+                pConn->nRecvOffset = 0;
+            }
+        }
+        if( SendPending(pConn) < 0 )
+            return -1;
+    }
+}
+
+static int CreateConnectingSocket(PWORKER pWorker, PECHO_CONN pConn) {
+    struct epoll_event ev;
+    int one = 1;
+
+    pConn->sd = socket(g_pAddr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if( pConn->sd < 0 ) {
+        printf("socket() failed: %s\n", strerror(errno));
+        return 0;
+    }
+    setsockopt(pConn->sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if( connect(pConn->sd, g_pAddr->ai_addr, g_pAddr->ai_addrlen) < 0 && errno != EINPROGRESS ) {
+        printf("connect(thread %d) failed: %s\n", pWorker->id, strerror(errno));
+        close(pConn->sd);
+        return 0;
+    }
+    pConn->state = ConnConnecting;
+
+    //
+    // edge triggered for both directions, never modified afterwards: a
+    // blocked send waits for the EPOLLOUT edge, everything else is driven
+    // by the echoes coming back
+    //
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = pConn;
+    if( epoll_ctl(pWorker->epfd, EPOLL_CTL_ADD, pConn->sd, &ev) < 0 ) {
+        printf("epoll_ctl() failed: %s\n", strerror(errno));
+        close(pConn->sd);
+        return 0;
+    }
+    return 1;
+}
+
+static void *EchoThread(void *lpParameter) {
+    PWORKER pWorker = (PWORKER)lpParameter;
+    struct epoll_event events[MAXEVENTS];
+    int i, n;
+
+    for( i = 0; i < g_Options.nConnections && !g_bEndClient; i++ ) {
+        pWorker->pConns[i].id = pWorker->id * g_Options.nConnections + i;
+        pWorker->pConns[i].state = ConnClosed;
+        if( !CreateConnectingSocket(pWorker, &pWorker->pConns[i]) )
+            pWorker->nErrors++;
+    }
+
+    while( !g_bEndClient ) {
+        n = epoll_wait(pWorker->epfd, events, MAXEVENTS, 100);
+        for( i = 0; i < n; i++ ) {
+            PECHO_CONN pConn = (PECHO_CONN)events[i].data.ptr;
+            int bFailed = 0;
+
+            if( pConn->state == ConnClosed )
+                continue;
+            if( pConn->state == ConnConnecting ) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                if( !(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) )
+                    continue;
+                getsockopt(pConn->sd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if( err != 0 ) {
+                    if( g_Options.bVerbose )
+                        printf("connect(thread %d) failed: %s\n", pWorker->id, strerror(err));
+                    CloseConn(pWorker, pConn, 1);
+                    continue;
+                }
+                pConn->state = ConnEstablished;
+                pWorker->nConnected++;
+            }
+            if( events[i].events & EPOLLOUT )
+                bFailed = SendPending(pConn) < 0;
+            if( !bFailed && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) )
+                bFailed = RecvEcho(pWorker, pConn) < 0;
+            if( bFailed )
+                CloseConn(pWorker, pConn, 1);
+        }
+    }
+
+    for( i = 0; i < g_Options.nConnections; i++ )
+        CloseConn(pWorker, &pWorker->pConns[i], 0);
+    return NULL;
+}
+
+static void Usage(char *szProgramname) {
+    printf("usage:\n%s -?\n", szProgramname);
+    printf("  -?\t\tDisplay this help\n");
+    printf("  -b:bufsize\tSize of a message; in 1K increments (Def:%d bytes)\n", g_Options.nBufSize);
+    printf("  -s:bytes\tSize of a message in bytes, overrides -b\n");
+    printf("  -e:port\tEndpoint number (port) to use (Def:%s)\n", g_Options.port);
+    printf("  -n:host\tConnect to 'host' (Def:%s)\n", g_Options.szHostname);
+    printf("  -t:#\t\tNumber of threads to use (Def:%d)\n", g_Options.nTotalThreads);
+    printf("  -c:#\t\tConnections per thread (Def:%d)\n", g_Options.nConnections);
+    printf("  -o:#\t\tMessages outstanding per connection (Def:%d, max %d)\n",
+           g_Options.nOutstanding, MAX_OUTSTANDING);
+    printf("  -d:seconds\tRun time, 0 until CTRL-C (Def:%d)\n", g_Options.nSeconds);
+    printf("  -v\t\tVerbose, print connect failures and mismatches\n");
+}
+
+static int ValidOptions(char *argv[], int argc) {
+    int i;
+
+    for( i = 1; i < argc; i++ ) {
+        if( (argv[i][0] == '-') || (argv[i][0] == '/') ) {
+            if( tolower(argv[i][1]) != 'v' && tolower(argv[i][1]) != '?' && strlen(argv[i]) <= 3 ) {
+                Usage(argv[0]);
+                return 0;
+            }
+            switch( tolower(argv[i][1]) ) {
+            case 'b':
+                g_Options.nBufSize = 1024 * atoi(&argv[i][3]);
+                break;
+
+            case 's':
+                g_Options.nBufSize = atoi(&argv[i][3]);
+                break;
+
+            case 'e':
+                g_Options.port = &argv[i][3];
+                break;
+
+            case 'n':
+                snprintf(g_Options.szHostname, sizeof(g_Options.szHostname), "%s", &argv[i][3]);
+                break;
+
+            case 't':
+                g_Options.nTotalThreads = atoi(&argv[i][3]);
+                break;
+
+            case 'c':
+                g_Options.nConnections = atoi(&argv[i][3]);
+                break;
+
+            case 'o':
+                g_Options.nOutstanding = atoi(&argv[i][3]);
+                break;
+
+            case 'd':
+                g_Options.nSeconds = atoi(&argv[i][3]);
+                break;
+
+            case 'v':
+                g_Options.bVerbose = 1;
+                break;
+
+            default:
+                Usage(argv[0]);
+                return 0;
+            }
+        }
+    }
+
+    if( g_Options.nBufSize < 1 || g_Options.nTotalThreads < 1 || g_Options.nTotalThreads > MAXTHREADS ||
+        g_Options.nConnections < 1 || g_Options.nOutstanding < 1 ||
+        g_Options.nOutstanding > MAX_OUTSTANDING || g_Options.nSeconds < 0 ) {
+        Usage(argv[0]);
+        return 0;
+    }
+    return 1;
+}
+
+static void SumWorkers(PWORKER pTotal) {
+    int i;
+
+    memset(pTotal, 0, offsetof(WORKER, Rtt));
+    hist_init(&pTotal->Rtt);
+    for( i = 0; i < g_Options.nTotalThreads; i++ ) {
+        PWORKER w = &g_Workers[i];
+
+        pTotal->nMsgs += __atomic_load_n(&w->nMsgs, __ATOMIC_RELAXED);
+        pTotal->nBytes += __atomic_load_n(&w->nBytes, __ATOMIC_RELAXED);
+        pTotal->nConnected += __atomic_load_n(&w->nConnected, __ATOMIC_RELAXED);
+        pTotal->nErrors += __atomic_load_n(&w->nErrors, __ATOMIC_RELAXED);
+        pTotal->nMismatch += __atomic_load_n(&w->nMismatch, __ATOMIC_RELAXED);
+        hist_add(&pTotal->Rtt, &w->Rtt);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static WORKER now, before;
+    static hist_t second;
+    struct addrinfo hints;
+    struct rlimit rl;
+    unsigned long long tStart, tEnd;
+    sigset_t set;
+    int i, nRet, sig, nElapsed = 0;
+
+    if( !ValidOptions(argv, argc) )
+        return 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if( (nRet = getaddrinfo(g_Options.szHostname, g_Options.port, &hints, &g_pAddr)) != 0 ) {
+        printf("getaddrinfo() failed: %s\n", gai_strerror(nRet));
+        return 1;
+    }
+
+    //
+    // thousands of connections need thousands of descriptors
+    //
+    if( getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max ) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    g_Pattern = (char *)malloc(g_Options.nBufSize + PATTERN_SLACK);
+    if( g_Pattern == NULL ) {
+        printf("malloc() failed\n");
+        return 1;
+    }
+    srand(time(NULL));
+    for( i = 0; i < g_Options.nBufSize + PATTERN_SLACK; i++ )
+        g_Pattern[i] = (char)rand();
+
+    //
+    // CTRL-C and the end of the run are both taken here
+    //
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    printf("%d threads x %d connections to %s:%s, %d byte messages, %d outstanding\n",
+           g_Options.nTotalThreads, g_Options.nConnections, g_Options.szHostname, g_Options.port,
+           g_Options.nBufSize, g_Options.nOutstanding);
+
+    tStart = NowNs();
+    for( i = 0; i < g_Options.nTotalThreads; i++ ) {
+        PWORKER w = &g_Workers[i];
+
+        w->id = i;
+        hist_init(&w->Rtt);
+        w->epfd = epoll_create1(0);
+        w->pConns = (PECHO_CONN)calloc(g_Options.nConnections, sizeof(ECHO_CONN));
+        w->pRecvBuf = (char *)malloc(RECV_BUF);
+        if( w->epfd < 0 || w->pConns == NULL || w->pRecvBuf == NULL ) {
+            printf("thread %d setup failed: %s\n", i, strerror(errno));
+            return 1;
+        }
+        if( pthread_create(&w->thread, NULL, EchoThread, w) != 0 ) {
+            printf("pthread_create(%d) failed\n", i);
+            return 1;
+        }
+    }
+
+    hist_init(&before.Rtt);
+    printf("sec\tconns\tmsg/s\tMB/s\terrors\tnak\tp50(us)\tp99(us)\tp99.9\tmax\n");
+    for( ;; ) {
+        struct timespec one = {1, 0};
+        siginfo_t info;
+
+        sig = sigtimedwait(&set, &info, &one);
+        if( sig == SIGINT || sig == SIGTERM )
+            break;
+
+        nElapsed++;
+        SumWorkers(&now);
+        hist_sub(&second, &now.Rtt, &before.Rtt);
+        printf("%d\t%lu\t%llu\t%.1f\t%lu\t%lu\t%.0f\t%.0f\t%.0f\t%.0f\n", nElapsed,
+               now.nConnected, now.nMsgs - before.nMsgs,
+               (now.nBytes - before.nBytes) / 1e6, now.nErrors, now.nMismatch,
+               hist_percentile(&second, 50) / 1e3, hist_percentile(&second, 99) / 1e3,
+               hist_percentile(&second, 99.9) / 1e3, hist_percentile(&second, 100) / 1e3);
+        before = now;
+        if( g_Options.nSeconds && nElapsed >= g_Options.nSeconds )
+            break;
+    }
+
+    g_bEndClient = 1;
+    for( i = 0; i < g_Options.nTotalThreads; i++ )
+        pthread_join(g_Workers[i].thread, NULL);
+    tEnd = NowNs();
+
+    SumWorkers(&now);
+    printf("\nConnections: %lu established, %lu errors, %lu echo mismatches\n",
+           now.nConnected, now.nErrors, now.nMismatch);
+    printf("Messages: %llu in %.2fs, %.0f msg/s, %.1f MB/s\n", now.nMsgs, (tEnd - tStart) / 1e9,
+           now.nMsgs / ((tEnd - tStart) / 1e9), now.nBytes / 1e6 / ((tEnd - tStart) / 1e9));
+    printf("Round trip: p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n",
+           hist_percentile(&now.Rtt, 50) / 1e3, hist_percentile(&now.Rtt, 99) / 1e3,
+           hist_percentile(&now.Rtt, 99.9) / 1e3, now.Rtt.max / 1e3);
+    hist_print(&now.Rtt, stdout, 1e3);
+
+    for( i = 0; i < g_Options.nTotalThreads; i++ ) {
+        close(g_Workers[i].epfd);
+        free(g_Workers[i].pConns);
+        free(g_Workers[i].pRecvBuf);
+    }
+    free(g_Pattern);
+    freeaddrinfo(g_pAddr);
+    return now.nMismatch ? 2 : 0;
+}
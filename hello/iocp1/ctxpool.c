@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600    /* SRWLOCK */
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "ctxpool.h"
+
+#define CACHE_LINE 64
+#define SLAB_BYTES (256 * 1024)
+#define DEF_SHARDS 64
+
+#ifdef _WIN32
+typedef SRWLOCK lock_t;
+#define lock_init(l)    InitializeSRWLock(l)
+#define lock_fini(l)    ((void)0)
+#define lock_take(l)    AcquireSRWLockExclusive(l)
+#define lock_drop(l)    ReleaseSRWLockExclusive(l)
+typedef DWORD tls_t;
+#else
+typedef pthread_mutex_t lock_t;
+#define lock_init(l)    pthread_mutex_init(l, NULL)
+#define lock_fini(l)    pthread_mutex_destroy(l)
+#define lock_take(l)    pthread_mutex_lock(l)
+#define lock_drop(l)    pthread_mutex_unlock(l)
+typedef pthread_key_t tls_t;
+#endif
+
+/* a free object, the first bytes of it */
+typedef struct item {
+    struct item *next;          /* next free object */
+    struct item *batch;         /* in the depot: next batch, in its head */
+    unsigned count;             /* in the depot: objects in the batch */
+} item_t;
+
+typedef struct slab {
+    struct slab *next;
+} slab_t;
+
+/* one thread's free objects, touched by that thread only */
+typedef struct cache {
+    item_t *items;
+    unsigned count;
+    ctxpool_t *pool;
+    struct cache *next;         /* the pool's caches, for destroy */
+} cache_t;
+
+struct ctxpool_s {
+    size_t size;                /* object size, a multiple of CACHE_LINE */
+    unsigned per_slab;
+    tls_t key;                  /* this thread's cache_t */
+
+    lock_t lock;                /* the depot, everything below */
+    item_t *batches;
+    slab_t *slabs;
+    cache_t *caches;
+    ctxpool_stats_t stats;
+};
+
+typedef struct shard {
+    lock_t lock;
+    ctxreg_link_t head;         /* circular, entries never have NULL links */
+    size_t count;
+    char pad[CACHE_LINE];       /* keep the next shard's lock off this line */
+} shard_t;
+
+struct ctxreg_s {
+    unsigned nshards;
+    unsigned shift;             /* 32 - log2(nshards) */
+    unsigned next_pop;
+    shard_t *shards;
+};
+
+static void depot_put(ctxpool_t *pool, item_t *head, unsigned count)
+{
+    lock_take(&pool->lock);
+    head->count = count;
+    head->batch = pool->batches;
+    pool->batches = head;
+    pool->stats.flushes++;
+    lock_drop(&pool->lock);
+}
+
+/* give all of a cache back, when its thread exits */
+static void cache_release(cache_t *c)
+{
+    ctxpool_t *pool = c->pool;
+    cache_t **pp;
+
+    if (c->items != NULL)
+        depot_put(pool, c->items, c->count);
+    lock_take(&pool->lock);
+    for (pp = &pool->caches; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == c) {
+            *pp = c->next;
+            break;
+        }
+    }
+    lock_drop(&pool->lock);
+    free(c);
+}
+
+#ifdef _WIN32
+static VOID WINAPI cache_exit(PVOID p)
+{
+    if (p != NULL)
+        cache_release((cache_t *)p);
+}
+
+#define tls_get(pool)       ((cache_t *)FlsGetValue((pool)->key))
+#define tls_set(pool, c)    FlsSetValue((pool)->key, (c))
+#else
+static void cache_exit(void *p)
+{
+    cache_release((cache_t *)p);
+}
+
+#define tls_get(pool)       ((cache_t *)pthread_getspecific((pool)->key))
+#define tls_set(pool, c)    pthread_setspecific((pool)->key, (c))
+#endif
+
+static cache_t *cache_new(ctxpool_t *pool)
+{
+    cache_t *c = (cache_t *)calloc(1, sizeof(cache_t));
+
+    if (c == NULL)
+        return NULL;
+    c->pool = pool;
+    lock_take(&pool->lock);
+    c->next = pool->caches;
+    pool->caches = c;
+    lock_drop(&pool->lock);
+    tls_set(pool, c);
+    return c;
+}
+
+/* fill an empty cache from the depot, or with a new slab */
+static int cache_refill(ctxpool_t *pool, cache_t *c)
+{
+    slab_t *slab;
+    char *p;
+    unsigned i;
+
+    lock_take(&pool->lock);
+    if (pool->batches != NULL) {
+        item_t *head = pool->batches;
+
+        pool->batches = head->batch;
+        pool->stats.refills++;
+        lock_drop(&pool->lock);
+        c->items = head;
+        c->count = head->count;
+        return 0;
+    }
+    lock_drop(&pool->lock);
+
+    slab = (slab_t *)malloc(CACHE_LINE + (size_t)pool->per_slab * pool->size);
+    if (slab == NULL)
+        return -1;
+    p = (char *)(((uintptr_t)(slab + 1) + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+
+    /* the first batch is the cache's, the others go to the depot */
+    lock_take(&pool->lock);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->stats.slabs++;
+    for (i = 0; i < pool->per_slab; i += CTXPOOL_BATCH) {
+        unsigned j, n = pool->per_slab - i;
+        item_t *head = NULL;
+
+        if (n > CTXPOOL_BATCH)
+            n = CTXPOOL_BATCH;
+        for (j = n; j-- > 0; ) {
+            item_t *it = (item_t *)(p + (size_t)(i + j) * pool->size);
+
+            it->next = head;
+            head = it;
+        }
+        if (i == 0) {
+            c->items = head;
+            c->count = n;
+        } else {
+            head->count = n;
+            head->batch = pool->batches;
+            pool->batches = head;
+        }
+    }
+    lock_drop(&pool->lock);
+    return 0;
+}
+
+ctxpool_t *ctxpool_create(size_t obj_size, unsigned per_slab)
+{
+    ctxpool_t *pool = (ctxpool_t *)calloc(1, sizeof(ctxpool_t));
+
+    if (pool == NULL)
+        return NULL;
+    if (obj_size < sizeof(item_t))
+        obj_size = sizeof(item_t);
+    pool->size = (obj_size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    if (per_slab == 0) {
+        per_slab = (unsigned)(SLAB_BYTES / pool->size);
+        if (per_slab < CTXPOOL_BATCH)
+            per_slab = CTXPOOL_BATCH;
+    }
+    pool->per_slab = per_slab;
+#ifdef _WIN32
+    pool->key = FlsAlloc(cache_exit);
+    if (pool->key == FLS_OUT_OF_INDEXES) {
+        free(pool);
+        return NULL;
+    }
+#else
+    if (pthread_key_create(&pool->key, cache_exit) != 0) {
+        free(pool);
+        return NULL;
+    }
+#endif
+    lock_init(&pool->lock);
+    return pool;
+}
+
+void ctxpool_destroy(ctxpool_t *pool)
+{
+    slab_t *slab;
+    cache_t *c;
+
+    /* FlsFree runs cache_exit for the threads still holding a cache,
+     * pthread_key_delete runs nothing; either way what is left is freed
+     * below */
+#ifdef _WIN32
+    FlsFree(pool->key);
+#else
+    pthread_key_delete(pool->key);
+#endif
+    while ((c = pool->caches) != NULL) {
+        pool->caches = c->next;
+        free(c);
+    }
+    while ((slab = pool->slabs) != NULL) {
+        pool->slabs = slab->next;
+        free(slab);
+    }
+    lock_fini(&pool->lock);
+    free(pool);
+}
+
+void *ctxpool_alloc(ctxpool_t *pool)
+{
+    cache_t *c = tls_get(pool);
+    item_t *it;
+
+    if (c == NULL && (c = cache_new(pool)) == NULL)
+        return NULL;
+    if (c->items == NULL && cache_refill(pool, c) < 0)
+        return NULL;
+    it = c->items;
+    c->items = it->next;
+    c->count--;
+    return it;
+}
+
+void ctxpool_free(ctxpool_t *pool, void *obj)
+{
+    cache_t *c = tls_get(pool);
+    item_t *it = (item_t *)obj, *tail;
+    unsigned i;
+
+    if (obj == NULL)
+        return;
+    if (c == NULL && (c = cache_new(pool)) == NULL) {
+        it->next = NULL;
+        depot_put(pool, it, 1);
+        return;
+    }
+    it->next = c->items;
+    c->items = it;
+    if (++c->count < 2 * CTXPOOL_BATCH)
+        return;
+
+    /* the newest batch stays, the rest goes back */
+    for (tail = c->items, i = 1; i < CTXPOOL_BATCH; i++)
+        tail = tail->next;
+    it = tail->next;
+    tail->next = NULL;
+    depot_put(pool, it, c->count - CTXPOOL_BATCH);
+    c->count = CTXPOOL_BATCH;
+}
+
+void ctxpool_stats(ctxpool_t *pool, ctxpool_stats_t *st)
+{
+    lock_take(&pool->lock);
+    *st = pool->stats;
+    lock_drop(&pool->lock);
+}
+
+ctxreg_t *ctxreg_create(unsigned shards)
+{
+    ctxreg_t *reg = (ctxreg_t *)calloc(1, sizeof(ctxreg_t));
+    unsigned i, n = 1, shift = 32;
+
+    if (reg == NULL)
+        return NULL;
+    if (shards == 0)
+        shards = DEF_SHARDS;
+    while (n < shards) {
+        n <<= 1;
+        shift--;
+    }
+    reg->shards = (shard_t *)calloc(n, sizeof(shard_t));
+    if (reg->shards == NULL) {
+        free(reg);
+        return NULL;
+    }
+    reg->nshards = n;
+    reg->shift = shift;
+    for (i = 0; i < n; i++) {
+        lock_init(&reg->shards[i].lock);
+        reg->shards[i].head.prev = reg->shards[i].head.next = &reg->shards[i].head;
+    }
+    return reg;
+}
+
+void ctxreg_destroy(ctxreg_t *reg)
+{
+    unsigned i;
+
+    for (i = 0; i < reg->nshards; i++)
+        lock_fini(&reg->shards[i].lock);
+    free(reg->shards);
+    free(reg);
+}
+
+static shard_t *shard_of(ctxreg_t *reg, ctxreg_link_t *link)
+{
+    uint32_t h;
+
+    if (reg->nshards == 1)
+        return reg->shards;
+    h = (uint32_t)((uintptr_t)link >> 6) * 2654435769u;
+    return &reg->shards[h >> reg->shift];
+}
+
+void ctxreg_add(ctxreg_t *reg, ctxreg_link_t *link)
+{
+    shard_t *s = shard_of(reg, link);
+
+    lock_take(&s->lock);
+    link->prev = &s->head;
+    link->next = s->head.next;
+    s->head.next->prev = link;
+    s->head.next = link;
+    s->count++;
+    lock_drop(&s->lock);
+}
+
+int ctxreg_remove(ctxreg_t *reg, ctxreg_link_t *link)
+{
+    shard_t *s = shard_of(reg, link);
+    int found = 0;
+
+    lock_take(&s->lock);
+    if (link->next != NULL) {
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+        link->prev = link->next = NULL;
+        s->count--;
+        found = 1;
+    }
+    lock_drop(&s->lock);
+    return found;
+}
+
+ctxreg_link_t *ctxreg_pop(ctxreg_t *reg)
+{
+    unsigned i, start = reg->next_pop;
+
+    for (i = 0; i < reg->nshards; i++) {
+        shard_t *s = &reg->shards[(start + i) & (reg->nshards - 1)];
+        ctxreg_link_t *link = NULL;
+
+        lock_take(&s->lock);
+        if (s->head.next != &s->head) {
+            link = s->head.next;
+            link->prev->next = link->next;
+            link->next->prev = link->prev;
+            link->prev = link->next = NULL;
+            s->count--;
+        }
+        lock_drop(&s->lock);
+        if (link != NULL) {
+            reg->next_pop = start + i;
+            return link;
+        }
+    }
+    return NULL;
+}
+
+size_t ctxreg_count(ctxreg_t *reg)
+{
+    size_t n = 0;
+    unsigned i;
+
+    for (i = 0; i < reg->nshards; i++) {
+        lock_take(&reg->shards[i].lock);
+        n += reg->shards[i].count;
+        lock_drop(&reg->shards[i].lock);
+    }
+    return n;
+}
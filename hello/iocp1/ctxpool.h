@@ -0,0 +1,72 @@
+#ifndef CTXPOOL_H
+#define CTXPOOL_H
+
+#include <stddef.h>    /* for size_t type */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ctxpool: the connection context allocator and connection registry of the
+ * IOCP servers, in portable C (Win32 or pthreads) so it can be built and
+ * measured on its own.
+ *
+ * ctxpool_t hands out fixed size objects (PER_SOCKET_CONTEXT,
+ * PER_IO_CONTEXT) carved from slabs, 64 byte aligned. Every thread
+ * allocates from and frees into a cache of its own without any lock or
+ * atomic. A connection accepted on one thread and closed on another moves
+ * its context to the closing thread's cache; a cache that grows past two
+ * batches gives a batch back to the pool's depot, an empty one takes a
+ * batch from it, so the depot lock is taken once per CTXPOOL_BATCH calls.
+ * A thread's cache goes back to the depot when the thread exits.
+ *
+ * ctxreg_t replaces the global doubly linked list and its critical section:
+ * the list is split in shards, each with its own lock, and an entry goes
+ * to the shard its address hashes to. The links are embedded in the
+ * context (ctxreg_link_t), a zeroed link is not registered.
+ *
+ * build with : gcc -c ctxpool.c (-pthread), or add ctxpool.c to the project
+ */
+
+#define CTXPOOL_BATCH 32
+
+typedef struct ctxpool_s ctxpool_t;
+typedef struct ctxreg_s ctxreg_t;
+
+typedef struct ctxreg_link {
+    struct ctxreg_link *prev;
+    struct ctxreg_link *next;
+} ctxreg_link_t;
+
+typedef struct ctxpool_stats {
+    unsigned long slabs;        /* slabs carved */
+    unsigned long refills;      /* batches taken from the depot */
+    unsigned long flushes;      /* batches given back to it */
+} ctxpool_stats_t;
+
+/* objects of obj_size bytes, per_slab of them per slab (0 for about
+ * 256K slabs). Returns NULL when out of memory. */
+ctxpool_t *ctxpool_create(size_t obj_size, unsigned per_slab);
+/* every object goes away with the pool, whoever still holds it */
+void ctxpool_destroy(ctxpool_t *pool);
+/* the object is not zeroed */
+void *ctxpool_alloc(ctxpool_t *pool);
+void ctxpool_free(ctxpool_t *pool, void *obj);
+void ctxpool_stats(ctxpool_t *pool, ctxpool_stats_t *st);
+
+/* shards is rounded up to a power of 2, 0 picks 64 */
+ctxreg_t *ctxreg_create(unsigned shards);
+void ctxreg_destroy(ctxreg_t *reg);
+void ctxreg_add(ctxreg_t *reg, ctxreg_link_t *link);
+/* 1 when the link was registered, 0 when it was not (or is no longer) */
+int ctxreg_remove(ctxreg_t *reg, ctxreg_link_t *link);
+/* unregister and return any entry, NULL when there are none left */
+ctxreg_link_t *ctxreg_pop(ctxreg_t *reg);
+size_t ctxreg_count(ctxreg_t *reg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    /* CTXPOOL_H */
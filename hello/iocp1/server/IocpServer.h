@@ -14,6 +14,8 @@
 
 #include <mswsock.h>
 
+#include "../ctxpool.h"
+
 #define DEFAULT_PORT        "5001"
 #define MAX_BUFF_SIZE       8192
 #define MAX_WORKER_THREAD   16
@@ -57,8 +59,11 @@ typedef struct _PER_SOCKET_CONTEXT {
     //linked list for all outstanding i/o on the socket
 	//
     PPER_IO_CONTEXT             pIOContext;  
-    struct _PER_SOCKET_CONTEXT  *pCtxtBack; 
-    struct _PER_SOCKET_CONTEXT  *pCtxtForward;
+
+	//
+    //links in the list of all connections (g_pCtxtList)
+	//
+    ctxreg_link_t               CtxtLink;
 } PER_SOCKET_CONTEXT, *PPER_SOCKET_CONTEXT;
 
 BOOL ValidOptions(int argc, char *argv[]);
@@ -0,0 +1,912 @@
+// Module:
+//      iocpserverex_linux.c
+//
+// Abstract:
+//      The iocpserverex.cpp echo server ported to Linux on io_uring, keeping
+//      its architecture:
+//
+//      - AcceptEx: every worker preposts g_nAccepts accepts on the shared
+//        listening socket, each with its own PER_IO_CONTEXT, and reposts one
+//        as soon as it completes, so a burst of connects never waits for a
+//        worker to come round (the "post multiple calls to AcceptEx"
+//        technique the Windows sample describes but does not implement).
+//      - PER_IO_CONTEXT with the data buffer embedded, doubling as the
+//        OVERLAPPED: its address is the io_uring user_data, the socket
+//        context it points to is the completion key.
+//      - GetQueuedCompletionStatus: N worker threads, but each reaps its own
+//        ring instead of sharing one port, so a connection stays on the
+//        worker that accepted it and nothing on the I/O path is shared.
+//        Everything a worker posts while draining a batch of completions
+//        is submitted together with the wait for the next batch.
+//      - PER_IO_CONTEXT and PER_SOCKET_CONTEXT come from per-worker free
+//        lists filled a slab at a time, and the list of live connections is
+//        per worker too, so there is no g_CriticalSection.
+//      - PostQueuedCompletionStatus(NULL) on shutdown is an IORING_OP_MSG_RING
+//        with a NULL user_data sent to every worker's ring.
+//
+//      AcceptEx also receives the first block of data; an io_uring accept
+//      does not, the first read is posted right after it instead. The
+//      SO_SNDBUF=0 trick of CreateSocket is Windows specific (it makes
+//      Winsock send straight from our buffer) and would only throttle a
+//      Linux socket, so it is left out.
+//
+//  Usage:
+//      Start the server and wait for connections on port 6001
+//          iocpserverex_linux -e:6001 -t:4
+//
+//  Build:
+//      gcc -O2 -Wall -pthread -o iocpserverex_linux iocpserverex_linux.c
+//      needs Linux 5.18 or later, for IORING_OP_MSG_RING
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define DEFAULT_PORT        "5001"
+#define MAX_BUFF_SIZE       8192
+#define MAX_WORKER_THREAD   64
+#define DEFAULT_ACCEPTS     16      // accepts preposted per worker
+#define CTX_SLAB            64      // contexts allocated at a time
+#define RING_ENTRIES        1024
+#define BACKOFF_MS          100     // accepts parked on EMFILE are retried after
+#define CANCEL_KEY          1UL     // user_data of the shutdown's cancel
+
+typedef enum _IO_OPERATION {
+    ClientIoAccept,
+    ClientIoRead,
+    ClientIoWrite,
+    ClientIoBackoff
+} IO_OPERATION, *PIO_OPERATION;
+
+struct _PER_SOCKET_CONTEXT;
+
+//
+// data to be associated for every I/O operation on a socket
+//
+typedef struct _PER_IO_CONTEXT {
+    char                        Buffer[MAX_BUFF_SIZE];
+    int                         nTotalBytes;
+    int                         nSentBytes;
+    IO_OPERATION                IOOperation;
+    struct sockaddr_storage     AcceptAddr;
+    socklen_t                   AcceptAddrLen;
+    struct _PER_SOCKET_CONTEXT  *pSocketContext;    // the completion key
+
+    struct _PER_IO_CONTEXT      *pIOContextForward; // free list
+} PER_IO_CONTEXT, *PPER_IO_CONTEXT;
+
+//
+// data to be associated with every connection
+//
+typedef struct _PER_SOCKET_CONTEXT {
+    int                         Socket;
+    PPER_IO_CONTEXT             pIOContext;
+    struct _PER_SOCKET_CONTEXT  *pCtxtBack;
+    struct _PER_SOCKET_CONTEXT  *pCtxtForward;
+} PER_SOCKET_CONTEXT, *PPER_SOCKET_CONTEXT;
+
+//
+// one io_uring instance, mapped by hand (no liburing)
+//
+typedef struct _RING {
+    int                         fd;
+    void                        *sq_ptr;
+    size_t                      sq_size;
+    void                        *cq_ptr;
+    size_t                      cq_size;
+    unsigned                    *sq_head;
+    unsigned                    *sq_tail;
+    unsigned                    *sq_array;
+    unsigned                    sq_mask;
+    unsigned                    sq_entries;
+    unsigned                    sq_local_tail;
+    struct io_uring_sqe         *sqes;
+    size_t                      sqes_size;
+    unsigned                    *cq_head;
+    unsigned                    *cq_tail;
+    unsigned                    cq_mask;
+    struct io_uring_cqe         *cqes;
+} RING, *PRING;
+
+typedef struct _SLAB {
+    struct _SLAB                *pNext;
+} SLAB;
+
+typedef struct _WORKER {
+    int                         id;
+    pthread_t                   thread;
+    RING                        ring;
+    PPER_IO_CONTEXT             pIOFree;
+    PPER_SOCKET_CONTEXT         pSocketFree;
+    SLAB                        *pSlabs;
+    PPER_SOCKET_CONTEXT         pCtxtList;      // live connections
+    PPER_IO_CONTEXT             *pAccepts;
+    PPER_IO_CONTEXT             pParked;        // accepts waiting for a descriptor
+    PPER_IO_CONTEXT             pBackoff;       // their timeout
+    int                         bBackoff;       // and it is posted
+    int                         bPaused;        // said so, until an accept succeeds
+    struct __kernel_timespec    tsBackoff;
+    int                         nPending;       // operations posted, not yet reaped
+    unsigned long               nAccepted;
+    unsigned long long          nBytes;
+} WORKER, *PWORKER;
+
+char *g_Port = DEFAULT_PORT;
+volatile int g_bEndServer = 0;
+int g_bVerbose = 0;
+int g_nThreads = 0;
+int g_nAccepts = DEFAULT_ACCEPTS;
+int g_sdListen = -1;
+WORKER g_Workers[MAX_WORKER_THREAD];
+pthread_barrier_t g_Started;
+
+//
+// ring setup and submission
+//
+static int RingSetup(PRING r, unsigned entries, int bSingleIssuer) {
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    if( bSingleIssuer )
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if( r->fd < 0 && errno == EINVAL && bSingleIssuer ) {
+        memset(&p, 0, sizeof(p));
+        r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    }
+    if( r->fd < 0 )
+        return -1;
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        if( r->cq_size > r->sq_size )
+            r->sq_size = r->cq_size;
+        r->cq_size = 0;
+    }
+    sq = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              r->fd, IORING_OFF_SQ_RING);
+    if( sq == MAP_FAILED )
+        return -1;
+    r->sq_ptr = sq;
+    cq = sq;
+    if( r->cq_size ) {
+        cq = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  r->fd, IORING_OFF_CQ_RING);
+        if( cq == MAP_FAILED )
+            return -1;
+        r->cq_ptr = cq;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if( r->sqes == MAP_FAILED )
+        return -1;
+
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    r->sq_local_tail = *r->sq_tail;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void RingClose(PRING r) {
+    if( r->sqes && r->sqes != MAP_FAILED )
+        munmap(r->sqes, r->sqes_size);
+    if( r->cq_ptr )
+        munmap(r->cq_ptr, r->cq_size);
+    if( r->sq_ptr )
+        munmap(r->sq_ptr, r->sq_size);
+    if( r->fd >= 0 )
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+//
+// Hand everything queued to the kernel and wait for at least nWait completions.
+//
+static int RingSubmit(PRING r, unsigned nWait) {
+    unsigned n;
+    int nRet;
+
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    n = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    do {
+        nRet = (int)syscall(__NR_io_uring_enter, r->fd, n, nWait,
+                            nWait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while( nRet < 0 && errno == EINTR && !g_bEndServer );
+    return nRet;
+}
+
+static struct io_uring_sqe *RingGetSqe(PRING r) {
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if( r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries &&
+        RingSubmit(r, 0) < 0 )
+        return NULL;
+    idx = r->sq_local_tail & r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_local_tail++;
+    return sqe;
+}
+
+//
+// Per worker pools: a slab of contexts is carved up whenever a free list
+// runs dry, released contexts go back to the list of the worker that owns
+// them, so allocation never takes a lock.
+//
+static PPER_IO_CONTEXT IoContextAllocate(PWORKER w) {
+    PPER_IO_CONTEXT lpIOContext = w->pIOFree;
+
+    if( lpIOContext == NULL ) {
+        SLAB *slab = malloc(sizeof(SLAB) + CTX_SLAB * sizeof(PER_IO_CONTEXT));
+        PPER_IO_CONTEXT p;
+        int i;
+
+        if( slab == NULL ) {
+            printf("malloc() PER_IO_CONTEXT failed\n");
+            return NULL;
+        }
+        slab->pNext = w->pSlabs;
+        w->pSlabs = slab;
+        p = (PPER_IO_CONTEXT)(slab + 1);
+        for( i = 0; i < CTX_SLAB; i++ ) {
+            p[i].pIOContextForward = w->pIOFree;
+            w->pIOFree = &p[i];
+        }
+        lpIOContext = w->pIOFree;
+    }
+    w->pIOFree = lpIOContext->pIOContextForward;
+    lpIOContext->pIOContextForward = NULL;
+    lpIOContext->nTotalBytes = 0;
+    lpIOContext->nSentBytes = 0;
+    lpIOContext->pSocketContext = NULL;
+    return lpIOContext;
+}
+
+static void IoContextFree(PWORKER w, PPER_IO_CONTEXT lpIOContext) {
+    lpIOContext->pIOContextForward = w->pIOFree;
+    w->pIOFree = lpIOContext;
+}
+
+//
+// Allocate a socket context for the new connection and add it to the
+// worker's list of connections.
+//
+static PPER_SOCKET_CONTEXT CtxtAllocate(PWORKER w, int sd, IO_OPERATION ClientIO) {
+    PPER_SOCKET_CONTEXT lpPerSocketContext = w->pSocketFree;
+
+    if( lpPerSocketContext == NULL ) {
+        SLAB *slab = malloc(sizeof(SLAB) + CTX_SLAB * sizeof(PER_SOCKET_CONTEXT));
+        PPER_SOCKET_CONTEXT p;
+        int i;
+
+        if( slab == NULL ) {
+            printf("malloc() PER_SOCKET_CONTEXT failed\n");
+            return NULL;
+        }
+        slab->pNext = w->pSlabs;
+        w->pSlabs = slab;
+        p = (PPER_SOCKET_CONTEXT)(slab + 1);
+        for( i = 0; i < CTX_SLAB; i++ ) {
+            p[i].pCtxtForward = w->pSocketFree;
+            w->pSocketFree = &p[i];
+        }
+        lpPerSocketContext = w->pSocketFree;
+    }
+
+    lpPerSocketContext->pIOContext = IoContextAllocate(w);
+    if( lpPerSocketContext->pIOContext == NULL )
+        return NULL;
+    w->pSocketFree = lpPerSocketContext->pCtxtForward;
+
+    lpPerSocketContext->Socket = sd;
+    lpPerSocketContext->pIOContext->IOOperation = ClientIO;
+    lpPerSocketContext->pIOContext->pSocketContext = lpPerSocketContext;
+
+    //
+    // add node to head of list
+    //
+    lpPerSocketContext->pCtxtBack = w->pCtxtList;
+    lpPerSocketContext->pCtxtForward = NULL;
+    if( w->pCtxtList )
+        w->pCtxtList->pCtxtForward = lpPerSocketContext;
+    w->pCtxtList = lpPerSocketContext;
+    return lpPerSocketContext;
+}
+
+static void CtxtListDeleteFrom(PWORKER w, PPER_SOCKET_CONTEXT lpPerSocketContext) {
+    PPER_SOCKET_CONTEXT pBack = lpPerSocketContext->pCtxtBack;
+    PPER_SOCKET_CONTEXT pForward = lpPerSocketContext->pCtxtForward;
+
+    if( pBack )
+        pBack->pCtxtForward = pForward;
+    if( pForward )
+        pForward->pCtxtBack = pBack;
+    else
+        w->pCtxtList = pBack;
+
+    IoContextFree(w, lpPerSocketContext->pIOContext);
+    lpPerSocketContext->pIOContext = NULL;
+    lpPerSocketContext->pCtxtForward = w->pSocketFree;
+    w->pSocketFree = lpPerSocketContext;
+}
+
+static void ResumeAccepts(PWORKER w, int n);
+
+//
+// Close down a connection with a client. Every connection has exactly one
+// read or write outstanding, and we only get here from its completion, so
+// nothing in the ring still points at the contexts.
+//
+static void CloseClient(PWORKER w, PPER_SOCKET_CONTEXT lpPerSocketContext, int bGraceful) {
+    if( g_bVerbose )
+        printf("CloseClient: Socket(%d) connection closing (graceful=%s)\n",
+               lpPerSocketContext->Socket, (bGraceful ? "TRUE" : "FALSE"));
+    if( !bGraceful ) {
+        //
+        // force the subsequent close to be abortative.
+        //
+        struct linger lingerStruct;
+
+        lingerStruct.l_onoff = 1;
+        lingerStruct.l_linger = 0;
+        setsockopt(lpPerSocketContext->Socket, SOL_SOCKET, SO_LINGER,
+                   (char *)&lingerStruct, sizeof(lingerStruct));
+    }
+    close(lpPerSocketContext->Socket);
+    lpPerSocketContext->Socket = -1;
+    CtxtListDeleteFrom(w, lpPerSocketContext);
+
+    //
+    // a descriptor is free again, one parked accept can have it
+    //
+    if( w->pParked )
+        ResumeAccepts(w, 1);
+}
+
+static int PostAccept(PWORKER w, PPER_IO_CONTEXT lpIOContext) {
+    struct io_uring_sqe *sqe = RingGetSqe(&w->ring);
+
+    if( sqe == NULL )
+        return -1;
+    w->nPending++;
+    lpIOContext->IOOperation = ClientIoAccept;
+    lpIOContext->AcceptAddrLen = sizeof(lpIOContext->AcceptAddr);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = g_sdListen;
+    sqe->addr = (unsigned long)&lpIOContext->AcceptAddr;
+    sqe->addr2 = (unsigned long)&lpIOContext->AcceptAddrLen;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (unsigned long)lpIOContext;
+    return 0;
+}
+
+//
+// Repost up to n (all when n < 0) of the accepts parked on EMFILE/ENFILE.
+//
+static void ResumeAccepts(PWORKER w, int n) {
+    while( w->pParked && n-- != 0 ) {
+        PPER_IO_CONTEXT lpIOContext = w->pParked;
+
+        w->pParked = lpIOContext->pIOContextForward;
+        lpIOContext->pIOContextForward = NULL;
+        if( PostAccept(w, lpIOContext) < 0 )
+            printf("failed to repost accept on worker %d\n", w->id);
+    }
+}
+
+//
+// Out of descriptors: reposting the accept at once would only fail again,
+// so it waits for a connection of this worker to close, or for BACKOFF_MS
+// when it has none to close.
+//
+static void ParkAccept(PWORKER w, PPER_IO_CONTEXT lpIOContext, int res) {
+    struct io_uring_sqe *sqe;
+
+    if( !w->bPaused )
+        printf("accept failed on worker %d: %s, accepts paused\n", w->id, strerror(-res));
+    w->bPaused = 1;
+    lpIOContext->pIOContextForward = w->pParked;
+    w->pParked = lpIOContext;
+
+    if( w->bBackoff )
+        return;
+    if( w->pBackoff == NULL && (w->pBackoff = IoContextAllocate(w)) == NULL )
+        return;
+    if( (sqe = RingGetSqe(&w->ring)) == NULL )
+        return;
+    w->nPending++;
+    w->bBackoff = 1;
+    w->pBackoff->IOOperation = ClientIoBackoff;
+    w->tsBackoff.tv_sec = BACKOFF_MS / 1000;
+    w->tsBackoff.tv_nsec = BACKOFF_MS % 1000 * 1000000LL;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long)&w->tsBackoff;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long)w->pBackoff;
+}
+
+static int PostRecv(PWORKER w, PPER_SOCKET_CONTEXT lpPerSocketContext) {
+    PPER_IO_CONTEXT lpIOContext = lpPerSocketContext->pIOContext;
+    struct io_uring_sqe *sqe = RingGetSqe(&w->ring);
+
+    if( sqe == NULL )
+        return -1;
+    w->nPending++;
+    lpIOContext->IOOperation = ClientIoRead;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = lpPerSocketContext->Socket;
+    sqe->addr = (unsigned long)lpIOContext->Buffer;
+    sqe->len = MAX_BUFF_SIZE;
+    sqe->user_data = (unsigned long)lpIOContext;
+    return 0;
+}
+
+static int PostSend(PWORKER w, PPER_SOCKET_CONTEXT lpPerSocketContext) {
+    PPER_IO_CONTEXT lpIOContext = lpPerSocketContext->pIOContext;
+    struct io_uring_sqe *sqe = RingGetSqe(&w->ring);
+
+    if( sqe == NULL )
+        return -1;
+    w->nPending++;
+    lpIOContext->IOOperation = ClientIoWrite;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = lpPerSocketContext->Socket;
+    sqe->addr = (unsigned long)(lpIOContext->Buffer + lpIOContext->nSentBytes);
+    sqe->len = lpIOContext->nTotalBytes - lpIOContext->nSentBytes;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)lpIOContext;
+    return 0;
+}
+
+//
+// An accept completed: set up the connection, post its first read and
+// post another accept in place of this one.
+//
+static void OnAccept(PWORKER w, PPER_IO_CONTEXT lpIOContext, int res) {
+    PPER_SOCKET_CONTEXT lpAcceptSocketContext;
+    int one = 1;
+
+    if( res >= 0 ) {
+        w->nAccepted++;
+        w->bPaused = 0;
+
+        //
+        // the echo goes back one send at a time; with Nagle a send shorter
+        // than the MSS waits for the peer to ACK the previous one
+        //
+        setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        lpAcceptSocketContext = CtxtAllocate(w, res, ClientIoRead);
+        if( lpAcceptSocketContext == NULL ) {
+            printf("failed to allocate a context for the accepted socket\n");
+            close(res);
+        } else if( PostRecv(w, lpAcceptSocketContext) < 0 ) {
+            CloseClient(w, lpAcceptSocketContext, 0);
+        } else if( g_bVerbose ) {
+            printf("WorkerThread %d: Socket(%d) accept completed, Recv posted\n",
+                   w->id, res);
+        }
+    } else if( res == -EMFILE || res == -ENFILE ) {
+        ParkAccept(w, lpIOContext, res);
+        return;
+    } else if( res != -EAGAIN && res != -ECONNABORTED && res != -EINTR ) {
+        printf("accept failed: %s\n", strerror(-res));
+    }
+
+    //
+    //Time to post another outstanding accept
+    //
+    if( PostAccept(w, lpIOContext) < 0 )
+        printf("failed to repost accept on worker %d\n", w->id);
+}
+
+//
+// Closing a ring cancels what is still posted on it, but asynchronously:
+// a cancelled recv may still write into its buffer after close() returns.
+// So before the worker exits, everything it posted is cancelled and its
+// completions reaped, and only then can the contexts be freed.
+//
+static int WorkerDrain(PWORKER w) {
+    PRING r = &w->ring;
+    struct io_uring_sqe *sqe = RingGetSqe(r);
+
+    if( sqe == NULL )
+        return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = CANCEL_KEY;
+
+    while( w->nPending > 0 ) {
+        unsigned head, tail;
+
+        if( RingSubmit(r, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+            return -1;
+        head = *r->cq_head;
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for( ; head != tail; head++ ) {
+            struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+            PPER_IO_CONTEXT lpIOContext = (PPER_IO_CONTEXT)(unsigned long)cqe->user_data;
+
+            if( cqe->user_data == CANCEL_KEY ) {
+                if( cqe->res == -EINVAL ) {     // before Linux 5.19
+                    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+                    return -1;
+                }
+                continue;
+            }
+            if( lpIOContext == NULL )
+                continue;
+            w->nPending--;
+            if( lpIOContext->IOOperation == ClientIoAccept && cqe->res >= 0 )
+                close(cqe->res);
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void *WorkerThread(void *WorkThreadContext) {
+    PWORKER w = WorkThreadContext;
+    PRING r = &w->ring;
+    int i;
+
+    if( RingSetup(r, RING_ENTRIES, 1) < 0 ) {
+        printf("io_uring_setup() failed on worker %d: %s\n", w->id, strerror(errno));
+        r->fd = -1;
+        pthread_barrier_wait(&g_Started);
+        return NULL;
+    }
+
+    w->pAccepts = calloc(g_nAccepts, sizeof(PPER_IO_CONTEXT));
+    for( i = 0; w->pAccepts && i < g_nAccepts; i++ ) {
+        w->pAccepts[i] = IoContextAllocate(w);
+        if( w->pAccepts[i] == NULL || PostAccept(w, w->pAccepts[i]) < 0 )
+            break;
+    }
+    pthread_barrier_wait(&g_Started);
+
+    while( !g_bEndServer ) {
+        unsigned head, tail;
+
+        //
+        // continually loop to service io completion packets
+        //
+        if( RingSubmit(r, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+            printf("io_uring_enter() failed on worker %d: %s\n", w->id, strerror(errno));
+            break;
+        }
+
+        head = *r->cq_head;
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for( ; head != tail; head++ ) {
+            struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+            PPER_IO_CONTEXT lpIOContext = (PPER_IO_CONTEXT)(unsigned long)cqe->user_data;
+            PPER_SOCKET_CONTEXT lpPerSocketContext;
+            int dwIoSize = cqe->res;
+
+            if( lpIOContext == NULL ) {
+                //
+                // the shutdown posted an I/O packet with a NULL context
+                //
+                g_bEndServer = 1;
+                break;
+            }
+            w->nPending--;
+            lpPerSocketContext = lpIOContext->pSocketContext;
+
+            //
+            // determine what type of IO packet has completed by checking the
+            // PER_IO_CONTEXT. This will determine what action to take.
+            //
+            switch( lpIOContext->IOOperation ) {
+            case ClientIoAccept:
+                OnAccept(w, lpIOContext, dwIoSize);
+                break;
+
+            case ClientIoBackoff:
+                w->bBackoff = 0;
+                ResumeAccepts(w, -1);
+                break;
+
+            case ClientIoRead:
+                //
+                // a read operation has completed, post a write operation to echo the
+                // data back to the client using the same data buffer.
+                //
+                if( dwIoSize <= 0 ) {
+                    //
+                    // client connection dropped
+                    //
+                    CloseClient(w, lpPerSocketContext, 1);
+                    break;
+                }
+                lpIOContext->nTotalBytes = dwIoSize;
+                lpIOContext->nSentBytes = 0;
+                if( PostSend(w, lpPerSocketContext) < 0 )
+                    CloseClient(w, lpPerSocketContext, 0);
+                else if( g_bVerbose )
+                    printf("WorkerThread %d: Socket(%d) Recv completed (%d bytes), Send posted\n",
+                           w->id, lpPerSocketContext->Socket, dwIoSize);
+                break;
+
+            case ClientIoWrite:
+                //
+                // a write operation has completed, determine if all the data intended to be
+                // sent actually was sent.
+                //
+                if( dwIoSize <= 0 ) {
+                    CloseClient(w, lpPerSocketContext, 0);
+                    break;
+                }
+                w->nBytes += dwIoSize;
+                lpIOContext->nSentBytes += dwIoSize;
+                if( lpIOContext->nSentBytes < lpIOContext->nTotalBytes ) {
+                    //
+                    // the previous write operation didn't send all the data,
+                    // post another send to complete the operation
+                    //
+                    if( PostSend(w, lpPerSocketContext) < 0 )
+                        CloseClient(w, lpPerSocketContext, 0);
+                } else if( PostRecv(w, lpPerSocketContext) < 0 ) {
+                    CloseClient(w, lpPerSocketContext, 0);
+                } else if( g_bVerbose ) {
+                    printf("WorkerThread %d: Socket(%d) Send completed (%d bytes), Recv posted\n",
+                           w->id, lpPerSocketContext->Socket, dwIoSize);
+                }
+                break;
+            }
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if( WorkerDrain(w) < 0 ) {
+        //
+        // the kernel may still write into them, leave them to the exit
+        //
+        printf("worker %d could not cancel its I/O, its contexts are not freed\n", w->id);
+        w->pSlabs = NULL;
+    }
+    return NULL;
+}
+
+//
+//  Create a listening socket, bind, and set up its listening backlog.
+//
+static int CreateListenSocket(void) {
+    struct addrinfo hints;
+    struct addrinfo *addrlocal = NULL;
+    int on = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_IP;
+
+    if( getaddrinfo(NULL, g_Port, &hints, &addrlocal) != 0 || addrlocal == NULL ) {
+        printf("getaddrinfo() failed to resolve/convert the interface\n");
+        return 0;
+    }
+
+    g_sdListen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_IP);
+    if( g_sdListen < 0 ) {
+        printf("socket() failed: %s\n", strerror(errno));
+        freeaddrinfo(addrlocal);
+        return 0;
+    }
+    setsockopt(g_sdListen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if( bind(g_sdListen, addrlocal->ai_addr, addrlocal->ai_addrlen) < 0 ) {
+        printf("bind() failed: %s\n", strerror(errno));
+        freeaddrinfo(addrlocal);
+        return 0;
+    }
+
+    //
+    // keep the backlog high, the preposted accepts only take connections
+    // off it as fast as the workers come round
+    //
+    if( listen(g_sdListen, SOMAXCONN) < 0 ) {
+        printf("listen() failed: %s\n", strerror(errno));
+        freeaddrinfo(addrlocal);
+        return 0;
+    }
+
+    freeaddrinfo(addrlocal);
+    return 1;
+}
+
+//
+// The PostQueuedCompletionStatus(NULL) of the Windows sample: a message
+// with a NULL user_data to every worker ring, sent from a ring of our own.
+//
+static void PostShutdown(void) {
+    RING r;
+    int i, n = 0;
+
+    memset(&r, 0, sizeof(r));
+    if( RingSetup(&r, 64, 0) < 0 ) {
+        printf("io_uring_setup() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    for( i = 0; i < g_nThreads; i++ ) {
+        struct io_uring_sqe *sqe;
+
+        if( g_Workers[i].ring.fd < 0 )
+            continue;
+        sqe = RingGetSqe(&r);
+        sqe->opcode = IORING_OP_MSG_RING;
+        sqe->fd = g_Workers[i].ring.fd;
+        sqe->addr = IORING_MSG_DATA;
+        sqe->off = 0;               // user_data of the posted completion
+        sqe->user_data = 1;
+        n++;
+    }
+    if( n )
+        RingSubmit(&r, n);
+    RingClose(&r);
+}
+
+//
+//  Free all context structures of a worker, closing the connections.
+//
+static void CtxtListFree(PWORKER w) {
+    SLAB *slab;
+
+    w->pParked = NULL;              // the ring is gone, nothing to repost on
+    while( w->pCtxtList )
+        CloseClient(w, w->pCtxtList, 0);
+    free(w->pAccepts);
+    while( (slab = w->pSlabs) != NULL ) {
+        w->pSlabs = slab->pNext;
+        free(slab);
+    }
+}
+
+//
+//  Just validate the command line options.
+//
+static int ValidOptions(int argc, char *argv[]) {
+    int bRet = 1;
+    int i;
+
+    for( i = 1; i < argc; i++ ) {
+        if( (argv[i][0] == '-') || (argv[i][0] == '/') ) {
+            switch( tolower(argv[i][1]) ) {
+            case 'e':
+                if( strlen(argv[i]) > 3 )
+                    g_Port = &argv[i][3];
+                break;
+
+            case 't':
+                if( strlen(argv[i]) > 3 )
+                    g_nThreads = atoi(&argv[i][3]);
+                break;
+
+            case 'a':
+                if( strlen(argv[i]) > 3 )
+                    g_nAccepts = atoi(&argv[i][3]);
+                break;
+
+            case 'v':
+                g_bVerbose = 1;
+                break;
+
+            case '?':
+                printf("Usage:\n  iocpserverex_linux [-e:port] [-t:threads] [-a:accepts] [-v] [-?]\n");
+                printf("  -e:port\tSpecify echoing port number\n");
+                printf("  -t:threads\tWorker threads, each with its own ring (default: one per CPU)\n");
+                printf("  -a:accepts\tAccepts preposted per worker (default: %d)\n", DEFAULT_ACCEPTS);
+                printf("  -v\t\tVerbose\n");
+                printf("  -?\t\tDisplay this help\n");
+                bRet = 0;
+                break;
+
+            default:
+                printf("Unknown options flag %s\n", argv[i]);
+                bRet = 0;
+                break;
+            }
+        }
+    }
+
+    return bRet;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long nAccepted = 0;
+    unsigned long long nBytes = 0;
+    sigset_t set;
+    int i, sig;
+
+    if( !ValidOptions(argc, argv) )
+        return 1;
+
+    if( g_nThreads <= 0 )
+        g_nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if( g_nThreads > MAX_WORKER_THREAD )
+        g_nThreads = MAX_WORKER_THREAD;
+    if( g_nThreads < 1 )
+        g_nThreads = 1;
+    if( g_nAccepts < 1 )
+        g_nAccepts = 1;
+
+    if( !CreateListenSocket() )
+        return 1;
+
+    //
+    // CTRL-C is taken by sigwait in this thread, the workers never see it
+    //
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_barrier_init(&g_Started, NULL, g_nThreads + 1);
+    for( i = 0; i < g_nThreads; i++ ) {
+        g_Workers[i].id = i;
+        if( pthread_create(&g_Workers[i].thread, NULL, WorkerThread, &g_Workers[i]) != 0 ) {
+            printf("pthread_create() failed to create worker thread\n");
+            return 1;
+        }
+    }
+    pthread_barrier_wait(&g_Started);
+
+    sigwait(&set, &sig);
+    if( g_bVerbose )
+        printf("CtrlHandler: closing listening socket\n");
+
+    //
+    // Cause worker threads to exit
+    //
+    g_bEndServer = 1;
+    PostShutdown();
+    for( i = 0; i < g_nThreads; i++ )
+        pthread_join(g_Workers[i].thread, NULL);
+
+    close(g_sdListen);
+    g_sdListen = -1;
+
+    //
+    // The workers reaped everything they posted before they exited, so the
+    // contexts can go along with the rings.
+    //
+    for( i = 0; i < g_nThreads; i++ ) {
+        nAccepted += g_Workers[i].nAccepted;
+        nBytes += g_Workers[i].nBytes;
+        if( g_Workers[i].ring.fd >= 0 )
+            RingClose(&g_Workers[i].ring);
+        CtxtListFree(&g_Workers[i]);
+    }
+    pthread_barrier_destroy(&g_Started);
+
+    printf("\niocpserverex_linux is exiting... %lu connections, %llu bytes echoed\n",
+           nAccepted, nBytes);
+    return 0;
+}